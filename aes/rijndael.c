@@ -31,6 +31,11 @@
 
 #include "rijndael.h"
 
+#ifdef RIJNDAEL_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
 #undef FULL_UNROLL
 
 /*
@@ -1229,6 +1234,125 @@ rijndaelDecrypt(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr, const aes_u8 ct[16],
 }
 #endif
 
+#ifdef RIJNDAEL_AESNI
+/* 1 if the CPU supports AES-NI, -1 if not, 0 if not checked yet */
+static int aesni_support;
+
+static int
+aesni_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	int support = __atomic_load_n(&aesni_support, __ATOMIC_RELAXED);
+
+	if (!support) {
+		support = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+		    (ecx & bit_AES)) ? 1 : -1;
+		__atomic_store_n(&aesni_support, support, __ATOMIC_RELAXED);
+	}
+	return support > 0;
+}
+
+/* Prepares the key schedule for aesni_encrypt() if AES-NI is available. */
+static void
+aesni_setup(rijndael_ctx *ctx)
+{
+	int i;
+
+	ctx->aesni = aesni_available();
+	if (ctx->aesni) {
+		for (i = 0; i < 4 * (ctx->Nr + 1); i++)
+			PUTU32(ctx->ek_bytes + 4 * i, ctx->ek[i]);
+	}
+}
+
+/* Encrypts a block with AES-NI, which also runs in constant time. */
+__attribute__((target("aes,sse2")))
+static void
+aesni_encrypt(const aes_u8 *rk, int Nr, const aes_u8 pt[16], aes_u8 ct[16])
+{
+	__m128i m;
+	int i;
+
+	m = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pt),
+	    _mm_loadu_si128((const __m128i *)rk));
+	for (i = 1; i < Nr; i++)
+		m = _mm_aesenc_si128(m,
+		    _mm_loadu_si128((const __m128i *)(rk + 16 * i)));
+	m = _mm_aesenclast_si128(m,
+	    _mm_loadu_si128((const __m128i *)(rk + 16 * Nr)));
+	_mm_storeu_si128((__m128i *)ct, m);
+}
+
+/*
+ * Encrypts W independent blocks. The rounds of all blocks are
+ * interleaved, so that the AES unit works on W blocks at a time
+ * instead of waiting for the result of each round. W must be a
+ * constant to keep the blocks in registers.
+ */
+__attribute__((target("aes,sse2"), always_inline))
+static inline void
+aesni_encrypt_wide(const aes_u8 *rk, int Nr, const aes_u8 *pt, aes_u8 *ct,
+    const unsigned int W)
+{
+	__m128i m[RIJNDAEL_MAX_BLOCKS], k;
+	unsigned int j;
+	int i;
+
+	k = _mm_loadu_si128((const __m128i *)rk);
+	for (j = 0; j < W; j++)
+		m[j] = _mm_xor_si128(
+		    _mm_loadu_si128((const __m128i *)(pt + 16 * j)), k);
+	for (i = 1; i < Nr; i++) {
+		k = _mm_loadu_si128((const __m128i *)(rk + 16 * i));
+		for (j = 0; j < W; j++)
+			m[j] = _mm_aesenc_si128(m[j], k);
+	}
+	k = _mm_loadu_si128((const __m128i *)(rk + 16 * Nr));
+	for (j = 0; j < W; j++)
+		_mm_storeu_si128((__m128i *)(ct + 16 * j),
+		    _mm_aesenclast_si128(m[j], k));
+}
+
+__attribute__((target("aes,sse2")))
+static void
+aesni_encrypt_blocks(const aes_u8 *rk, int Nr, const aes_u8 *pt, aes_u8 *ct,
+    unsigned int n)
+{
+	switch (n) {
+	case 8: aesni_encrypt_wide(rk, Nr, pt, ct, 8); break;
+	case 7: aesni_encrypt_wide(rk, Nr, pt, ct, 7); break;
+	case 6: aesni_encrypt_wide(rk, Nr, pt, ct, 6); break;
+	case 5: aesni_encrypt_wide(rk, Nr, pt, ct, 5); break;
+	case 4: aesni_encrypt_wide(rk, Nr, pt, ct, 4); break;
+	case 3: aesni_encrypt_wide(rk, Nr, pt, ct, 3); break;
+	case 2: aesni_encrypt_wide(rk, Nr, pt, ct, 2); break;
+	case 1: aesni_encrypt_wide(rk, Nr, pt, ct, 1); break;
+	default: break;
+	}
+}
+
+__attribute__((target("aes,sse2")))
+static void
+aesni_cbc_mac(const aes_u8 *rk, int Nr, aes_u8 *x, const aes_u8 *src,
+    unsigned int n)
+{
+	__m128i m;
+	int i;
+
+	m = _mm_loadu_si128((const __m128i *)x);
+	for (; n; n--, src += 16) {
+		m = _mm_xor_si128(m, _mm_loadu_si128((const __m128i *)src));
+		m = _mm_xor_si128(m, _mm_loadu_si128((const __m128i *)rk));
+		for (i = 1; i < Nr; i++)
+			m = _mm_aesenc_si128(m,
+			    _mm_loadu_si128((const __m128i *)(rk + 16 * i)));
+		m = _mm_aesenclast_si128(m,
+		    _mm_loadu_si128((const __m128i *)(rk + 16 * Nr)));
+	}
+	_mm_storeu_si128((__m128i *)x, m);
+}
+#endif /* RIJNDAEL_AESNI */
+
 /* setup key context for encryption only */
 int
 rijndael_set_key_enc_only(rijndael_ctx *ctx, const u_char *key, int bits)
@@ -1243,6 +1367,9 @@ rijndael_set_key_enc_only(rijndael_ctx *ctx, const u_char *key, int bits)
 #ifdef WITH_AES_DECRYPT
 	ctx->enc_only = 1;
 #endif
+#ifdef RIJNDAEL_AESNI
+	aesni_setup(ctx);
+#endif
 
 	return 0;
 }
@@ -1262,6 +1389,9 @@ rijndael_set_key(rijndael_ctx *ctx, const u_char *key, int bits)
 
 	ctx->Nr = rounds;
 	ctx->enc_only = 0;
+#ifdef RIJNDAEL_AESNI
+	aesni_setup(ctx);
+#endif
 
 	return 0;
 }
@@ -1276,5 +1406,54 @@ rijndael_decrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 void
 rijndael_encrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 {
+#ifdef RIJNDAEL_AESNI
+	if (ctx->aesni) {
+		aesni_encrypt(ctx->ek_bytes, ctx->Nr, src, dst);
+		return;
+	}
+#endif
 	rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
 }
+
+void
+rijndael_encrypt_blocks(rijndael_ctx *ctx, const u_char *src, u_char *dst,
+    unsigned int n)
+{
+#ifdef RIJNDAEL_AESNI
+	if (ctx->aesni) {
+		aesni_encrypt_blocks(ctx->ek_bytes, ctx->Nr, src, dst, n);
+		return;
+	}
+#endif
+	for (; n; n--, src += 16, dst += 16)
+		rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
+}
+
+void
+rijndael_cbc_mac(rijndael_ctx *ctx, u_char *x, const u_char *src,
+    unsigned int n)
+{
+	int i;
+
+#ifdef RIJNDAEL_AESNI
+	if (ctx->aesni) {
+		aesni_cbc_mac(ctx->ek_bytes, ctx->Nr, x, src, n);
+		return;
+	}
+#endif
+	for (; n; n--) {
+		for (i = 0; i < 16; i++)
+			x[i] ^= *src++;
+		rijndaelEncrypt(ctx->ek, ctx->Nr, x, x);
+	}
+}
+
+int
+rijndael_hw_available(void)
+{
+#ifdef RIJNDAEL_AESNI
+	return aesni_available();
+#else
+	return 0;
+#endif
+}
@@ -34,6 +34,15 @@
 #define AES_MAXKEYBYTES	(AES_MAXKEYBITS/8)
 /* for 256-bit keys we need 14 rounds for a 128 we only need 10 round */
 #define AES_MAXROUNDS	10
+/* maximum number of blocks for rijndael_encrypt_blocks() */
+#define RIJNDAEL_MAX_BLOCKS	8
+
+/* The encryption uses the AES-NI instructions when the CPU supports
+ * them. Define RIJNDAEL_NO_AESNI to build the portable code only. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(RIJNDAEL_NO_AESNI)
+#define RIJNDAEL_AESNI 1
+#endif
 
 /* bergmann: to avoid conflicts with typedefs from certain Contiki platforms,
  * the following type names have been prefixed with "aes_": */
@@ -49,6 +58,10 @@ typedef struct {
 #endif
 	int	Nr;			/* key-length-dependent number of rounds */
 	aes_u32	ek[4*(AES_MAXROUNDS + 1)];	/* encrypt key schedule */
+#ifdef RIJNDAEL_AESNI
+	int	aesni;			/* use AES-NI with ek_bytes */
+	aes_u8	ek_bytes[16*(AES_MAXROUNDS + 1)]; /* ek in byte order */
+#endif
 #ifdef WITH_AES_DECRYPT
 	aes_u32	dk[4*(AES_MAXROUNDS + 1)];	/* decrypt key schedule */
 #endif
@@ -58,6 +71,14 @@ int	 rijndael_set_key(rijndael_ctx *, const u_char *, int);
 int	 rijndael_set_key_enc_only(rijndael_ctx *, const u_char *, int);
 void	 rijndael_decrypt(rijndael_ctx *, const u_char *, u_char *);
 void	 rijndael_encrypt(rijndael_ctx *, const u_char *, u_char *);
+/* encrypts n independent 16-byte blocks, n <= RIJNDAEL_MAX_BLOCKS */
+void	 rijndael_encrypt_blocks(rijndael_ctx *, const u_char *, u_char *,
+	    unsigned int);
+/* CBC-MAC: X = E(X ^ src_i) for n consecutive 16-byte blocks */
+void	 rijndael_cbc_mac(rijndael_ctx *, u_char *, const u_char *,
+	    unsigned int);
+/* 1 if the encryption uses the AES instructions of the CPU */
+int	 rijndael_hw_available(void);
 
 int	rijndaelKeySetupEnc(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], int keyBits);
 int	rijndaelKeySetupDec(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], int keyBits);
@@ -0,0 +1,236 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "dtls_debug.h"
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+
+/* Session ids are random, so their first bytes are a good hash. */
+static inline size_t
+id_bucket(const uint8 *id, size_t id_length) {
+  uint32_t h = 0;
+  size_t i;
+
+  for (i = 0; i < id_length && i < sizeof(h); i++)
+    h = (h << 8) | id[i];
+  return h % DTLS_SESSION_CACHE_SIZE;
+}
+
+static inline size_t
+key_bucket(const dtls_peer_key_t *key) {
+  return dtls_peer_key_hash(key) % DTLS_SESSION_CACHE_SIZE;
+}
+
+static void
+lru_unlink(dtls_cache_t *cache, dtls_cache_entry_t *entry) {
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    cache->lru_head = entry->lru_next;
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    cache->lru_tail = entry->lru_prev;
+  entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void
+lru_push(dtls_cache_t *cache, dtls_cache_entry_t *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->lru_prev = entry;
+  else
+    cache->lru_tail = entry;
+  cache->lru_head = entry;
+}
+
+static int
+expired(const dtls_cache_entry_t *entry, clock_time_t now) {
+  return now - entry->created >= DTLS_SESSION_LIFETIME * CLOCK_SECOND;
+}
+
+dtls_cache_t *
+dtls_cache_new(void) {
+  return (dtls_cache_t *)calloc(1, sizeof(dtls_cache_t));
+}
+
+void
+dtls_cache_remove(dtls_cache_t *cache, dtls_cache_entry_t *entry) {
+  dtls_cache_entry_t **p;
+
+  if (!cache || !entry || !entry->id_length)
+    return;
+
+  for (p = &cache->id_buckets[id_bucket(entry->id, entry->id_length)];
+       *p; p = &(*p)->id_next) {
+    if (*p == entry) {
+      *p = entry->id_next;
+      break;
+    }
+  }
+
+  for (p = &cache->key_buckets[key_bucket(&entry->key)];
+       *p; p = &(*p)->key_next) {
+    if (*p == entry) {
+      *p = entry->key_next;
+      break;
+    }
+  }
+
+  lru_unlink(cache, entry);
+
+#if DTLS_SESSION_TICKETS
+  free(entry->ticket);
+#endif /* DTLS_SESSION_TICKETS */
+
+  /* keep the entry in the LRU list, so that it is reused first */
+  memset(entry, 0, sizeof(dtls_cache_entry_t));
+  entry->lru_prev = cache->lru_tail;
+  if (cache->lru_tail)
+    cache->lru_tail->lru_next = entry;
+  else
+    cache->lru_head = entry;
+  cache->lru_tail = entry;
+}
+
+dtls_cache_entry_t *
+dtls_cache_add(dtls_cache_t *cache, const dtls_peer_key_t *key,
+	       const uint8 *id, size_t id_length,
+	       dtls_cipher_t cipher, dtls_compression_t compression,
+	       const uint8 *master_secret,
+	       const uint8 *ticket, size_t ticket_length, clock_time_t now) {
+  dtls_cache_entry_t *entry;
+  size_t bucket;
+
+  if (!cache || !id_length || id_length > DTLS_SESSION_ID_LENGTH
+      || ticket_length > DTLS_TICKET_MAX_LENGTH)
+    return NULL;
+
+  /* only one session per remote peer */
+  dtls_cache_remove(cache, dtls_cache_find_key(cache, key, now));
+
+  if (cache->used < DTLS_SESSION_CACHE_SIZE) {
+    entry = &cache->entries[cache->used++];
+  } else {
+    entry = cache->lru_tail;
+    if (entry->id_length)
+      dtls_debug("session cache full, evicting least recently used entry\n");
+    dtls_cache_remove(cache, entry);
+    lru_unlink(cache, entry);
+  }
+
+  memcpy(&entry->key, key, sizeof(dtls_peer_key_t));
+  entry->id_length = id_length;
+  memcpy(entry->id, id, id_length);
+  entry->cipher = cipher;
+  entry->compression = compression;
+  entry->created = now;
+  memcpy(entry->master_secret, master_secret, DTLS_MASTER_SECRET_LENGTH);
+#if DTLS_SESSION_TICKETS
+  /* without storage for the ticket, the session is cached without it */
+  entry->ticket = ticket_length ? (uint8 *)malloc(ticket_length) : NULL;
+  if (entry->ticket) {
+    entry->ticket_length = ticket_length;
+    memcpy(entry->ticket, ticket, ticket_length);
+  }
+#else /* DTLS_SESSION_TICKETS */
+  (void)ticket;
+#endif /* DTLS_SESSION_TICKETS */
+
+  bucket = id_bucket(id, id_length);
+  entry->id_next = cache->id_buckets[bucket];
+  cache->id_buckets[bucket] = entry;
+
+  bucket = key_bucket(key);
+  entry->key_next = cache->key_buckets[bucket];
+  cache->key_buckets[bucket] = entry;
+
+  lru_push(cache, entry);
+  return entry;
+}
+
+dtls_cache_entry_t *
+dtls_cache_find_id(dtls_cache_t *cache, const uint8 *id, size_t id_length,
+		   clock_time_t now) {
+  dtls_cache_entry_t *entry;
+
+  if (!cache || !id_length || id_length > DTLS_SESSION_ID_LENGTH)
+    return NULL;
+
+  for (entry = cache->id_buckets[id_bucket(id, id_length)];
+       entry; entry = entry->id_next) {
+    if (entry->id_length == id_length &&
+	memcmp(entry->id, id, id_length) == 0)
+      break;
+  }
+
+  if (entry && expired(entry, now)) {
+    dtls_cache_remove(cache, entry);
+    entry = NULL;
+  }
+
+  if (entry) {
+    lru_unlink(cache, entry);
+    lru_push(cache, entry);
+  }
+  return entry;
+}
+
+dtls_cache_entry_t *
+dtls_cache_find_key(dtls_cache_t *cache, const dtls_peer_key_t *key,
+		    clock_time_t now) {
+  dtls_cache_entry_t *entry;
+
+  if (!cache)
+    return NULL;
+
+  for (entry = cache->key_buckets[key_bucket(key)];
+       entry; entry = entry->key_next) {
+    if (dtls_peer_key_equals(&entry->key, key))
+      break;
+  }
+
+  if (entry && expired(entry, now)) {
+    dtls_cache_remove(cache, entry);
+    entry = NULL;
+  }
+
+  if (entry) {
+    lru_unlink(cache, entry);
+    lru_push(cache, entry);
+  }
+  return entry;
+}
+
+void
+dtls_cache_free(dtls_cache_t *cache) {
+  size_t i;
+
+  if (!cache)
+    return;
+
+  for (i = 0; i < cache->used; i++)
+    dtls_cache_remove(cache, &cache->entries[i]);
+  memset(cache, 0, sizeof(dtls_cache_t));
+  free(cache);
+}
+
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
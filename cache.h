@@ -0,0 +1,204 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file cache.h
+ * @brief Session cache for abbreviated handshakes
+ */
+
+#ifndef _DTLS_CACHE_H_
+#define _DTLS_CACHE_H_
+
+#include "tinydtls.h"
+#include "global.h"
+#include "session.h"
+#include "crypto.h"
+#include "dtls_time.h"
+
+/**
+ * \defgroup cache Session Cache
+ * The session cache keeps the master secret of completed handshakes
+ * to allow abbreviated handshakes as described in RFC 5246, section
+ * 7.3. A server looks up sessions by the session id that is offered
+ * in the ClientHello, a client by the address of the server. The
+ * cache has a fixed number of entries and is allocated with
+ * dtls_cache_new() when the first session is stored. When it is full,
+ * the least recently used entry is replaced.
+ * @{
+ */
+
+#ifndef DTLS_SESSION_CACHE_SIZE
+#ifdef WITH_CONTIKI
+#define DTLS_SESSION_CACHE_SIZE 0 /**< number of cached sessions, 0 disables the cache */
+#else /* WITH_CONTIKI */
+#define DTLS_SESSION_CACHE_SIZE 256 /**< number of cached sessions, 0 disables the cache */
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_SESSION_CACHE_SIZE */
+
+#ifndef DTLS_SESSION_LIFETIME
+/** Maximum time in seconds a cached session can be resumed after the
+    full handshake. */
+#define DTLS_SESSION_LIFETIME 3600
+#endif /* DTLS_SESSION_LIFETIME */
+
+typedef struct dtls_cache_entry_t {
+  struct dtls_cache_entry_t *lru_prev; /**< next more recently used entry */
+  struct dtls_cache_entry_t *lru_next; /**< next less recently used entry */
+  struct dtls_cache_entry_t *id_next;  /**< next entry in the same id bucket */
+  struct dtls_cache_entry_t *key_next; /**< next entry in the same key bucket */
+
+  dtls_peer_key_t key;		/**< address of the remote peer */
+  uint8 id_length;		/**< length of the session id, 0 if unused */
+  uint8 id[DTLS_SESSION_ID_LENGTH]; /**< the session id */
+  dtls_cipher_t cipher;		/**< negotiated cipher suite */
+  dtls_compression_t compression; /**< negotiated compression method */
+  clock_time_t created;		/**< when the full handshake has completed */
+  uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
+#if DTLS_SESSION_TICKETS
+  uint8 ticket_length;		/**< length of the session ticket, 0 if none */
+  uint8 *ticket;		/**< ticket received from the server, client only */
+#endif /* DTLS_SESSION_TICKETS */
+} dtls_cache_entry_t;
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+typedef struct {
+  dtls_cache_entry_t entries[DTLS_SESSION_CACHE_SIZE];
+  dtls_cache_entry_t *id_buckets[DTLS_SESSION_CACHE_SIZE];
+  dtls_cache_entry_t *key_buckets[DTLS_SESSION_CACHE_SIZE];
+  dtls_cache_entry_t *lru_head;	/**< most recently used entry */
+  dtls_cache_entry_t *lru_tail;	/**< least recently used entry */
+  size_t used;			/**< number of entries taken from entries */
+} dtls_cache_t;
+
+/** Creates an empty session cache or returns @c NULL on error. */
+dtls_cache_t *dtls_cache_new(void);
+
+/** Wipes all entries of @p cache and releases its storage. */
+void dtls_cache_free(dtls_cache_t *cache);
+
+/**
+ * Stores a session in @p cache. An existing entry for the same
+ * remote peer @p key is replaced. The least recently used entry is
+ * evicted when the cache is full. The ticket is kept in storage of
+ * its own, so that entries of a server do not carry a ticket buffer.
+ *
+ * @param cache         The session cache or @c NULL.
+ * @param key           The address of the remote peer.
+ * @param id            The session id.
+ * @param id_length     The length of @p id.
+ * @param cipher        The negotiated cipher suite.
+ * @param compression   The negotiated compression method.
+ * @param master_secret The master secret of the session.
+ * @param ticket        The session ticket received from the server or
+ *                      @c NULL.
+ * @param ticket_length The length of @p ticket.
+ * @param now           The current time.
+ * @return The new entry or @c NULL if @p cache is @c NULL or
+ *         @p id_length is not valid.
+ */
+dtls_cache_entry_t *dtls_cache_add(dtls_cache_t *cache,
+				   const dtls_peer_key_t *key,
+				   const uint8 *id, size_t id_length,
+				   dtls_cipher_t cipher,
+				   dtls_compression_t compression,
+				   const uint8 *master_secret,
+				   const uint8 *ticket, size_t ticket_length,
+				   clock_time_t now);
+
+/**
+ * Returns the entry with session id @p id or @c NULL if there is no
+ * such entry, it has expired or @p cache is @c NULL. The entry
+ * becomes the most recently used one.
+ */
+dtls_cache_entry_t *dtls_cache_find_id(dtls_cache_t *cache,
+				       const uint8 *id, size_t id_length,
+				       clock_time_t now);
+
+/**
+ * Returns the entry for the remote peer @p key or @c NULL if there is
+ * no such entry, it has expired or @p cache is @c NULL. The entry
+ * becomes the most recently used one.
+ */
+dtls_cache_entry_t *dtls_cache_find_key(dtls_cache_t *cache,
+					const dtls_peer_key_t *key,
+					clock_time_t now);
+
+/** Removes @p entry from @p cache and wipes its master secret. */
+void dtls_cache_remove(dtls_cache_t *cache, dtls_cache_entry_t *entry);
+
+#else /* DTLS_SESSION_CACHE_SIZE > 0 */
+typedef struct {
+  uint8 unused;
+} dtls_cache_t;
+
+static inline dtls_cache_t *
+dtls_cache_new(void) {
+  return NULL;
+}
+
+static inline void
+dtls_cache_free(dtls_cache_t *cache) {
+  (void)cache;
+}
+
+static inline dtls_cache_entry_t *
+dtls_cache_add(dtls_cache_t *cache, const dtls_peer_key_t *key,
+	       const uint8 *id, size_t id_length,
+	       dtls_cipher_t cipher, dtls_compression_t compression,
+	       const uint8 *master_secret,
+	       const uint8 *ticket, size_t ticket_length, clock_time_t now) {
+  (void)cache;
+  (void)key;
+  (void)id;
+  (void)id_length;
+  (void)cipher;
+  (void)compression;
+  (void)master_secret;
+  (void)ticket;
+  (void)ticket_length;
+  (void)now;
+  return NULL;
+}
+
+static inline dtls_cache_entry_t *
+dtls_cache_find_id(dtls_cache_t *cache, const uint8 *id, size_t id_length,
+		   clock_time_t now) {
+  (void)cache;
+  (void)id;
+  (void)id_length;
+  (void)now;
+  return NULL;
+}
+
+static inline dtls_cache_entry_t *
+dtls_cache_find_key(dtls_cache_t *cache, const dtls_peer_key_t *key,
+		    clock_time_t now) {
+  (void)cache;
+  (void)key;
+  (void)now;
+  return NULL;
+}
+
+static inline void
+dtls_cache_remove(dtls_cache_t *cache, dtls_cache_entry_t *entry) {
+  (void)cache;
+  (void)entry;
+}
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+
+/** @} */
+
+#endif /* _DTLS_CACHE_H_ */
@@ -30,14 +30,6 @@
 
 #define MASK_L(_L) ((1 << 8 * _L) - 1)
 
-#define SET_COUNTER(A,L,cnt,C) {					\
-    unsigned int i_;                                                    \
-    memset((A) + DTLS_CCM_BLOCKSIZE - (L), 0, (L));			\
-    (C) = (cnt) & MASK_L(L);						\
-    for (i_ = DTLS_CCM_BLOCKSIZE - 1; (C) && (i_ > (L)); --i_, (C) >>= 8) \
-      (A)[i_] |= (C) & 0xFF;						\
-  }
-
 static inline void 
 block0(size_t M,       /* number of auth bytes */
        size_t L,       /* number of bytes to encode message length */
@@ -58,6 +50,19 @@ block0(size_t M,       /* number of auth bytes */
   }
 }
 
+/**
+ * Sets \p B to the CBC-MAC input for the next \p len bytes of \p msg,
+ * i.e. X ^ msg for the first \p len bytes and X ^ 0 for the remainder
+ * of the block.
+ */
+static inline void
+mac_input(const unsigned char *msg, size_t len,
+	  unsigned char B[DTLS_CCM_BLOCKSIZE],
+	  const unsigned char X[DTLS_CCM_BLOCKSIZE]) {
+  memcpy(B, X, DTLS_CCM_BLOCKSIZE);
+  memxor(B, msg, len);
+}
+
 /** 
  * Creates the CBC-MAC for the additional authentication data that
  * is sent in cleartext. 
@@ -120,12 +125,11 @@ add_auth_data(rijndael_ctx *ctx, const unsigned char *msg, size_t la,
   
   rijndael_encrypt(ctx, B, X);
   
-  while (la > DTLS_CCM_BLOCKSIZE) {
-    for (i = 0; i < DTLS_CCM_BLOCKSIZE; ++i)
-      B[i] = X[i] ^ *msg++;
-    la -= DTLS_CCM_BLOCKSIZE;
-
-    rijndael_encrypt(ctx, B, X);
+  if (la > DTLS_CCM_BLOCKSIZE) {
+    i = (la - 1) / DTLS_CCM_BLOCKSIZE;
+    rijndael_cbc_mac(ctx, X, msg, i);
+    msg += i * DTLS_CCM_BLOCKSIZE;
+    la -= i * DTLS_CCM_BLOCKSIZE;
   }
   
   if (la) {
@@ -137,31 +141,89 @@ add_auth_data(rijndael_ctx *ctx, const unsigned char *msg, size_t la,
   } 
 }
 
+/**
+ * Fills \p out with \p n counter blocks A_counter .. A_counter+n-1
+ * built from the template \p A.
+ */
 static inline void
-encrypt(rijndael_ctx *ctx, size_t L, unsigned long counter,
-	unsigned char *msg, size_t len,
-	unsigned char A[DTLS_CCM_BLOCKSIZE],
-	unsigned char S[DTLS_CCM_BLOCKSIZE]) {
-
-  static unsigned long counter_tmp;
+counter_blocks(const unsigned char A[DTLS_CCM_BLOCKSIZE], size_t L,
+	       unsigned long counter, unsigned char *out, size_t n) {
+  unsigned long c;
+  size_t i;
 
-  SET_COUNTER(A, L, counter, counter_tmp);    
-  rijndael_encrypt(ctx, A, S);
-  memxor(msg, S, len);
+  for (; n; n--, counter++, out += DTLS_CCM_BLOCKSIZE) {
+    memcpy(out, A, DTLS_CCM_BLOCKSIZE - L);
+    c = counter & MASK_L(L);
+    for (i = DTLS_CCM_BLOCKSIZE; i > DTLS_CCM_BLOCKSIZE - L; c >>= 8)
+      out[--i] = c & 0xFF;
+  }
 }
 
 static inline void
 mac(rijndael_ctx *ctx, 
-    unsigned char *msg, size_t len,
+    const unsigned char *msg, size_t len,
     unsigned char B[DTLS_CCM_BLOCKSIZE],
     unsigned char X[DTLS_CCM_BLOCKSIZE]) {
-  size_t i;
+  mac_input(msg, len, B, X);
+  rijndael_encrypt(ctx, B, X);
+}
 
-  for (i = 0; i < len; ++i)
-    B[i] = X[i] ^ msg[i];
+/**
+ * Updates the CBC-MAC \p X with the \p len bytes starting at \p msg.
+ * A partial last block is padded with zeroes.
+ */
+static inline void
+mac_blocks(rijndael_ctx *ctx, 
+	   const unsigned char *msg, size_t len,
+	   unsigned char B[DTLS_CCM_BLOCKSIZE],
+	   unsigned char X[DTLS_CCM_BLOCKSIZE]) {
+  size_t n = len / DTLS_CCM_BLOCKSIZE;
 
-  rijndael_encrypt(ctx, B, X);
+  if (n)
+    rijndael_cbc_mac(ctx, X, msg, n);
 
+  if (len % DTLS_CCM_BLOCKSIZE)
+    mac(ctx, msg + n * DTLS_CCM_BLOCKSIZE, len % DTLS_CCM_BLOCKSIZE, B, X);
+}
+
+/*
+ * The message is processed in chunks of up to DTLS_CCM_PARALLEL
+ * blocks. The key stream blocks S_i of a chunk do not depend on each
+ * other and are computed with a single call to
+ * rijndael_encrypt_blocks() (together with S_0 for the first chunk),
+ * while the CBC-MAC is an inherently serial chain that is kept in
+ * registers by rijndael_cbc_mac(). As neither depends on the other,
+ * the CPU overlaps the key stream of one chunk with the MAC chain of
+ * the previous one. The result is identical to processing one block
+ * at a time.
+ */
+#define CCM_BATCH_MAX (DTLS_CCM_PARALLEL + 1)
+
+#if CCM_BATCH_MAX > RIJNDAEL_MAX_BLOCKS
+#error "DTLS_CCM_PARALLEL is too large"
+#endif
+
+/**
+ * Computes the key stream for the next \p n bytes of the message
+ * starting with block \p counter into \p S. If \p S0 is not NULL, S_0
+ * is calculated as well.
+ */
+static inline void
+key_stream(rijndael_ctx *ctx, size_t L, unsigned long counter, size_t n,
+	   const unsigned char A[DTLS_CCM_BLOCKSIZE],
+	   unsigned char S[CCM_BATCH_MAX * DTLS_CCM_BLOCKSIZE],
+	   unsigned char S0[DTLS_CCM_BLOCKSIZE]) {
+  unsigned char in[CCM_BATCH_MAX * DTLS_CCM_BLOCKSIZE];
+  size_t w = (n + DTLS_CCM_BLOCKSIZE - 1) / DTLS_CCM_BLOCKSIZE;
+
+  counter_blocks(A, L, counter, in, w);
+  if (S0)
+    counter_blocks(A, L, 0, in + w * DTLS_CCM_BLOCKSIZE, 1);
+
+  rijndael_encrypt_blocks(ctx, in, S, w + (S0 != NULL));
+
+  if (S0)
+    memcpy(S0, S + w * DTLS_CCM_BLOCKSIZE, DTLS_CCM_BLOCKSIZE);
 }
 
 long int
@@ -169,13 +231,13 @@ dtls_ccm_encrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
 			 unsigned char nonce[DTLS_CCM_BLOCKSIZE], 
 			 unsigned char *msg, size_t lm, 
 			 const unsigned char *aad, size_t la) {
-  size_t i, len;
-  unsigned long counter_tmp;
+  size_t n, len;
   unsigned long counter = 1; /* \bug does not work correctly on ia32 when
 			             lm >= 2^16 */
   unsigned char A[DTLS_CCM_BLOCKSIZE]; /* A_i blocks for encryption input */
   unsigned char B[DTLS_CCM_BLOCKSIZE]; /* B_i blocks for CBC-MAC input */
-  unsigned char S[DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
+  unsigned char S[CCM_BATCH_MAX * DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
+  unsigned char S0[DTLS_CCM_BLOCKSIZE]; /* S_0 = encrypted A_0 */
   unsigned char X[DTLS_CCM_BLOCKSIZE]; /* X_i = encrypted B_i blocks */
 
   len = lm;			/* save original length */
@@ -189,41 +251,28 @@ dtls_ccm_encrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
   /* copy the nonce */
   memcpy(A + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
   
-  while (lm >= DTLS_CCM_BLOCKSIZE) {
+  n = min(DTLS_CCM_PARALLEL * DTLS_CCM_BLOCKSIZE, lm);
+  key_stream(ctx, L, counter, n, A, S, S0);
+
+  while (lm) {
     /* calculate MAC */
-    mac(ctx, msg, DTLS_CCM_BLOCKSIZE, B, X);
+    mac_blocks(ctx, msg, n, B, X);
 
     /* encrypt */
-    encrypt(ctx, L, counter, msg, DTLS_CCM_BLOCKSIZE, A, S);
+    memxor(msg, S, n);
 
     /* update local pointers */
-    lm -= DTLS_CCM_BLOCKSIZE;
-    msg += DTLS_CCM_BLOCKSIZE;
-    counter++;
-  }
-
-  if (lm) {
-    /* Calculate MAC. The remainder of B must be padded with zeroes, so
-     * B is constructed to contain X ^ msg for the first lm bytes (done in
-     * mac() and X ^ 0 for the remaining DTLS_CCM_BLOCKSIZE - lm bytes
-     * (i.e., we can use memcpy() here).
-     */
-    memcpy(B + lm, X + lm, DTLS_CCM_BLOCKSIZE - lm);
-    mac(ctx, msg, lm, B, X);
+    lm -= n;
+    msg += n;
+    counter += DTLS_CCM_PARALLEL;
 
-    /* encrypt */
-    encrypt(ctx, L, counter, msg, lm, A, S);
-
-    /* update local pointers */
-    msg += lm;
+    n = min(DTLS_CCM_PARALLEL * DTLS_CCM_BLOCKSIZE, lm);
+    if (n)
+      key_stream(ctx, L, counter, n, A, S, NULL);
   }
   
-  /* calculate S_0 */  
-  SET_COUNTER(A, L, 0, counter_tmp);
-  rijndael_encrypt(ctx, A, S);
-
-  for (i = 0; i < M; ++i)
-    *msg++ = X[i] ^ S[i];
+  memcpy(msg, X, M);
+  memxor(msg, S0, M);
 
   return len + M;
 }
@@ -234,13 +283,13 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
 			 unsigned char *msg, size_t lm, 
 			 const unsigned char *aad, size_t la) {
   
-  size_t len;
-  unsigned long counter_tmp;
+  size_t n, len;
   unsigned long counter = 1; /* \bug does not work correctly on ia32 when
 			             lm >= 2^16 */
   unsigned char A[DTLS_CCM_BLOCKSIZE]; /* A_i blocks for encryption input */
   unsigned char B[DTLS_CCM_BLOCKSIZE]; /* B_i blocks for CBC-MAC input */
-  unsigned char S[DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
+  unsigned char S[CCM_BATCH_MAX * DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
+  unsigned char S0[DTLS_CCM_BLOCKSIZE]; /* S_0 = encrypted A_0 */
   unsigned char X[DTLS_CCM_BLOCKSIZE]; /* X_i = encrypted B_i blocks */
 
   if (lm < M)
@@ -259,40 +308,27 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
   /* copy the nonce */
   memcpy(A + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
   
-  while (lm >= DTLS_CCM_BLOCKSIZE) {
-    /* decrypt */
-    encrypt(ctx, L, counter, msg, DTLS_CCM_BLOCKSIZE, A, S);
-    
-    /* calculate MAC */
-    mac(ctx, msg, DTLS_CCM_BLOCKSIZE, B, X);
+  n = min(DTLS_CCM_PARALLEL * DTLS_CCM_BLOCKSIZE, lm);
+  key_stream(ctx, L, counter, n, A, S, S0);
 
-    /* update local pointers */
-    lm -= DTLS_CCM_BLOCKSIZE;
-    msg += DTLS_CCM_BLOCKSIZE;
-    counter++;
-  }
-
-  if (lm) {
+  while (lm) {
     /* decrypt */
-    encrypt(ctx, L, counter, msg, lm, A, S);
+    memxor(msg, S, n);
 
-    /* Calculate MAC. Note that msg ends in the MAC so we must
-     * construct B to contain X ^ msg for the first lm bytes (done in
-     * mac() and X ^ 0 for the remaining DTLS_CCM_BLOCKSIZE - lm bytes
-     * (i.e., we can use memcpy() here).
-     */
-    memcpy(B + lm, X + lm, DTLS_CCM_BLOCKSIZE - lm);
-    mac(ctx, msg, lm, B, X); 
+    /* calculate MAC */
+    mac_blocks(ctx, msg, n, B, X);
 
     /* update local pointers */
-    msg += lm;
+    lm -= n;
+    msg += n;
+    counter += DTLS_CCM_PARALLEL;
+
+    n = min(DTLS_CCM_PARALLEL * DTLS_CCM_BLOCKSIZE, lm);
+    if (n)
+      key_stream(ctx, L, counter, n, A, S, NULL);
   }
   
-  /* calculate S_0 */  
-  SET_COUNTER(A, L, 0, counter_tmp);
-  rijndael_encrypt(ctx, A, S);
-
-  memxor(msg, S, M);
+  memxor(msg, S0, M);
 
   /* return length if MAC is valid, otherwise continue with error handling */
   if (equals(X, msg, M))
@@ -301,3 +337,4 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
  error:
   return -1;
 }
+
@@ -26,6 +26,19 @@
 #define DTLS_CCM_MAX        16	/**< max number of bytes in digest */
 #define DTLS_CCM_NONCE_SIZE 12	/**< size of nonce */
 
+/**
+ * Number of key stream blocks that are computed at once when
+ * encrypting or decrypting a message (at most 7). Small devices do
+ * not gain anything from this but pay for the larger stack buffers.
+ */
+#ifndef DTLS_CCM_PARALLEL
+#ifdef WITH_CONTIKI
+#define DTLS_CCM_PARALLEL 1
+#else /* WITH_CONTIKI */
+#define DTLS_CCM_PARALLEL 4
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_CCM_PARALLEL */
+
 /** 
  * Authenticates and encrypts a message using AES in CCM mode. Please
  * see also RFC 3610 for the meaning of \p M, \p L, \p lm and \p la.
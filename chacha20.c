@@ -0,0 +1,451 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "tinydtls.h"
+#include "global.h"
+#include "chacha20.h"
+
+#if defined(DTLS_CHACHA20_SSE2) || defined(DTLS_CHACHA20_AVX2)
+#include <immintrin.h>
+#endif
+#ifdef DTLS_CHACHA20_NEON
+#include <arm_neon.h>
+#endif
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) {			\
+    a += b; d ^= a; d = ROTL32(d, 16);			\
+    c += d; b ^= c; b = ROTL32(b, 12);			\
+    a += b; d ^= a; d = ROTL32(d, 8);			\
+    c += d; b ^= c; b = ROTL32(b, 7);			\
+  }
+
+static inline uint32_t
+get_le32(const unsigned char *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+    | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+put_le32(unsigned char *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+static void
+chacha20_setup(uint32_t state[16],
+	       const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+	       uint32_t counter,
+	       const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE]) {
+  int i;
+
+  /* "expand 32-byte k" */
+  state[0] = 0x61707865;
+  state[1] = 0x3320646e;
+  state[2] = 0x79622d32;
+  state[3] = 0x6b206574;
+  for (i = 0; i < 8; i++)
+    state[4 + i] = get_le32(key + 4 * i);
+  state[12] = counter;
+  for (i = 0; i < 3; i++)
+    state[13 + i] = get_le32(nonce + 4 * i);
+}
+
+/* Writes the key stream block for state[12] to ks and advances the
+ * counter. */
+static void
+chacha20_block(uint32_t state[16], unsigned char ks[DTLS_CHACHA20_BLOCKSIZE]) {
+  uint32_t x[16];
+  int i;
+
+  memcpy(x, state, sizeof(x));
+
+  for (i = 0; i < 10; i++) {
+    QUARTERROUND(x[0], x[4], x[8],  x[12]);
+    QUARTERROUND(x[1], x[5], x[9],  x[13]);
+    QUARTERROUND(x[2], x[6], x[10], x[14]);
+    QUARTERROUND(x[3], x[7], x[11], x[15]);
+    QUARTERROUND(x[0], x[5], x[10], x[15]);
+    QUARTERROUND(x[1], x[6], x[11], x[12]);
+    QUARTERROUND(x[2], x[7], x[8],  x[13]);
+    QUARTERROUND(x[3], x[4], x[9],  x[14]);
+  }
+
+  for (i = 0; i < 16; i++)
+    put_le32(ks + 4 * i, x[i] + state[i]);
+
+  state[12]++;
+}
+
+/* The SIMD kernels below keep word i of N consecutive blocks in the
+ * lanes of vector x[i], so that the rounds are the scalar ones with
+ * vector operations. After the rounds each group of four vectors is
+ * transposed back into four 16-byte pieces of the key stream. */
+
+#ifdef DTLS_CHACHA20_SSE2
+#define SSE2_TARGET __attribute__((target("sse2")))
+
+#define SSE2_ROTL(v, n)						\
+  _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define SSE2_QR(a, b, c, d) {						\
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 16); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 12); \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 8); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 7); \
+  }
+
+/* XORs the key stream for four blocks per iteration to msg. */
+SSE2_TARGET static void
+chacha20_sse2(uint32_t state[16], unsigned char *msg, size_t n) {
+  __m128i x[16], s[16];
+  __m128i t0, t1, t2, t3;
+  unsigned char *p;
+  int i, r;
+
+  for (i = 0; i < 16; i++)
+    s[i] = _mm_set1_epi32((int)state[i]);
+
+  for (; n; n--, msg += 4 * DTLS_CHACHA20_BLOCKSIZE) {
+    s[12] = _mm_add_epi32(_mm_set1_epi32((int)state[12]),
+			  _mm_set_epi32(3, 2, 1, 0));
+    memcpy(x, s, sizeof(x));
+
+    for (r = 0; r < 10; r++) {
+      SSE2_QR(x[0], x[4], x[8],  x[12]);
+      SSE2_QR(x[1], x[5], x[9],  x[13]);
+      SSE2_QR(x[2], x[6], x[10], x[14]);
+      SSE2_QR(x[3], x[7], x[11], x[15]);
+      SSE2_QR(x[0], x[5], x[10], x[15]);
+      SSE2_QR(x[1], x[6], x[11], x[12]);
+      SSE2_QR(x[2], x[7], x[8],  x[13]);
+      SSE2_QR(x[3], x[4], x[9],  x[14]);
+    }
+
+    for (i = 0; i < 16; i += 4) {
+      t0 = _mm_unpacklo_epi32(_mm_add_epi32(x[i], s[i]),
+			      _mm_add_epi32(x[i + 1], s[i + 1]));
+      t1 = _mm_unpacklo_epi32(_mm_add_epi32(x[i + 2], s[i + 2]),
+			      _mm_add_epi32(x[i + 3], s[i + 3]));
+      t2 = _mm_unpackhi_epi32(_mm_add_epi32(x[i], s[i]),
+			      _mm_add_epi32(x[i + 1], s[i + 1]));
+      t3 = _mm_unpackhi_epi32(_mm_add_epi32(x[i + 2], s[i + 2]),
+			      _mm_add_epi32(x[i + 3], s[i + 3]));
+
+      p = msg + 4 * i;
+      _mm_storeu_si128((__m128i *)p,
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)p),
+		      _mm_unpacklo_epi64(t0, t1)));
+      p += DTLS_CHACHA20_BLOCKSIZE;
+      _mm_storeu_si128((__m128i *)p,
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)p),
+		      _mm_unpackhi_epi64(t0, t1)));
+      p += DTLS_CHACHA20_BLOCKSIZE;
+      _mm_storeu_si128((__m128i *)p,
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)p),
+		      _mm_unpacklo_epi64(t2, t3)));
+      p += DTLS_CHACHA20_BLOCKSIZE;
+      _mm_storeu_si128((__m128i *)p,
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)p),
+		      _mm_unpackhi_epi64(t2, t3)));
+    }
+
+    state[12] += 4;
+  }
+}
+#endif /* DTLS_CHACHA20_SSE2 */
+
+#ifdef DTLS_CHACHA20_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+#define AVX2_ROTL(v, n)							\
+  _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+/* rotations by 16 and 8 bits are byte shuffles */
+#define AVX2_QR(a, b, c, d) {						\
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);		\
+    d = _mm256_shuffle_epi8(d, rot16);					\
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);		\
+    b = AVX2_ROTL(b, 12);						\
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);		\
+    d = _mm256_shuffle_epi8(d, rot8);					\
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);		\
+    b = AVX2_ROTL(b, 7);						\
+  }
+
+AVX2_TARGET static inline void
+avx2_xor_store(unsigned char *p, __m256i ks) {
+  _mm256_storeu_si256((__m256i *)p,
+    _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)p), ks));
+}
+
+/* XORs the key stream for eight blocks per iteration to msg. Lane j
+ * of the lower 128 bits holds block j, of the upper 128 bits block
+ * j + 4, as the unpack instructions work within 128-bit lanes. */
+AVX2_TARGET static void
+chacha20_avx2(uint32_t state[16], unsigned char *msg, size_t n) {
+  const __m256i rot16 =
+    _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+		    13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+  const __m256i rot8 =
+    _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+		    14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+  __m256i x[16], s[16];
+  __m256i t0, t1, t2, t3, y[16];
+  int i, r;
+
+  for (i = 0; i < 16; i++)
+    s[i] = _mm256_set1_epi32((int)state[i]);
+
+  for (; n; n--, msg += 8 * DTLS_CHACHA20_BLOCKSIZE) {
+    s[12] = _mm256_add_epi32(_mm256_set1_epi32((int)state[12]),
+			     _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    memcpy(x, s, sizeof(x));
+
+    for (r = 0; r < 10; r++) {
+      AVX2_QR(x[0], x[4], x[8],  x[12]);
+      AVX2_QR(x[1], x[5], x[9],  x[13]);
+      AVX2_QR(x[2], x[6], x[10], x[14]);
+      AVX2_QR(x[3], x[7], x[11], x[15]);
+      AVX2_QR(x[0], x[5], x[10], x[15]);
+      AVX2_QR(x[1], x[6], x[11], x[12]);
+      AVX2_QR(x[2], x[7], x[8],  x[13]);
+      AVX2_QR(x[3], x[4], x[9],  x[14]);
+    }
+
+    for (i = 0; i < 16; i++)
+      x[i] = _mm256_add_epi32(x[i], s[i]);
+
+    /* y[4 * k + g] holds words 4g..4g+3 of blocks k and k + 4 */
+    for (i = 0; i < 4; i++) {
+      t0 = _mm256_unpacklo_epi32(x[4 * i], x[4 * i + 1]);
+      t1 = _mm256_unpacklo_epi32(x[4 * i + 2], x[4 * i + 3]);
+      t2 = _mm256_unpackhi_epi32(x[4 * i], x[4 * i + 1]);
+      t3 = _mm256_unpackhi_epi32(x[4 * i + 2], x[4 * i + 3]);
+      y[i]      = _mm256_unpacklo_epi64(t0, t1);
+      y[4 + i]  = _mm256_unpackhi_epi64(t0, t1);
+      y[8 + i]  = _mm256_unpacklo_epi64(t2, t3);
+      y[12 + i] = _mm256_unpackhi_epi64(t2, t3);
+    }
+
+    for (i = 0; i < 4; i++) {
+      unsigned char *lo = msg + i * DTLS_CHACHA20_BLOCKSIZE;
+      unsigned char *hi = lo + 4 * DTLS_CHACHA20_BLOCKSIZE;
+
+      avx2_xor_store(lo,      _mm256_permute2x128_si256(y[4 * i], y[4 * i + 1], 0x20));
+      avx2_xor_store(lo + 32, _mm256_permute2x128_si256(y[4 * i + 2], y[4 * i + 3], 0x20));
+      avx2_xor_store(hi,      _mm256_permute2x128_si256(y[4 * i], y[4 * i + 1], 0x31));
+      avx2_xor_store(hi + 32, _mm256_permute2x128_si256(y[4 * i + 2], y[4 * i + 3], 0x31));
+    }
+
+    state[12] += 8;
+  }
+}
+#endif /* DTLS_CHACHA20_AVX2 */
+
+#ifdef DTLS_CHACHA20_NEON
+#define NEON_ROTL(v, n) vsriq_n_u32(vshlq_n_u32(v, n), v, 32 - (n))
+
+#define NEON_QR(a, b, c, d) {						\
+    a = vaddq_u32(a, b); d = veorq_u32(d, a); d = NEON_ROTL(d, 16);	\
+    c = vaddq_u32(c, d); b = veorq_u32(b, c); b = NEON_ROTL(b, 12);	\
+    a = vaddq_u32(a, b); d = veorq_u32(d, a); d = NEON_ROTL(d, 8);	\
+    c = vaddq_u32(c, d); b = veorq_u32(b, c); b = NEON_ROTL(b, 7);	\
+  }
+
+/* XORs the key stream for four blocks per iteration to msg. The
+ * interleaving store vst4q_u32 does the transposition. */
+static void
+chacha20_neon(uint32_t state[16], unsigned char *msg, size_t n) {
+  static const uint32_t lanes[4] = { 0, 1, 2, 3 };
+  uint32x4_t x[16], s[16];
+  uint32x4x4_t q;
+  uint32_t t[16];
+  unsigned char *p;
+  int i, k, r;
+
+  for (i = 0; i < 16; i++)
+    s[i] = vdupq_n_u32(state[i]);
+
+  for (; n; n--, msg += 4 * DTLS_CHACHA20_BLOCKSIZE) {
+    s[12] = vaddq_u32(vdupq_n_u32(state[12]), vld1q_u32(lanes));
+    for (i = 0; i < 16; i++)
+      x[i] = s[i];
+
+    for (r = 0; r < 10; r++) {
+      NEON_QR(x[0], x[4], x[8],  x[12]);
+      NEON_QR(x[1], x[5], x[9],  x[13]);
+      NEON_QR(x[2], x[6], x[10], x[14]);
+      NEON_QR(x[3], x[7], x[11], x[15]);
+      NEON_QR(x[0], x[5], x[10], x[15]);
+      NEON_QR(x[1], x[6], x[11], x[12]);
+      NEON_QR(x[2], x[7], x[8],  x[13]);
+      NEON_QR(x[3], x[4], x[9],  x[14]);
+    }
+
+    for (i = 0; i < 16; i += 4) {
+      q.val[0] = vaddq_u32(x[i], s[i]);
+      q.val[1] = vaddq_u32(x[i + 1], s[i + 1]);
+      q.val[2] = vaddq_u32(x[i + 2], s[i + 2]);
+      q.val[3] = vaddq_u32(x[i + 3], s[i + 3]);
+      vst4q_u32(t, q);
+
+      for (k = 0; k < 4; k++) {
+	p = msg + k * DTLS_CHACHA20_BLOCKSIZE + 4 * i;
+	vst1q_u8(p, veorq_u8(vld1q_u8(p),
+			     vreinterpretq_u8_u32(vld1q_u32(t + 4 * k))));
+      }
+    }
+
+    state[12] += 4;
+  }
+}
+#endif /* DTLS_CHACHA20_NEON */
+
+#if defined(DTLS_CHACHA20_SSE2) || defined(DTLS_CHACHA20_AVX2)
+static int chacha20_simd;
+
+/* Returns 2 if AVX2 is available, 1 for SSE2, and 0 otherwise. */
+static int
+chacha20_simd_level(void) {
+  int level = __atomic_load_n(&chacha20_simd, __ATOMIC_RELAXED);
+
+  if (!level) {
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ? 3
+      : __builtin_cpu_supports("sse2") ? 2 : 1;
+    __atomic_store_n(&chacha20_simd, level, __ATOMIC_RELAXED);
+  }
+  return level - 1;
+}
+#endif
+
+void
+dtls_chacha20_xor(const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+		  uint32_t counter,
+		  const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE],
+		  unsigned char *msg, size_t len) {
+  uint32_t state[16];
+  unsigned char ks[DTLS_CHACHA20_BLOCKSIZE];
+  size_t n;
+
+  chacha20_setup(state, key, counter, nonce);
+
+#if defined(DTLS_CHACHA20_SSE2) || defined(DTLS_CHACHA20_AVX2)
+  if (len >= 4 * DTLS_CHACHA20_BLOCKSIZE) {
+    int level = chacha20_simd_level();
+
+#ifdef DTLS_CHACHA20_AVX2
+    if (level >= 2 && (n = len / (8 * DTLS_CHACHA20_BLOCKSIZE))) {
+      chacha20_avx2(state, msg, n);
+      msg += n * 8 * DTLS_CHACHA20_BLOCKSIZE;
+      len -= n * 8 * DTLS_CHACHA20_BLOCKSIZE;
+    }
+#endif /* DTLS_CHACHA20_AVX2 */
+#ifdef DTLS_CHACHA20_SSE2
+    if (level >= 1 && (n = len / (4 * DTLS_CHACHA20_BLOCKSIZE))) {
+      chacha20_sse2(state, msg, n);
+      msg += n * 4 * DTLS_CHACHA20_BLOCKSIZE;
+      len -= n * 4 * DTLS_CHACHA20_BLOCKSIZE;
+    }
+#endif /* DTLS_CHACHA20_SSE2 */
+  }
+#endif
+#ifdef DTLS_CHACHA20_NEON
+  if ((n = len / (4 * DTLS_CHACHA20_BLOCKSIZE))) {
+    chacha20_neon(state, msg, n);
+    msg += n * 4 * DTLS_CHACHA20_BLOCKSIZE;
+    len -= n * 4 * DTLS_CHACHA20_BLOCKSIZE;
+  }
+#endif /* DTLS_CHACHA20_NEON */
+
+  while (len) {
+    n = len < DTLS_CHACHA20_BLOCKSIZE ? len : DTLS_CHACHA20_BLOCKSIZE;
+    chacha20_block(state, ks);
+    memxor(msg, ks, n);
+    msg += n;
+    len -= n;
+  }
+
+  memset(state, 0, sizeof(state));
+  memset(ks, 0, sizeof(ks));
+}
+
+/* Calculates the Poly1305 tag over aad and the ciphertext with the
+ * one-time key from key stream block 0. */
+static void
+chacha20_poly1305_tag(const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+		      const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE],
+		      const unsigned char *ct, size_t lc,
+		      const unsigned char *aad, size_t la,
+		      unsigned char tag[DTLS_POLY1305_TAG_SIZE]) {
+  unsigned char otk[DTLS_POLY1305_KEY_SIZE];
+  unsigned char lengths[16];
+  dtls_poly1305_t st;
+  int i;
+
+  memset(otk, 0, sizeof(otk));
+  dtls_chacha20_xor(key, 0, nonce, otk, sizeof(otk));
+  dtls_poly1305_init(&st, otk);
+
+  dtls_poly1305_update_padded(&st, aad, la);
+  dtls_poly1305_update_padded(&st, ct, lc);
+
+  for (i = 0; i < 8; i++) {
+    lengths[i] = ((uint64_t)la >> (8 * i)) & 0xff;
+    lengths[8 + i] = ((uint64_t)lc >> (8 * i)) & 0xff;
+  }
+  dtls_poly1305_update_padded(&st, lengths, sizeof(lengths));
+
+  dtls_poly1305_finish(&st, tag);
+  memset(otk, 0, sizeof(otk));
+}
+
+long int
+dtls_chacha20_poly1305_encrypt_message(const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+				       const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE],
+				       unsigned char *msg, size_t lm,
+				       const unsigned char *aad, size_t la) {
+  dtls_chacha20_xor(key, 1, nonce, msg, lm);
+  chacha20_poly1305_tag(key, nonce, msg, lm, aad, la, msg + lm);
+
+  return lm + DTLS_POLY1305_TAG_SIZE;
+}
+
+long int
+dtls_chacha20_poly1305_decrypt_message(const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+				       const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE],
+				       unsigned char *msg, size_t lm,
+				       const unsigned char *aad, size_t la) {
+  unsigned char tag[DTLS_POLY1305_TAG_SIZE];
+
+  if (lm < DTLS_POLY1305_TAG_SIZE)
+    return -1;
+
+  lm -= DTLS_POLY1305_TAG_SIZE;
+  chacha20_poly1305_tag(key, nonce, msg, lm, aad, la, tag);
+
+  if (!equals(tag, msg + lm, DTLS_POLY1305_TAG_SIZE))
+    return -1;
+
+  dtls_chacha20_xor(key, 1, nonce, msg, lm);
+  return lm;
+}
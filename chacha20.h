@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#ifndef _DTLS_CHACHA20_H_
+#define _DTLS_CHACHA20_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "poly1305.h"
+
+/* ChaCha20 and the ChaCha20-Poly1305 AEAD, RFC 8439 */
+
+#define DTLS_CHACHA20_KEY_SIZE   32 /**< size of the key */
+#define DTLS_CHACHA20_NONCE_SIZE 12 /**< size of nonce */
+#define DTLS_CHACHA20_BLOCKSIZE  64 /**< size of a key stream block */
+
+/* Multi-block kernels: four blocks with SSE2 or NEON, eight blocks
+ * with AVX2 when the CPU supports it. Define DTLS_CHACHA20_NO_SIMD to
+ * build the portable code only. */
+#ifndef DTLS_CHACHA20_NO_SIMD
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DTLS_CHACHA20_SSE2 1
+#define DTLS_CHACHA20_AVX2 1
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) \
+  && !defined(__ARMEB__) && !defined(__AARCH64EB__)
+#define DTLS_CHACHA20_NEON 1
+#endif
+#endif /* DTLS_CHACHA20_NO_SIMD */
+
+/**
+ * XORs \p len bytes of the ChaCha20 key stream starting at block
+ * \p counter to \p msg.
+ */
+void dtls_chacha20_xor(const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+		       uint32_t counter,
+		       const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE],
+		       unsigned char *msg, size_t len);
+
+/**
+ * Encrypts the \p lm bytes in \p msg in place and appends the
+ * DTLS_POLY1305_TAG_SIZE bytes tag over \p aad and the ciphertext.
+ * \p msg must provide space for the tag.
+ *
+ * \return The length of the ciphertext including the tag.
+ */
+long int
+dtls_chacha20_poly1305_encrypt_message(const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+				       const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE],
+				       unsigned char *msg, size_t lm,
+				       const unsigned char *aad, size_t la);
+
+/**
+ * Decrypts the \p lm bytes in \p msg in place, where the last
+ * DTLS_POLY1305_TAG_SIZE bytes are the tag. The tag is verified
+ * before anything is decrypted.
+ *
+ * \return The length of the plaintext, or \c -1 if the tag could not
+ *         be verified.
+ */
+long int
+dtls_chacha20_poly1305_decrypt_message(const unsigned char key[DTLS_CHACHA20_KEY_SIZE],
+				       const unsigned char nonce[DTLS_CHACHA20_NONCE_SIZE],
+				       unsigned char *msg, size_t lm,
+				       const unsigned char *aad, size_t la);
+
+#endif /* _DTLS_CHACHA20_H_ */
@@ -31,38 +31,39 @@
 #include "dtls.h"
 #include "crypto.h"
 #include "ccm.h"
+#include "gcm.h"
 #include "ecc/ecc.h"
 #include "prng.h"
 #include "netq.h"
-
-#ifndef WITH_CONTIKI
-#include <pthread.h>
-#endif
+#include "pool.h"
 
 #define HMAC_UPDATE_SEED(Context,Seed,Length)		\
   if (Seed) dtls_hmac_update(Context, (Seed), (Length))
 
-static struct dtls_cipher_context_t cipher_context;
-#ifndef WITH_CONTIKI
-static pthread_mutex_t cipher_context_mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
+#if !defined(WITH_CONTIKI) && defined(DTLS_POOL)
+DTLS_POOL_DEFINE(handshake_pool, sizeof(dtls_handshake_parameters_t));
+DTLS_POOL_DEFINE(security_pool, sizeof(dtls_security_parameters_t));
 
-static struct dtls_cipher_context_t *dtls_cipher_context_get(void)
+void crypto_init(void)
 {
-#ifndef WITH_CONTIKI
-  pthread_mutex_lock(&cipher_context_mutex);
-#endif
-  return &cipher_context;
 }
 
-static void dtls_cipher_context_release(void)
-{
-#ifndef WITH_CONTIKI
-  pthread_mutex_unlock(&cipher_context_mutex);
-#endif
+static dtls_handshake_parameters_t *dtls_handshake_malloc(void) {
+  return dtls_pool_alloc(&handshake_pool);
 }
 
-#ifndef WITH_CONTIKI
+static void dtls_handshake_dealloc(dtls_handshake_parameters_t *handshake) {
+  dtls_pool_free(&handshake_pool, handshake);
+}
+
+static dtls_security_parameters_t *dtls_security_malloc(void) {
+  return dtls_pool_alloc(&security_pool);
+}
+
+static void dtls_security_dealloc(dtls_security_parameters_t *security) {
+  dtls_pool_free(&security_pool, security);
+}
+#elif !defined(WITH_CONTIKI)
 void crypto_init(void)
 {
 }
@@ -176,62 +177,51 @@ dtls_p_hash(dtls_hashfunc_t h,
 	    const unsigned char *random1, size_t random1len,
 	    const unsigned char *random2, size_t random2len,
 	    unsigned char *buf, size_t buflen) {
-  dtls_hmac_context_t *hmac_a, *hmac_p;
+  dtls_hmac_key_t hmac_key;
+  dtls_hmac_context_t hmac;
 
   unsigned char A[DTLS_HMAC_DIGEST_SIZE];
   unsigned char tmp[DTLS_HMAC_DIGEST_SIZE];
   size_t dlen;			/* digest length */
   size_t len = 0;			/* result length */
+  size_t n;
   (void)h;
 
-  hmac_a = dtls_hmac_new(key, keylen);
-  if (!hmac_a)
-    return 0;
+  /* hash the pads only once for all HMAC calculations below */
+  dtls_hmac_key_init(&hmac_key, key, keylen);
 
   /* calculate A(1) from A(0) == seed */
-  HMAC_UPDATE_SEED(hmac_a, label, labellen);
-  HMAC_UPDATE_SEED(hmac_a, random1, random1len);
-  HMAC_UPDATE_SEED(hmac_a, random2, random2len);
+  dtls_hmac_init_key(&hmac, &hmac_key);
+  HMAC_UPDATE_SEED(&hmac, label, labellen);
+  HMAC_UPDATE_SEED(&hmac, random1, random1len);
+  HMAC_UPDATE_SEED(&hmac, random2, random2len);
 
-  dlen = dtls_hmac_finalize(hmac_a, A);
+  dlen = dtls_hmac_finalize(&hmac, A);
 
-  hmac_p = dtls_hmac_new(key, keylen);
-  if (!hmac_p)
-    goto error;
+  while (len < buflen) {
+    dtls_hmac_init_key(&hmac, &hmac_key);
+    dtls_hmac_update(&hmac, A, dlen);
 
-  while (len + dlen < buflen) {
+    HMAC_UPDATE_SEED(&hmac, label, labellen);
+    HMAC_UPDATE_SEED(&hmac, random1, random1len);
+    HMAC_UPDATE_SEED(&hmac, random2, random2len);
 
-    /* FIXME: rewrite loop to avoid superflous call to dtls_hmac_init() */
-    dtls_hmac_init(hmac_p, key, keylen);
-    dtls_hmac_update(hmac_p, A, dlen);
-
-    HMAC_UPDATE_SEED(hmac_p, label, labellen);
-    HMAC_UPDATE_SEED(hmac_p, random1, random1len);
-    HMAC_UPDATE_SEED(hmac_p, random2, random2len);
-
-    len += dtls_hmac_finalize(hmac_p, tmp);
-    memcpy(buf, tmp, dlen);
-    buf += dlen;
+    dtls_hmac_finalize(&hmac, tmp);
+    n = buflen - len < dlen ? buflen - len : dlen;
+    memcpy(buf, tmp, n);
+    buf += n;
+    len += n;
 
     /* calculate A(i+1) */
-    dtls_hmac_init(hmac_a, key, keylen);
-    dtls_hmac_update(hmac_a, A, dlen);
-    dtls_hmac_finalize(hmac_a, A);
+    if (len < buflen) {
+      dtls_hmac_init_key(&hmac, &hmac_key);
+      dtls_hmac_update(&hmac, A, dlen);
+      dtls_hmac_finalize(&hmac, A);
+    }
   }
 
-  dtls_hmac_init(hmac_p, key, keylen);
-  dtls_hmac_update(hmac_p, A, dlen);
-  
-  HMAC_UPDATE_SEED(hmac_p, label, labellen);
-  HMAC_UPDATE_SEED(hmac_p, random1, random1len);
-  HMAC_UPDATE_SEED(hmac_p, random2, random2len);
-  
-  dtls_hmac_finalize(hmac_p, tmp);
-  memcpy(buf, tmp, buflen - len);
-
- error:
-  dtls_hmac_free(hmac_a);
-  dtls_hmac_free(hmac_p);
+  memset(&hmac_key, 0, sizeof(hmac_key));
+  memset(tmp, 0, sizeof(tmp));
 
   return buflen;
 }
@@ -271,7 +261,7 @@ dtls_mac(dtls_hmac_context_t *hmac_ctx,
 }
 
 static size_t
-dtls_ccm_encrypt(aes128_ccm_t *ccm_ctx, const unsigned char *src, size_t srclen,
+dtls_ccm_encrypt(dtls_aead_t *ccm_ctx, const unsigned char *src, size_t srclen,
 		 unsigned char *buf, 
 		 unsigned char *nounce,
 		 const unsigned char *aad, size_t la) {
@@ -280,7 +270,7 @@ dtls_ccm_encrypt(aes128_ccm_t *ccm_ctx, const unsigned char *src, size_t srclen,
 
   assert(ccm_ctx);
 
-  len = dtls_ccm_encrypt_message(&ccm_ctx->ctx, 8 /* M */, 
+  len = dtls_ccm_encrypt_message(&ccm_ctx->key.ccm, 8 /* M */, 
 				 max(2, 15 - DTLS_CCM_NONCE_SIZE),
 				 nounce,
 				 buf, srclen, 
@@ -289,7 +279,7 @@ dtls_ccm_encrypt(aes128_ccm_t *ccm_ctx, const unsigned char *src, size_t srclen,
 }
 
 static size_t
-dtls_ccm_decrypt(aes128_ccm_t *ccm_ctx, const unsigned char *src,
+dtls_ccm_decrypt(dtls_aead_t *ccm_ctx, const unsigned char *src,
 		 size_t srclen, unsigned char *buf,
 		 unsigned char *nounce,
 		 const unsigned char *aad, size_t la) {
@@ -298,7 +288,7 @@ dtls_ccm_decrypt(aes128_ccm_t *ccm_ctx, const unsigned char *src,
 
   assert(ccm_ctx);
 
-  len = dtls_ccm_decrypt_message(&ccm_ctx->ctx, 8 /* M */, 
+  len = dtls_ccm_decrypt_message(&ccm_ctx->key.ccm, 8 /* M */, 
 				 max(2, 15 - DTLS_CCM_NONCE_SIZE),
 				 nounce,
 				 buf, srclen, 
@@ -513,29 +503,107 @@ dtls_ecdsa_verify_sig(const unsigned char *pub_key_x,
 }
 #endif /* DTLS_ECC */
 
-int 
-dtls_encrypt(const unsigned char *src, size_t length,
-	     unsigned char *buf,
-	     unsigned char *nounce,
-	     unsigned char *key, size_t keylen,
-	     const unsigned char *aad, size_t la)
+int
+dtls_cipher_set_key(dtls_aead_t *aead_ctx, dtls_cipher_t cipher,
+		    const unsigned char *key, size_t keylen)
 {
+  rijndael_ctx *aes = &aead_ctx->key.ccm;
   int ret;
-  struct dtls_cipher_context_t *ctx = dtls_cipher_context_get();
 
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
+  assert(aead_ctx);
+
+#if DTLS_CHACHA20_POLY1305
+  if (dtls_cipher_is_chacha20(cipher)) {
+    if (keylen != DTLS_CHACHA20_KEY_SIZE) {
+      dtls_warn("invalid ChaCha20 key length %zu\n", keylen);
+      return -1;
+    }
+    aead_ctx->cipher = cipher;
+    memcpy(aead_ctx->key.chacha20, key, keylen);
+    return 0;
+  }
+#endif /* DTLS_CHACHA20_POLY1305 */
+
+#if DTLS_GCM
+  if (dtls_cipher_is_gcm(cipher))
+    aes = &aead_ctx->key.gcm.ctx;
+#endif /* DTLS_GCM */
+
+  ret = rijndael_set_key_enc_only(aes, key, 8 * keylen);
   if (ret < 0) {
-    /* cleanup everything in case the key has the wrong size */
     dtls_warn("cannot set rijndael key\n");
-    goto error;
+    return ret;
   }
 
+  aead_ctx->cipher = cipher;
+#if DTLS_GCM
+  if (dtls_cipher_is_gcm(cipher))
+    dtls_gcm_init(&aead_ctx->key.gcm.ghash, aes);
+#endif /* DTLS_GCM */
+  return ret;
+}
+
+int
+dtls_encrypt_ctx(dtls_aead_t *aead_ctx,
+		 const unsigned char *src, size_t length,
+		 unsigned char *buf,
+		 unsigned char *nounce,
+		 const unsigned char *aad, size_t la)
+{
   if (src != buf)
     memmove(buf, src, length);
-  ret = dtls_ccm_encrypt(&ctx->data, src, length, buf, nounce, aad, la);
+#if DTLS_GCM
+  if (dtls_cipher_is_gcm(aead_ctx->cipher))
+    return dtls_gcm_encrypt_message(&aead_ctx->key.gcm.ctx,
+				    &aead_ctx->key.gcm.ghash, nounce,
+				    buf, length, aad, la);
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20_POLY1305
+  if (dtls_cipher_is_chacha20(aead_ctx->cipher))
+    return dtls_chacha20_poly1305_encrypt_message(aead_ctx->key.chacha20,
+						  nounce, buf, length, aad, la);
+#endif /* DTLS_CHACHA20_POLY1305 */
+  return dtls_ccm_encrypt(aead_ctx, src, length, buf, nounce, aad, la);
+}
+
+int
+dtls_decrypt_ctx(dtls_aead_t *aead_ctx,
+		 const unsigned char *src, size_t length,
+		 unsigned char *buf,
+		 unsigned char *nounce,
+		 const unsigned char *aad, size_t la)
+{
+  if (src != buf)
+    memmove(buf, src, length);
+#if DTLS_GCM
+  if (dtls_cipher_is_gcm(aead_ctx->cipher))
+    return dtls_gcm_decrypt_message(&aead_ctx->key.gcm.ctx,
+				    &aead_ctx->key.gcm.ghash, nounce,
+				    buf, length, aad, la);
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20_POLY1305
+  if (dtls_cipher_is_chacha20(aead_ctx->cipher))
+    return dtls_chacha20_poly1305_decrypt_message(aead_ctx->key.chacha20,
+						  nounce, buf, length, aad, la);
+#endif /* DTLS_CHACHA20_POLY1305 */
+  return dtls_ccm_decrypt(aead_ctx, src, length, buf, nounce, aad, la);
+}
 
-error:
-  dtls_cipher_context_release();
+int 
+dtls_encrypt(const unsigned char *src, size_t length,
+	     unsigned char *buf,
+	     unsigned char *nounce,
+	     unsigned char *key, size_t keylen,
+	     const unsigned char *aad, size_t la)
+{
+  int ret;
+  dtls_aead_t ccm_ctx;		/* per-call state, no locking required */
+
+  ret = dtls_cipher_set_key(&ccm_ctx, TLS_PSK_WITH_AES_128_CCM_8, key, keylen);
+  if (ret >= 0)
+    ret = dtls_encrypt_ctx(&ccm_ctx, src, length, buf, nounce, aad, la);
+
+  memset(&ccm_ctx, 0, sizeof(ccm_ctx));
   return ret;
 }
 
@@ -547,21 +615,13 @@ dtls_decrypt(const unsigned char *src, size_t length,
 	     const unsigned char *aad, size_t la)
 {
   int ret;
-  struct dtls_cipher_context_t *ctx = dtls_cipher_context_get();
-
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
-  if (ret < 0) {
-    /* cleanup everything in case the key has the wrong size */
-    dtls_warn("cannot set rijndael key\n");
-    goto error;
-  }
+  dtls_aead_t ccm_ctx;		/* per-call state, no locking required */
 
-  if (src != buf)
-    memmove(buf, src, length);
-  ret = dtls_ccm_decrypt(&ctx->data, src, length, buf, nounce, aad, la);
+  ret = dtls_cipher_set_key(&ccm_ctx, TLS_PSK_WITH_AES_128_CCM_8, key, keylen);
+  if (ret >= 0)
+    ret = dtls_decrypt_ctx(&ccm_ctx, src, length, buf, nounce, aad, la);
 
-error:
-  dtls_cipher_context_release();
+  memset(&ccm_ctx, 0, sizeof(ccm_ctx));
   return ret;
 }
 
@@ -29,13 +29,27 @@
 #include "numeric.h"
 #include "hmac.h"
 #include "ccm.h"
+#include "gcm.h"
+#include "chacha20.h"
 
-/* TLS_PSK_WITH_AES_128_CCM_8 */
+/* TLS_PSK_WITH_AES_128_CCM_8, the GCM cipher suites use the same
+ * key block layout */
 #define DTLS_MAC_KEY_LENGTH    0
 #define DTLS_KEY_LENGTH        16 /* AES-128 */
 #define DTLS_BLK_LENGTH        16 /* AES-128 */
 #define DTLS_MAC_LENGTH        DTLS_HMAC_DIGEST_SIZE
-#define DTLS_IV_LENGTH         4  /* length of nonce_explicit */
+#define DTLS_IV_LENGTH         4  /* length of the implicit nonce part */
+#define DTLS_CCM_TAG_LENGTH    8  /* AES-128-CCM_8 */
+#define DTLS_GCM_TAG_LENGTH    DTLS_GCM_TAG_SIZE
+
+/* The ChaCha20-Poly1305 cipher suites (RFC 7905) derive a 12 byte
+ * IV and have no nonce_explicit in the records. */
+#define DTLS_CHACHA20_KEY_LENGTH DTLS_CHACHA20_KEY_SIZE
+#define DTLS_CHACHA20_IV_LENGTH  DTLS_CHACHA20_NONCE_SIZE
+#define DTLS_CHACHA20_TAG_LENGTH DTLS_POLY1305_TAG_SIZE
+
+/** Length of nonce_explicit in records of the AES cipher suites. */
+#define DTLS_RECORD_IV_LENGTH  8
 
 /** 
  * Maximum size of the generated keyblock. Note that MAX_KEYBLOCK_LENGTH must 
@@ -43,11 +57,38 @@
  * pre-shared key + 1.
  */
 #define MAX_KEYBLOCK_LENGTH  \
-  (2 * DTLS_MAC_KEY_LENGTH + 2 * DTLS_KEY_LENGTH + 2 * DTLS_IV_LENGTH)
+  (2 * DTLS_MAC_KEY_LENGTH + 2 * DTLS_CHACHA20_KEY_LENGTH \
+   + 2 * DTLS_CHACHA20_IV_LENGTH)
 
 /** Length of DTLS master_secret */
 #define DTLS_MASTER_SECRET_LENGTH 48
 #define DTLS_RANDOM_LENGTH 32
+#define DTLS_SESSION_ID_LENGTH 32
+
+#ifndef DTLS_SESSION_TICKETS
+#ifdef WITH_CONTIKI
+#define DTLS_SESSION_TICKETS 0 /**< set to 1 to support session tickets */
+#else /* WITH_CONTIKI */
+#define DTLS_SESSION_TICKETS 1 /**< set to 0 to compile out session tickets */
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_SESSION_TICKETS */
+
+/* The AES-128-GCM and ChaCha20-Poly1305 cipher suites can be
+ * compiled out to save code and per-peer memory. Contiki sets both
+ * to 0 in platform.h unless DTLS_CONF_GCM or
+ * DTLS_CONF_CHACHA20_POLY1305 is set. */
+#ifndef DTLS_GCM
+#define DTLS_GCM 1 /**< set to 0 to compile out the AES-128-GCM cipher suites */
+#endif /* DTLS_GCM */
+
+#ifndef DTLS_CHACHA20_POLY1305
+#define DTLS_CHACHA20_POLY1305 1 /**< set to 0 to compile out ChaCha20-Poly1305 */
+#endif /* DTLS_CHACHA20_POLY1305 */
+
+#ifndef DTLS_TICKET_MAX_LENGTH
+/** Maximum size of a session ticket a client accepts from a server. */
+#define DTLS_TICKET_MAX_LENGTH 128
+#endif /* DTLS_TICKET_MAX_LENGTH */
 
 typedef enum { AES128=0 
 } dtls_crypto_alg;
@@ -56,15 +97,43 @@ typedef enum {
   DTLS_ECDH_CURVE_SECP256R1
 } dtls_ecdh_curve;
 
-/** Crypto context for TLS_PSK_WITH_AES_128_CCM_8 cipher suite. */
-typedef struct {
-  rijndael_ctx ctx;		       /**< AES-128 encryption context */
-} aes128_ccm_t;
+/**
+ * Returns true if \p Cipher is one of the AES-128-GCM cipher suites
+ * and these have been compiled in.
+ */
+#define dtls_cipher_is_gcm(Cipher)					\
+  (DTLS_GCM && ((Cipher) == TLS_PSK_WITH_AES_128_GCM_SHA256		\
+		|| (Cipher) == TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256))
+
+/**
+ * Returns true if \p Cipher is one of the ChaCha20-Poly1305 cipher
+ * suites and these have been compiled in.
+ */
+#define dtls_cipher_is_chacha20(Cipher)					\
+  (DTLS_CHACHA20_POLY1305						\
+   && ((Cipher) == TLS_PSK_WITH_CHACHA20_POLY1305_SHA256		\
+       || (Cipher) == TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256))
 
-typedef struct dtls_cipher_context_t {
-  /** numeric identifier of this cipher suite in host byte order. */
-  aes128_ccm_t data;		/**< The crypto context */
-} dtls_cipher_context_t;
+/**
+ * Crypto context for the AEAD of the negotiated cipher suite. Only
+ * the member of key that belongs to cipher is in use, so a peer that
+ * uses CCM_8 does not pay for the GHASH tables.
+ */
+typedef struct {
+  dtls_cipher_t cipher;		       /**< selects the member of key */
+  union {
+    rijndael_ctx ccm;		       /**< AES-128 key schedule for CCM_8 */
+#if DTLS_GCM
+    struct {
+      rijndael_ctx ctx;		       /**< AES-128 key schedule */
+      dtls_ghash_key_t ghash;	       /**< GHASH key derived from ctx */
+    } gcm;
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20_POLY1305
+    unsigned char chacha20[DTLS_CHACHA20_KEY_SIZE]; /**< the raw key */
+#endif /* DTLS_CHACHA20_POLY1305 */
+  } key;
+} dtls_aead_t;
 
 typedef struct {
   uint8 own_eph_priv[32];
@@ -105,6 +174,15 @@ typedef struct {
    * access the components of the key block.
    */
   uint8 key_block[MAX_KEYBLOCK_LENGTH];
+
+  /**
+   * Expanded AES key schedules for the local and remote write keys
+   * from \c key_block. These are set up once with
+   * dtls_cipher_set_key() when the key block has been calculated
+   * and then used for every record of this epoch.
+   */
+  dtls_aead_t write_cipher;	/**< context for records we send */
+  dtls_aead_t read_cipher;	/**< context for records we receive */
   
   seqnum_t cseq;        /**<sequence number of last record received*/
 } dtls_security_parameters_t;
@@ -126,6 +204,18 @@ typedef struct {
   dtls_compression_t compression;		/**< compression method */
   dtls_cipher_t cipher;		/**< cipher type */
   unsigned int do_client_auth:1;
+  unsigned int resumed:1;	/**< abbreviated handshake of a cached session */
+  uint8 session_id_length;
+  uint8 session_id[DTLS_SESSION_ID_LENGTH]; /**< offered or negotiated session id */
+  unsigned int ticket_ext:1;	/**< the peer has sent the SessionTicket extension */
+#if DTLS_SESSION_TICKETS
+  uint8 ticket_length;
+  uint8 ticket[DTLS_TICKET_MAX_LENGTH]; /**< presented or received session ticket */
+  uint8 ticket_secret[DTLS_MASTER_SECRET_LENGTH]; /**< master secret of the presented ticket */
+#endif /* DTLS_SESSION_TICKETS */
+  unsigned int cid_ext:1;	/**< the peer has sent the connection_id extension */
+  unsigned int failed:1;	/**< counted in the context's handshakes_failed */
+  uint64_t hello_time;		/**< when the ClientHello without cookie was sent (us) */
   union {
 #ifdef DTLS_ECC
     dtls_handshake_parameters_ecdsa_t ecdsa;
@@ -154,7 +244,7 @@ typedef struct {
 #define dtls_kb_client_write_key(Param, Role)				\
   (dtls_kb_server_mac_secret(Param, Role) + DTLS_MAC_KEY_LENGTH)
 #define dtls_kb_server_write_key(Param, Role)				\
-  (dtls_kb_client_write_key(Param, Role) + DTLS_KEY_LENGTH)
+  (dtls_kb_client_write_key(Param, Role) + dtls_kb_key_size(Param, Role))
 #define dtls_kb_remote_write_key(Param, Role)				\
   ((Role) == DTLS_SERVER						\
    ? dtls_kb_client_write_key(Param, Role)				\
@@ -163,11 +253,13 @@ typedef struct {
   ((Role) == DTLS_CLIENT						\
    ? dtls_kb_client_write_key(Param, Role)				\
    : dtls_kb_server_write_key(Param, Role))
-#define dtls_kb_key_size(Param, Role) DTLS_KEY_LENGTH
+#define dtls_kb_key_size(Param, Role)					\
+  (dtls_cipher_is_chacha20((Param)->cipher)				\
+   ? DTLS_CHACHA20_KEY_LENGTH : DTLS_KEY_LENGTH)
 #define dtls_kb_client_iv(Param, Role)					\
-  (dtls_kb_server_write_key(Param, Role) + DTLS_KEY_LENGTH)
+  (dtls_kb_server_write_key(Param, Role) + dtls_kb_key_size(Param, Role))
 #define dtls_kb_server_iv(Param, Role)					\
-  (dtls_kb_client_iv(Param, Role) + DTLS_IV_LENGTH)
+  (dtls_kb_client_iv(Param, Role) + dtls_kb_iv_size(Param, Role))
 #define dtls_kb_remote_iv(Param, Role)					\
   ((Role) == DTLS_SERVER						\
    ? dtls_kb_client_iv(Param, Role)					\
@@ -176,7 +268,19 @@ typedef struct {
   ((Role) == DTLS_CLIENT						\
    ? dtls_kb_client_iv(Param, Role)					\
    : dtls_kb_server_iv(Param, Role))
-#define dtls_kb_iv_size(Param, Role) DTLS_IV_LENGTH
+#define dtls_kb_iv_size(Param, Role)					\
+  (dtls_cipher_is_chacha20((Param)->cipher)				\
+   ? DTLS_CHACHA20_IV_LENGTH : DTLS_IV_LENGTH)
+/** Length of the explicit nonce that is sent with each record. */
+#define dtls_kb_record_iv_size(Param, Role)				\
+  (dtls_cipher_is_chacha20((Param)->cipher) ? 0 : DTLS_RECORD_IV_LENGTH)
+
+/* size of the authentication tag appended to each record */
+#define dtls_kb_tag_size(Param, Role)					\
+  (dtls_cipher_is_gcm((Param)->cipher)					\
+   ? DTLS_GCM_TAG_LENGTH						\
+   : dtls_cipher_is_chacha20((Param)->cipher)				\
+   ? DTLS_CHACHA20_TAG_LENGTH : DTLS_CCM_TAG_LENGTH)
 
 #define dtls_kb_size(Param, Role)					\
   (2 * (dtls_kb_mac_secret_size(Param, Role) +				\
@@ -290,6 +394,40 @@ int dtls_decrypt(const unsigned char *src, size_t length,
 		 unsigned char *key, size_t keylen,
 		 const unsigned char *a_data, size_t a_data_length);
 
+/**
+ * Expands the given \p key into the AES key schedule of \p aead_ctx
+ * for subsequent use with dtls_encrypt_ctx() or dtls_decrypt_ctx().
+ * The ChaCha20-Poly1305 cipher suites keep the raw 32 byte key.
+ *
+ * \param aead_ctx The cipher context to initialize.
+ * \param cipher  The cipher suite that selects the AEAD mode.
+ * \param key     The raw key.
+ * \param keylen  Length of \p key in bytes.
+ * \return Less than zero on error, zero otherwise.
+ */
+int dtls_cipher_set_key(dtls_aead_t *aead_ctx, dtls_cipher_t cipher,
+			const unsigned char *key, size_t keylen);
+
+/**
+ * Like dtls_encrypt(), but uses the already expanded key schedule
+ * in \p aead_ctx instead of setting up the key for each call.
+ */
+int dtls_encrypt_ctx(dtls_aead_t *aead_ctx,
+		     const unsigned char *src, size_t length,
+		     unsigned char *buf,
+		     unsigned char *nounce,
+		     const unsigned char *aad, size_t aad_length);
+
+/**
+ * Like dtls_decrypt(), but uses the already expanded key schedule
+ * in \p aead_ctx instead of setting up the key for each call.
+ */
+int dtls_decrypt_ctx(dtls_aead_t *aead_ctx,
+		     const unsigned char *src, size_t length,
+		     unsigned char *buf,
+		     unsigned char *nounce,
+		     const unsigned char *aad, size_t aad_length);
+
 /* helper functions */
 
 /** 
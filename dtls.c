@@ -42,9 +42,6 @@
 #endif /* HAVE_INTTYPES_H */
 
 #include "utlist.h"
-#ifndef DTLS_PEERS_NOHASH
-#include "uthash.h"
-#endif /* DTLS_PEERS_NOHASH */
 
 #include "dtls_debug.h"
 #include "numeric.h"
@@ -69,40 +66,133 @@
 #define dtls_get_sequence_number(H) dtls_uint48_to_ulong((H)->sequence_number)
 #define dtls_get_fragment_length(H) dtls_uint24_to_int((H)->fragment_length)
 
+#if DTLS_STATS
+/* The counters in ctx->stats are only written by the thread that
+ * handles the context, but dtls_get_stats() may read them from any
+ * thread. A relaxed load and store keeps the update a plain increment
+ * while ruling out torn values. Where 64-bit atomics would need a
+ * library call, e.g. on 32-bit microcontrollers, plain accesses are
+ * used instead. */
+#if defined(__GNUC__) && defined(__GCC_ATOMIC_LLONG_LOCK_FREE) \
+  && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define DTLS_STAT_GET(Var) __atomic_load_n(&(Var), __ATOMIC_RELAXED)
+#define DTLS_STAT_SET(Var, Value)				\
+  __atomic_store_n(&(Var), (uint64_t)(Value), __ATOMIC_RELAXED)
+#else /* __GCC_ATOMIC_LLONG_LOCK_FREE == 2 */
+#define DTLS_STAT_GET(Var) (Var)
+#define DTLS_STAT_SET(Var, Value) ((Var) = (uint64_t)(Value))
+#endif /* __GCC_ATOMIC_LLONG_LOCK_FREE == 2 */
+
+#define DTLS_STAT_ADD(Ctx, Field, N)				\
+  DTLS_STAT_SET((Ctx)->stats.Field, DTLS_STAT_GET((Ctx)->stats.Field) + (N))
+#define DTLS_STAT_INC(Ctx, Field) DTLS_STAT_ADD(Ctx, Field, 1)
+
+/* Counts a record of the given content type in Field. */
+#define DTLS_STAT_RECORD(Ctx, Field, Type)				\
+  do {									\
+    if ((Type) >= DTLS_CT_CHANGE_CIPHER_SPEC &&				\
+	(Type) < DTLS_CT_CHANGE_CIPHER_SPEC + DTLS_STATS_CONTENT_TYPES)	\
+      DTLS_STAT_INC(Ctx, Field[(Type) - DTLS_CT_CHANGE_CIPHER_SPEC]);	\
+  } while (0)
+#else /* DTLS_STATS */
+#define DTLS_STAT_ADD(Ctx, Field, N) ((void)(Ctx))
+#define DTLS_STAT_INC(Ctx, Field) ((void)(Ctx))
+#define DTLS_STAT_RECORD(Ctx, Field, Type) ((void)(Ctx))
+#endif /* DTLS_STATS */
+
+/* Updates the number of peers in the statistics of ctx. */
+static inline void
+dtls_stats_update_peers(dtls_context_t *ctx) {
+#if !DTLS_STATS
+  (void)ctx;
+#elif defined(DTLS_PEERS_NOHASH)
+  dtls_peer_t *tmp;
+  size_t count;
+
+  LL_COUNT(ctx->peers, tmp, count);
+  DTLS_STAT_SET(ctx->stats.peers, count);
+#else /* DTLS_PEERS_NOHASH */
+  DTLS_STAT_SET(ctx->stats.peers, dtls_peer_table_count(&ctx->peers));
+#endif /* DTLS_PEERS_NOHASH */
+}
+
 #ifdef DTLS_PEERS_NOHASH
-#define FIND_PEER(head,sess,out)                                \
+#define FIND_PEER(head,key,hash,out)                            \
   do {                                                          \
     dtls_peer_t * tmp;                                          \
     (out) = NULL;                                               \
     LL_FOREACH((head), tmp) {                                   \
-      if (dtls_session_equals(&tmp->session, (sess))) {         \
+      if (dtls_peer_key_equals(&tmp->key, (key))) {             \
         (out) = tmp;                                            \
         break;                                                  \
       }                                                         \
     }                                                           \
   } while (0)
-#define DEL_PEER(head,delptr)                   \
-  if ((head) != NULL && (delptr) != NULL) {	\
-    LL_DELETE(head,delptr);                     \
+#define DEL_PEER(ctx,delptr)                    \
+  if ((ctx)->peers != NULL && (delptr) != NULL) { \
+    LL_DELETE((ctx)->peers,delptr);             \
+    (ctx)->peers_generation++;                  \
+    dtls_stats_update_peers(ctx);               \
   }
-#define ADD_PEER(head,sess,add)                 \
-  LL_PREPEND(ctx->peers, peer);
 #else /* DTLS_PEERS_NOHASH */
-#define FIND_PEER(head,sess,out)		\
-  HASH_FIND(hh,head,sess,sizeof(session_t),out)
-#define ADD_PEER(head,sess,add)                 \
-  HASH_ADD(hh,head,sess,sizeof(session_t),add)
-#define DEL_PEER(head,delptr)                   \
-  if ((head) != NULL && (delptr) != NULL) {	\
-    HASH_DELETE(hh,head,delptr);		\
+#define FIND_PEER(head,key,hash,out)            \
+  ((out) = dtls_peer_table_find(&(head),key,hash))
+#define DEL_PEER(ctx,delptr)                    \
+  if ((delptr) != NULL) {                       \
+    dtls_peer_table_remove(&(ctx)->peers,delptr); \
+    dtls_cid_remove(ctx,delptr);                \
+    (ctx)->peers_generation++;                  \
+    dtls_stats_update_peers(ctx);               \
   }
+
+/* Connection ids are random, so their first bytes are a good hash. */
+static inline size_t
+cid_bucket(const uint8 *cid) {
+  uint32_t h = 0;
+  size_t i;
+
+  for (i = 0; i < DTLS_CID_LENGTH && i < sizeof(h); i++)
+    h = (h << 8) | cid[i];
+  return h % DTLS_CID_BUCKETS;
+}
+
+/** Adds @p peer to the connection id index of @p ctx if it has an id. */
+static void
+dtls_cid_add(dtls_context_t *ctx, dtls_peer_t *peer) {
+  size_t bucket;
+
+  if (!peer->own_cid_length)
+    return;
+
+  bucket = cid_bucket(peer->own_cid);
+  peer->cid_next = ctx->cid_peers[bucket];
+  ctx->cid_peers[bucket] = peer;
+}
+
+/** Removes @p peer from the connection id index of @p ctx. */
+static void
+dtls_cid_remove(dtls_context_t *ctx, dtls_peer_t *peer) {
+  dtls_peer_t **p;
+
+  if (!peer->own_cid_length)
+    return;
+
+  for (p = &ctx->cid_peers[cid_bucket(peer->own_cid)]; *p;
+       p = &(*p)->cid_next) {
+    if (*p == peer) {
+      *p = peer->cid_next;
+      break;
+    }
+  }
+  peer->cid_next = NULL;
+}
 #endif /* DTLS_PEERS_NOHASH */
 
 #define DTLS_RH_LENGTH sizeof(dtls_record_header_t)
 #define DTLS_HS_LENGTH sizeof(dtls_handshake_header_t)
 #define DTLS_CH_LENGTH sizeof(dtls_client_hello_t) /* no variable length fields! */
 #define DTLS_COOKIE_LENGTH_MAX 32
-#define DTLS_CH_LENGTH_MAX sizeof(dtls_client_hello_t) + DTLS_COOKIE_LENGTH_MAX + 12 + 26
+#define DTLS_CH_LENGTH_MAX sizeof(dtls_client_hello_t) + DTLS_COOKIE_LENGTH_MAX + DTLS_SESSION_ID_LENGTH + 20 + 26 + 4 + DTLS_TICKET_MAX_LENGTH + 5
 #define DTLS_HV_LENGTH sizeof(dtls_hello_verify_t)
 #define DTLS_SH_LENGTH (2 + DTLS_RANDOM_LENGTH + 1 + 2 + 1)
 #define DTLS_CE_LENGTH (3 + 3 + 27 + DTLS_EC_KEY_SIZE + DTLS_EC_KEY_SIZE)
@@ -112,11 +202,35 @@
 #define DTLS_CKXPSK_LENGTH_MIN 2
 #define DTLS_CKXEC_LENGTH (1 + 1 + DTLS_EC_KEY_SIZE + DTLS_EC_KEY_SIZE)
 #define DTLS_CV_LENGTH (1 + 1 + 2 + 1 + 1 + 1 + 1 + DTLS_EC_KEY_SIZE + 1 + 1 + DTLS_EC_KEY_SIZE)
+/* the ASN.1 integers r and s of a signature can be as short as 1 byte */
+#define DTLS_SKEXEC_LENGTH_MIN (DTLS_SKEXEC_LENGTH - 2 * (DTLS_EC_KEY_SIZE - 1))
+#define DTLS_CV_LENGTH_MIN (DTLS_CV_LENGTH - 2 * (DTLS_EC_KEY_SIZE - 1))
 #define DTLS_FIN_LENGTH 12
 
 #define HS_HDR_LENGTH  DTLS_RH_LENGTH + DTLS_HS_LENGTH
 #define HV_HDR_LENGTH  HS_HDR_LENGTH + DTLS_HV_LENGTH
 
+#if DTLS_SESSION_TICKETS
+/** The size of the (unprotected) record with our NewSessionTicket. */
+#define DTLS_NST_RECORD_LENGTH						\
+  (DTLS_RH_LENGTH + DTLS_HS_LENGTH + sizeof(uint32) + sizeof(uint16)	\
+   + DTLS_TICKET_LENGTH)
+#endif /* DTLS_SESSION_TICKETS */
+
+/**
+ * Returns @c 1 if @p ctx offers and issues session tickets. Tickets
+ * are not used when our NewSessionTicket does not fit into a record.
+ */
+static inline int
+dtls_tickets_enabled(const dtls_context_t *ctx) {
+#if DTLS_SESSION_TICKETS
+  return ctx->tickets && DTLS_NST_RECORD_LENGTH <= DTLS_MAX_BUF;
+#else /* DTLS_SESSION_TICKETS */
+  (void)ctx;
+  return 0;
+#endif /* DTLS_SESSION_TICKETS */
+}
+
 #define HIGH(V) (((V) >> 8) & 0xff)
 #define LOW(V)  ((V) & 0xff)
 
@@ -213,6 +327,170 @@ dtls_send_multi(dtls_context_t *ctx, dtls_peer_t *peer,
 		unsigned char type, uint8 *buf_array[],
 		size_t buf_len_array[], size_t buf_array_len);
 
+#ifndef WITH_CONTIKI
+/**
+ * Passes all datagrams that have been collected for the write_batch
+ * handler to the application. Datagrams that have not been sent are
+ * counted as write errors.
+ *
+ * \return \c 0 if all datagrams have been sent, a value less than
+ * zero otherwise.
+ */
+static int
+dtls_write_batch_flush(dtls_context_t *ctx) {
+  dtls_write_batch_t *batch = &ctx->write_batch;
+  int res;
+
+  if (!batch->count)
+    return 0;
+
+  res = ctx->h->write_batch(ctx, batch->sessions,
+			    batch->bufs, batch->lens, batch->count);
+  if (res < (int)batch->count) {
+    dtls_warn("write_batch sent only %d of %zu datagrams\n",
+	      res, batch->count);
+    DTLS_STAT_ADD(ctx, write_errors, batch->count - (res > 0 ? res : 0));
+    res = -1;
+  } else {
+    res = 0;
+  }
+
+  batch->count = 0;
+  batch->used = 0;
+  return res;
+}
+#endif /* WITH_CONTIKI */
+
+/**
+ * Hands the datagram in @p buf to the application, either directly
+ * through the write handler or by adding it to the current write
+ * batch. The return value is the number of bytes sent or a value
+ * less than zero on error. An error of a previous batch that had to
+ * be flushed to make room for @p buf is returned as well.
+ */
+static int
+dtls_write_datagram(dtls_context_t *ctx, session_t *session,
+		    uint8 *buf, size_t len) {
+  int res;
+#ifndef WITH_CONTIKI
+  dtls_write_batch_t *batch = &ctx->write_batch;
+
+  if (ctx->output_active > 0 && ctx->h && ctx->h->write_batch &&
+      len <= sizeof(batch->data)) {
+    res = 0;
+    if (batch->count == DTLS_WRITE_BATCH_MAX ||
+	batch->used + len > sizeof(batch->data))
+      res = dtls_write_batch_flush(ctx);
+
+    memcpy(&batch->sessions[batch->count], session, sizeof(session_t));
+    batch->bufs[batch->count] = batch->data + batch->used;
+    batch->lens[batch->count] = len;
+    memcpy(batch->bufs[batch->count], buf, len);
+    batch->used += len;
+    batch->count++;
+    return res < 0 ? res : (int)len;
+  }
+#endif /* WITH_CONTIKI */
+  res = CALL(ctx, write, session, buf, len);
+  if (res < 0)
+    DTLS_STAT_INC(ctx, write_errors);
+  return res;
+}
+
+/**
+ * Sends the datagram that holds the packed handshake records.
+ *
+ * \return \c 0 on success, a value less than zero if the datagram
+ * could not be sent.
+ */
+static int
+dtls_packed_flush(dtls_context_t *ctx) {
+  int res = 0;
+
+  if (ctx->packed.length) {
+    res = dtls_write_datagram(ctx, &ctx->packed.session,
+			      ctx->packed.data, ctx->packed.length);
+    ctx->packed.length = 0;
+  }
+  return res < 0 ? res : 0;
+}
+
+/**
+ * Sends the record in @p buf to @p session. While output is
+ * collected and @p pack is set, the record is appended to the
+ * datagram that is currently being packed as long as the result
+ * does not exceed @p mtu. Otherwise, the pending datagram is sent
+ * first to keep the order of records.
+ *
+ * \return The number of bytes sent or a value less than zero on error.
+ * If the pending datagram cannot be sent, its error is returned and
+ * @p buf is not sent either.
+ */
+static int
+dtls_write_record(dtls_context_t *ctx, session_t *session, size_t mtu,
+		  uint8 *buf, size_t len, int pack) {
+  int res;
+
+  if (mtu > sizeof(ctx->packed.data))
+    mtu = sizeof(ctx->packed.data);
+
+  pack = pack && ctx->output_active > 0 && len <= mtu;
+
+  if (ctx->packed.length &&
+      (!pack || ctx->packed.length + len > ctx->packed.mtu ||
+       !dtls_session_equals(&ctx->packed.session, session))) {
+    res = dtls_packed_flush(ctx);
+    if (res < 0)
+      return res;
+  }
+
+  if (pack) {
+    if (!ctx->packed.length) {
+      memcpy(&ctx->packed.session, session, sizeof(session_t));
+      ctx->packed.mtu = mtu;
+    }
+    memcpy(ctx->packed.data + ctx->packed.length, buf, len);
+    ctx->packed.length += len;
+    return len;
+  }
+
+  return dtls_write_datagram(ctx, session, buf, len);
+}
+
+/**
+ * Starts collecting output. Until the matching call to
+ * dtls_output_end(), consecutive handshake records for the same peer
+ * are packed into as few datagrams as possible, and datagrams are
+ * collected for the write_batch handler if one is set.
+ */
+static inline void
+dtls_output_begin(dtls_context_t *ctx) {
+  ctx->output_active++;
+}
+
+/**
+ * Stops collecting output and sends everything collected so far.
+ *
+ * \return \c 0 on success, a value less than zero if some of the
+ * collected output could not be sent.
+ */
+static int
+dtls_output_end(dtls_context_t *ctx) {
+  int res = 0;
+
+  if (ctx->output_active == 1) {
+    /* still active, so the packed datagram joins the write batch */
+    res = dtls_packed_flush(ctx);
+#ifndef WITH_CONTIKI
+    if (ctx->h && ctx->h->write_batch && dtls_write_batch_flush(ctx) < 0)
+      res = -1;
+#endif /* WITH_CONTIKI */
+  }
+  if (ctx->output_active > 0)
+    ctx->output_active--;
+  return res;
+}
+
 /** 
  * Sends the fragment of length \p buflen given in \p buf to the
  * specified \p peer. The data will be MAC-protected and encrypted
@@ -238,14 +516,71 @@ dtls_send(dtls_context_t *ctx, dtls_peer_t *peer, unsigned char type,
  * Stops ongoing retransmissions of handshake messages for @p peer.
  */
 static void dtls_stop_retransmission(dtls_context_t *context, dtls_peer_t *peer);
+static void dtls_keep_flight(dtls_context_t *context, dtls_peer_t *peer);
+static void dtls_resend_flight(dtls_context_t *context, dtls_peer_t *peer);
+static void dtls_update_rtt(dtls_peer_t *peer);
 
-dtls_peer_t *
-dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
+/**
+ * Returns the peer for the given lookup @p key or @c NULL if not
+ * found. @p hash must be the result of dtls_peer_key_hash() for
+ * @p key.
+ */
+static inline dtls_peer_t *
+dtls_get_peer_by_key(const dtls_context_t *ctx,
+		     const dtls_peer_key_t *key, uint32_t hash) {
   dtls_peer_t *p;
-  FIND_PEER(ctx->peers, session, p);
+  (void)hash;
+  FIND_PEER(ctx->peers, key, hash, p);
+  return p;
+}
+
+/**
+ * Returns the peer that has asked us to send the connection id @p cid
+ * or @c NULL if not found. @p cid must hold DTLS_CID_LENGTH bytes.
+ */
+static dtls_peer_t *
+dtls_get_peer_by_cid(const dtls_context_t *ctx, const uint8 *cid) {
+  dtls_peer_t *p;
+
+#ifdef DTLS_PEERS_NOHASH
+  LL_FOREACH(ctx->peers, p) {
+    if (p->own_cid_length && memcmp(p->own_cid, cid, DTLS_CID_LENGTH) == 0)
+      break;
+  }
+#else /* DTLS_PEERS_NOHASH */
+  for (p = ctx->cid_peers[cid_bucket(cid)]; p; p = p->cid_next) {
+    if (memcmp(p->own_cid, cid, DTLS_CID_LENGTH) == 0)
+      break;
+  }
+#endif /* DTLS_PEERS_NOHASH */
   return p;
 }
 
+/**
+ * Returns the peer that has sent the datagram @p msg. Records with a
+ * connection id are looked up by that id, all others by the @p key
+ * of the sender's address. @p hash must be the result of
+ * dtls_peer_key_hash() for @p key.
+ */
+static dtls_peer_t *
+dtls_get_peer_for_datagram(const dtls_context_t *ctx,
+			   const dtls_peer_key_t *key, uint32_t hash,
+			   const uint8 *msg, size_t msglen) {
+  if (msglen >= DTLS_RH_LENGTH + DTLS_CID_LENGTH &&
+      msg[0] == DTLS_CT_TLS12_CID)
+    return dtls_get_peer_by_cid(ctx, msg + DTLS_RH_LENGTH - sizeof(uint16));
+
+  return dtls_get_peer_by_key(ctx, key, hash);
+}
+
+dtls_peer_t *
+dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
+  dtls_peer_key_t key;
+
+  dtls_session_key(session, &key);
+  return dtls_get_peer_by_key(ctx, &key, dtls_peer_key_hash(&key));
+}
+
 /**
  * Adds @p peer to list of peers in @p ctx. This function returns @c 0
  * on success, or a negative value on error (e.g. due to insufficient
@@ -253,7 +588,73 @@ dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
  */
 static int
 dtls_add_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
-  ADD_PEER(ctx->peers, session, peer);
+#ifdef DTLS_PEERS_NOHASH
+  LL_PREPEND(ctx->peers, peer);
+#else /* DTLS_PEERS_NOHASH */
+  int res;
+
+  res = dtls_peer_table_add(&ctx->peers, peer);
+  if (res < 0)
+    return res;
+  dtls_cid_add(ctx, peer);
+#endif /* DTLS_PEERS_NOHASH */
+
+  ctx->peers_generation++;
+  dtls_stats_update_peers(ctx);
+  return 0;
+}
+
+/**
+ * Assigns a random connection id to @p peer that no other peer in
+ * @p ctx uses. This function returns @c 0 on success, or a value
+ * less than zero on error.
+ */
+static int
+dtls_new_own_cid(dtls_context_t *ctx, dtls_peer_t *peer) {
+  do {
+    if (!dtls_prng(peer->own_cid, DTLS_CID_LENGTH))
+      return -1;
+  } while (dtls_get_peer_by_cid(ctx, peer->own_cid));
+
+  peer->own_cid_length = DTLS_CID_LENGTH;
+#ifndef DTLS_PEERS_NOHASH
+  dtls_cid_add(ctx, peer);
+#endif /* DTLS_PEERS_NOHASH */
+  return 0;
+}
+
+static void dtls_destroy_peer(dtls_context_t *ctx, dtls_peer_t *peer, int unlink);
+
+/**
+ * Moves @p peer to the transport address @p session. This is done
+ * when an authentic record with the peer's connection id that is
+ * newer than all records received so far arrives from a new
+ * address, e.g. after a NAT rebinding (RFC 9146, section 6). The
+ * peer is kept at its old address when another peer is known at the
+ * new one. This function returns @c 0 on success, or a value less
+ * than zero if @p peer had to be destroyed.
+ */
+static int
+dtls_update_peer_address(dtls_context_t *ctx, dtls_peer_t *peer,
+			 const session_t *session) {
+  dtls_peer_key_t key;
+
+  dtls_session_key(session, &key);
+  if (dtls_get_peer_by_key(ctx, &key, dtls_peer_key_hash(&key))) {
+    dtls_warn("cannot move peer, address is in use\n");
+    return 0;
+  }
+
+  DEL_PEER(ctx, peer);
+  memcpy(&peer->session, session, sizeof(session_t));
+  memcpy(&peer->key, &key, sizeof(dtls_peer_key_t));
+  if (dtls_add_peer(ctx, peer) < 0) {
+    dtls_alert("cannot add peer\n");
+    dtls_destroy_peer(ctx, peer, 0);
+    return -1;
+  }
+
+  dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "peer moved to", session);
   return 0;
 }
 
@@ -307,14 +708,60 @@ dtls_get_cookie(uint8 *msg, size_t msglen, uint8 **cookie) {
   return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
 }
 
+/**
+ * Determines the parts of the ClientHello \p msg that are covered by
+ * its cookie, see dtls_create_cookie(). On success, \p input and \p
+ * ilen are set to the three parts and \c 0 is returned.
+ */
+static int
+dtls_cookie_input(session_t *session, uint8 *msg, size_t msglen,
+		  const unsigned char *input[3], size_t ilen[3]) {
+  size_t e, fraglen;
+
+  if (msglen < DTLS_HS_LENGTH)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+
+  fraglen = dtls_get_fragment_length(DTLS_HANDSHAKE_HEADER(msg));
+  if (fraglen > msglen - DTLS_HS_LENGTH)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+
+  input[0] = (unsigned char *)&session->addr;
+  ilen[0] = session->size;
+
+  /* the beginning of the Client Hello up to and including the
+     session id */
+  e = sizeof(dtls_client_hello_t);
+  if (e + DTLS_HS_LENGTH >= msglen)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  e += (*(msg + DTLS_HS_LENGTH + e) & 0xff) + sizeof(uint8);
+  if (e + DTLS_HS_LENGTH > msglen)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+
+  input[1] = msg + DTLS_HS_LENGTH;
+  ilen[1] = e;
+
+  /* skip cookie bytes and length byte */
+  if (e + DTLS_HS_LENGTH >= msglen)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  e += *(uint8 *)(msg + DTLS_HS_LENGTH + e) & 0xff;
+  e += sizeof(uint8);
+  if (e > fraglen)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+
+  input[2] = msg + DTLS_HS_LENGTH + e;
+  ilen[2] = fraglen - e;
+  return 0;
+}
+
 static int
 dtls_create_cookie(dtls_context_t *ctx, 
 		   session_t *session,
 		   uint8 *msg, size_t msglen,
 		   uint8 *cookie, int *clen) {
   unsigned char buf[DTLS_HMAC_MAX];
-  size_t e;
-  int len;
+  const unsigned char *input[3];
+  size_t ilen[3];
+  int i, len;
 
   /* create cookie with HMAC-SHA256 over:
    * - SECRET
@@ -325,6 +772,9 @@ dtls_create_cookie(dtls_context_t *ctx,
    * - cipher_suites 
    * - compression method
    */
+  i = dtls_cookie_input(session, msg, msglen, input, ilen);
+  if (i < 0)
+    return i;
 
   /* We use our own buffer as hmac_context instead of a dynamic buffer
    * created by dtls_hmac_new() to separate storage space for cookie
@@ -333,29 +783,10 @@ dtls_create_cookie(dtls_context_t *ctx,
    * implementation of dtls_hmac_context_new()). */
 
   dtls_hmac_context_t hmac_context;
-  dtls_hmac_init(&hmac_context, ctx->cookie_secret, DTLS_COOKIE_SECRET_LENGTH);
+  dtls_hmac_init_key(&hmac_context, &ctx->cookie_key);
 
-  dtls_hmac_update(&hmac_context, 
-		   (unsigned char *)&session->addr, session->size);
-
-  /* feed in the beginning of the Client Hello up to and including the
-     session id */
-  e = sizeof(dtls_client_hello_t);
-  e += (*(msg + DTLS_HS_LENGTH + e) & 0xff) + sizeof(uint8);
-  if (e + DTLS_HS_LENGTH > msglen)
-    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
-
-  dtls_hmac_update(&hmac_context, msg + DTLS_HS_LENGTH, e);
-  
-  /* skip cookie bytes and length byte */
-  e += *(uint8 *)(msg + DTLS_HS_LENGTH + e) & 0xff;
-  e += sizeof(uint8);
-  if (e + DTLS_HS_LENGTH > msglen)
-    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
-
-  dtls_hmac_update(&hmac_context, 
-		   msg + DTLS_HS_LENGTH + e,
-		   dtls_get_fragment_length(DTLS_HANDSHAKE_HEADER(msg)) - e);
+  for (i = 0; i < 3; i++)
+    dtls_hmac_update(&hmac_context, input[i], ilen[i]);
 
   len = dtls_hmac_finalize(&hmac_context, buf);
 
@@ -375,10 +806,22 @@ static char const content_types[] = {
   DTLS_CT_ALERT,
   DTLS_CT_HANDSHAKE,
   DTLS_CT_APPLICATION_DATA,
+  DTLS_CT_TLS12_CID,
   0 				/* end marker */
 };
 #endif
 
+/**
+ * Returns the length of the header of the received record \p msg.
+ * Records with a connection id carry our own id, which always has
+ * DTLS_CID_LENGTH bytes.
+ */
+static inline size_t
+record_header_length(const uint8 *msg) {
+  return msg[0] == DTLS_CT_TLS12_CID
+    ? DTLS_RH_LENGTH + DTLS_CID_LENGTH : DTLS_RH_LENGTH;
+}
+
 /**
  * Checks if \p msg points to a valid DTLS record. If
  * 
@@ -386,6 +829,7 @@ static char const content_types[] = {
 static unsigned int
 is_record(uint8 *msg, size_t msglen) {
   unsigned int rlen = 0;
+  size_t hlen;
 
   if (msglen >= DTLS_RH_LENGTH	/* FIXME allow empty records? */
 #ifdef DTLS_CHECK_CONTENTTYPE
@@ -394,8 +838,12 @@ is_record(uint8 *msg, size_t msglen) {
       && msg[1] == HIGH(DTLS_VERSION)
       && msg[2] == LOW(DTLS_VERSION)) 
     {
-      rlen = DTLS_RH_LENGTH + 
-	dtls_uint16_to_int(DTLS_RECORD_HEADER(msg)->length);
+      hlen = record_header_length(msg);
+      if (msglen < hlen)
+	return 0;
+
+      /* the length field is the last field of the header */
+      rlen = hlen + dtls_uint16_to_int(msg + hlen - sizeof(uint16));
       
       /* we do not accept wrong length field in record header */
       if (rlen > msglen)	
@@ -494,16 +942,142 @@ static inline int is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(dtls_cipher_t cipher)
 #endif /* DTLS_ECC */
 }
 
+/** returns true if the cipher matches TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256 */
+static inline int is_tls_ecdhe_ecdsa_with_aes_128_gcm_sha256(dtls_cipher_t cipher)
+{
+#ifdef DTLS_ECC
+  return DTLS_GCM && cipher == TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256;
+#else
+  (void)cipher;
+  return 0;
+#endif /* DTLS_ECC */
+}
+
+/** returns true if the cipher matches TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 */
+static inline int is_tls_ecdhe_ecdsa_with_chacha20_poly1305_sha256(dtls_cipher_t cipher)
+{
+#ifdef DTLS_ECC
+  return DTLS_CHACHA20_POLY1305 && cipher == TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256;
+#else
+  (void)cipher;
+  return 0;
+#endif /* DTLS_ECC */
+}
+
 /** returns true if the cipher matches TLS_PSK_WITH_AES_128_CCM_8 */
 static inline int is_tls_psk_with_aes_128_ccm_8(dtls_cipher_t cipher)
 {
 #ifdef DTLS_PSK
   return cipher == TLS_PSK_WITH_AES_128_CCM_8;
 #else
+  (void)cipher;
+  return 0;
+#endif /* DTLS_PSK */
+}
+
+/** returns true if the cipher matches TLS_PSK_WITH_AES_128_GCM_SHA256 */
+static inline int is_tls_psk_with_aes_128_gcm_sha256(dtls_cipher_t cipher)
+{
+#ifdef DTLS_PSK
+  return DTLS_GCM && cipher == TLS_PSK_WITH_AES_128_GCM_SHA256;
+#else
+  (void)cipher;
+  return 0;
+#endif /* DTLS_PSK */
+}
+
+/** returns true if the cipher matches TLS_PSK_WITH_CHACHA20_POLY1305_SHA256 */
+static inline int is_tls_psk_with_chacha20_poly1305_sha256(dtls_cipher_t cipher)
+{
+#ifdef DTLS_PSK
+  return DTLS_CHACHA20_POLY1305 && cipher == TLS_PSK_WITH_CHACHA20_POLY1305_SHA256;
+#else
+  (void)cipher;
   return 0;
 #endif /* DTLS_PSK */
 }
 
+/** returns true if the cipher uses the ECDHE_ECDSA key exchange */
+static inline int is_tls_ecdhe_ecdsa(dtls_cipher_t cipher)
+{
+  return is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(cipher)
+    || is_tls_ecdhe_ecdsa_with_aes_128_gcm_sha256(cipher)
+    || is_tls_ecdhe_ecdsa_with_chacha20_poly1305_sha256(cipher);
+}
+
+/** returns true if the cipher uses the PSK key exchange */
+static inline int is_tls_psk(dtls_cipher_t cipher)
+{
+  return is_tls_psk_with_aes_128_ccm_8(cipher)
+    || is_tls_psk_with_aes_128_gcm_sha256(cipher)
+    || is_tls_psk_with_chacha20_poly1305_sha256(cipher);
+}
+
+/**
+ * Ranks the AEAD of @p cipher by our preference, lower is better.
+ * GCM is much faster where the CPU has AES and carry-less multiply
+ * instructions, ChaCha20-Poly1305 is faster everywhere else.
+ */
+static int
+dtls_cipher_rank(dtls_cipher_t cipher) {
+  int aes_hw = rijndael_hw_available();
+
+  if (dtls_cipher_is_gcm(cipher))
+    return aes_hw ? 0 : 1;
+  if (dtls_cipher_is_chacha20(cipher))
+    return aes_hw ? 1 : 0;
+  return 2;
+}
+
+/* Maps cipher to the index of its handshake counters. */
+static inline dtls_stats_cipher_t
+dtls_stats_cipher(dtls_cipher_t cipher) {
+  if (is_tls_psk_with_aes_128_ccm_8(cipher))
+    return DTLS_STATS_CIPHER_PSK_AES_128_CCM_8;
+  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(cipher))
+    return DTLS_STATS_CIPHER_ECDHE_ECDSA_AES_128_CCM_8;
+  if (is_tls_psk_with_aes_128_gcm_sha256(cipher))
+    return DTLS_STATS_CIPHER_PSK_AES_128_GCM_SHA256;
+  if (is_tls_ecdhe_ecdsa_with_aes_128_gcm_sha256(cipher))
+    return DTLS_STATS_CIPHER_ECDHE_ECDSA_AES_128_GCM_SHA256;
+  if (is_tls_psk_with_chacha20_poly1305_sha256(cipher))
+    return DTLS_STATS_CIPHER_PSK_CHACHA20_POLY1305_SHA256;
+  if (is_tls_ecdhe_ecdsa_with_chacha20_poly1305_sha256(cipher))
+    return DTLS_STATS_CIPHER_ECDHE_ECDSA_CHACHA20_POLY1305_SHA256;
+  return DTLS_STATS_CIPHER_NONE;
+}
+
+/* Adds the time since start to the histogram of phase. */
+static void
+dtls_stats_record_phase(dtls_context_t *ctx, dtls_phase_t phase,
+			uint64_t start) {
+#if DTLS_STATS
+  uint64_t now, duration;
+
+  dtls_usecs(&now);
+  duration = now > start ? now - start : 0;
+
+  DTLS_STAT_INC(ctx, phases[phase].count);
+  DTLS_STAT_ADD(ctx, phases[phase].sum, duration);
+  DTLS_STAT_INC(ctx, phases[phase].buckets[dtls_histogram_bucket(duration)]);
+#else /* DTLS_STATS */
+  (void)ctx;
+  (void)phase;
+  (void)start;
+#endif /* DTLS_STATS */
+}
+
+/* Counts the running handshake with peer as failed, at most once. */
+static void
+dtls_handshake_failed(dtls_context_t *ctx, dtls_peer_t *peer) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+
+  if (handshake && !handshake->failed) {
+    handshake->failed = 1;
+    DTLS_STAT_INC(ctx, handshakes_failed[dtls_stats_cipher(handshake->cipher)]);
+  }
+}
+
 /** returns true if the application is configured for psk */
 static inline int is_psk_supported(dtls_context_t *ctx)
 {
@@ -555,8 +1129,8 @@ known_cipher(dtls_context_t *ctx, dtls_cipher_t code, int is_client) {
 
   psk = is_psk_supported(ctx);
   ecdsa = is_ecdsa_supported(ctx, is_client);
-  return (psk && is_tls_psk_with_aes_128_ccm_8(code)) ||
-	 (ecdsa && is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(code));
+  return (psk && is_tls_psk(code)) ||
+	 (ecdsa && is_tls_ecdhe_ecdsa(code));
 }
 
 /**
@@ -634,6 +1208,8 @@ static char *dtls_handshake_type_to_name(int type)
     return "server_hello";
   case DTLS_HT_HELLO_VERIFY_REQUEST:
     return "hello_verify_request";
+  case DTLS_HT_NEW_SESSION_TICKET:
+    return "new_session_ticket";
   case DTLS_HT_CERTIFICATE:
     return "certificate";
   case DTLS_HT_SERVER_KEY_EXCHANGE:
@@ -653,6 +1229,53 @@ static char *dtls_handshake_type_to_name(int type)
   }
 }
 
+/**
+ * Expands @p master_secret into the key block of @p security and sets
+ * up the ciphers for the next epoch. This is the part of the key
+ * calculation that is shared by full and abbreviated handshakes.
+ */
+static int
+derive_key_block(dtls_handshake_parameters_t *handshake,
+		 dtls_peer_t *peer,
+		 dtls_security_parameters_t *security,
+		 const uint8 *master_secret,
+		 dtls_peer_type role) {
+  (void)role; /* The macro dtls_kb_size() does not use role. */
+
+  /* the layout of the key block depends on the cipher suite */
+  security->cipher = handshake->cipher;
+
+  /* create key_block from master_secret
+   * key_block = PRF(master_secret,
+                    "key expansion" + tmp.random.server + tmp.random.client) */
+
+  dtls_prf(master_secret,
+	   DTLS_MASTER_SECRET_LENGTH,
+	   PRF_LABEL(key), PRF_LABEL_SIZE(key),
+	   handshake->tmp.random.server, DTLS_RANDOM_LENGTH,
+	   handshake->tmp.random.client, DTLS_RANDOM_LENGTH,
+	   security->key_block,
+	   dtls_kb_size(security, role));
+
+  memcpy(handshake->tmp.master_secret, master_secret, DTLS_MASTER_SECRET_LENGTH);
+  dtls_debug_keyblock(security);
+
+  /* expand the AES key schedules once for the whole epoch */
+  if (dtls_cipher_set_key(&security->write_cipher, handshake->cipher,
+			  dtls_kb_local_write_key(security, peer->role),
+			  dtls_kb_key_size(security, peer->role)) < 0
+      || dtls_cipher_set_key(&security->read_cipher, handshake->cipher,
+			     dtls_kb_remote_write_key(security, peer->role),
+			     dtls_kb_key_size(security, peer->role)) < 0) {
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+
+  security->compression = handshake->compression;
+  security->rseq = 0;
+
+  return 0;
+}
+
 /**
  * Calculate the pre master secret and after that calculate the master-secret.
  */
@@ -666,7 +1289,6 @@ calculate_key_block(dtls_context_t *ctx,
   int pre_master_len = 0;
   dtls_security_parameters_t *security = dtls_security_params_next(peer);
   uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
-  (void)role; /* The macro dtls_kb_size() does not use role. */
 
   if (!security) {
     return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
@@ -676,7 +1298,9 @@ calculate_key_block(dtls_context_t *ctx,
 
   switch (handshake->cipher) {
 #ifdef DTLS_PSK
-  case TLS_PSK_WITH_AES_128_CCM_8: {
+  case TLS_PSK_WITH_AES_128_CCM_8:
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256: {
     unsigned char psk[DTLS_PSK_MAX_KEY_LEN];
     int len;
 
@@ -705,7 +1329,9 @@ calculate_key_block(dtls_context_t *ctx,
   }
 #endif /* DTLS_PSK */
 #ifdef DTLS_ECC
-  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8: {
+  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256: {
     pre_master_len = dtls_ecdh_pre_master_secret(handshake->keyx.ecdsa.own_eph_priv,
 						 handshake->keyx.ecdsa.other_eph_pub_x,
 						 handshake->keyx.ecdsa.other_eph_pub_y,
@@ -729,11 +1355,15 @@ calculate_key_block(dtls_context_t *ctx,
      */
 #ifndef DTLS_PSK
   case TLS_PSK_WITH_AES_128_CCM_8:
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256:
     /* fall through to default */
 #endif /* !DTLS_PSK */
 
 #ifndef DTLS_ECC
   case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256:
     /* fall through to default */
 #endif /* !DTLS_ECC */
 
@@ -755,26 +1385,65 @@ calculate_key_block(dtls_context_t *ctx,
 
   dtls_debug_dump("master_secret", master_secret, DTLS_MASTER_SECRET_LENGTH);
 
-  /* create key_block from master_secret
-   * key_block = PRF(master_secret,
-                    "key expansion" + tmp.random.server + tmp.random.client) */
+  return derive_key_block(handshake, peer, security, master_secret, role);
+}
 
-  dtls_prf(master_secret,
-	   DTLS_MASTER_SECRET_LENGTH,
-	   PRF_LABEL(key), PRF_LABEL_SIZE(key),
-	   handshake->tmp.random.server, DTLS_RANDOM_LENGTH,
-	   handshake->tmp.random.client, DTLS_RANDOM_LENGTH,
-	   security->key_block,
-	   dtls_kb_size(security, role));
+/**
+ * Sets up the security parameters for the next epoch of an abbreviated
+ * handshake from the master secret of the resumed session. A server
+ * takes the session from the ticket that dtls_update_parameters() has
+ * opened or looks it up in the cache by the id from the ClientHello.
+ * A client looks up the session by the address of the server.
+ */
+static int
+resume_key_block(dtls_context_t *ctx, dtls_peer_t *peer) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_security_parameters_t *security;
+  dtls_cache_entry_t *entry = NULL;
+  dtls_cipher_t cipher = TLS_NULL_WITH_NULL_NULL;
+  dtls_compression_t compression = TLS_COMPRESSION_NULL;
+  uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
+  dtls_tick_t now;
+  int res;
 
-  memcpy(handshake->tmp.master_secret, master_secret, DTLS_MASTER_SECRET_LENGTH);
-  dtls_debug_keyblock(security);
+  dtls_ticks(&now);
+#if DTLS_SESSION_TICKETS
+  if (peer->role == DTLS_SERVER && handshake->ticket_length) {
+    cipher = handshake->cipher;
+    compression = handshake->compression;
+    memcpy(master_secret, handshake->ticket_secret, DTLS_MASTER_SECRET_LENGTH);
+    memset(handshake->ticket_secret, 0, sizeof(handshake->ticket_secret));
+  } else
+#endif /* DTLS_SESSION_TICKETS */
+  {
+    if (peer->role == DTLS_SERVER)
+      entry = dtls_cache_find_id(ctx->cache, handshake->session_id,
+				 handshake->session_id_length, now);
+    else
+      entry = dtls_cache_find_key(ctx->cache, &peer->key, now);
 
-  security->cipher = handshake->cipher;
-  security->compression = handshake->compression;
-  security->rseq = 0;
+    if (entry && entry->id_length == handshake->session_id_length
+	&& memcmp(entry->id, handshake->session_id, entry->id_length) == 0) {
+      cipher = entry->cipher;
+      compression = entry->compression;
+      memcpy(master_secret, entry->master_secret, DTLS_MASTER_SECRET_LENGTH);
+    }
+  }
 
-  return 0;
+  if (cipher == TLS_NULL_WITH_NULL_NULL || cipher != handshake->cipher) {
+    dtls_warn("cannot resume session\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  }
+
+  security = dtls_security_params_next(peer);
+  if (!security)
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+
+  handshake->compression = compression;
+  res = derive_key_block(handshake, peer, security, master_secret,
+			 peer->role);
+  memset(master_secret, 0, sizeof(master_secret));
+  return res;
 }
 
 /* TODO: add a generic method which iterates over a list and searches for a specific key */
@@ -866,7 +1535,7 @@ dtls_check_tls_extension(dtls_peer_t *peer,
 
   if (data_length < sizeof(uint16)) { 
     /* no tls extensions specified */
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher)) {
+    if (is_tls_ecdhe_ecdsa(handshake->cipher)) {
       goto error;
     }
     return 0;
@@ -929,6 +1598,35 @@ dtls_check_tls_extension(dtls_peer_t *peer,
         if (verify_ext_ec_point_formats(data, j))
           goto error;
         break;
+      case TLS_EXT_SESSION_TICKET:
+	/* The extension announces support for session tickets. In a
+	 * ClientHello, it may contain a ticket to resume a session.
+	 * Tickets that are too long cannot be ours and are ignored. */
+	handshake->ticket_ext = 1;
+#if DTLS_SESSION_TICKETS
+	if (client_hello && j <= DTLS_TICKET_MAX_LENGTH) {
+	  handshake->ticket_length = j;
+	  memcpy(handshake->ticket, data, j);
+	}
+#endif /* DTLS_SESSION_TICKETS */
+	break;
+      case TLS_EXT_CONNECTION_ID:
+	/* The connection id that the peer wants to receive. It is only
+	 * negotiated in the initial handshake and then kept. */
+	if (j < sizeof(uint8) || dtls_uint8_to_int(data) != j - sizeof(uint8))
+	  goto error;
+	if (j - sizeof(uint8) > DTLS_CID_MAX_LENGTH) {
+	  dtls_warn("connection id is too long\n");
+	  if (!client_hello)
+	    goto error;
+	  break;
+	}
+	handshake->cid_ext = 1;
+	if (dtls_security_params(peer)->epoch == 0) {
+	  peer->peer_cid_length = j - sizeof(uint8);
+	  memcpy(peer->peer_cid, data + sizeof(uint8), peer->peer_cid_length);
+	}
+	break;
       case TLS_EXT_ENCRYPT_THEN_MAC:
 	/* As only AEAD cipher suites are currently available, this
 	 * extension can be skipped. 
@@ -942,13 +1640,13 @@ dtls_check_tls_extension(dtls_peer_t *peer,
     data += j;
     data_length -= j;
   }
-  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher) && client_hello) {
+  if (is_tls_ecdhe_ecdsa(handshake->cipher) && client_hello) {
     if (!ext_elliptic_curve || !ext_client_cert_type || !ext_server_cert_type
 	|| !ext_ec_point_formats) {
       dtls_warn("not all required tls extensions found in client hello\n");
       goto error;
     }
-  } else if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher) && !client_hello) {
+  } else if (is_tls_ecdhe_ecdsa(handshake->cipher) && !client_hello) {
     if (!ext_client_cert_type || !ext_server_cert_type) {
       dtls_warn("not all required tls extensions found in server hello\n");
       goto error;
@@ -964,6 +1662,24 @@ error:
   }
 }
 
+/**
+ * Returns @c 1 if @p cipher is supported by us and contained in the
+ * list of cipher suites @p ciphers from a ClientHello, @c 0 otherwise.
+ */
+static int
+offers_cipher(dtls_context_t *ctx, const uint8 *ciphers, int length,
+	      dtls_cipher_t cipher) {
+  if (!known_cipher(ctx, cipher, 0))
+    return 0;
+
+  for (; length >= (int)sizeof(uint16); length -= sizeof(uint16)) {
+    if (dtls_uint16_to_int(ciphers) == cipher)
+      return 1;
+    ciphers += sizeof(uint16);
+  }
+  return 0;
+}
+
 /**
  * Parses the ClientHello from the client and updates the internal handshake
  * parameters with the new data for the given \p peer. When the ClientHello
@@ -985,6 +1701,15 @@ dtls_update_parameters(dtls_context_t *ctx,
   int ok;
   dtls_handshake_parameters_t *config = peer->handshake_params;
   dtls_security_parameters_t *security = dtls_security_params(peer);
+  dtls_cache_entry_t *cached;
+  dtls_tick_t now;
+  uint8 *ciphers;
+  int ciphers_length;
+#if DTLS_SESSION_TICKETS
+  dtls_cipher_t ticket_cipher;
+  dtls_compression_t ticket_compression;
+#endif /* DTLS_SESSION_TICKETS */
+  int err;
 
   assert(config);
   assert(data_length > DTLS_HS_LENGTH + DTLS_CH_LENGTH);
@@ -998,8 +1723,26 @@ dtls_update_parameters(dtls_context_t *ctx,
   data += DTLS_RANDOM_LENGTH;
   data_length -= DTLS_RANDOM_LENGTH;
 
+  /* remember the session id to resume the cached session */
+  i = dtls_uint8_to_int(data);
+  if (i > DTLS_SESSION_ID_LENGTH || data_length < i + sizeof(uint8))
+    goto error;
+  config->resumed = 0;
+  config->ticket_ext = 0;
+  config->cid_ext = 0;
+#if DTLS_SESSION_TICKETS
+  config->ticket_length = 0;
+#endif /* DTLS_SESSION_TICKETS */
+  config->session_id_length = i;
+  memcpy(config->session_id, data + sizeof(uint8), i);
+  data += i + sizeof(uint8);
+  data_length -= i + sizeof(uint8);
+
+  dtls_ticks(&now);
+  cached = dtls_cache_find_id(ctx->cache, config->session_id,
+			      config->session_id_length, now);
+
   /* Caution: SKIP_VAR_FIELD may jump to error: */
-  SKIP_VAR_FIELD(data, data_length, uint8);	/* skip session id */
   SKIP_VAR_FIELD(data, data_length, uint8);	/* skip cookie */
 
   i = dtls_uint16_to_int(data);
@@ -1019,6 +1762,13 @@ dtls_update_parameters(dtls_context_t *ctx,
   data += sizeof(uint16);
   data_length -= sizeof(uint16) + i;
 
+  ciphers = data;
+  ciphers_length = i;
+
+  /* the cached session is resumed only if its cipher is still offered */
+  if (cached && !offers_cipher(ctx, ciphers, ciphers_length, cached->cipher))
+    cached = NULL;
+
   ok = 0;
   while (i && !ok) {
     config->cipher = dtls_uint16_to_int(data);
@@ -1027,6 +1777,18 @@ dtls_update_parameters(dtls_context_t *ctx,
     data += sizeof(uint16);
   }
 
+  /* The client's first choice determines the key exchange, the AEAD
+   * is the one we prefer among those offered with it. */
+  for (j = 0; ok && i > 0 && j + sizeof(uint16) <= (unsigned int)i;
+       j += sizeof(uint16)) {
+    dtls_cipher_t other = dtls_uint16_to_int(data + j);
+
+    if (known_cipher(ctx, other, 0)
+	&& is_tls_psk(other) == is_tls_psk(config->cipher)
+	&& dtls_cipher_rank(other) < dtls_cipher_rank(config->cipher))
+      config->cipher = other;
+  }
+
   /* skip remaining ciphers */
   data += i;
 
@@ -1068,8 +1830,36 @@ dtls_update_parameters(dtls_context_t *ctx,
     /* reset config cipher to a well-defined value */
     goto error;
   }
+
+  if (cached && cached->compression == config->compression) {
+    dtls_debug("resume cached session\n");
+    config->cipher = cached->cipher;
+    config->resumed = 1;
+  }
   
-  return dtls_check_tls_extension(peer, data, data_length, 1);
+  err = dtls_check_tls_extension(peer, data, data_length, 1);
+
+#if DTLS_SESSION_TICKETS
+  /* The client has presented a session ticket. The session id is
+   * echoed in the ServerHello when the session is resumed. The master
+   * secret of a ticket that is used is kept for resume_key_block(). */
+  if (err == 0 && !config->resumed && config->ticket_length
+      && dtls_tickets_enabled(ctx) && config->session_id_length
+      && dtls_ticket_open(&ctx->ticket_keys,
+			  config->ticket, config->ticket_length,
+			  &ticket_cipher, &ticket_compression,
+			  config->ticket_secret, now) == 0
+      && offers_cipher(ctx, ciphers, ciphers_length, ticket_cipher)
+      && ticket_compression == config->compression) {
+    dtls_debug("resume session from ticket\n");
+    config->cipher = ticket_cipher;
+    config->resumed = 1;
+  } else {
+    config->ticket_length = 0;
+    memset(config->ticket_secret, 0, sizeof(config->ticket_secret));
+  }
+#endif /* DTLS_SESSION_TICKETS */
+  return err;
 error:
   if (peer->state == DTLS_STATE_CONNECTED) {
     return dtls_alert_create(DTLS_ALERT_LEVEL_WARNING, DTLS_ALERT_NO_RENEGOTIATION);
@@ -1088,7 +1878,7 @@ check_client_keyexchange(dtls_context_t *ctx,
 			 uint8 *data, size_t length) {
   (void)ctx;
 #ifdef DTLS_ECC
-  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher)) {
+  if (is_tls_ecdhe_ecdsa(handshake->cipher)) {
 
     if (length < DTLS_HS_LENGTH + DTLS_CKXEC_LENGTH) {
       dtls_debug("The client key exchange is too short\n");
@@ -1118,7 +1908,7 @@ check_client_keyexchange(dtls_context_t *ctx,
   }
 #endif /* DTLS_ECC */
 #ifdef DTLS_PSK
-  if (is_tls_psk_with_aes_128_ccm_8(handshake->cipher)) {
+  if (is_tls_psk(handshake->cipher)) {
     int id_length;
 
     if (length < DTLS_HS_LENGTH + DTLS_CKXPSK_LENGTH_MIN) {
@@ -1234,6 +2024,80 @@ check_finished(dtls_context_t *ctx, dtls_peer_t *peer,
     : dtls_alert_create(DTLS_ALERT_LEVEL_FATAL, DTLS_ALERT_HANDSHAKE_FAILURE);
 }
 
+/**
+ * length of additional_data for the AEAD cipher which consists of
+ * seq_num(2+6) + type(1) + version(2) + length(2), or of the fields
+ * from RFC 9146, section 5 for records with a connection id
+ */
+#define A_DATA_MAX_LEN (23 + DTLS_CID_MAX_LENGTH)
+
+/**
+ * Creates the AEAD nonce from the write IV \p iv and the eight bytes
+ * at \p seq_num. The AES cipher suites append the nonce_explicit of
+ * the record to the four byte IV (RFC 6655), ChaCha20-Poly1305 XORs
+ * the epoch and sequence number of the record into the last eight
+ * bytes of the twelve byte IV (RFC 7905). \p nonce must hold
+ * DTLS_CCM_BLOCKSIZE bytes.
+ */
+static void
+dtls_record_nonce(dtls_security_parameters_t *security, dtls_peer_type role,
+		  const uint8 *iv, const uint8 *seq_num, unsigned char *nonce) {
+  size_t iv_size = dtls_kb_iv_size(security, role);
+  (void)role; /* The macro dtls_kb_iv_size() does not use role. */
+
+  memset(nonce, 0, DTLS_CCM_BLOCKSIZE);
+  memcpy(nonce, iv, iv_size);
+  if (dtls_cipher_is_chacha20(security->cipher))
+    memxor(nonce + iv_size - 8, seq_num, 8);
+  else
+    memcpy(nonce + iv_size, seq_num, 8); /* epoch + seq_num */
+}
+
+/**
+ * Creates the additional data for the AEAD cipher of the record that
+ * starts with \p header in \p A_DATA. \p cid_length is the length
+ * of the connection id in \p header and \p length the length of
+ * the plaintext. \p A_DATA must hold A_DATA_MAX_LEN bytes.
+ * \return The length of the additional data.
+ */
+static size_t
+dtls_record_aad(uint8 *A_DATA, const uint8 *header, size_t cid_length,
+		size_t length) {
+  uint8 *p = A_DATA;
+
+  if (header[0] != DTLS_CT_TLS12_CID) {
+    /* RFC 5246, Section 6.2.3.3:
+     *
+     * additional_data = seq_num + TLSCompressed.type +
+     *                   TLSCompressed.version + TLSCompressed.length;
+     */
+    memcpy(p, &DTLS_RECORD_HEADER(header)->epoch, 8); /* epoch and seq_num */
+    memcpy(p + 8, &DTLS_RECORD_HEADER(header)->content_type, 3); /* type and version */
+    dtls_int_to_uint16(p + 11, length);
+    return 13;
+  }
+
+  /* RFC 9146, Section 5:
+   *
+   * additional_data = seq_num_placeholder + tls12_cid + cid_length +
+   *                   tls12_cid + DTLSCiphertext.version + epoch +
+   *                   sequence_number + cid +
+   *                   length_of_DTLSInnerPlaintext;
+   */
+  memset(p, 0xff, 8);
+  p += 8;
+  dtls_int_to_uint8(p, DTLS_CT_TLS12_CID);
+  dtls_int_to_uint8(p + 1, cid_length);
+  dtls_int_to_uint8(p + 2, DTLS_CT_TLS12_CID);
+  p += 3;
+  /* version, epoch, seq_num and cid are in the same order as in
+   * the record header */
+  memcpy(p, header + sizeof(uint8), 10 + cid_length);
+  p += 10 + cid_length;
+  dtls_int_to_uint16(p, length);
+  return p + sizeof(uint16) - A_DATA;
+}
+
 /**
  * Prepares the payload given in \p data for sending with
  * dtls_send(). The \p data is encrypted and compressed according to
@@ -1267,13 +2131,28 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
   uint8 *p, *start;
   int res;
   unsigned int i;
+  size_t hlen;
+  int cid;
+
+  /* Records are sent with the peer's connection id as soon as the
+   * new keys are in place. The actual content type is encrypted. */
+  cid = peer && security && security->epoch > 0 && peer->peer_cid_length;
+  hlen = DTLS_RH_LENGTH + (cid ? peer->peer_cid_length : 0);
   
-  if (*rlen < DTLS_RH_LENGTH) {
+  if (*rlen < hlen) {
     dtls_alert("The sendbuf (%zu bytes) is too small\n", *rlen);
     return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
   }
 
-  p = dtls_set_record_header(type, security, sendbuf);
+  p = dtls_set_record_header(cid ? DTLS_CT_TLS12_CID : type, security, sendbuf);
+  if (cid) {
+    /* the connection id precedes the length field */
+    p -= sizeof(uint16);
+    memcpy(p, peer->peer_cid, peer->peer_cid_length);
+    p += peer->peer_cid_length;
+    memset(p, 0, sizeof(uint16));
+    p += sizeof(uint16);
+  }
   start = p;
 
   if (!security || security->cipher == TLS_NULL_WITH_NULL_NULL) {
@@ -1282,7 +2161,7 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
     res = 0;
     for (i = 0; i < data_array_len; i++) {
       /* check the minimum that we need for packets that are not encrypted */
-      if (*rlen < res + DTLS_RH_LENGTH + data_len_array[i]) {
+      if (*rlen < res + hlen + data_len_array[i]) {
         dtls_debug("dtls_prepare_record: send buffer too small\n");
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
       }
@@ -1291,19 +2170,24 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
       p += data_len_array[i];
       res += data_len_array[i];
     }
-  } else { /* TLS_PSK_WITH_AES_128_CCM_8 or TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 */   
-    /** 
-     * length of additional_data for the AEAD cipher which consists of
-     * seq_num(2+6) + type(1) + version(2) + length(2)
-     */
-#define A_DATA_LEN 13
+  } else { /* one of the AEAD cipher suites */
     unsigned char nonce[DTLS_CCM_BLOCKSIZE];
-    unsigned char A_DATA[A_DATA_LEN];
+    unsigned char A_DATA[A_DATA_MAX_LEN];
+    size_t A_DATA_LEN;
+    size_t riv = dtls_kb_record_iv_size(security, peer->role);
 
     if (is_tls_psk_with_aes_128_ccm_8(security->cipher)) {
       dtls_debug("dtls_prepare_record(): encrypt using TLS_PSK_WITH_AES_128_CCM_8\n");
     } else if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(security->cipher)) {
       dtls_debug("dtls_prepare_record(): encrypt using TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8\n");
+    } else if (is_tls_psk_with_aes_128_gcm_sha256(security->cipher)) {
+      dtls_debug("dtls_prepare_record(): encrypt using TLS_PSK_WITH_AES_128_GCM_SHA256\n");
+    } else if (is_tls_ecdhe_ecdsa_with_aes_128_gcm_sha256(security->cipher)) {
+      dtls_debug("dtls_prepare_record(): encrypt using TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256\n");
+    } else if (is_tls_psk_with_chacha20_poly1305_sha256(security->cipher)) {
+      dtls_debug("dtls_prepare_record(): encrypt using TLS_PSK_WITH_CHACHA20_POLY1305_SHA256\n");
+    } else if (is_tls_ecdhe_ecdsa_with_chacha20_poly1305_sha256(security->cipher)) {
+      dtls_debug("dtls_prepare_record(): encrypt using TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256\n");
     } else {
       dtls_debug("dtls_prepare_record(): encrypt using unknown cipher\n");
     }
@@ -1346,15 +2230,17 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
    	             case server:
    	               CCMServerNonce:
    	            } CCMNonceExample;
+
+       ChaCha20-Poly1305 has no nonce_explicit, see dtls_record_nonce().
     */
 
-    memcpy(p, &DTLS_RECORD_HEADER(sendbuf)->epoch, 8);
-    p += 8;
-    res = 8;
+    memcpy(p, &DTLS_RECORD_HEADER(sendbuf)->epoch, riv);
+    p += riv;
+    res = riv;
 
     for (i = 0; i < data_array_len; i++) {
       /* check the minimum that we need for packets that are not encrypted */
-      if (*rlen < res + DTLS_RH_LENGTH + data_len_array[i]) {
+      if (*rlen < res + hlen + data_len_array[i]) {
         dtls_debug("dtls_prepare_record: send buffer too small\n");
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
       }
@@ -1364,40 +2250,50 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
       res += data_len_array[i];
     }
 
-    memset(nonce, 0, DTLS_CCM_BLOCKSIZE);
-    memcpy(nonce, dtls_kb_local_iv(security, peer->role),
-	   dtls_kb_iv_size(security, peer->role));
-    memcpy(nonce + dtls_kb_iv_size(security, peer->role), start, 8); /* epoch + seq_num */
+    if (cid) {
+      /* DTLSInnerPlaintext: the content is followed by its real type,
+       * no padding is added */
+      if (*rlen < res + hlen + sizeof(uint8)) {
+        dtls_debug("dtls_prepare_record: send buffer too small\n");
+        return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+      }
+      dtls_int_to_uint8(p, type);
+      p += sizeof(uint8);
+      res += sizeof(uint8);
+    }
+
+    /* the cipher appends the authentication tag */
+    if (*rlen < res + hlen + dtls_kb_tag_size(security, peer->role)) {
+      dtls_debug("dtls_prepare_record: send buffer too small\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    }
+
+    dtls_record_nonce(security, peer->role,
+		      dtls_kb_local_iv(security, peer->role),
+		      (uint8 *)&DTLS_RECORD_HEADER(sendbuf)->epoch, nonce);
 
     dtls_debug_dump("nonce:", nonce, DTLS_CCM_BLOCKSIZE);
     dtls_debug_dump("key:", dtls_kb_local_write_key(security, peer->role),
 		    dtls_kb_key_size(security, peer->role));
     
-    /* re-use N to create additional data according to RFC 5246, Section 6.2.3.3:
-     * 
-     * additional_data = seq_num + TLSCompressed.type +
-     *                   TLSCompressed.version + TLSCompressed.length;
-     */
-    memcpy(A_DATA, &DTLS_RECORD_HEADER(sendbuf)->epoch, 8); /* epoch and seq_num */
-    memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(sendbuf)->content_type, 3); /* type and version */
-    dtls_int_to_uint16(A_DATA + 11, res - 8); /* length */
+    A_DATA_LEN = dtls_record_aad(A_DATA, sendbuf,
+				 cid ? peer->peer_cid_length : 0, res - riv);
     
-    res = dtls_encrypt(start + 8, res - 8, start + 8, nonce,
-		       dtls_kb_local_write_key(security, peer->role),
-		       dtls_kb_key_size(security, peer->role),
-		       A_DATA, A_DATA_LEN);
+    res = dtls_encrypt_ctx(&security->write_cipher,
+			   start + riv, res - riv, start + riv, nonce,
+			   A_DATA, A_DATA_LEN);
 
     if (res < 0)
       return res;
 
-    res += 8;			/* increment res by size of nonce_explicit */
+    res += riv;			/* increment res by size of nonce_explicit */
     dtls_debug_dump("message:", start, res);
   }
 
   /* fix length of fragment in sendbuf */
-  dtls_int_to_uint16(sendbuf + 11, res);
+  dtls_int_to_uint16(sendbuf + hlen - sizeof(uint16), res);
   
-  *rlen = DTLS_RH_LENGTH + res;
+  *rlen = hlen + res;
   return 0;
 }
 
@@ -1472,6 +2368,86 @@ dtls_send_handshake_msg(dtls_context_t *ctx,
      (dtls_uint16_to_int(DTLS_RECORD_HEADER(Data)->epoch > 0) ||	\
       (dtls_uint16_to_int(HANDSHAKE(Data)->message_seq) > 0)))))
 
+/** Length of the header that precedes each message in a flight. */
+#define DTLS_FLIGHT_HEADER_LENGTH 5
+
+/**
+ * Adds a handshake or CCS message to the flight that is currently
+ * sent to @p peer. A flight is kept in a single netq_t node, where
+ * every message is preceded by its content type, epoch and length.
+ * The retransmission timer of the flight is restarted. A new flight
+ * is started when the peer has no outstanding flight or when the
+ * last flight has been retransmitted already.
+ *
+ * When the node cannot grow any further, e.g. on Contiki where a
+ * node holds at most DTLS_MAX_BUF bytes, or would exceed the limit
+ * set with dtls_set_flight_limit(), the message is put into a node of
+ * its own that is retransmitted with its own timer.
+ */
+static int
+dtls_flight_add(dtls_context_t *ctx, dtls_peer_t *peer,
+		dtls_security_parameters_t *security,
+		unsigned char type, uint8 *buf_array[],
+		size_t buf_len_array[], size_t buf_array_len,
+		size_t length) {
+  netq_t *n = peer->retransmit, *tmp = NULL;
+  unsigned char *p;
+  dtls_tick_t now;
+  size_t i, size;
+
+  if (n && n->retransmit_cnt == 0) {
+    size = n->length + DTLS_FLIGHT_HEADER_LENGTH + length;
+    if (!ctx->flight_limit || size <= ctx->flight_limit) {
+      netq_wheel_remove(&ctx->sendqueue, n);
+      tmp = netq_node_resize(n, size);
+      if (!tmp)
+	netq_wheel_insert(&ctx->sendqueue, n);
+    }
+    if (!tmp)
+      dtls_debug("flight does not fit into one node, "
+		 "retransmit message separately\n");
+  }
+
+  if (tmp) {
+    n = tmp;
+  } else {
+    n = netq_node_new(DTLS_FLIGHT_HEADER_LENGTH + length);
+    if (!n)
+      return -1;
+
+    n->peer = peer;
+    n->timeout = peer->rto;
+    n->retransmit_cnt = 0;
+    n->length = 0;
+    netq_peer_link(&peer->retransmit, n);
+  }
+
+  p = n->data + n->length;
+  dtls_int_to_uint8(p, type);
+  dtls_int_to_uint16(p + 1, security ? security->epoch : 0);
+  dtls_int_to_uint16(p + 3, length);
+  p += DTLS_FLIGHT_HEADER_LENGTH;
+  for (i = 0; i < buf_array_len; i++) {
+    memcpy(p, buf_array[i], buf_len_array[i]);
+    p += buf_len_array[i];
+  }
+  n->length += DTLS_FLIGHT_HEADER_LENGTH + length;
+
+  dtls_ticks(&now);
+  n->t = now + n->timeout;
+  netq_wheel_insert(&ctx->sendqueue, n);
+
+#ifdef WITH_CONTIKI
+  /* must set timer within the context of the retransmit process */
+  PROCESS_CONTEXT_BEGIN(&dtls_retransmit_process);
+  etimer_set(&ctx->retransmit_timer, n->timeout);
+  PROCESS_CONTEXT_END(&dtls_retransmit_process);
+#else /* WITH_CONTIKI */
+  dtls_debug("copied to sendqueue\n");
+#endif /* WITH_CONTIKI */
+  return 0;
+}
+
 /**
  * Sends the data passed in @p buf as a DTLS record of type @p type to
  * the given peer. The data will be encrypted and compressed according
@@ -1519,43 +2495,23 @@ dtls_send_multi(dtls_context_t *ctx, dtls_peer_t *peer,
 
   if ((type == DTLS_CT_HANDSHAKE && buf_array[0][0] != DTLS_HT_HELLO_VERIFY_REQUEST) ||
       type == DTLS_CT_CHANGE_CIPHER_SPEC) {
-    /* copy handshake messages other than HelloVerify into retransmit buffer */
-    netq_t *n = netq_node_new(overall_len);
-    if (n) {
-      dtls_tick_t now;
-      dtls_ticks(&now);
-      n->t = now + 2 * CLOCK_SECOND;
-      n->retransmit_cnt = 0;
-      n->timeout = 2 * CLOCK_SECOND;
-      n->peer = peer;
-      n->epoch = (security) ? security->epoch : 0;
-      n->type = type;
-      n->length = 0;
-      for (i = 0; i < buf_array_len; i++) {
-        memcpy(n->data + n->length, buf_array[i], buf_len_array[i]);
-        n->length += buf_len_array[i];
-      }
-
-      if (!netq_insert_node(&ctx->sendqueue, n)) {
-	dtls_warn("cannot add packet to retransmit buffer\n");
-	netq_node_free(n);
-#ifdef WITH_CONTIKI
-      } else {
-	/* must set timer within the context of the retransmit process */
-	PROCESS_CONTEXT_BEGIN(&dtls_retransmit_process);
-	etimer_set(&ctx->retransmit_timer, n->timeout);
-	PROCESS_CONTEXT_END(&dtls_retransmit_process);
-#else /* WITH_CONTIKI */
-	dtls_debug("copied to sendqueue\n");
-#endif /* WITH_CONTIKI */
-      }
-    } else 
+    /* copy handshake messages other than HelloVerify into the
+     * retransmit buffer of the current flight */
+    if (dtls_flight_add(ctx, peer, security, type, buf_array,
+			buf_len_array, buf_array_len, overall_len) < 0)
       dtls_warn("retransmit buffer full\n");
   }
 
   /* FIXME: copy to peer's sendqueue (after fragmentation if
    * necessary) and initialize retransmit timer */
-  res = CALL(ctx, write, session, sendbuf, len);
+  res = dtls_write_record(ctx, session, peer ? peer->mtu : DTLS_DEFAULT_MTU,
+			  sendbuf, len,
+			  type == DTLS_CT_HANDSHAKE ||
+			  type == DTLS_CT_CHANGE_CIPHER_SPEC);
+  if (res >= 0) {
+    DTLS_STAT_RECORD(ctx, records_out, type);
+    DTLS_STAT_ADD(ctx, bytes_out, len);
+  }
 
   /* Guess number of bytes application data actually sent:
    * dtls_prepare_record() tells us in len the number of bytes to
@@ -1589,10 +2545,12 @@ dtls_close(dtls_context_t *ctx, const session_t *remote) {
 
 static void dtls_destroy_peer(dtls_context_t *ctx, dtls_peer_t *peer, int unlink)
 {
+  dtls_handshake_failed(ctx, peer);
   if (peer->state != DTLS_STATE_CLOSED && peer->state != DTLS_STATE_CLOSING)
     dtls_close(ctx, &peer->session);
+  dtls_stop_retransmission(ctx, peer);
   if (unlink) {
-    DEL_PEER(ctx->peers, peer);
+    DEL_PEER(ctx, peer);
     dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "removed peer", &peer->session);
   }
   dtls_free_peer(peer);
@@ -1629,10 +2587,16 @@ dtls_verify_peer(dtls_context_t *ctx,
 #undef mycookie
 #define mycookie (buf + DTLS_HV_LENGTH)
 
-  /* Store cookie where we can reuse it for the HelloVerify request. */
-  err = dtls_create_cookie(ctx, session, data, data_length, mycookie, &len);
-  if (err < 0)
-    return err;
+  /* Store cookie where we can reuse it for the HelloVerify
+   * request. dtls_handle_messages() may have created it already. */
+  if (ctx->hello == data) {
+    memcpy(mycookie, ctx->hello_cookie, DTLS_COOKIE_LENGTH);
+    err = 0;
+  } else {
+    err = dtls_create_cookie(ctx, session, data, data_length, mycookie, &len);
+    if (err < 0)
+      return err;
+  }
 
   dtls_debug_dump("create cookie", mycookie, len);
 
@@ -1681,6 +2645,8 @@ dtls_verify_peer(dtls_context_t *ctx,
 		     buf, p - buf, 0);
   if (err < 0) {
     dtls_warn("cannot send HelloVerify request\n");
+  } else {
+    DTLS_STAT_INC(ctx, hello_verify_requests);
   }
   return err; /* HelloVerify is sent, now we cannot do anything but wait */
 
@@ -1690,10 +2656,12 @@ dtls_verify_peer(dtls_context_t *ctx,
 #ifdef DTLS_ECC
 static int
 dtls_check_ecdsa_signature_elem(uint8 *data, size_t data_length,
-				unsigned char **result_r,
-				unsigned char **result_s)
+				unsigned char result_r[DTLS_EC_KEY_SIZE],
+				unsigned char result_s[DTLS_EC_KEY_SIZE])
 {
-  int i;
+  unsigned char *key;
+  size_t i;
+  int n;
   uint8 *data_orig = data;
 
   if (dtls_uint8_to_int(data) != TLS_EXT_SIG_HASH_ALGO_SHA256) {
@@ -1731,39 +2699,37 @@ dtls_check_ecdsa_signature_elem(uint8 *data, size_t data_length,
   data += sizeof(uint8);
   data_length -= sizeof(uint8);
 
-  if (dtls_uint8_to_int(data) != 0x02) {
-    dtls_alert("wrong ASN.1 struct, expected Integer\n");
-    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
-  }
-  data += sizeof(uint8);
-  data_length -= sizeof(uint8);
-
-  i = dtls_uint8_to_int(data);
-  data += sizeof(uint8);
-  data_length -= sizeof(uint8);
+  for (n = 0; n < 2; n++) {
+    if (data_length < 2 || dtls_uint8_to_int(data) != 0x02) {
+      dtls_alert("wrong ASN.1 struct, expected Integer\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+    }
+    i = dtls_uint8_to_int(data + 1);
+    data += 2;
+    data_length -= 2;
 
-  /* Sometimes these values have a leeding 0 byte */
-  *result_r = data + i - DTLS_EC_KEY_SIZE;
+    if (i < 1 || i > data_length) {
+      dtls_alert("signature length wrong\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+    }
 
-  data += i;
-  data_length -= i;
+    /* The integer has a leading 0 byte when its first bit is set,
+     * and is shorter when it starts with 0 bytes. */
+    key = n ? result_s : result_r;
+    if (i > DTLS_EC_KEY_SIZE) {
+      if (i > DTLS_EC_KEY_SIZE + 1 || data[0] != 0) {
+	dtls_alert("signature length wrong\n");
+	return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+      }
+      memcpy(key, data + 1, DTLS_EC_KEY_SIZE);
+    } else {
+      memset(key, 0, DTLS_EC_KEY_SIZE - i);
+      memcpy(key + DTLS_EC_KEY_SIZE - i, data, i);
+    }
 
-  if (dtls_uint8_to_int(data) != 0x02) {
-    dtls_alert("wrong ASN.1 struct, expected Integer\n");
-    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+    data += i;
+    data_length -= i;
   }
-  data += sizeof(uint8);
-  data_length -= sizeof(uint8);
-
-  i = dtls_uint8_to_int(data);
-  data += sizeof(uint8);
-  data_length -= sizeof(uint8);
-
-  /* Sometimes these values have a leeding 0 byte */
-  *result_s = data + i - DTLS_EC_KEY_SIZE;
-
-  data += i;
-  data_length -= i;
 
   return data - data_orig;
 }
@@ -1775,21 +2741,21 @@ check_client_certificate_verify(dtls_context_t *ctx,
 {
   dtls_handshake_parameters_t *config = peer->handshake_params;
   int ret;
-  unsigned char *result_r;
-  unsigned char *result_s;
+  unsigned char result_r[DTLS_EC_KEY_SIZE];
+  unsigned char result_s[DTLS_EC_KEY_SIZE];
   dtls_hash_ctx hs_hash;
   unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE];
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_ecdhe_ecdsa(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
-  if (data_length < DTLS_HS_LENGTH + DTLS_CV_LENGTH) {
+  if (data_length < DTLS_HS_LENGTH + DTLS_CV_LENGTH_MIN) {
     dtls_alert("the packet length does not match the expected\n");
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
   }
 
-  ret = dtls_check_ecdsa_signature_elem(data, data_length, &result_r, &result_s);
+  ret = dtls_check_ecdsa_signature_elem(data, data_length, result_r, result_s);
   if (ret < 0) {
     return ret;
   }
@@ -1819,16 +2785,35 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
   /* Ensure that the largest message to create fits in our source
    * buffer. (The size of the destination buffer is checked by the
    * encoding function, so we do not need to guess.) */
-  uint8 buf[DTLS_SH_LENGTH + 2 + 5 + 5 + 8 + 6];
+  uint8 buf[DTLS_SH_LENGTH + DTLS_SESSION_ID_LENGTH + 2 + 5 + 5 + 8 + 6 + 4
+	    + 5 + DTLS_CID_LENGTH];
   uint8 *p;
   int ecdsa;
+  int ticket;
+  int cid;
   uint8 extension_size;
   dtls_handshake_parameters_t *handshake = peer->handshake_params;
   dtls_tick_t now;
 
-  ecdsa = is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher);
+  ecdsa = is_tls_ecdhe_ecdsa(handshake->cipher);
 
-  extension_size = (ecdsa) ? 2 + 5 + 5 + 6 : 0;
+  /* A new ticket is issued if the client supports tickets. The
+   * flag is cleared otherwise, as it decides whether the
+   * NewSessionTicket is sent. */
+  handshake->ticket_ext = handshake->ticket_ext && !handshake->resumed
+    && dtls_tickets_enabled(ctx);
+  ticket = handshake->ticket_ext;
+
+  /* A connection id is assigned in the initial handshake if the
+   * client supports connection ids. Renegotiation keeps it. */
+  if (handshake->cid_ext && !peer->own_cid_length &&
+      dtls_security_params(peer)->epoch == 0 &&
+      dtls_new_own_cid(ctx, peer) < 0)
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  cid = handshake->cid_ext && peer->own_cid_length;
+
+  extension_size = ((ecdsa) ? 5 + 5 + 6 : 0) + ((ticket) ? 4 : 0)
+    + ((cid) ? 5 + peer->own_cid_length : 0);
 
   /* Handshake header */
   p = buf;
@@ -1846,7 +2831,19 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
   memcpy(p, handshake->tmp.random.server, DTLS_RANDOM_LENGTH);
   p += DTLS_RANDOM_LENGTH;
 
-  *p++ = 0;			/* no session id */
+  /* A resumed session keeps the id offered by the client. Otherwise,
+   * a new id is created if the session can be cached. Sessions with a
+   * ticket are not cached by the server. */
+  if (!handshake->resumed) {
+    handshake->session_id_length =
+      DTLS_SESSION_CACHE_SIZE > 0 && !ticket ? DTLS_SESSION_ID_LENGTH : 0;
+    dtls_prng(handshake->session_id, handshake->session_id_length);
+  }
+
+  dtls_int_to_uint8(p, handshake->session_id_length);
+  p += sizeof(uint8);
+  memcpy(p, handshake->session_id, handshake->session_id_length);
+  p += handshake->session_id_length;
 
   if (handshake->cipher != TLS_NULL_WITH_NULL_NULL) {
     /* selected cipher suite */
@@ -1859,7 +2856,7 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
 
   if (extension_size) {
     /* length of the extensions */
-    dtls_int_to_uint16(p, extension_size - 2);
+    dtls_int_to_uint16(p, extension_size);
     p += sizeof(uint16);
   }
 
@@ -1902,6 +2899,30 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
     p += sizeof(uint8);
   }
 
+  if (ticket) {
+    /* empty session ticket extension, the ticket follows later */
+    dtls_int_to_uint16(p, TLS_EXT_SESSION_TICKET);
+    p += sizeof(uint16);
+
+    dtls_int_to_uint16(p, 0);
+    p += sizeof(uint16);
+  }
+
+  if (cid) {
+    /* the connection id that the client must use */
+    dtls_int_to_uint16(p, TLS_EXT_CONNECTION_ID);
+    p += sizeof(uint16);
+
+    dtls_int_to_uint16(p, sizeof(uint8) + peer->own_cid_length);
+    p += sizeof(uint16);
+
+    dtls_int_to_uint8(p, peer->own_cid_length);
+    p += sizeof(uint8);
+
+    memcpy(p, peer->own_cid, peer->own_cid_length);
+    p += peer->own_cid_length;
+  }
+
   assert((buf <= p) && ((unsigned int)(p - buf) <= sizeof(buf)));
 
   /* TODO use the same record sequence number as in the ClientHello,
@@ -2163,7 +3184,7 @@ dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
   }
 
 #ifdef DTLS_ECC
-  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+  if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher)) {
     const dtls_ecdsa_key_t *ecdsa_key;
 
     res = CALL(ctx, get_ecdsa_key, &peer->session, &ecdsa_key);
@@ -2186,7 +3207,7 @@ dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
       return res;
     }
 
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
+    if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher) &&
 	is_ecdsa_client_auth_supported(ctx)) {
       res = dtls_send_server_certificate_request(ctx, peer);
 
@@ -2199,7 +3220,7 @@ dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
 #endif /* DTLS_ECC */
 
 #ifdef DTLS_PSK
-  if (is_tls_psk_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+  if (is_tls_psk(peer->handshake_params->cipher)) {
     unsigned char psk_hint[DTLS_PSK_MAX_CLIENT_IDENTITY_LEN];
     int len;
 
@@ -2252,7 +3273,9 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
 
   switch (handshake->cipher) {
 #ifdef DTLS_PSK
-  case TLS_PSK_WITH_AES_128_CCM_8: {
+  case TLS_PSK_WITH_AES_128_CCM_8:
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256: {
     int len;
 
     len = CALL(ctx, get_psk_info, &peer->session, DTLS_PSK_IDENTITY,
@@ -2283,7 +3306,9 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
   }
 #endif /* DTLS_PSK */
 #ifdef DTLS_ECC
-  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8: {
+  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256: {
     uint8 *ephemeral_pub_x;
     uint8 *ephemeral_pub_y;
 
@@ -2317,11 +3342,15 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
      */
 #ifndef DTLS_PSK
   case TLS_PSK_WITH_AES_128_CCM_8:
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256:
     /* fall through to default */
 #endif /* !DTLS_PSK */
 
 #ifndef DTLS_ECC
   case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256:
     /* fall through to default */
 #endif /* !DTLS_ECC */
 
@@ -2373,6 +3402,45 @@ dtls_send_certificate_verify_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
 }
 #endif /* DTLS_ECC */
 
+#if DTLS_SESSION_TICKETS
+/**
+ * Sends a NewSessionTicket with the state of the session that is
+ * being established with @p peer. The ticket is sealed with the
+ * current ticket key of @p ctx.
+ */
+static int
+dtls_send_new_session_ticket(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  uint8 buf[sizeof(uint32) + sizeof(uint16) + DTLS_TICKET_LENGTH];
+  uint8 *p = buf;
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_tick_t now;
+  int len;
+
+  /* ticket_lifetime_hint */
+  dtls_int_to_uint32(p, DTLS_TICKET_LIFETIME);
+  p += sizeof(uint32);
+
+  dtls_ticks(&now);
+  len = dtls_ticket_seal(&ctx->ticket_keys,
+			 handshake->cipher, handshake->compression,
+			 handshake->tmp.master_secret,
+			 p + sizeof(uint16), DTLS_TICKET_LENGTH, now);
+  if (len < 0) {
+    dtls_warn("cannot create session ticket\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+
+  dtls_int_to_uint16(p, len);
+  p += sizeof(uint16) + len;
+
+  assert((buf <= p) && ((unsigned int)(p - buf) <= sizeof(buf)));
+
+  return dtls_send_handshake_msg(ctx, peer, DTLS_HT_NEW_SESSION_TICKET,
+				 buf, p - buf);
+}
+#endif /* DTLS_SESSION_TICKETS */
+
 static int
 dtls_send_finished(dtls_context_t *ctx, dtls_peer_t *peer,
 		   const unsigned char *label, size_t labellen)
@@ -2404,23 +3472,50 @@ dtls_send_finished(dtls_context_t *ctx, dtls_peer_t *peer,
 				 buf, p - buf);
 }
 
+/** Number of AEAD variants of each key exchange that are compiled in. */
+#define DTLS_AEAD_VARIANTS (1 + DTLS_GCM + DTLS_CHACHA20_POLY1305)
+
+/**
+ * Writes the AEAD variants of a key exchange from @p ciphers to @p p
+ * in the order of dtls_cipher_rank(). Variants that have not been
+ * compiled in are skipped.
+ * @return The position after the last cipher suite.
+ */
+static uint8 *
+dtls_add_ciphers(uint8 *p, const dtls_cipher_t ciphers[3]) {
+  int rank, i;
+
+  for (rank = 0; rank < 3; rank++) {
+    for (i = 0; i < 3; i++) {
+      if (dtls_cipher_rank(ciphers[i]) == rank &&
+	  (is_tls_psk(ciphers[i]) || is_tls_ecdhe_ecdsa(ciphers[i]))) {
+	dtls_int_to_uint16(p, ciphers[i]);
+	p += sizeof(uint16);
+      }
+    }
+  }
+  return p;
+}
+
 static int
 dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
                        uint8 cookie[], size_t cookie_length) {
   uint8 buf[DTLS_CH_LENGTH_MAX];
   uint8 *p = buf;
   uint8_t cipher_size;
-  uint8_t extension_size;
+  uint16_t extension_size;
   int psk;
   int ecdsa;
   dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_cache_entry_t *cached;
   dtls_tick_t now;
 
   psk = is_psk_supported(ctx);
   ecdsa = is_ecdsa_supported(ctx, 1);
 
-  cipher_size = 2 + ((ecdsa) ? 2 : 0) + ((psk) ? 2 : 0);
-  extension_size = (ecdsa) ? 2 + 6 + 6 + 8 + 6: 0;
+  cipher_size = 2 + ((ecdsa) ? 2 * DTLS_AEAD_VARIANTS : 0)
+    + ((psk) ? 2 * DTLS_AEAD_VARIANTS : 0);
+  extension_size = (ecdsa) ? 6 + 6 + 8 + 6 : 0;
 
   if (cipher_size == 0) {
     dtls_crit("no cipher callbacks implemented\n");
@@ -2438,17 +3533,32 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
     /* Set client random: First 4 bytes are the client's Unix timestamp,
      * followed by 28 bytes of generate random data. */
     dtls_ticks(&now);
+    dtls_usecs(&handshake->hello_time);
     dtls_int_to_uint32(handshake->tmp.random.client, now / CLOCK_SECOND);
     dtls_prng(handshake->tmp.random.client + sizeof(uint32),
          DTLS_RANDOM_LENGTH - sizeof(uint32));
+
+    /* offer the cached session with this server for resumption */
+    cached = dtls_cache_find_key(ctx->cache, &peer->key, now);
+    handshake->session_id_length = cached ? cached->id_length : 0;
+    if (cached)
+      memcpy(handshake->session_id, cached->id, cached->id_length);
+#if DTLS_SESSION_TICKETS
+    handshake->ticket_length = cached && dtls_tickets_enabled(ctx)
+      ? cached->ticket_length : 0;
+    if (handshake->ticket_length)
+      memcpy(handshake->ticket, cached->ticket, cached->ticket_length);
+#endif /* DTLS_SESSION_TICKETS */
   }
   /* we must use the same Client Random as for the previous request */
   memcpy(p, handshake->tmp.random.client, DTLS_RANDOM_LENGTH);
   p += DTLS_RANDOM_LENGTH;
 
-  /* session id (length 0) */
-  dtls_int_to_uint8(p, 0);
+  /* session id, the same as for the previous request */
+  dtls_int_to_uint8(p, handshake->session_id_length);
   p += sizeof(uint8);
+  memcpy(p, handshake->session_id, handshake->session_id_length);
+  p += handshake->session_id_length;
 
   /* cookie */
   dtls_int_to_uint8(p, cookie_length);
@@ -2463,12 +3573,20 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
   p += sizeof(uint16);
 
   if (ecdsa) {
-    dtls_int_to_uint16(p, TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8);
-    p += sizeof(uint16);
+    static const dtls_cipher_t ecdsa_ciphers[] = {
+      TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+      TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+      TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8
+    };
+    p = dtls_add_ciphers(p, ecdsa_ciphers);
   }
   if (psk) {
-    dtls_int_to_uint16(p, TLS_PSK_WITH_AES_128_CCM_8);
-    p += sizeof(uint16);
+    static const dtls_cipher_t psk_ciphers[] = {
+      TLS_PSK_WITH_AES_128_GCM_SHA256,
+      TLS_PSK_WITH_CHACHA20_POLY1305_SHA256,
+      TLS_PSK_WITH_AES_128_CCM_8
+    };
+    p = dtls_add_ciphers(p, psk_ciphers);
   }
 
   /* compression method */
@@ -2478,11 +3596,21 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
   dtls_int_to_uint8(p, TLS_COMPRESSION_NULL);
   p += sizeof(uint8);
 
-  if (extension_size) {
-    /* length of the extensions */
-    dtls_int_to_uint16(p, extension_size - 2);
-    p += sizeof(uint16);
-  }
+  /* The SessionTicket extension is sent unless tickets are disabled,
+   * with the ticket of the session that is offered for resumption,
+   * if any. The connection_id extension is always sent. We do not
+   * ask the server for a connection id as our address is not
+   * expected to change without us noticing, but we use the server's
+   * id. */
+  extension_size += 5;
+#if DTLS_SESSION_TICKETS
+  if (dtls_tickets_enabled(ctx))
+    extension_size += 4 + handshake->ticket_length;
+#endif /* DTLS_SESSION_TICKETS */
+
+  /* length of the extensions */
+  dtls_int_to_uint16(p, extension_size);
+  p += sizeof(uint16);
 
   if (ecdsa) {
     /* client certificate type extension */
@@ -2546,6 +3674,30 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
     p += sizeof(uint8);
   }
 
+#if DTLS_SESSION_TICKETS
+  if (dtls_tickets_enabled(ctx)) {
+    /* session ticket */
+    dtls_int_to_uint16(p, TLS_EXT_SESSION_TICKET);
+    p += sizeof(uint16);
+
+    dtls_int_to_uint16(p, handshake->ticket_length);
+    p += sizeof(uint16);
+
+    memcpy(p, handshake->ticket, handshake->ticket_length);
+    p += handshake->ticket_length;
+  }
+#endif /* DTLS_SESSION_TICKETS */
+
+  /* empty connection id */
+  dtls_int_to_uint16(p, TLS_EXT_CONNECTION_ID);
+  p += sizeof(uint16);
+
+  dtls_int_to_uint16(p, sizeof(uint8));
+  p += sizeof(uint16);
+
+  dtls_int_to_uint8(p, 0);
+  p += sizeof(uint8);
+
   assert((buf <= p) && ((unsigned int)(p - buf) <= sizeof(buf)));
 
   if (cookie_length != 0)
@@ -2556,6 +3708,52 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
 				      buf, p - buf, cookie_length != 0);
 }
 
+#if DTLS_SESSION_TICKETS
+/**
+ * Parses the NewSessionTicket from the server and keeps the ticket in
+ * the handshake parameters of @p peer. The ticket lifetime hint is
+ * not used as the ticket expires with the cached session.
+ */
+static int
+check_new_session_ticket(dtls_context_t *ctx, dtls_peer_t *peer,
+			 uint8 *data, size_t data_length)
+{
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  size_t length;
+  (void)ctx;
+
+  if (data_length < DTLS_HS_LENGTH + sizeof(uint32) + sizeof(uint16))
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+
+  /* skip the handshake header and the ticket lifetime hint */
+  data += DTLS_HS_LENGTH + sizeof(uint32);
+  data_length -= DTLS_HS_LENGTH + sizeof(uint32);
+
+  length = dtls_uint16_to_int(data);
+  data += sizeof(uint16);
+  data_length -= sizeof(uint16);
+
+  if (data_length < length)
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+
+  if (length > DTLS_TICKET_MAX_LENGTH) {
+    dtls_warn("session ticket is too long, ignored\n");
+    length = 0;
+  }
+
+  handshake->ticket_length = length;
+  memcpy(handshake->ticket, data, length);
+
+  /* The ticket is presented together with a session id of our
+   * choice. The server echoes this id when it accepts the ticket. */
+  if (length) {
+    handshake->session_id_length = DTLS_SESSION_ID_LENGTH;
+    dtls_prng(handshake->session_id, DTLS_SESSION_ID_LENGTH);
+  }
+  return 0;
+}
+#endif /* DTLS_SESSION_TICKETS */
+
 static int
 check_server_hello(dtls_context_t *ctx, 
 		      dtls_peer_t *peer,
@@ -2598,7 +3796,24 @@ check_server_hello(dtls_context_t *ctx,
   data += DTLS_RANDOM_LENGTH;
   data_length -= DTLS_RANDOM_LENGTH;
 
-  SKIP_VAR_FIELD(data, data_length, uint8); /* skip session id */
+  /* The session is resumed when the server echoes the session id
+   * from our ClientHello. Otherwise, we keep the new id for later. */
+  if (dtls_uint8_to_int(data) > DTLS_SESSION_ID_LENGTH ||
+      data_length < dtls_uint8_to_int(data) + sizeof(uint8))
+    goto error;
+  handshake->resumed = handshake->session_id_length != 0 &&
+    handshake->session_id_length == dtls_uint8_to_int(data) &&
+    memcmp(handshake->session_id, data + sizeof(uint8),
+	   handshake->session_id_length) == 0;
+  handshake->session_id_length = dtls_uint8_to_int(data);
+  memcpy(handshake->session_id, data + sizeof(uint8),
+	 handshake->session_id_length);
+#if DTLS_SESSION_TICKETS
+  if (!handshake->resumed)
+    handshake->ticket_length = 0;	/* the offered ticket is useless */
+#endif /* DTLS_SESSION_TICKETS */
+  data += handshake->session_id_length + sizeof(uint8);
+  data_length -= handshake->session_id_length + sizeof(uint8);
     
   /* Check cipher suite. As we offer all we have, it is sufficient
    * to check if the cipher suite selected by the server is in our
@@ -2620,6 +3835,7 @@ check_server_hello(dtls_context_t *ctx,
   data += sizeof(uint8);
   data_length -= sizeof(uint8);
 
+  handshake->cid_ext = 0;
   return dtls_check_tls_extension(peer, data, data_length, 0);
 
 error:
@@ -2639,6 +3855,9 @@ check_server_hello_verify_request(dtls_context_t *ctx,
 
   hv = (dtls_hello_verify_t *)(data + DTLS_HS_LENGTH);
 
+  dtls_stats_record_phase(ctx, DTLS_PHASE_COOKIE,
+			  peer->handshake_params->hello_time);
+
   res = dtls_send_client_hello(ctx, peer, hv->cookie, hv->cookie_length);
 
   if (res < 0)
@@ -2658,7 +3877,7 @@ check_server_certificate(dtls_context_t *ctx,
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_ecdhe_ecdsa(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
@@ -2702,17 +3921,17 @@ check_server_key_exchange_ecdsa(dtls_context_t *ctx,
 {
   dtls_handshake_parameters_t *config = peer->handshake_params;
   int ret;
-  unsigned char *result_r;
-  unsigned char *result_s;
+  unsigned char result_r[DTLS_EC_KEY_SIZE];
+  unsigned char result_s[DTLS_EC_KEY_SIZE];
   unsigned char *key_params;
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_ecdhe_ecdsa(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
-  if (data_length < DTLS_HS_LENGTH + DTLS_SKEXEC_LENGTH) {
+  if (data_length < DTLS_HS_LENGTH + DTLS_SKEXEC_LENGTH_MIN) {
     dtls_alert("the packet length does not match the expected\n");
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
   }
@@ -2754,7 +3973,7 @@ check_server_key_exchange_ecdsa(dtls_context_t *ctx,
   data += sizeof(config->keyx.ecdsa.other_eph_pub_y);
   data_length -= sizeof(config->keyx.ecdsa.other_eph_pub_y);
 
-  ret = dtls_check_ecdsa_signature_elem(data, data_length, &result_r, &result_s);
+  ret = dtls_check_ecdsa_signature_elem(data, data_length, result_r, result_s);
   if (ret < 0) {
     return ret;
   }
@@ -2789,7 +4008,7 @@ check_server_key_exchange_psk(dtls_context_t *ctx,
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_psk_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_psk(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
@@ -2831,7 +4050,7 @@ check_certificate_request(dtls_context_t *ctx,
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher));
+  assert(is_tls_ecdhe_ecdsa(peer->handshake_params->cipher));
 
   data += DTLS_HS_LENGTH;
 
@@ -2903,6 +4122,7 @@ check_server_hellodone(dtls_context_t *ctx,
 		      uint8 *data, size_t data_length)
 {
   int res;
+  uint64_t start;
 #ifdef DTLS_ECC
   const dtls_ecdsa_key_t *ecdsa_key;
 #endif /* DTLS_ECC */
@@ -2951,8 +4171,10 @@ check_server_hellodone(dtls_context_t *ctx,
   }
 #endif /* DTLS_ECC */
 
+  dtls_usecs(&start);
   res = calculate_key_block(ctx, handshake, peer,
 			    &peer->session, peer->role);
+  dtls_stats_record_phase(ctx, DTLS_PHASE_KEY_BLOCK, start);
   if (res < 0) {
     return res;
   }
@@ -2970,71 +4192,89 @@ check_server_hellodone(dtls_context_t *ctx,
   return dtls_send_finished(ctx, peer, PRF_LABEL(client), PRF_LABEL_SIZE(client));
 }
 
+/**
+ * Decrypts and verifies the record \p packet of the given \p length
+ * from \p peer. On success, \p cleartext points to the payload and
+ * \p content_type is set to the content type of the payload, which is
+ * encrypted in records with a connection id.
+ * \return The length of the payload, or less than zero on error.
+ */
 static int
 decrypt_verify(dtls_peer_t *peer, uint8 *packet, size_t length,
-	       uint8 **cleartext)
+	       uint8 **cleartext, uint8 *content_type)
 {
   dtls_record_header_t *header = DTLS_RECORD_HEADER(packet);
   dtls_security_parameters_t *security = dtls_security_params_epoch(peer, dtls_get_epoch(header));
+  size_t hlen = record_header_length(packet);
   int clen;
   
-  *cleartext = (uint8 *)packet + sizeof(dtls_record_header_t);
-  clen = length - sizeof(dtls_record_header_t);
+  *content_type = packet[0];
+  *cleartext = (uint8 *)packet + hlen;
+  clen = length - hlen;
 
   if (!security) {
     dtls_alert("No security context for epoch: %i\n", dtls_get_epoch(header));
     return -1;
   }
 
+  /* Once we have asked for a connection id, all records with the new
+   * keys must carry it, and records of epoch 0 never do. */
+  if ((packet[0] == DTLS_CT_TLS12_CID) !=
+      (security->epoch > 0 && peer->own_cid_length > 0)) {
+    dtls_warn("unexpected record type %d in epoch %d\n",
+	      packet[0], security->epoch);
+    return -1;
+  }
+
   if (security->cipher == TLS_NULL_WITH_NULL_NULL) {
     /* no cipher suite selected */
     return clen;
-  } else { /* TLS_PSK_WITH_AES_128_CCM_8 or TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 */
-    /** 
-     * length of additional_data for the AEAD cipher which consists of
-     * seq_num(2+6) + type(1) + version(2) + length(2)
-     */
-#define A_DATA_LEN 13
+  } else { /* one of the AEAD cipher suites */
     unsigned char nonce[DTLS_CCM_BLOCKSIZE];
-    unsigned char A_DATA[A_DATA_LEN];
+    unsigned char A_DATA[A_DATA_MAX_LEN];
+    size_t A_DATA_LEN;
+    size_t tag_size = dtls_kb_tag_size(security, peer->role);
+    size_t riv = dtls_kb_record_iv_size(security, peer->role);
 
-    if (clen < 16)		/* need at least IV and MAC */
+    if (clen < (int)(riv + tag_size))	/* need at least IV and MAC */
       return -1;
 
-    memset(nonce, 0, DTLS_CCM_BLOCKSIZE);
-    memcpy(nonce, dtls_kb_remote_iv(security, peer->role),
-	   dtls_kb_iv_size(security, peer->role));
-
     /* read epoch and seq_num from message */
-    memcpy(nonce + dtls_kb_iv_size(security, peer->role), *cleartext, 8);
-    *cleartext += 8;
-    clen -= 8;
+    dtls_record_nonce(security, peer->role,
+		      dtls_kb_remote_iv(security, peer->role),
+		      riv ? *cleartext : (uint8 *)&header->epoch, nonce);
+    *cleartext += riv;
+    clen -= riv;
 
     dtls_debug_dump("nonce", nonce, DTLS_CCM_BLOCKSIZE);
     dtls_debug_dump("key", dtls_kb_remote_write_key(security, peer->role),
 		    dtls_kb_key_size(security, peer->role));
     dtls_debug_dump("ciphertext", *cleartext, clen);
 
-    /* re-use N to create additional data according to RFC 5246, Section 6.2.3.3:
-     * 
-     * additional_data = seq_num + TLSCompressed.type +
-     *                   TLSCompressed.version + TLSCompressed.length;
-     */
-    memcpy(A_DATA, &DTLS_RECORD_HEADER(packet)->epoch, 8); /* epoch and seq_num */
-    memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(packet)->content_type, 3); /* type and version */
-    dtls_int_to_uint16(A_DATA + 11, clen - 8); /* length without nonce_explicit */
-
-    clen = dtls_decrypt(*cleartext, clen, *cleartext, nonce,
-		       dtls_kb_remote_write_key(security, peer->role),
-		       dtls_kb_key_size(security, peer->role),
-		       A_DATA, A_DATA_LEN);
+    /* length without MAC */
+    A_DATA_LEN = dtls_record_aad(A_DATA, packet, hlen - DTLS_RH_LENGTH,
+				 clen - tag_size);
+
+    clen = dtls_decrypt_ctx(&security->read_cipher,
+			    *cleartext, clen, *cleartext, nonce,
+			    A_DATA, A_DATA_LEN);
+
+    if (clen >= 0 && packet[0] == DTLS_CT_TLS12_CID) {
+      /* DTLSInnerPlaintext: the content is followed by its real type
+       * and optional zero padding */
+      while (clen > 0 && (*cleartext)[clen - 1] == 0)
+	clen--;
+      if (clen == 0) {
+	dtls_warn("no content type in record\n");
+	return -1;
+      }
+      *content_type = (*cleartext)[--clen];
+    }
+
     if (clen < 0)
       dtls_warn("decryption failed\n");
     else {
-#ifndef NDEBUG
-      printf("decrypt_verify(): found %i bytes cleartext\n", clen);
-#endif
-      dtls_security_params_free_other(peer);
+      dtls_debug("decrypt_verify(): found %i bytes cleartext\n", clen);
       dtls_debug_dump("cleartext", *cleartext, clen);
     }
   }
@@ -3066,10 +4306,14 @@ dtls_renegotiate(dtls_context_t *ctx, const session_t *dst)
   peer->handshake_params = dtls_handshake_new();
   if (!peer->handshake_params)
     return -1;
+  DTLS_STAT_INC(ctx, handshakes_started);
 
   peer->handshake_params->hs_state.mseq_r = 0;
   peer->handshake_params->hs_state.mseq_s = 0;
 
+  /* the last flight of the previous handshake is not needed anymore */
+  dtls_stop_retransmission(ctx, peer);
+
   if (peer->role == DTLS_CLIENT) {
     /* send ClientHello with empty Cookie */
     err = dtls_send_client_hello(ctx, peer, NULL, 0);
@@ -3091,6 +4335,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 		 uint8 *data, size_t data_length) {
 
   int err = 0;
+  uint64_t start;
 
   /* This will clear the retransmission buffer if we get an expected
    * handshake message. We have to make sure that no handshake message
@@ -3098,6 +4343,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
    * we do everything accordingly to the DTLS 1.2 standard this should
    * not be a problem. */
   if (peer) {
+    dtls_update_rtt(peer);
     dtls_stop_retransmission(ctx, peer);
   }
 
@@ -3136,7 +4382,13 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_server_hello err: %i\n", err);
       return err;
     }
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher))
+    if (peer->handshake_params->resumed) {
+      /* abbreviated handshake: expect the server's Finished next */
+      err = resume_key_block(ctx, peer);
+      if (err < 0)
+	return err;
+      peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
+    } else if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher))
       peer->state = DTLS_STATE_WAIT_SERVERCERTIFICATE;
     else
       peer->state = DTLS_STATE_WAIT_SERVERHELLODONE;
@@ -3169,7 +4421,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
   case DTLS_HT_SERVER_KEY_EXCHANGE:
 
 #ifdef DTLS_ECC
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+    if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher)) {
       if (state != DTLS_STATE_WAIT_SERVERKEYEXCHANGE) {
         return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
       }
@@ -3177,7 +4429,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     }
 #endif /* DTLS_ECC */
 #ifdef DTLS_PSK
-    if (is_tls_psk_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+    if (is_tls_psk(peer->handshake_params->cipher)) {
       if (state != DTLS_STATE_WAIT_SERVERHELLODONE) {
         return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
       }
@@ -3210,6 +4462,24 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
     break;
 
+#if DTLS_SESSION_TICKETS
+  case DTLS_HT_NEW_SESSION_TICKET:
+
+    if (role != DTLS_CLIENT || state != DTLS_STATE_WAIT_CHANGECIPHERSPEC
+	|| !peer->handshake_params->ticket_ext) {
+      return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
+    }
+
+    err = check_new_session_ticket(ctx, peer, data, data_length);
+    if (err < 0) {
+      dtls_warn("error in check_new_session_ticket err: %i\n", err);
+      return err;
+    }
+    update_hs_hash(peer, data, data_length);
+
+    break;
+#endif /* DTLS_SESSION_TICKETS */
+
   case DTLS_HT_CERTIFICATE_REQUEST:
 
     if (state != DTLS_STATE_WAIT_SERVERHELLODONE) {
@@ -3231,15 +4501,27 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
 
+    dtls_usecs(&start);
     err = check_finished(ctx, peer, data, data_length);
+    dtls_stats_record_phase(ctx, DTLS_PHASE_FINISHED, start);
     if (err < 0) {
       dtls_warn("error in check_finished err: %i\n", err);
       return err;
     }
-    if (role == DTLS_SERVER) {
-      /* send ServerFinished */
+    if ((role == DTLS_SERVER) != peer->handshake_params->resumed) {
+      /* send our Finished, which is the ServerFinished in a full
+       * handshake and the ClientFinished in an abbreviated one */
       update_hs_hash(peer, data, data_length);
 
+#if DTLS_SESSION_TICKETS
+      /* the server issues a new ticket if it has announced one */
+      if (role == DTLS_SERVER && peer->handshake_params->ticket_ext) {
+	err = dtls_send_new_session_ticket(ctx, peer);
+	if (err < 0)
+	  return err;
+      }
+#endif /* DTLS_SESSION_TICKETS */
+
       /* send change cipher spec message and switch to new configuration */
       err = dtls_send_ccs(ctx, peer);
       if (err < 0) {
@@ -3249,12 +4531,35 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
       dtls_security_params_switch(peer);
 
-      err = dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+      if (role == DTLS_SERVER)
+	err = dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+      else
+	err = dtls_send_finished(ctx, peer, PRF_LABEL(client), PRF_LABEL_SIZE(client));
       if (err < 0) {
-        dtls_warn("sending server Finished failed\n");
+        dtls_warn("sending Finished failed\n");
         return err;
       }
     }
+    if (!peer->handshake_params->resumed) {
+      dtls_handshake_parameters_t *handshake = peer->handshake_params;
+      dtls_tick_t now;
+
+      /* keep the master secret for abbreviated handshakes */
+      dtls_ticks(&now);
+      if (!ctx->cache)
+	ctx->cache = dtls_cache_new();
+      dtls_cache_add(ctx->cache, &peer->key,
+		     handshake->session_id, handshake->session_id_length,
+		     handshake->cipher, handshake->compression,
+		     handshake->tmp.master_secret,
+#if DTLS_SESSION_TICKETS
+		     handshake->ticket, handshake->ticket_length,
+#else /* DTLS_SESSION_TICKETS */
+		     NULL, 0,
+#endif /* DTLS_SESSION_TICKETS */
+		     now);
+    }
+    DTLS_STAT_INC(ctx, handshakes_completed[dtls_stats_cipher(peer->handshake_params->cipher)]);
     dtls_handshake_free(peer->handshake_params);
     peer->handshake_params = NULL;
     dtls_debug("Handshake complete\n");
@@ -3282,7 +4587,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     }
     update_hs_hash(peer, data, data_length);
 
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
+    if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher) &&
 	is_ecdsa_client_auth_supported(ctx))
       peer->state = DTLS_STATE_WAIT_CERTIFICATEVERIFY;
     else
@@ -3342,7 +4647,8 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       * the cookie exchange */
     if (peer && state == DTLS_STATE_WAIT_CLIENTHELLO) {
        dtls_debug("removing the peer\n");
-       DEL_PEER(ctx->peers, peer);
+       dtls_handshake_failed(ctx, peer);
+       DEL_PEER(ctx, peer);
 
        dtls_free_peer(peer);
        peer = NULL;
@@ -3379,6 +4685,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       peer->handshake_params = dtls_handshake_new();
       if (!peer->handshake_params)
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+      DTLS_STAT_INC(ctx, handshakes_started);
 
       peer->handshake_params->hs_state.mseq_r = dtls_uint16_to_int(hs_header->message_seq);
       peer->handshake_params->hs_state.mseq_s = 1;
@@ -3401,11 +4708,44 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     /* update finish MAC */
     update_hs_hash(peer, data, data_length);
 
+    if (peer->handshake_params->resumed) {
+      /* abbreviated handshake: ServerHello is followed by our
+       * ChangeCipherSpec and Finished */
+      err = dtls_send_server_hello(ctx, peer);
+      if (err < 0) {
+	dtls_debug("dtls_server_hello: cannot prepare ServerHello record\n");
+	return err;
+      }
+
+      err = resume_key_block(ctx, peer);
+      if (err < 0)
+	return err;
+
+      err = dtls_send_ccs(ctx, peer);
+      if (err < 0) {
+	dtls_warn("cannot send CCS message\n");
+	return err;
+      }
+
+      dtls_security_params_switch(peer);
+
+      err = dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+      if (err < 0) {
+	dtls_warn("sending server Finished failed\n");
+	return err;
+      }
+
+      peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
+      break;
+    }
+
+    dtls_usecs(&start);
     err = dtls_send_server_hello_msgs(ctx, peer);
+    dtls_stats_record_phase(ctx, DTLS_PHASE_SERVER_HELLO, start);
     if (err < 0) {
       return err;
     }
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
+    if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher) &&
 	is_ecdsa_client_auth_supported(ctx))
       peer->state = DTLS_STATE_WAIT_CLIENTCERTIFICATE;
     else
@@ -3429,6 +4769,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       peer->handshake_params = dtls_handshake_new();
       if (!peer->handshake_params)
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+      DTLS_STAT_INC(ctx, handshakes_started);
 
       peer->handshake_params->hs_state.mseq_r = 0;
       peer->handshake_params->hs_state.mseq_s = 0;
@@ -3484,6 +4825,12 @@ handle_handshake(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 	hs_header->msg_type == DTLS_HT_HELLO_REQUEST) {
       return handle_handshake_msg(ctx, peer, session, role, state, data,
 				  data_length);
+    } else if (hs_header->msg_type == DTLS_HT_FINISHED &&
+	       peer->state == DTLS_STATE_CONNECTED && peer->retransmit) {
+      /* the peer has not seen our last flight */
+      dtls_info("resend last flight\n");
+      dtls_resend_flight(ctx, peer);
+      return 0;
     } else {
       dtls_warn("ignore unexpected handshake message\n");
       return 0;
@@ -3587,10 +4934,15 @@ handle_ccs(dtls_context_t *ctx, dtls_peer_t *peer,
   if (data_length < 1 || data[0] != 1)
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
 
-  /* Just change the cipher when we are on the same epoch */
-  if (peer->role == DTLS_SERVER) {
+  /* Just change the cipher when we are on the same epoch. In an
+   * abbreviated handshake, the keys are already in place. */
+  if (peer->role == DTLS_SERVER && !handshake->resumed) {
+    uint64_t start;
+
+    dtls_usecs(&start);
     err = calculate_key_block(ctx, handshake, peer,
 			      &peer->session, peer->role);
+    dtls_stats_record_phase(ctx, DTLS_PHASE_KEY_BLOCK, start);
     if (err < 0) {
       return err;
     }
@@ -3630,7 +4982,7 @@ handle_alert(dtls_context_t *ctx, dtls_peer_t *peer,
   if (data[0] == DTLS_ALERT_LEVEL_FATAL || data[1] == DTLS_ALERT_CLOSE_NOTIFY) {
     dtls_alert("%d invalidate peer\n", data[1]);
     
-    DEL_PEER(ctx->peers, peer);
+    DEL_PEER(ctx, peer);
 
 #ifdef WITH_CONTIKI
 #ifndef NDEBUG
@@ -3696,35 +5048,47 @@ static int dtls_alert_send_from_err(dtls_context_t *ctx, dtls_peer_t *peer,
   return -1;
 }
 
-/** 
- * Handles incoming data as DTLS message from given peer.
+/**
+ * Handles the records in @p msg that have been received from
+ * @p session. @p peer must be the result of
+ * dtls_get_peer_for_datagram() for @p msg.
+ *
+ * When @p peer has been found by the connection id of the first
+ * record, the datagram may come from anyone who has seen one of the
+ * peer's records. Every record must then carry the peer's connection
+ * id and must be authentic and new. The rest of the datagram is
+ * dropped otherwise, without touching the peer.
  */
-int
-dtls_handle_message(dtls_context_t *ctx, 
-		    session_t *session,
-		    uint8 *msg, int msglen) {
-  dtls_peer_t *peer = NULL;
+static int
+handle_datagram(dtls_context_t *ctx, session_t *session, dtls_peer_t *peer,
+		uint8 *msg, int msglen) {
   unsigned int rlen;		/* record length */
   uint8 *data; 			/* (decrypted) payload */
   int data_length;		/* length of decrypted payload 
 				   (without MAC and padding) */
+  uint8 content_type;		/* the (decrypted) content type */
+  int by_cid;			/* peer has been found by connection id */
   int err;
 
-  /* check if we have DTLS state for addr/port/ifindex */
-  peer = dtls_get_peer(ctx, session);
+  DTLS_STAT_ADD(ctx, bytes_in, msglen);
 
-  if (!peer) {
-    dtls_debug("dtls_handle_message: PEER NOT FOUND\n");
-    dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "peer addr", session);
-  } else {
-    dtls_debug("dtls_handle_message: FOUND PEER\n");
-  }
+  by_cid = peer && msglen > 0 && msg[0] == DTLS_CT_TLS12_CID;
 
   while ((rlen = is_record(msg,msglen))) {
     dtls_peer_type role;
     dtls_state_t state;
 
     dtls_debug("got packet %d (%d bytes)\n", msg[0], rlen);
+    content_type = msg[0];
+
+    if (by_cid && (content_type != DTLS_CT_TLS12_CID ||
+		   memcmp(msg + DTLS_RH_LENGTH - sizeof(uint16),
+			  peer->own_cid, DTLS_CID_LENGTH) != 0)) {
+      dtls_info("record without the connection id of the peer, "
+		"dropping the rest of the datagram\n");
+      break;
+    }
+
     if (peer) {
       dtls_record_header_t *header = DTLS_RECORD_HEADER(msg);
       
@@ -3735,43 +5099,61 @@ dtls_handle_message(dtls_context_t *ctx,
       } else {
         uint64_t pkt_seq_nr = dtls_uint48_to_int(header->sequence_number);
         if(pkt_seq_nr == 0 && security->cseq.cseq == 0) {
-          data_length = decrypt_verify(peer, msg, rlen, &data);
+          data_length = decrypt_verify(peer, msg, rlen, &data, &content_type);
           if (data_length) {
             security->cseq.cseq = 0;
             security->cseq.bitfield = -1;
           }
         } else if (pkt_seq_nr == security->cseq.cseq) {
           dtls_info("Duplicate packet arrived (cseq=%" PRIu64 ")\n", security->cseq.cseq);
-          return 0;
+          goto replayed;
         } else if ((int64_t)(security->cseq.cseq-pkt_seq_nr) > 0) { /* pkt_seq_nr < security->cseq.cseq */
           if (((security->cseq.cseq-1)-pkt_seq_nr) < 64) {
               if(security->cseq.bitfield & (1<<((security->cseq.cseq-1)-pkt_seq_nr))) {
                 dtls_info("Duplicate packet arrived (bitfield)\n");
                 /* seen it */
-                  return 0;
+                goto replayed;
               } else {
                 dtls_info("Packet arrived out of order\n");
-                data_length = decrypt_verify(peer, msg, rlen, &data);
+                data_length = decrypt_verify(peer, msg, rlen, &data, &content_type);
                 if(data_length > 0) {
                   security->cseq.bitfield |= (1<<((security->cseq.cseq-1)-pkt_seq_nr));
                 }
               }
           } else {
             dtls_info("Packet from before the bitfield arrived\n");
-              return 0;
+            goto replayed;
           }
         } else { /* pkt_seq_nr > security->cseq.cseq */
-          data_length = decrypt_verify(peer, msg, rlen, &data);
+          data_length = decrypt_verify(peer, msg, rlen, &data, &content_type);
           if(data_length > 0) {
             security->cseq.bitfield <<= (pkt_seq_nr-security->cseq.cseq);
             security->cseq.bitfield |= 1<<((pkt_seq_nr-security->cseq.cseq)-1);
             security->cseq.cseq = pkt_seq_nr;
             dtls_debug("new packet arrived with seq_nr: %" PRIu64 "\n", pkt_seq_nr);
             dtls_debug("new bitfield is               : %" PRIx64 "\n", security->cseq.bitfield);
+
+            /* the newest record with our connection id determines
+             * the peer's address */
+            if (msg[0] == DTLS_CT_TLS12_CID &&
+                !dtls_session_equals(session, &peer->session) &&
+                dtls_update_peer_address(ctx, peer, session) < 0)
+              return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
           }
         }
+        /* only a record verified under the current epoch supersedes
+         * the other one, and not before its replay window is updated;
+         * the last flight may still need the other epoch */
+        if (data_length >= 0 && security == dtls_security_params(peer) &&
+            !peer->retransmit)
+          dtls_security_params_free_other(peer);
       }
-      if (data_length < 0) {
+      if (data_length < 0 && by_cid) {
+	/* not necessarily sent by the peer, so the peer is kept */
+	dtls_info("decrypt_verify() failed, dropping datagram\n");
+	DTLS_STAT_INC(ctx, decrypt_failures);
+	return dtls_alert_fatal_create(DTLS_ALERT_DECRYPT_ERROR);
+      } else if (data_length < 0) {
         if (hs_attempt_with_existing_peer(msg, rlen, peer)) {
           data = msg + DTLS_RH_LENGTH;
           data_length = rlen - DTLS_RH_LENGTH;
@@ -3780,6 +5162,7 @@ dtls_handle_message(dtls_context_t *ctx,
         } else {
 	  err =  dtls_alert_fatal_create(DTLS_ALERT_DECRYPT_ERROR);
           dtls_info("decrypt_verify() failed\n");
+	  DTLS_STAT_INC(ctx, decrypt_failures);
 	  if (peer->state < DTLS_STATE_CONNECTED) {
 	    dtls_alert_send_from_err(ctx, peer, &peer->session, err);
 	    peer->state = DTLS_STATE_CLOSED;
@@ -3808,10 +5191,14 @@ dtls_handle_message(dtls_context_t *ctx,
      * combining multiple fragments of one type into a single
      * record. */
 
-    switch (msg[0]) {
+    DTLS_STAT_RECORD(ctx, records_in, content_type);
+
+    switch (content_type) {
 
     case DTLS_CT_CHANGE_CIPHER_SPEC:
-      if (peer) {
+      /* a retransmitted CCS must not drop the last flight */
+      if (peer && peer->handshake_params) {
+        dtls_update_rtt(peer);
         dtls_stop_retransmission(ctx, peer);
       }
       err = handle_ccs(ctx, peer, msg, data, data_length);
@@ -3852,12 +5239,23 @@ dtls_handle_message(dtls_context_t *ctx,
 	/* The new security parameters must be used for all messages
 	 * that are sent after the ChangeCipherSpec message. This
 	 * means that the client's Finished message uses epoch + 1
-	 * while the server is still in the old epoch.
+	 * while the server is still in the old epoch. In an
+	 * abbreviated handshake, the roles are reversed.
 	 */
-	if (role == DTLS_SERVER && state == DTLS_STATE_WAIT_FINISHED) {
+	if (state == DTLS_STATE_WAIT_FINISHED &&
+	    (role == DTLS_SERVER) != peer->handshake_params->resumed) {
 	  expected_epoch++;
 	}
 
+	/* A NewSessionTicket is sent before the server's
+	 * ChangeCipherSpec, i.e. after the client has switched to
+	 * the new epoch. */
+	if (role == DTLS_CLIENT && state == DTLS_STATE_WAIT_CHANGECIPHERSPEC &&
+	    !peer->handshake_params->resumed && expected_epoch > 0 &&
+	    data_length > 0 && data[0] == DTLS_HT_NEW_SESSION_TICKET) {
+	  expected_epoch--;
+	}
+
 	if (expected_epoch != msg_epoch) {
           if (hs_attempt_with_existing_peer(msg, rlen, peer)) {
             state = DTLS_STATE_WAIT_CLIENTHELLO;
@@ -3873,12 +5271,16 @@ dtls_handle_message(dtls_context_t *ctx,
       err = handle_handshake(ctx, peer, session, role, state, data, data_length);
       if (err < 0) {
 	dtls_warn("error while handling handshake packet\n");
+	if (peer || (peer = dtls_get_peer(ctx, session)))
+	  dtls_handshake_failed(ctx, peer);
 	dtls_alert_send_from_err(ctx, peer, session, err);
 	return err;
       }
-      if (peer && peer->state == DTLS_STATE_CONNECTED) {
-	/* stop retransmissions */
-	dtls_stop_retransmission(ctx, peer);
+      if (peer && state != DTLS_STATE_CONNECTED &&
+	  peer->state == DTLS_STATE_CONNECTED) {
+	/* our last flight may get lost, so keep it until the peer
+	 * sends application data */
+	dtls_keep_flight(ctx, peer);
 	CALL(ctx, event, &peer->session, 0, DTLS_EVENT_CONNECTED);
       }
       break;
@@ -3894,10 +5296,21 @@ dtls_handle_message(dtls_context_t *ctx,
       CALL(ctx, read, &peer->session, data, data_length);
       break;
     default:
-      dtls_info("dropped unknown message of type %d\n",msg[0]);
+      dtls_info("dropped unknown message of type %d\n",content_type);
     }
 
-    /* advance msg by length of ciphertext */
+    goto next_record;
+
+  replayed:
+    DTLS_STAT_INC(ctx, replays);
+    if (by_cid)
+      break;
+
+  next_record:
+    /* Advance msg by length of ciphertext. Records that have been
+     * dropped as duplicates are skipped as well, as the remaining
+     * records of a datagram with packed handshake messages still
+     * need to be processed. */
     msg += rlen;
     msglen -= rlen;
   }
@@ -3905,6 +5318,239 @@ dtls_handle_message(dtls_context_t *ctx,
   return 0;
 }
 
+/** 
+ * Handles incoming data as DTLS message from given peer.
+ */
+int
+dtls_handle_message(dtls_context_t *ctx, 
+		    session_t *session,
+		    uint8 *msg, int msglen) {
+  dtls_peer_t *peer = NULL;
+  dtls_peer_key_t key;
+  int res;
+
+  /* check if we have DTLS state for addr/port/ifindex or for the
+   * connection id of the record */
+  dtls_session_key(session, &key);
+  peer = dtls_get_peer_for_datagram(ctx, &key, dtls_peer_key_hash(&key),
+				    msg, msglen);
+
+  if (!peer) {
+    dtls_debug("dtls_handle_message: PEER NOT FOUND\n");
+    dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "peer addr", session);
+  } else {
+    dtls_debug("dtls_handle_message: FOUND PEER\n");
+  }
+
+  dtls_output_begin(ctx);
+  res = handle_datagram(ctx, session, peer, msg, msglen);
+  if (dtls_output_end(ctx) < 0 && res >= 0)
+    res = -1;
+
+  return res;
+}
+
+#if DTLS_MESSAGES_BATCH < 1 || DTLS_MESSAGES_BATCH > 128
+#error "DTLS_MESSAGES_BATCH must be between 1 and 128"
+#endif
+
+/* Terminates the list of datagrams from the same sender. */
+#define DTLS_BATCH_END 0xff
+
+/** Per-datagram state of dtls_handle_messages(). */
+typedef struct {
+  dtls_peer_key_t key;		/**< lookup key of the sender */
+  uint32_t hash;		/**< dtls_peer_key_hash() of key */
+  const uint8 *hello;		/**< ClientHello the cookie belongs to */
+  uint8 cookie[DTLS_COOKIE_LENGTH]; /**< precomputed cookie for hello */
+  uint8 first;			/**< first datagram from this sender */
+  uint8 next;			/**< next datagram from this sender */
+  uint8 last;			/**< last datagram from this sender,
+				     valid for the first one only */
+} dtls_batch_entry_t;
+
+/**
+ * Links the datagrams in \p msgs that come from the same sender into
+ * lists in the order they have been received. The head of each list
+ * is marked with \c first. The senders are hashed into a table with
+ * twice as many slots as datagrams, so grouping takes linear time.
+ */
+static void
+dtls_group_messages(const dtls_message_t *msgs, dtls_batch_entry_t *b,
+		    size_t count) {
+  uint8 slots[2 * DTLS_MESSAGES_BATCH];
+  dtls_batch_entry_t *head = NULL;
+  size_t i, s;
+
+  memset(slots, 0, sizeof(slots));
+
+  for (i = 0; i < count; i++) {
+    dtls_session_key(msgs[i].session, &b[i].key);
+    b[i].hash = dtls_peer_key_hash(&b[i].key);
+    b[i].hello = NULL;
+    b[i].next = DTLS_BATCH_END;
+
+    /* slots hold the index of the first datagram plus one */
+    for (s = b[i].hash % sizeof(slots); slots[s];
+	 s = (s + 1) % sizeof(slots)) {
+      head = &b[slots[s] - 1];
+      if (head->hash == b[i].hash &&
+	  dtls_peer_key_equals(&head->key, &b[i].key))
+	break;
+    }
+
+    if (slots[s]) {
+      b[head->last].next = i;
+      head->last = i;
+      b[i].first = 0;
+    } else {
+      slots[s] = i + 1;
+      b[i].first = 1;
+      b[i].last = i;
+    }
+  }
+}
+
+#ifndef WITH_CONTIKI
+/**
+ * Creates the cookies for all datagrams in \p msgs that start with
+ * an unprotected ClientHello, hashing up to DTLS_HASH_LANES of them
+ * in parallel. The cookie of each such datagram is stored in its
+ * entry of \p b, which dtls_verify_peer() finds through ctx->hello
+ * while the datagram is handled.
+ */
+static void
+dtls_create_cookies(dtls_context_t *ctx, const dtls_message_t *msgs,
+		    dtls_batch_entry_t *b, size_t count) {
+  dtls_hmac_context_t hmac[DTLS_HASH_LANES], *hp[DTLS_HASH_LANES];
+  dtls_batch_entry_t *m[DTLS_HASH_LANES];
+  const unsigned char *input[3][DTLS_HASH_LANES];
+  size_t ilen[3][DTLS_HASH_LANES];
+  unsigned char buf[DTLS_HASH_LANES][DTLS_HMAC_MAX];
+  unsigned char *result[DTLS_HASH_LANES];
+  const unsigned char *in[3];
+  size_t i, il[3];
+  unsigned int rlen, n, k;
+  uint8 *data;
+
+  for (i = 0; i < count; ) {
+    for (n = 0; n < DTLS_HASH_LANES && i < count; i++) {
+      rlen = is_record(msgs[i].msg, msgs[i].msglen);
+      if (!rlen || msgs[i].msg[0] != DTLS_CT_HANDSHAKE ||
+	  dtls_get_epoch(DTLS_RECORD_HEADER(msgs[i].msg)) != 0 ||
+	  rlen <= DTLS_RH_LENGTH)
+	continue;
+
+      data = msgs[i].msg + DTLS_RH_LENGTH;
+      if (data[0] != DTLS_HT_CLIENT_HELLO ||
+	  dtls_cookie_input(msgs[i].session, data, rlen - DTLS_RH_LENGTH,
+			    in, il) < 0)
+	continue;
+
+      for (k = 0; k < 3; k++) {
+	input[k][n] = in[k];
+	ilen[k][n] = il[k];
+      }
+      b[i].hello = data;
+      m[n++] = &b[i];
+    }
+
+    if (!n)
+      break;
+
+    for (k = 0; k < n; k++) {
+      dtls_hmac_init_key(&hmac[k], &ctx->cookie_key);
+      hp[k] = &hmac[k];
+      result[k] = buf[k];
+    }
+    for (k = 0; k < 3; k++)
+      dtls_hmac_update_multi(hp, input[k], ilen[k], n);
+    dtls_hmac_finalize_multi(hp, result, n);
+
+    for (k = 0; k < n; k++)
+      memcpy(m[k]->cookie, buf[k], DTLS_COOKIE_LENGTH);
+  }
+}
+#endif /* WITH_CONTIKI */
+
+/**
+ * Handles at most DTLS_MESSAGES_BATCH datagrams for
+ * dtls_handle_messages() and returns the number of datagrams that
+ * have been handled without error.
+ */
+static int
+dtls_handle_batch(dtls_context_t *ctx, dtls_message_t *msgs, size_t count) {
+  dtls_batch_entry_t b[DTLS_MESSAGES_BATCH];
+  dtls_peer_t *peer;
+  unsigned int generation;
+  size_t i, j;
+  int lookup;
+  int handled = 0;
+
+  dtls_group_messages(msgs, b, count);
+
+#ifndef WITH_CONTIKI
+  dtls_create_cookies(ctx, msgs, b, count);
+#endif /* WITH_CONTIKI */
+
+  for (i = 0; i < count; i++) {
+    if (!b[i].first)
+      continue;
+
+    peer = NULL;
+    generation = ctx->peers_generation;
+    lookup = 1;
+
+    /* Handle msgs[i] and all remaining datagrams from the same
+     * session. The peer is looked up again only if the peer table
+     * has changed in the meantime or if a datagram carries a
+     * connection id, which may belong to a different peer. */
+    for (j = i; j != DTLS_BATCH_END; j = b[j].next) {
+      if (msgs[j].msglen > 0 && msgs[j].msg[0] == DTLS_CT_TLS12_CID)
+	lookup = 1;
+
+      if (lookup || generation != ctx->peers_generation) {
+	peer = dtls_get_peer_for_datagram(ctx, &b[j].key, b[j].hash,
+					  msgs[j].msg, msgs[j].msglen);
+	generation = ctx->peers_generation;
+
+	/* the next datagram needs its own lookup if this one has
+	 * been matched by its connection id */
+	lookup = msgs[j].msglen > 0 && msgs[j].msg[0] == DTLS_CT_TLS12_CID;
+      }
+
+      ctx->hello = b[j].hello;
+      ctx->hello_cookie = b[j].cookie;
+      msgs[j].result = handle_datagram(ctx, msgs[j].session, peer,
+				       msgs[j].msg, msgs[j].msglen);
+      ctx->hello = NULL;
+      if (msgs[j].result == 0)
+	handled++;
+    }
+  }
+
+  return handled;
+}
+
+int
+dtls_handle_messages(dtls_context_t *ctx, dtls_message_t *msgs,
+		     size_t count) {
+  size_t n;
+  int handled = 0;
+
+  dtls_output_begin(ctx);
+
+  for (; count; msgs += n, count -= n) {
+    n = count < DTLS_MESSAGES_BATCH ? count : DTLS_MESSAGES_BATCH;
+    handled += dtls_handle_batch(ctx, msgs, n);
+  }
+
+  /* datagrams that cannot be sent are counted as write errors */
+  dtls_output_end(ctx);
+
+  return handled;
+}
+
 dtls_context_t *
 dtls_new_context(void *app_data) {
   dtls_context_t *c;
@@ -3939,6 +5585,9 @@ dtls_new_context(void *app_data) {
 
   memset(c, 0, sizeof(dtls_context_t));
   c->app = app_data;
+#if DTLS_SESSION_TICKETS
+  c->tickets = 1;
+#endif /* DTLS_SESSION_TICKETS */
   
 #ifdef WITH_CONTIKI
   process_start(&dtls_retransmit_process, (char *)c);
@@ -3952,6 +5601,9 @@ dtls_new_context(void *app_data) {
     c->cookie_secret_age = now;
   else 
     goto error;
+
+  dtls_hmac_key_init(&c->cookie_key, c->cookie_secret,
+		     DTLS_COOKIE_SECRET_LENGTH);
   
   return c;
 
@@ -3962,6 +5614,82 @@ dtls_new_context(void *app_data) {
   return NULL;
 }
 
+int
+dtls_set_ticket_key(dtls_context_t *ctx,
+		    const unsigned char name[DTLS_TICKET_KEY_NAME_LENGTH],
+		    const unsigned char key[DTLS_TICKET_KEY_LENGTH]) {
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  return dtls_ticket_set_key(&ctx->ticket_keys, name, key, now);
+}
+
+void
+dtls_set_session_tickets(dtls_context_t *ctx, int enable) {
+#if DTLS_SESSION_TICKETS
+  ctx->tickets = enable != 0;
+#else /* DTLS_SESSION_TICKETS */
+  (void)ctx;
+  (void)enable;
+#endif /* DTLS_SESSION_TICKETS */
+}
+
+void
+dtls_set_flight_limit(dtls_context_t *ctx, size_t limit) {
+  ctx->flight_limit = limit;
+}
+
+void
+dtls_get_stats(const dtls_context_t *ctx, dtls_stats_t *stats) {
+#if DTLS_STATS
+  const uint64_t *src = (const uint64_t *)&ctx->stats;
+  uint64_t *dst = (uint64_t *)stats;
+  size_t i;
+
+  for (i = 0; i < sizeof(dtls_stats_t) / sizeof(uint64_t); i++)
+    dst[i] = DTLS_STAT_GET(src[i]);
+#else /* DTLS_STATS */
+  (void)ctx;
+  memset(stats, 0, sizeof(dtls_stats_t));
+#endif /* DTLS_STATS */
+}
+
+unsigned int
+dtls_histogram_bucket(uint64_t duration) {
+  unsigned int bucket = 0;
+
+  while (bucket < DTLS_HISTOGRAM_BUCKETS - 1 && (duration >> (bucket + 1)))
+    bucket++;
+  return bucket;
+}
+
+uint64_t
+dtls_histogram_quantile(const dtls_histogram_t *histogram,
+			unsigned int permille) {
+  uint64_t total = 0, rank, seen = 0;
+  unsigned int i;
+
+  /* count and buckets may be copied at different times, so the
+   * total is taken from the buckets */
+  for (i = 0; i < DTLS_HISTOGRAM_BUCKETS; i++)
+    total += histogram->buckets[i];
+  if (!total)
+    return 0;
+
+  if (permille > 1000)
+    permille = 1000;
+  rank = (total * permille + 999) / 1000;
+  if (!rank)
+    rank = 1;
+
+  for (i = 0; i < DTLS_HISTOGRAM_BUCKETS - 1; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank)
+      break;
+  }
+  return ((uint64_t)2 << i) - 1;
+}
+
 void dtls_reset_peer(dtls_context_t *ctx, dtls_peer_t *peer)
 {
     dtls_stop_retransmission(ctx, peer);
@@ -3970,25 +5698,65 @@ void dtls_reset_peer(dtls_context_t *ctx, dtls_peer_t *peer)
 
 void
 dtls_free_context(dtls_context_t *ctx) {
-  dtls_peer_t *p, *tmp;
+  dtls_peer_t *p;
+#ifdef DTLS_PEERS_NOHASH
+  dtls_peer_t *tmp;
+#else /* DTLS_PEERS_NOHASH */
+  size_t pos = 0;
+#endif /* DTLS_PEERS_NOHASH */
 
   if (!ctx) {
     return;
   }
 
-  if (ctx->peers) {
 #ifdef DTLS_PEERS_NOHASH
+  if (ctx->peers) {
     LL_FOREACH_SAFE(ctx->peers, p, tmp) {
-#else /* DTLS_PEERS_NOHASH */
-    HASH_ITER(hh, ctx->peers, p, tmp) {
-#endif /* DTLS_PEERS_NOHASH */
       dtls_destroy_peer(ctx, p, 1);
     }
   }
+#else /* DTLS_PEERS_NOHASH */
+  while ((p = dtls_peer_table_next(&ctx->peers, &pos))) {
+    dtls_destroy_peer(ctx, p, 1);
+  }
+  dtls_peer_table_free(&ctx->peers);
+#endif /* DTLS_PEERS_NOHASH */
 
+  netq_wheel_delete_all(&ctx->sendqueue);
+  dtls_cache_free(ctx->cache);
+  memset(&ctx->ticket_keys, 0, sizeof(ctx->ticket_keys));
   free_context(ctx);
 }
 
+dtls_peer_t *
+dtls_detach_peer(dtls_context_t *ctx, const session_t *session) {
+  dtls_peer_t *peer = dtls_get_peer(ctx, session);
+
+  if (peer) {
+    dtls_stop_retransmission(ctx, peer);
+    DEL_PEER(ctx, peer);
+    dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "detached peer", &peer->session);
+  }
+  return peer;
+}
+
+int
+dtls_attach_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+  assert(peer);
+  if (!peer || dtls_get_peer(ctx, &peer->session)) {
+    dtls_warn("cannot attach peer\n");
+    return -1;
+  }
+
+  if (dtls_add_peer(ctx, peer) < 0) {
+    dtls_alert("cannot add peer\n");
+    return -1;
+  }
+
+  dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "attached peer", &peer->session);
+  return 0;
+}
+
 int
 dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
   int res;
@@ -4015,6 +5783,7 @@ dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
   peer->handshake_params = dtls_handshake_new();
       if (!peer->handshake_params)
         return -1;
+  DTLS_STAT_INC(ctx, handshakes_started);
 
   peer->handshake_params->hs_state.mseq_r = 0;
   peer->handshake_params->hs_state.mseq_s = 0;
@@ -4055,87 +5824,181 @@ dtls_connect(dtls_context_t *ctx, const session_t *dst) {
   return res;
 }
 
+/** Sends all messages of the flight that is kept in @p node. */
+static void
+dtls_send_flight(dtls_context_t *context, netq_t *node) {
+  unsigned char sendbuf[DTLS_MAX_BUF];
+  size_t len, length, pos;
+  int err;
+  unsigned char *data;
+  unsigned char type;
+  dtls_security_parameters_t *security;
+
+  DTLS_STAT_INC(context, retransmissions);
+
+  for (pos = 0; pos + DTLS_FLIGHT_HEADER_LENGTH <= node->length;
+       pos += DTLS_FLIGHT_HEADER_LENGTH + length) {
+    type = dtls_uint8_to_int(node->data + pos);
+    security = dtls_security_params_epoch(node->peer,
+		     dtls_uint16_to_int(node->data + pos + 1));
+    length = dtls_uint16_to_int(node->data + pos + 3);
+    data = node->data + pos + DTLS_FLIGHT_HEADER_LENGTH;
+
+    if (type == DTLS_CT_HANDSHAKE) {
+      dtls_handshake_header_t *hs_header = DTLS_HANDSHAKE_HEADER(data);
+
+      dtls_debug("** retransmit handshake packet of type: %s (%i)\n",
+		 dtls_handshake_type_to_name(hs_header->msg_type), hs_header->msg_type);
+    } else {
+      dtls_debug("** retransmit packet\n");
+    }
+
+    len = sizeof(sendbuf);
+    err = dtls_prepare_record(node->peer, security, type, &data, &length,
+			      1, sendbuf, &len);
+    if (err < 0) {
+      dtls_warn("can not retransmit packet, err: %i\n", err);
+      return;
+    }
+    dtls_debug_hexdump("retransmit header", sendbuf,
+		       sizeof(dtls_record_header_t));
+    dtls_debug_hexdump("retransmit unencrypted", data, length);
+
+    if (dtls_write_record(context, &node->peer->session,
+			  node->peer->mtu, sendbuf, len, 1) >= 0) {
+      DTLS_STAT_RECORD(context, records_out, type);
+      DTLS_STAT_ADD(context, bytes_out, len);
+    }
+  }
+}
+
 static void
 dtls_retransmit(dtls_context_t *context, netq_t *node) {
   if (!context || !node)
     return;
 
+  /* The last flight of a completed handshake is only resent on
+   * request of the peer and dropped when its time is up. */
+  if (node->peer && !node->peer->handshake_params) {
+    dtls_debug("** removed last flight\n");
+    netq_peer_unlink(node);
+    netq_node_free(node);
+    return;
+  }
+
   /* re-initialize timeout when maximum number of retransmissions are not reached yet */
   if (node->retransmit_cnt < DTLS_DEFAULT_MAX_RETRANSMIT) {
-      unsigned char sendbuf[DTLS_MAX_BUF];
-      size_t len = sizeof(sendbuf);
-      int err;
-      unsigned char *data = node->data;
-      size_t length = node->length;
       dtls_tick_t now;
-      dtls_security_parameters_t *security = dtls_security_params_epoch(node->peer, node->epoch);
+      clock_time_t timeout;
 
       dtls_ticks(&now);
       node->retransmit_cnt++;
-      node->t = now + (node->timeout << node->retransmit_cnt);
-      netq_insert_node(&context->sendqueue, node);
-      
-      if (node->type == DTLS_CT_HANDSHAKE) {
-	dtls_handshake_header_t *hs_header = DTLS_HANDSHAKE_HEADER(data);
-
-	dtls_debug("** retransmit handshake packet of type: %s (%i)\n",
-	           dtls_handshake_type_to_name(hs_header->msg_type), hs_header->msg_type);
-      } else {
-	dtls_debug("** retransmit packet\n");
-      }
-      
-      err = dtls_prepare_record(node->peer, security, node->type, &data, &length,
-				1, sendbuf, &len);
-      if (err < 0) {
-	dtls_warn("can not retransmit packet, err: %i\n", err);
-	return;
-      }
-      dtls_debug_hexdump("retransmit header", sendbuf,
-			 sizeof(dtls_record_header_t));
-      dtls_debug_hexdump("retransmit unencrypted", node->data, node->length);
-
-      (void)CALL(context, write, &node->peer->session, sendbuf, len);
+      timeout = (node->timeout << node->retransmit_cnt) < DTLS_MAX_RTO
+	? (node->timeout << node->retransmit_cnt) : DTLS_MAX_RTO;
+      node->t = now + timeout;
+      netq_wheel_insert(&context->sendqueue, node);
+
+      /* The next flight starts with the backed off timeout as well
+       * (RFC 6298, section 5.5) until a new round-trip time has been
+       * measured. */
+      if (node->peer && node->peer->rto < timeout)
+	node->peer->rto = timeout;
+
+      /* resend all messages of the flight */
+      dtls_send_flight(context, node);
       return;
   }
 
   /* no more retransmissions, remove node from system */
   
   dtls_debug("** removed transaction\n");
+  if (node->peer)
+    dtls_handshake_failed(context, node->peer);
 
   /* And finally delete the node */
+  netq_peer_unlink(node);
   netq_node_free(node);
 }
 
+/**
+ * Updates the round-trip time estimate of @p peer when a message of
+ * the peer's next flight has been received. Flights that have been
+ * retransmitted are not used (Karn's algorithm).
+ */
+static void
+dtls_update_rtt(dtls_peer_t *peer) {
+  dtls_tick_t now;
+  clock_time_t sent = 0;
+  netq_t *node;
+
+  if (!peer->retransmit)
+    return;
+
+  for (node = peer->retransmit; node; node = node->peer_next) {
+    if (node->retransmit_cnt)
+      return;
+    if (node->t - node->timeout > sent)
+      sent = node->t - node->timeout;
+  }
+
+  dtls_ticks(&now);
+  dtls_peer_rtt_sample(peer, now - sent);
+  dtls_debug("rtt %u, srtt %u, rto %u\n", (unsigned int)(now - sent),
+	     (unsigned int)peer->srtt, (unsigned int)peer->rto);
+}
+
 static void
 dtls_stop_retransmission(dtls_context_t *context, dtls_peer_t *peer) {
   netq_t *node;
-  node = netq_head(&context->sendqueue); 
 
-  while (node) {
-    if (dtls_session_equals(&node->peer->session, &peer->session)) {
-      netq_t *tmp = node;
-      node = netq_next(node);
-      netq_remove(&context->sendqueue, tmp);
-      netq_node_free(tmp);
-    } else
-      node = netq_next(node);    
+  while ((node = peer->retransmit)) {
+    netq_peer_unlink(node);
+    netq_wheel_remove(&context->sendqueue, node);
+    netq_node_free(node);
+  }
+}
+
+/**
+ * Keeps the last flight of a completed handshake with @p peer for
+ * twice the maximum segment lifetime. The flight is resent only when
+ * the peer retransmits its own last flight (RFC 6347, section 4.2.4).
+ */
+static void
+dtls_keep_flight(dtls_context_t *context, dtls_peer_t *peer) {
+  dtls_tick_t now;
+  netq_t *node;
+
+  dtls_ticks(&now);
+  for (node = peer->retransmit; node; node = node->peer_next) {
+    netq_wheel_remove(&context->sendqueue, node);
+    node->t = now + 2 * DTLS_MSL;
+    netq_wheel_insert(&context->sendqueue, node);
   }
 }
 
+/** Resends the last flight that is kept for @p peer. */
+static void
+dtls_resend_flight(dtls_context_t *context, dtls_peer_t *peer) {
+  netq_t *node;
+
+  for (node = peer->retransmit; node; node = node->peer_next)
+    dtls_send_flight(context, node);
+}
+
 void
 dtls_check_retransmit(dtls_context_t *context, clock_time_t *next) {
   dtls_tick_t now;
-  netq_t *node = netq_head(&context->sendqueue);
+  netq_t *node;
 
   dtls_ticks(&now);
-  while (node && node->t <= now) {
-    netq_pop_first(&context->sendqueue);
+  dtls_output_begin(context);
+  while ((node = netq_wheel_expire(&context->sendqueue, now))) {
     dtls_retransmit(context, node);
-    node = netq_head(&context->sendqueue);
   }
+  dtls_output_end(context);
 
   if (next) {
-    *next = node ? node->t : 0;
+    *next = netq_wheel_next(&context->sendqueue);
   }
 }
 
@@ -4145,7 +6008,7 @@ dtls_check_retransmit(dtls_context_t *context, clock_time_t *next) {
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(dtls_retransmit_process, ev, data)
 {
-  clock_time_t now;
+  clock_time_t now, next;
   netq_t *node;
 
   PROCESS_BEGIN();
@@ -4157,19 +6020,17 @@ PROCESS_THREAD(dtls_retransmit_process, ev, data)
     if (ev == PROCESS_EVENT_TIMER) {
       if (etimer_expired(&the_dtls_context.retransmit_timer)) {
 	
-	node = netq_head(&the_dtls_context.sendqueue);
-	
 	now = clock_time();
-	if (node && node->t <= now) {
-	  netq_pop_first(&the_dtls_context.sendqueue);
+	node = netq_wheel_expire(&the_dtls_context.sendqueue, now);
+	if (node) {
 	  dtls_retransmit(&the_dtls_context, node);
-	  node = netq_head(&the_dtls_context.sendqueue);
 	}
 
 	/* need to set timer to some value even if no nextpdu is available */
-	if (node) {
+	next = netq_wheel_next(&the_dtls_context.sendqueue);
+	if (next) {
 	  etimer_set(&the_dtls_context.retransmit_timer, 
-		     node->t <= now ? 1 : node->t - now);
+		     next <= now ? 1 : next - now);
 	} else {
 	  etimer_set(&the_dtls_context.retransmit_timer, 0xFFFF);
 	}
@@ -39,6 +39,9 @@
 
 #include "global.h"
 #include "dtls_time.h"
+#include "netq.h"
+#include "cache.h"
+#include "ticket.h"
 
 #ifndef DTLSv12
 #define DTLS_VERSION 0xfeff	/* DTLS v1.1 */
@@ -207,26 +210,190 @@ typedef struct {
 			  const unsigned char *other_pub_y,
 			  size_t key_size);
 #endif /* DTLS_ECC */
+
+#ifndef WITH_CONTIKI
+  /**
+   * Optional. When set, all datagrams that are produced while
+   * handling received messages with dtls_handle_message() or
+   * dtls_handle_messages() or while retransmitting with
+   * dtls_check_retransmit() are collected and passed to this
+   * function at the end of that processing step instead of calling
+   * write() for each of them. This allows the application to send a
+   * whole handshake flight, or the flights for several peers, with a
+   * single call to sendmmsg(). The datagrams are passed in the order
+   * they have been produced.
+   *
+   * @param ctx      The current DTLS context.
+   * @param sessions The session objects, including the address of
+   *                 the remote peer where the datagram with the same
+   *                 index in @p bufs shall be sent.
+   * @param bufs     The datagrams to send.
+   * @param lens     The actual length of each datagram in @p bufs.
+   * @param count    The number of datagrams in @p bufs.
+   * @return The number of datagrams that were sent, or a value less
+   *         than zero to indicate an error.
+   */
+  int (*write_batch)(struct dtls_context_t *ctx, session_t sessions[],
+		     uint8 *bufs[], size_t lens[], size_t count);
+#endif /* WITH_CONTIKI */
 } dtls_handler_t;
 
-struct netq_t;
+#ifndef WITH_CONTIKI
+#ifndef DTLS_WRITE_BATCH_MAX
+/** Maximum number of datagrams passed to write_batch() at once. */
+#define DTLS_WRITE_BATCH_MAX 8
+#endif /* DTLS_WRITE_BATCH_MAX */
+
+/** Datagrams that are collected for the write_batch() handler. */
+typedef struct {
+  size_t count;			/**< number of collected datagrams */
+  size_t used;			/**< number of bytes used in data */
+  session_t sessions[DTLS_WRITE_BATCH_MAX]; /**< destination of each datagram */
+  uint8 *bufs[DTLS_WRITE_BATCH_MAX];
+  size_t lens[DTLS_WRITE_BATCH_MAX];
+  uint8 data[4 * DTLS_MAX_BUF];
+} dtls_write_batch_t;
+#endif /* WITH_CONTIKI */
+
+#if !defined(DTLS_PEERS_NOHASH) && !defined(DTLS_CID_BUCKETS)
+/** Number of hash buckets for the lookup of peers by connection id. */
+#define DTLS_CID_BUCKETS 256
+#endif /* !DTLS_PEERS_NOHASH && !DTLS_CID_BUCKETS */
+
+#ifndef DTLS_STATS
+#ifdef WITH_CONTIKI
+#define DTLS_STATS 0 /**< set to 1 to keep the counters of dtls_get_stats() */
+#else /* WITH_CONTIKI */
+#define DTLS_STATS 1 /**< set to 0 to compile out the counters of dtls_get_stats() */
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_STATS */
+
+/**
+ * Number of record content types that are counted in dtls_stats_t,
+ * starting with DTLS_CT_CHANGE_CIPHER_SPEC.
+ */
+#define DTLS_STATS_CONTENT_TYPES 4
+
+/** The cipher suites that are counted separately in dtls_stats_t. */
+typedef enum {
+  DTLS_STATS_CIPHER_NONE = 0,	/**< no cipher suite negotiated yet */
+  DTLS_STATS_CIPHER_PSK_AES_128_CCM_8,
+  DTLS_STATS_CIPHER_ECDHE_ECDSA_AES_128_CCM_8,
+  DTLS_STATS_CIPHER_PSK_AES_128_GCM_SHA256,
+  DTLS_STATS_CIPHER_ECDHE_ECDSA_AES_128_GCM_SHA256,
+  DTLS_STATS_CIPHER_PSK_CHACHA20_POLY1305_SHA256,
+  DTLS_STATS_CIPHER_ECDHE_ECDSA_CHACHA20_POLY1305_SHA256,
+  DTLS_STATS_CIPHERS
+} dtls_stats_cipher_t;
+
+/** The handshake phases whose durations are recorded in dtls_stats_t. */
+typedef enum {
+  DTLS_PHASE_COOKIE = 0,	/**< client: from ClientHello to HelloVerifyRequest */
+  DTLS_PHASE_SERVER_HELLO,	/**< server: creating the ServerHello flight */
+  DTLS_PHASE_KEY_BLOCK,		/**< computing the master secret and keys */
+  DTLS_PHASE_FINISHED,		/**< verifying the peer's Finished message */
+  DTLS_PHASES
+} dtls_phase_t;
+
+#ifndef DTLS_HISTOGRAM_BUCKETS
+/** Number of buckets in a dtls_histogram_t. */
+#define DTLS_HISTOGRAM_BUCKETS 32
+#endif /* DTLS_HISTOGRAM_BUCKETS */
+
+/**
+ * Distribution of durations in microseconds. Bucket 0 counts
+ * durations below 2us, bucket i counts durations from 2^i to
+ * 2^(i+1)-1us. The last bucket also counts all longer durations.
+ */
+typedef struct {
+  uint64_t count;		/**< number of recorded durations */
+  uint64_t sum;			/**< sum of all durations in microseconds */
+  uint64_t buckets[DTLS_HISTOGRAM_BUCKETS];
+} dtls_histogram_t;
+
+/**
+ * Counters of a DTLS context, see dtls_get_stats(). The arrays
+ * records_in and records_out are indexed by the content type minus
+ * DTLS_CT_CHANGE_CIPHER_SPEC, the handshake counters by
+ * dtls_stats_cipher_t and phases by dtls_phase_t. All members must
+ * consist of uint64_t only.
+ */
+typedef struct {
+  uint64_t records_in[DTLS_STATS_CONTENT_TYPES]; /**< records received */
+  uint64_t records_out[DTLS_STATS_CONTENT_TYPES]; /**< records sent */
+  uint64_t bytes_in;		/**< size of all received datagrams */
+  uint64_t bytes_out;		/**< size of all sent records */
+  uint64_t decrypt_failures;	/**< records that could not be decrypted */
+  uint64_t replays;		/**< duplicates dropped by the replay window */
+  uint64_t hello_verify_requests; /**< HelloVerifyRequests sent */
+  uint64_t handshakes_started;	/**< handshakes started as client or server */
+  uint64_t handshakes_completed[DTLS_STATS_CIPHERS];
+  uint64_t handshakes_failed[DTLS_STATS_CIPHERS];
+  uint64_t retransmissions;	/**< flights that have been retransmitted */
+  uint64_t write_errors;	/**< datagrams that could not be sent */
+  uint64_t peers;		/**< current number of peers */
+  dtls_histogram_t phases[DTLS_PHASES]; /**< handshake phase durations */
+} dtls_stats_t;
 
 /** Holds global information of the DTLS engine. */
 typedef struct dtls_context_t {
   unsigned char cookie_secret[DTLS_COOKIE_SECRET_LENGTH];
   clock_time_t cookie_secret_age; /**< the time the secret has been generated */
-
-  dtls_peer_t *peers;		/**< peer hash map */
+  dtls_hmac_key_t cookie_key;	/**< cookie_secret prepared for HMAC */
+
+#ifdef DTLS_PEERS_NOHASH
+  dtls_peer_t *peers;		/**< peer list */
+#else /* DTLS_PEERS_NOHASH */
+  dtls_peer_table_t peers;	/**< peer hash table */
+  dtls_peer_t *cid_peers[DTLS_CID_BUCKETS]; /**< peers by own_cid */
+#endif /* DTLS_PEERS_NOHASH */
+  unsigned int peers_generation; /**< changes when peers are added or removed */
+  dtls_cache_t *cache;		/**< sessions that can be resumed, or NULL */
+  dtls_ticket_keys_t ticket_keys; /**< keys for session tickets we issue */
+#if DTLS_SESSION_TICKETS
+  int tickets;			/**< see dtls_set_session_tickets() */
+#endif /* DTLS_SESSION_TICKETS */
 #ifdef WITH_CONTIKI
   struct etimer retransmit_timer; /**< fires when the next packet must be sent */
 #endif /* WITH_CONTIKI */
 
-  struct netq_t *sendqueue;     /**< the packets to send */
+  netq_wheel_t sendqueue;	/**< the packets to retransmit */
+  size_t flight_limit;		/**< see dtls_set_flight_limit() */
 
   void *app;			/**< application-specific data */
 
   dtls_handler_t *h;		/**< callback handlers */
 
+#if DTLS_STATS
+  dtls_stats_t stats;		/**< counters, see dtls_get_stats() */
+#endif /* DTLS_STATS */
+
+  /** greater than zero while output is collected, see dtls_output_begin() */
+  int output_active;
+
+  /**
+   * The ClientHello that dtls_handle_messages() is handling and its
+   * cookie if it has been created in advance, or NULL.
+   */
+  const uint8 *hello;
+  const uint8 *hello_cookie;
+
+  /**
+   * Handshake records that are packed into a single datagram while
+   * output is collected. The datagram is sent when the next record
+   * does not fit into the peer's MTU or when collecting stops.
+   */
+  struct {
+    session_t session;		/**< destination of the datagram */
+    size_t mtu;			/**< maximum size of the datagram */
+    size_t length;		/**< number of bytes used in data */
+    uint8 data[DTLS_MAX_BUF];
+  } packed;
+
+#ifndef WITH_CONTIKI
+  dtls_write_batch_t write_batch; /**< output for h->write_batch */
+#endif /* WITH_CONTIKI */
+
   unsigned char readbuf[DTLS_MAX_BUF];
 } dtls_context_t;
 
@@ -244,6 +411,83 @@ dtls_context_t *dtls_new_context(void *app_data);
 /** Releases any storage that has been allocated for \p ctx. */
 void dtls_free_context(dtls_context_t *ctx);
 
+/**
+ * Sets the key that protects the session tickets issued by @p ctx.
+ * Servers that use the same key accept each other's tickets. The
+ * previous key remains valid for tickets that have been issued
+ * before, so the key should be replaced regularly. Without a key
+ * set by the application, a random key is generated and replaced
+ * every DTLS_TICKET_LIFETIME seconds.
+ *
+ * @param ctx  The DTLS context to use.
+ * @param name A public name that identifies @p key.
+ * @param key  The secret AES-128 key.
+ * @return @c 0 on success, less than zero otherwise.
+ */
+int dtls_set_ticket_key(dtls_context_t *ctx,
+			const unsigned char name[DTLS_TICKET_KEY_NAME_LENGTH],
+			const unsigned char key[DTLS_TICKET_KEY_LENGTH]);
+
+/**
+ * Enables or disables session tickets for @p ctx. A client with
+ * tickets disabled does not send the SessionTicket extension, so that
+ * the server resumes its sessions from the server's session cache. A
+ * server with tickets disabled does not issue tickets. Tickets are
+ * enabled by default unless tinydtls is built with
+ * DTLS_SESSION_TICKETS set to 0, in which case this function has no
+ * effect.
+ *
+ * @param ctx    The DTLS context to use.
+ * @param enable @c 1 to use session tickets, @c 0 otherwise.
+ */
+void dtls_set_session_tickets(dtls_context_t *ctx, int enable);
+
+/**
+ * Limits the number of bytes of a flight that @p ctx keeps for
+ * retransmission in a single buffer with a single timer. Messages
+ * that would exceed the limit are kept and retransmitted separately,
+ * each with its own timer. The first message of a flight is never
+ * split. A @p limit of @c 0 removes the limit, which is the default.
+ * On Contiki, a buffer holds at most DTLS_MAX_BUF bytes in any case.
+ *
+ * @param ctx   The DTLS context to use.
+ * @param limit The maximum number of bytes, or @c 0.
+ */
+void dtls_set_flight_limit(dtls_context_t *ctx, size_t limit);
+
+/**
+ * Copies the counters of @p ctx to @p stats. The counters are
+ * updated by the thread that handles the messages of @p ctx. They
+ * can be read from any thread at any time without synchronization
+ * with that thread. Each counter is read atomically, but counters
+ * that change together may be copied before and after an update.
+ * All counters are zero if the library has been built with
+ * DTLS_STATS set to 0.
+ *
+ * @param ctx   The DTLS context to read.
+ * @param stats The result.
+ */
+void dtls_get_stats(const dtls_context_t *ctx, dtls_stats_t *stats);
+
+/**
+ * Returns the index of the bucket of a dtls_histogram_t that counts
+ * @p duration microseconds.
+ */
+unsigned int dtls_histogram_bucket(uint64_t duration);
+
+/**
+ * Estimates a quantile of the durations in @p histogram. The result
+ * is the upper end of the bucket that holds the quantile, e.g. a
+ * @p permille of 990 yields an upper bound of the 99th percentile.
+ *
+ * @param histogram The histogram to read, e.g. from dtls_get_stats().
+ * @param permille  The quantile in parts per thousand, at most 1000.
+ * @return The duration in microseconds, or @c 0 if @p histogram is
+ *         empty.
+ */
+uint64_t dtls_histogram_quantile(const dtls_histogram_t *histogram,
+				 unsigned int permille);
+
 #define dtls_set_app_data(CTX,DATA) ((CTX)->app = (DATA))
 #define dtls_get_app_data(CTX) ((CTX)->app)
 
@@ -264,6 +508,32 @@ static inline void dtls_set_handler(dtls_context_t *ctx, dtls_handler_t *h) {
  */
 int dtls_connect(dtls_context_t *ctx, const session_t *dst);
 
+/**
+ * Removes the peer for @p session from @p ctx without closing the
+ * session, e.g. to move it to a context that runs on a different
+ * thread with dtls_attach_peer(). Pending retransmissions for the
+ * peer are dropped. The caller takes over the returned peer object
+ * and must either attach it to a context or release it with
+ * dtls_free_peer().
+ *
+ * @param ctx     The DTLS context that currently holds the peer.
+ * @param session The peer's session.
+ * @return The detached peer or @c NULL if not found.
+ */
+dtls_peer_t *dtls_detach_peer(dtls_context_t *ctx, const session_t *session);
+
+/**
+ * Adds a @p peer that has been detached with dtls_detach_peer() to
+ * @p ctx. From now on, records for this peer must be passed to
+ * dtls_handle_message() for @p ctx.
+ *
+ * @param ctx  The DTLS context to take over the peer.
+ * @param peer The detached peer.
+ * @return @c 0 on success, or a value less than zero when @p ctx
+ *         already has a peer for the same session or on error.
+ */
+int dtls_attach_peer(dtls_context_t *ctx, dtls_peer_t *peer);
+
 /**
  * Establishes a DTLS channel with the specified remote peer.
  * This function returns @c 0 if that channel already exists, a value
@@ -315,6 +585,7 @@ void dtls_check_retransmit(dtls_context_t *context, clock_time_t *next);
 #define DTLS_CT_ALERT              21
 #define DTLS_CT_HANDSHAKE          22
 #define DTLS_CT_APPLICATION_DATA   23
+#define DTLS_CT_TLS12_CID          25 /* see RFC 9146 */
 
 /** Generic header structure of the DTLS record layer. */
 typedef struct __attribute__((__packed__)) {
@@ -332,6 +603,7 @@ typedef struct __attribute__((__packed__)) {
 #define DTLS_HT_CLIENT_HELLO         1
 #define DTLS_HT_SERVER_HELLO         2
 #define DTLS_HT_HELLO_VERIFY_REQUEST 3
+#define DTLS_HT_NEW_SESSION_TICKET   4
 #define DTLS_HT_CERTIFICATE         11
 #define DTLS_HT_SERVER_KEY_EXCHANGE 12
 #define DTLS_HT_CERTIFICATE_REQUEST 13
@@ -392,6 +664,51 @@ int dtls_record_read(dtls_state_t *state, uint8 *msg, int msglen);
 int dtls_handle_message(dtls_context_t *ctx, session_t *session,
 			uint8 *msg, int msglen);
 
+#ifndef DTLS_MESSAGES_BATCH
+/** Number of datagrams that dtls_handle_messages() groups by peer. */
+#ifdef WITH_CONTIKI
+#define DTLS_MESSAGES_BATCH 4
+#else /* WITH_CONTIKI */
+#define DTLS_MESSAGES_BATCH 64
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_MESSAGES_BATCH */
+
+/**
+ * A single received datagram for dtls_handle_messages(). The fields
+ * session, msg and msglen must be set by the caller, result is
+ * filled in by dtls_handle_messages().
+ */
+typedef struct {
+  session_t *session;		/**< the sender of this datagram */
+  uint8 *msg;			/**< the received data */
+  int msglen;			/**< the actual length of msg */
+  int result;			/**< the result of handling this datagram */
+} dtls_message_t;
+
+/**
+ * Handles a batch of received datagrams, e.g. as returned by
+ * recvmmsg(). Each entry in @p msgs is processed like a call to
+ * dtls_handle_message(), and the result of handling the datagram is
+ * stored in its @c result field. @p msgs is processed in groups of
+ * DTLS_MESSAGES_BATCH datagrams. Within a group, datagrams from the
+ * same peer are processed back to back in the order they were
+ * received, so the peer is looked up only once for all of them.
+ * The order of datagrams from different peers is not preserved.
+ *
+ * Unlike dtls_handle_message(), the output for all datagrams is
+ * collected and sent once after the last one has been handled.
+ * Errors while sending it do not change any @c result or the return
+ * value; they are only counted in @c write_errors of dtls_stats_t.
+ *
+ * @param ctx   The dtls context to use.
+ * @param msgs  The received datagrams.
+ * @param count The number of elements in @p msgs.
+ * @return The number of datagrams that have been handled without
+ *         error.
+ */
+int dtls_handle_messages(dtls_context_t *ctx, dtls_message_t *msgs,
+			 size_t count);
+
 /**
  * Check if @p session is associated with a peer object in @p context.
  * This function returns a pointer to the peer if found, NULL otherwise.
@@ -431,8 +748,8 @@ void dtls_reset_peer(dtls_context_t *context, dtls_peer_t *peer);
  * 
  * @subsection uthash UTHash
  *
- * This library uses <a href="http://uthash.sourceforge.net/">uthash</a> to manage
- * its peers (not used for Contiki). @b uthash uses the <b>BSD revised license</b>, see
+ * This library uses the list macros from <a href="http://uthash.sourceforge.net/">uthash</a>
+ * for its queues and, on Contiki, its peers. @b uthash uses the <b>BSD revised license</b>, see
  * <a href="http://uthash.sourceforge.net/license.html">http://uthash.sourceforge.net/license.html</a>.
  *
  * @subsection sha256 Aaron D. Gifford's SHA256 Implementation
@@ -39,7 +39,7 @@
 #define min(a,b) ((a) < (b) ? (a) : (b))
 #endif
 
-static int maxlog = DTLS_LOG_WARN;	/* default maximum log level */
+int dtls_maxlog = DTLS_LOG_WARN;	/* default maximum log level */
 
 const char *dtls_package_name() {
   return PACKAGE_NAME;
@@ -51,15 +51,15 @@ const char *dtls_package_version() {
 
 log_t 
 dtls_get_log_level() {
-  return maxlog;
+  return dtls_maxlog;
 }
 
 void
 dtls_set_log_level(log_t level) {
 #ifdef NDEBUG
-  maxlog = min(level, DTLS_LOG_INFO);
+  dtls_maxlog = min(level, DTLS_LOG_INFO);
 #else /* !NDEBUG */
-  maxlog = level;
+  dtls_maxlog = level;
 #endif /* NDEBUG */
 }
 
@@ -93,6 +93,145 @@ print_timestamp(char *s, size_t len, clock_time_t t) {
 
 #endif /* HAVE_TIME_H */
 
+#if !defined(WITH_CONTIKI) && defined(__GNUC__)
+#define LOG_RING 1
+
+/* A slot of the log ring. The slots form a bounded multi-producer
+ * queue: seq equals the position of the slot when it is free for the
+ * producer at that position, and position + 1 when it holds a message
+ * for the consumer. */
+typedef struct {
+  size_t seq;
+  time_t time;
+  log_t level;
+  char text[DTLS_LOG_RING_ENTRY_SIZE];
+} log_slot_t;
+
+static log_slot_t *log_ring;	/* NULL while the ring is disabled */
+static size_t log_ring_mask;
+static size_t log_ring_head;	/* next position to write */
+static size_t log_ring_tail;	/* next position to read */
+static unsigned long log_ring_lost;
+
+int
+dtls_log_ring_enable(size_t entries) {
+  log_slot_t *ring;
+  size_t size = 2, i;
+
+  if (__atomic_load_n(&log_ring, __ATOMIC_ACQUIRE))
+    return -1;
+
+  while (size < entries)
+    size <<= 1;
+
+  ring = (log_slot_t *)malloc(size * sizeof(log_slot_t));
+  if (!ring)
+    return -1;
+
+  for (i = 0; i < size; i++)
+    ring[i].seq = i;
+  log_ring_mask = size - 1;
+  __atomic_store_n(&log_ring, ring, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Returns the slot for a new message at *pos, or NULL if the ring
+ * is full. The message is passed on by log_ring_commit(). */
+static log_slot_t *
+log_ring_reserve(log_slot_t *ring, log_t level, size_t *pos) {
+  size_t p = __atomic_load_n(&log_ring_head, __ATOMIC_RELAXED);
+  size_t seq;
+  log_slot_t *slot;
+
+  for (;;) {
+    slot = &ring[p & log_ring_mask];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == p) {
+      if (__atomic_compare_exchange_n(&log_ring_head, &p, p + 1, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	break;
+    } else if ((long)(seq - p) < 0) {
+      __atomic_fetch_add(&log_ring_lost, 1, __ATOMIC_RELAXED);
+      return NULL;
+    } else {
+      p = __atomic_load_n(&log_ring_head, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->time = time(NULL);
+  slot->level = level;
+  *pos = p;
+  return slot;
+}
+
+static inline void
+log_ring_commit(log_slot_t *slot, size_t pos) {
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+size_t
+dtls_log_ring_drain(void) {
+  static char timebuf[32];
+  log_slot_t *ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+  log_slot_t *slot;
+  size_t n = 0;
+  FILE *log_fd;
+
+  if (!ring)
+    return 0;
+
+  for (;;) {
+    slot = &ring[log_ring_tail & log_ring_mask];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log_ring_tail + 1)
+      break;
+
+    log_fd = slot->level <= DTLS_LOG_CRIT ? stderr : stdout;
+    if (print_timestamp(timebuf, sizeof(timebuf), slot->time))
+      fprintf(log_fd, "%s ", timebuf);
+    if (slot->level <= DTLS_LOG_DEBUG)
+      fprintf(log_fd, "%s ", loglevels[slot->level]);
+    fputs(slot->text, log_fd);
+
+    /* hand the slot back to the producers */
+    __atomic_store_n(&slot->seq, log_ring_tail + log_ring_mask + 1,
+		     __ATOMIC_RELEASE);
+    log_ring_tail++;
+    n++;
+  }
+
+  if (n) {
+    fflush(stdout);
+    fflush(stderr);
+  }
+  return n;
+}
+
+unsigned long
+dtls_log_ring_dropped(void) {
+  return __atomic_load_n(&log_ring_lost, __ATOMIC_RELAXED);
+}
+
+#else /* !WITH_CONTIKI && __GNUC__ */
+
+int
+dtls_log_ring_enable(size_t entries) {
+  (void)entries;
+  return -1;
+}
+
+size_t
+dtls_log_ring_drain(void) {
+  return 0;
+}
+
+unsigned long
+dtls_log_ring_dropped(void) {
+  return 0;
+}
+
+#endif /* !WITH_CONTIKI && __GNUC__ */
+
 #ifndef NDEBUG
 
 /** 
@@ -211,9 +350,31 @@ dsrv_log(log_t level, char *format, ...) {
   va_list ap;
   FILE *log_fd;
 
-  if (maxlog < (int)level)
+  if (dtls_maxlog < (int)level)
     return;
 
+#ifdef LOG_RING
+  {
+    log_slot_t *ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+    log_slot_t *slot;
+    size_t pos;
+
+    if (ring) {
+      slot = log_ring_reserve(ring, level, &pos);
+      if (slot) {
+	va_start(ap, format);
+	/* a truncated message keeps its line break */
+	if (vsnprintf(slot->text, sizeof(slot->text), format, ap)
+	    >= (int)sizeof(slot->text))
+	  slot->text[sizeof(slot->text) - 2] = '\n';
+	va_end(ap);
+	log_ring_commit(slot, pos);
+      }
+      return;
+    }
+  }
+#endif /* LOG_RING */
+
   log_fd = level <= DTLS_LOG_CRIT ? stderr : stdout;
 
   if (print_timestamp(timebuf,sizeof(timebuf), time(NULL)))
@@ -233,7 +394,7 @@ dsrv_log(log_t level, char *format, ...) {
   static char timebuf[32];
   va_list ap;
 
-  if (maxlog < level)
+  if (dtls_maxlog < (int)level)
     return;
 
   if (print_timestamp(timebuf,sizeof(timebuf), clock_time()))
@@ -280,6 +441,9 @@ void dtls_dsrv_log_addr(log_t level, const char *name, const session_t *addr)
   char addrbuf[73];
   int len;
 
+  if (!dtls_log_enabled(level))
+    return;
+
   len = dsrv_print_addr(addr, addrbuf, sizeof(addrbuf));
   if (!len)
     return;
@@ -293,9 +457,33 @@ dtls_dsrv_hexdump_log(log_t level, const char *name, const unsigned char *buf, s
   FILE *log_fd;
   int n = 0;
 
-  if (maxlog < (int)level)
+  if (dtls_maxlog < (int)level)
     return;
 
+#ifdef LOG_RING
+  {
+    log_slot_t *ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+    log_slot_t *slot;
+    size_t pos, used, room = DTLS_LOG_RING_ENTRY_SIZE - 1;
+
+    /* the dump is written as a single line and truncated to the slot */
+    if (ring) {
+      slot = log_ring_reserve(ring, level, &pos);
+      if (slot) {
+	used = snprintf(slot->text, room, "%s: (%zu bytes): ", name, length);
+	if (used > room - 1)
+	  used = room - 1;
+	while (length-- && used + 2 < room)
+	  used += snprintf(slot->text + used, 3, "%02X", *buf++);
+	slot->text[used++] = '\n';
+	slot->text[used] = '\0';
+	log_ring_commit(slot, pos);
+      }
+      return;
+    }
+  }
+#endif /* LOG_RING */
+
   log_fd = level <= DTLS_LOG_CRIT ? stderr : stdout;
 
   if (print_timestamp(timebuf, sizeof(timebuf), time(NULL)))
@@ -336,7 +524,7 @@ dtls_dsrv_hexdump_log(log_t level, const char *name, const unsigned char *buf, s
   static char timebuf[32];
   int n = 0;
 
-  if (maxlog < level)
+  if (dtls_maxlog < (int)level)
     return;
 
   if (print_timestamp(timebuf,sizeof(timebuf), clock_time()))
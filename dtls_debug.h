@@ -57,6 +57,30 @@ typedef enum { DTLS_LOG_EMERG=0, DTLS_LOG_ALERT, DTLS_LOG_CRIT, DTLS_LOG_WARN,
        DTLS_LOG_NOTICE, DTLS_LOG_INFO, DTLS_LOG_DEBUG
 } log_t;
 
+#ifndef DTLS_MAX_LOG_LEVEL
+/**
+ * Messages with a level above this value are removed at compile
+ * time, i.e., their arguments are not even evaluated. The value must
+ * be a number as it is used by the preprocessor, e.g. 3 to keep
+ * DTLS_LOG_WARN and more severe messages only.
+ */
+#ifdef NDEBUG
+#define DTLS_MAX_LOG_LEVEL 5	/* DTLS_LOG_INFO */
+#else /* NDEBUG */
+#define DTLS_MAX_LOG_LEVEL 6	/* DTLS_LOG_DEBUG */
+#endif /* NDEBUG */
+#endif /* DTLS_MAX_LOG_LEVEL */
+
+/** The current log level, use dtls_set_log_level() to change it. */
+extern int dtls_maxlog;
+
+/**
+ * Returns true if messages of @p level are output. This is checked
+ * before the arguments of a message are evaluated.
+ */
+#define dtls_log_enabled(level)						\
+  ((int)(level) <= DTLS_MAX_LOG_LEVEL && (int)(level) <= dtls_maxlog)
+
 /** Returns a zero-terminated string with the name of this library. */
 const char *dtls_package_name(void);
 
@@ -108,15 +132,64 @@ dtls_dsrv_log_addr(log_t level, const char *name, const session_t *addr)
 
 #endif /* NDEBUG */
 
+/**
+ * The log ring is an optional sink for the log messages. When it is
+ * enabled, dsrv_log() only formats the message into a free slot of
+ * the ring. Writing the messages to stdout and stderr is left to
+ * dtls_log_ring_drain(), which the application calls from a thread
+ * of its own. Messages that find the ring full are dropped, so that
+ * logging never waits for I/O. The ring is available on POSIX
+ * systems with GCC-style atomic builtins.
+ */
+#ifndef DTLS_LOG_RING_ENTRY_SIZE
+/** Size of a slot in the log ring. Longer messages are truncated. */
+#define DTLS_LOG_RING_ENTRY_SIZE 256
+#endif /* DTLS_LOG_RING_ENTRY_SIZE */
+
+/**
+ * Enables the log ring with at least @p entries slots. This must be
+ * called before other threads start logging and can be done only once.
+ *
+ * @param entries The number of slots, rounded up to a power of two.
+ * @return @c 0 on success, or less than zero if the ring is not
+ *         available, already enabled or cannot be allocated.
+ */
+int dtls_log_ring_enable(size_t entries);
+
+/**
+ * Writes the messages in the log ring to stdout and stderr. This
+ * function may run concurrently with the logging threads, but not
+ * with itself.
+ *
+ * @return The number of messages written.
+ */
+size_t dtls_log_ring_drain(void);
+
+/** Returns the number of messages that were dropped as the ring was full. */
+unsigned long dtls_log_ring_dropped(void);
+
 /* A set of convenience macros for common log levels. */
-#define dtls_emerg(...) dsrv_log(DTLS_LOG_EMERG, __VA_ARGS__)
-#define dtls_alert(...) dsrv_log(DTLS_LOG_ALERT, __VA_ARGS__)
-#define dtls_crit(...) dsrv_log(DTLS_LOG_CRIT, __VA_ARGS__)
-#define dtls_warn(...) dsrv_log(DTLS_LOG_WARN, __VA_ARGS__)
-#define dtls_notice(...) dsrv_log(DTLS_LOG_NOTICE, __VA_ARGS__)
-#define dtls_info(...) dsrv_log(DTLS_LOG_INFO, __VA_ARGS__)
-#define dtls_debug(...) dsrv_log(DTLS_LOG_DEBUG, __VA_ARGS__)
-#define dtls_debug_hexdump(name, buf, length) dtls_dsrv_hexdump_log(DTLS_LOG_DEBUG, name, buf, length, 1)
-#define dtls_debug_dump(name, buf, length) dtls_dsrv_hexdump_log(DTLS_LOG_DEBUG, name, buf, length, 0)
+#define dtls_log(level, ...)					\
+  do {								\
+    if (dtls_log_enabled(level))				\
+      dsrv_log(level, __VA_ARGS__);				\
+  } while (0)
+#define dtls_emerg(...) dtls_log(DTLS_LOG_EMERG, __VA_ARGS__)
+#define dtls_alert(...) dtls_log(DTLS_LOG_ALERT, __VA_ARGS__)
+#define dtls_crit(...) dtls_log(DTLS_LOG_CRIT, __VA_ARGS__)
+#define dtls_warn(...) dtls_log(DTLS_LOG_WARN, __VA_ARGS__)
+#define dtls_notice(...) dtls_log(DTLS_LOG_NOTICE, __VA_ARGS__)
+#define dtls_info(...) dtls_log(DTLS_LOG_INFO, __VA_ARGS__)
+#define dtls_debug(...) dtls_log(DTLS_LOG_DEBUG, __VA_ARGS__)
+#define dtls_debug_hexdump(name, buf, length)				\
+  do {									\
+    if (dtls_log_enabled(DTLS_LOG_DEBUG))				\
+      dtls_dsrv_hexdump_log(DTLS_LOG_DEBUG, name, buf, length, 1);	\
+  } while (0)
+#define dtls_debug_dump(name, buf, length)				\
+  do {									\
+    if (dtls_log_enabled(DTLS_LOG_DEBUG))				\
+      dtls_dsrv_hexdump_log(DTLS_LOG_DEBUG, name, buf, length, 0);	\
+  } while (0)
 
 #endif /* _DTLS_DEBUG_H_ */
@@ -36,6 +36,11 @@ dtls_ticks(dtls_tick_t *t) {
   *t = clock_time();
 }
 
+void
+dtls_usecs(uint64_t *t) {
+  *t = (uint64_t)clock_time() * 1000000 / CLOCK_SECOND;
+}
+
 #else /* WITH_CONTIKI */
 
 time_t dtls_clock_offset;
@@ -65,6 +70,16 @@ void dtls_ticks(dtls_tick_t *t) {
 #endif
 }
 
+void dtls_usecs(uint64_t *t) {
+#ifdef HAVE_SYS_TIME_H
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  *t = (uint64_t)(tv.tv_sec - dtls_clock_offset) * 1000000 + tv.tv_usec;
+#else
+#error "clock not implemented"
+#endif
+}
+
 #endif /* WITH_CONTIKI */
 
 
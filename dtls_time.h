@@ -52,9 +52,22 @@ typedef clock_time_t dtls_tick_t;
 #define DTLS_TICKS_PER_SECOND CLOCK_SECOND
 #endif /* DTLS_TICKS_PER_SECOND */
 
+#ifdef WITH_CONTIKI
+extern clock_time_t dtls_clock_offset;
+#else /* WITH_CONTIKI */
+/** The Unix time when dtls_clock_init() has been called. */
+extern time_t dtls_clock_offset;
+#endif /* WITH_CONTIKI */
+
 void dtls_clock_init(void);
 void dtls_ticks(dtls_tick_t *t);
 
+/**
+ * Sets @p t to the current time in microseconds. This clock is used
+ * for measuring short durations, its origin is unspecified.
+ */
+void dtls_usecs(uint64_t *t);
+
 /** @} */
 
 #endif /* _DTLS_DTLS_TIME_H_ */
@@ -693,7 +693,7 @@ int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e,
 	uint32_t tmp1_y[8];
 	uint32_t tmp2_x[8];
 	uint32_t tmp2_y[8];
-	uint32_t tmp3_x[8];
+	uint32_t tmp3_x[9];	/* fieldModO() writes 9 words */
 	uint32_t tmp3_y[8];
 
 	// 3. Calculate w = s^{-1} \pmod{n}
@@ -0,0 +1,423 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "tinydtls.h"
+#include "global.h"
+#include "numeric.h"
+#include "gcm.h"
+
+#ifdef DTLS_GCM_CLMUL
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#endif /* DTLS_GCM_CLMUL */
+
+/** Number of counter blocks that are encrypted at once. */
+#define GCM_BATCH RIJNDAEL_MAX_BLOCKS
+
+static inline uint64_t
+get_be64(const unsigned char *p) {
+  return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
+    | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+    | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
+    | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+static inline void
+put_be64(unsigned char *p, uint64_t v) {
+  int i;
+
+  for (i = 7; i >= 0; i--, v >>= 8)
+    p[i] = v & 0xff;
+}
+
+/*
+ * The table-driven GHASH multiplies by H four bits at a time, see
+ * Shoup's method in the GCM specification. last4[] holds the
+ * reduction of the four bits that are shifted out.
+ */
+static const uint64_t last4[16] = {
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static void
+ghash_table_init(dtls_ghash_key_t *key, const unsigned char H[DTLS_GCM_BLOCKSIZE]) {
+  uint64_t vh, vl;
+  int i, j;
+
+  vh = get_be64(H);
+  vl = get_be64(H + 8);
+
+  key->hh[0] = key->hl[0] = 0;
+  key->hh[8] = vh;
+  key->hl[8] = vl;
+
+  for (i = 4; i > 0; i >>= 1) {
+    uint64_t t = (vl & 1) * 0xe100000000000000ULL;
+    vl = (vh << 63) | (vl >> 1);
+    vh = (vh >> 1) ^ t;
+    key->hh[i] = vh;
+    key->hl[i] = vl;
+  }
+
+  for (i = 2; i <= 8; i *= 2) {
+    for (j = 1; j < i; j++) {
+      key->hh[i + j] = key->hh[i] ^ key->hh[j];
+      key->hl[i + j] = key->hl[i] ^ key->hl[j];
+    }
+  }
+}
+
+/* X = X * H */
+static void
+ghash_table_mult(const dtls_ghash_key_t *key, unsigned char X[DTLS_GCM_BLOCKSIZE]) {
+  uint64_t zh, zl;
+  unsigned char lo, hi, rem;
+  int i;
+
+  lo = X[15] & 0x0f;
+  zh = key->hh[lo];
+  zl = key->hl[lo];
+
+  for (i = 15; i >= 0; i--) {
+    lo = X[i] & 0x0f;
+    hi = X[i] >> 4;
+
+    if (i != 15) {
+      rem = zl & 0x0f;
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ (last4[rem] << 48);
+      zh ^= key->hh[lo];
+      zl ^= key->hl[lo];
+    }
+
+    rem = zl & 0x0f;
+    zl = (zh << 60) | (zl >> 4);
+    zh = (zh >> 4) ^ (last4[rem] << 48);
+    zh ^= key->hh[hi];
+    zl ^= key->hl[hi];
+  }
+
+  put_be64(X, zh);
+  put_be64(X + 8, zl);
+}
+
+#ifdef DTLS_GCM_CLMUL
+static int clmul_support;
+
+static int
+clmul_available(void) {
+  unsigned int eax, ebx, ecx, edx;
+  int support = __atomic_load_n(&clmul_support, __ATOMIC_RELAXED);
+
+  if (!support) {
+    support = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+	       (ecx & bit_PCLMUL) && (ecx & bit_SSSE3)) ? 1 : -1;
+    __atomic_store_n(&clmul_support, support, __ATOMIC_RELAXED);
+  }
+  return support > 0;
+}
+
+#define CLMUL_TARGET __attribute__((target("pclmul,ssse3,sse2")))
+
+/* Reverses the byte order of a block, GHASH is defined big-endian. */
+CLMUL_TARGET static inline __m128i
+clmul_bswap(__m128i x) {
+  return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					  8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/* Adds the 256-bit carry-less product a * b to (lo, hi). */
+CLMUL_TARGET static inline void
+clmul_acc(__m128i a, __m128i b, __m128i *lo, __m128i *hi) {
+  __m128i t0, t1, t2;
+
+  t0 = _mm_clmulepi64_si128(a, b, 0x00);
+  t1 = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+		     _mm_clmulepi64_si128(a, b, 0x01));
+  t2 = _mm_clmulepi64_si128(a, b, 0x11);
+
+  *lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+  *hi = _mm_xor_si128(*hi, _mm_xor_si128(t2, _mm_srli_si128(t1, 8)));
+}
+
+/*
+ * Reduces the product (lo, hi) modulo the GHASH polynomial. As the
+ * bits are reflected, the product is shifted left by one bit
+ * first. This follows Gueron and Kounavis, "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing the GCM
+ * Mode".
+ */
+CLMUL_TARGET static inline __m128i
+clmul_reduce(__m128i lo, __m128i hi) {
+  __m128i t7, t8, t9, t2, t4, t5;
+
+  t7 = _mm_srli_epi32(lo, 31);
+  t8 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  lo = _mm_or_si128(lo, t7);
+  hi = _mm_or_si128(hi, t8);
+  hi = _mm_or_si128(hi, t9);
+
+  t7 = _mm_slli_epi32(lo, 31);
+  t8 = _mm_slli_epi32(lo, 30);
+  t9 = _mm_slli_epi32(lo, 25);
+  t7 = _mm_xor_si128(t7, t8);
+  t7 = _mm_xor_si128(t7, t9);
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  lo = _mm_xor_si128(lo, t7);
+
+  t2 = _mm_srli_epi32(lo, 1);
+  t4 = _mm_srli_epi32(lo, 2);
+  t5 = _mm_srli_epi32(lo, 7);
+  t2 = _mm_xor_si128(t2, t4);
+  t2 = _mm_xor_si128(t2, t5);
+  t2 = _mm_xor_si128(t2, t8);
+  lo = _mm_xor_si128(lo, t2);
+  return _mm_xor_si128(hi, lo);
+}
+
+CLMUL_TARGET static inline __m128i
+clmul_mult(__m128i a, __m128i b) {
+  __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+  clmul_acc(a, b, &lo, &hi);
+  return clmul_reduce(lo, hi);
+}
+
+CLMUL_TARGET static void
+ghash_clmul_init(dtls_ghash_key_t *key, const unsigned char H[DTLS_GCM_BLOCKSIZE]) {
+  __m128i h, hn;
+  int i;
+
+  h = clmul_bswap(_mm_loadu_si128((const __m128i *)H));
+  hn = h;
+  _mm_storeu_si128((__m128i *)key->hpow[0], h);
+  for (i = 1; i < 4; i++) {
+    hn = clmul_mult(hn, h);
+    _mm_storeu_si128((__m128i *)key->hpow[i], hn);
+  }
+}
+
+/*
+ * Hashes n blocks. Four blocks are multiplied with H^4 .. H^1 and
+ * summed up before a single reduction.
+ */
+CLMUL_TARGET static void
+ghash_clmul(const dtls_ghash_key_t *key, unsigned char X[DTLS_GCM_BLOCKSIZE],
+	    const unsigned char *p, size_t n) {
+  __m128i x, lo, hi;
+  __m128i h1 = _mm_loadu_si128((const __m128i *)key->hpow[0]);
+
+  x = clmul_bswap(_mm_loadu_si128((const __m128i *)X));
+
+  if (n >= 4) {
+    __m128i h2 = _mm_loadu_si128((const __m128i *)key->hpow[1]);
+    __m128i h3 = _mm_loadu_si128((const __m128i *)key->hpow[2]);
+    __m128i h4 = _mm_loadu_si128((const __m128i *)key->hpow[3]);
+
+    for (; n >= 4; n -= 4, p += 4 * DTLS_GCM_BLOCKSIZE) {
+      lo = hi = _mm_setzero_si128();
+      clmul_acc(_mm_xor_si128(x, clmul_bswap(_mm_loadu_si128((const __m128i *)p))),
+		h4, &lo, &hi);
+      clmul_acc(clmul_bswap(_mm_loadu_si128((const __m128i *)(p + 16))),
+		h3, &lo, &hi);
+      clmul_acc(clmul_bswap(_mm_loadu_si128((const __m128i *)(p + 32))),
+		h2, &lo, &hi);
+      clmul_acc(clmul_bswap(_mm_loadu_si128((const __m128i *)(p + 48))),
+		h1, &lo, &hi);
+      x = clmul_reduce(lo, hi);
+    }
+  }
+
+  for (; n; n--, p += DTLS_GCM_BLOCKSIZE)
+    x = clmul_mult(_mm_xor_si128(x, clmul_bswap(_mm_loadu_si128((const __m128i *)p))),
+		   h1);
+
+  _mm_storeu_si128((__m128i *)X, clmul_bswap(x));
+}
+#endif /* DTLS_GCM_CLMUL */
+
+/**
+ * Updates the GHASH state \p X with \p len bytes from \p p. A
+ * partial last block is padded with zeroes, hence only the last
+ * call for the additional data or the ciphertext may pass a length
+ * that is not a multiple of DTLS_GCM_BLOCKSIZE.
+ */
+static void
+ghash(const dtls_ghash_key_t *key, unsigned char X[DTLS_GCM_BLOCKSIZE],
+      const unsigned char *p, size_t len) {
+  unsigned char last[DTLS_GCM_BLOCKSIZE];
+  size_t n = len / DTLS_GCM_BLOCKSIZE;
+
+  if (len % DTLS_GCM_BLOCKSIZE) {
+    memset(last, 0, sizeof(last));
+    memcpy(last, p + n * DTLS_GCM_BLOCKSIZE, len % DTLS_GCM_BLOCKSIZE);
+  }
+
+#ifdef DTLS_GCM_CLMUL
+  if (key->clmul) {
+    ghash_clmul(key, X, p, n);
+    if (len % DTLS_GCM_BLOCKSIZE)
+      ghash_clmul(key, X, last, 1);
+    return;
+  }
+#endif /* DTLS_GCM_CLMUL */
+
+  for (; n; n--, p += DTLS_GCM_BLOCKSIZE) {
+    memxor(X, p, DTLS_GCM_BLOCKSIZE);
+    ghash_table_mult(key, X);
+  }
+
+  if (len % DTLS_GCM_BLOCKSIZE) {
+    memxor(X, last, DTLS_GCM_BLOCKSIZE);
+    ghash_table_mult(key, X);
+  }
+}
+
+void
+dtls_gcm_init(dtls_ghash_key_t *key, rijndael_ctx *ctx) {
+  unsigned char H[DTLS_GCM_BLOCKSIZE];
+
+  memset(H, 0, sizeof(H));
+  rijndael_encrypt(ctx, H, H);
+
+  ghash_table_init(key, H);
+#ifdef DTLS_GCM_CLMUL
+  key->clmul = clmul_available();
+  if (key->clmul)
+    ghash_clmul_init(key, H);
+#endif /* DTLS_GCM_CLMUL */
+
+  memset(H, 0, sizeof(H));
+}
+
+/**
+ * Encrypts the counter blocks for the next \p len bytes of the
+ * message starting with \p counter and XORs them to \p msg. If \p
+ * tag is not NULL, E(J_0) is calculated in the same batch.
+ */
+static void
+gcm_ctr(rijndael_ctx *ctx, const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+	uint32_t counter, unsigned char *msg, size_t len,
+	unsigned char tag[DTLS_GCM_BLOCKSIZE]) {
+  unsigned char in[GCM_BATCH * DTLS_GCM_BLOCKSIZE];
+  unsigned char out[GCM_BATCH * DTLS_GCM_BLOCKSIZE];
+  size_t w = (len + DTLS_GCM_BLOCKSIZE - 1) / DTLS_GCM_BLOCKSIZE;
+  size_t i, n = w;
+
+  for (i = 0; i < w; i++) {
+    memcpy(in + i * DTLS_GCM_BLOCKSIZE, nonce, DTLS_GCM_NONCE_SIZE);
+    dtls_int_to_uint32(in + i * DTLS_GCM_BLOCKSIZE + DTLS_GCM_NONCE_SIZE,
+		       counter + i);
+  }
+  if (tag) {
+    memcpy(in + n * DTLS_GCM_BLOCKSIZE, nonce, DTLS_GCM_NONCE_SIZE);
+    dtls_int_to_uint32(in + n * DTLS_GCM_BLOCKSIZE + DTLS_GCM_NONCE_SIZE, 1);
+    n++;
+  }
+
+  rijndael_encrypt_blocks(ctx, in, out, n);
+
+  memxor(msg, out, len);
+  if (tag)
+    memcpy(tag, out + w * DTLS_GCM_BLOCKSIZE, DTLS_GCM_BLOCKSIZE);
+}
+
+/* Processes the message in batches, where ghash_first tells whether
+ * the GHASH is calculated before (decrypt) or after (encrypt) the
+ * key stream is applied. */
+static void
+gcm_crypt(rijndael_ctx *ctx, const dtls_ghash_key_t *key,
+	  const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+	  unsigned char *msg, size_t lm,
+	  const unsigned char *aad, size_t la,
+	  int ghash_first, unsigned char tag[DTLS_GCM_BLOCKSIZE]) {
+  unsigned char X[DTLS_GCM_BLOCKSIZE];
+  unsigned char S0[DTLS_GCM_BLOCKSIZE];
+  unsigned char lengths[DTLS_GCM_BLOCKSIZE];
+  uint32_t counter = 2;		/* counter 1 is J_0 for the tag */
+  size_t n, total = lm;
+  int have_s0 = 0;
+
+  memset(X, 0, sizeof(X));
+  ghash(key, X, aad, la);
+
+  while (lm) {
+    n = min(GCM_BATCH * DTLS_GCM_BLOCKSIZE - (have_s0 ? 0 : DTLS_GCM_BLOCKSIZE),
+	    lm);
+
+    if (ghash_first)
+      ghash(key, X, msg, n);
+
+    gcm_ctr(ctx, nonce, counter, msg, n, have_s0 ? NULL : S0);
+    have_s0 = 1;
+
+    if (!ghash_first)
+      ghash(key, X, msg, n);
+
+    counter += n / DTLS_GCM_BLOCKSIZE;
+    msg += n;
+    lm -= n;
+  }
+
+  if (!have_s0)
+    gcm_ctr(ctx, nonce, counter, msg, 0, S0);
+
+  put_be64(lengths, (uint64_t)la * 8);
+  put_be64(lengths + 8, (uint64_t)total * 8);
+  ghash(key, X, lengths, sizeof(lengths));
+
+  memcpy(tag, X, DTLS_GCM_BLOCKSIZE);
+  memxor(tag, S0, DTLS_GCM_BLOCKSIZE);
+}
+
+long int
+dtls_gcm_encrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *key,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la) {
+  gcm_crypt(ctx, key, nonce, msg, lm, aad, la, 0, msg + lm);
+  return lm + DTLS_GCM_TAG_SIZE;
+}
+
+long int
+dtls_gcm_decrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *key,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la) {
+  unsigned char tag[DTLS_GCM_BLOCKSIZE];
+
+  if (lm < DTLS_GCM_TAG_SIZE)
+    return -1;
+
+  lm -= DTLS_GCM_TAG_SIZE;
+  gcm_crypt(ctx, key, nonce, msg, lm, aad, la, 1, tag);
+
+  /* return length if the tag is valid */
+  if (equals(tag, msg + lm, DTLS_GCM_TAG_SIZE))
+    return lm;
+
+  return -1;
+}
@@ -0,0 +1,83 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#ifndef _DTLS_GCM_H_
+#define _DTLS_GCM_H_
+
+#include <stdint.h>
+
+#include "aes/rijndael.h"
+
+/* implementation of the Galois/Counter Mode, NIST SP 800-38D */
+
+#define DTLS_GCM_BLOCKSIZE  16	/**< size of GHASH blocks */
+#define DTLS_GCM_TAG_SIZE   16	/**< size of the authentication tag */
+#define DTLS_GCM_NONCE_SIZE 12	/**< size of nonce */
+
+/* Use PCLMULQDQ for GHASH on x86 when the CPU supports it. Define
+ * DTLS_GCM_NO_CLMUL to build the table-driven code only. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(DTLS_GCM_NO_CLMUL)
+#define DTLS_GCM_CLMUL 1
+#endif
+
+/**
+ * The GHASH key derived from an AES key schedule. The table holds
+ * the multiples of H for the 4-bit method from Shoup, the powers of
+ * H are used for the PCLMULQDQ code that reduces four products at
+ * once.
+ */
+typedef struct {
+  uint64_t hl[16];		/**< low halves of i * H */
+  uint64_t hh[16];		/**< high halves of i * H */
+#ifdef DTLS_GCM_CLMUL
+  int clmul;			/**< use PCLMULQDQ with hpow */
+  unsigned char hpow[4][DTLS_GCM_BLOCKSIZE]; /**< H^1..H^4, byte-reversed */
+#endif /* DTLS_GCM_CLMUL */
+} dtls_ghash_key_t;
+
+/**
+ * Derives the GHASH key for the AES key schedule in \p ctx.
+ */
+void dtls_gcm_init(dtls_ghash_key_t *key, rijndael_ctx *ctx);
+
+/**
+ * Encrypts the \p lm bytes in \p msg in place and appends the
+ * DTLS_GCM_TAG_SIZE bytes authentication tag over \p aad and the
+ * ciphertext. \p msg must provide space for the tag.
+ *
+ * \return The length of the ciphertext including the tag.
+ */
+long int
+dtls_gcm_encrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *key,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la);
+
+/**
+ * Decrypts the \p lm bytes in \p msg in place, where the last
+ * DTLS_GCM_TAG_SIZE bytes are the authentication tag.
+ *
+ * \return The length of the plaintext, or \c -1 if the tag could not
+ *         be verified.
+ */
+long int
+dtls_gcm_decrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *key,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la);
+
+#endif /* _DTLS_GCM_H_ */
@@ -19,6 +19,7 @@
 #define _DTLS_GLOBAL_H_
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "tinydtls.h"
@@ -57,6 +58,12 @@ typedef unsigned char uint48[6];
 #endif /* WITH_CONTIKI */
 #endif
 
+#ifndef DTLS_DEFAULT_MTU
+/** Default size limit for datagrams that carry packed handshake
+    records. This can be changed per peer in dtls_peer_t.mtu. */
+#define DTLS_DEFAULT_MTU DTLS_MAX_BUF
+#endif
+
 #ifndef DTLS_DEFAULT_MAX_RETRANSMIT
 /** Number of message retransmissions. */
 #define DTLS_DEFAULT_MAX_RETRANSMIT 7
@@ -66,7 +73,11 @@ typedef unsigned char uint48[6];
 typedef enum { 
   TLS_NULL_WITH_NULL_NULL = 0x0000,   /**< NULL cipher  */
   TLS_PSK_WITH_AES_128_CCM_8 = 0xC0A8, /**< see RFC 6655 */
-  TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 = 0xC0AE /**< see RFC 7251 */
+  TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 = 0xC0AE, /**< see RFC 7251 */
+  TLS_PSK_WITH_AES_128_GCM_SHA256 = 0x00A8, /**< see RFC 5487 */
+  TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256 = 0xC02B, /**< see RFC 5289 */
+  TLS_PSK_WITH_CHACHA20_POLY1305_SHA256 = 0xCCAB, /**< see RFC 7905 */
+  TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 = 0xCCA9 /**< see RFC 7905 */
 } dtls_cipher_t;
 
 /** Known compression suites.*/
@@ -80,6 +91,8 @@ typedef enum {
 #define TLS_EXT_CLIENT_CERTIFICATE_TYPE	19 /* see RFC 7250 */
 #define TLS_EXT_SERVER_CERTIFICATE_TYPE	20 /* see RFC 7250 */
 #define TLS_EXT_ENCRYPT_THEN_MAC	22 /* see RFC 7366 */
+#define TLS_EXT_SESSION_TICKET		35 /* see RFC 5077 */
+#define TLS_EXT_CONNECTION_ID		54 /* see RFC 9146 */
 
 #define TLS_CERT_TYPE_RAW_PUBLIC_KEY	2 /* see RFC 7250 */
 
@@ -95,10 +108,23 @@ typedef enum {
 #define TLS_EXT_SIG_HASH_ALGO_ECDSA		3 /* see RFC 5246 */
 
 /** 
- * XORs \p n bytes byte-by-byte starting at \p y to the memory area
- * starting at \p x. */
+ * XORs \p n bytes starting at \p y to the memory area starting at
+ * \p x. Except for Contiki, where the word size is small anyway, this
+ * is done one machine word at a time. The memcpy() calls are turned
+ * into plain (unaligned) loads and stores by the compiler. */
 static inline void
 memxor(unsigned char *x, const unsigned char *y, size_t n) {
+#ifndef WITH_CONTIKI
+  unsigned long a, b;
+
+  while (n >= sizeof(unsigned long)) {
+    memcpy(&a, x, sizeof(a));
+    memcpy(&b, y, sizeof(b));
+    a ^= b;
+    memcpy(x, &a, sizeof(a));
+    x += sizeof(a); y += sizeof(b); n -= sizeof(a);
+  }
+#endif /* WITH_CONTIKI */
   while(n--) {
     *x ^= *y;
     x++; y++;
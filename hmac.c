@@ -84,31 +84,59 @@ dtls_hmac_new(const unsigned char *key, size_t klen) {
   return ctx;
 }
 
-void
-dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen) {
+/* Sets inner and outer to the hash states after the ipad and the
+ * opad for the secret key. */
+static void
+dtls_hmac_setup(dtls_hash_ctx *inner, dtls_hash_ctx *outer,
+		const unsigned char *key, size_t klen) {
+  unsigned char pad[DTLS_HMAC_BLOCKSIZE];
   int i;
 
-  assert(ctx);
-
-  memset(ctx, 0, sizeof(dtls_hmac_context_t));
+  memset(pad, 0, sizeof(pad));
 
   if (klen > DTLS_HMAC_BLOCKSIZE) {
-    dtls_hash_init(&ctx->data);
-    dtls_hash_update(&ctx->data, key, klen);
-    dtls_hash_finalize(ctx->pad, &ctx->data);
+    dtls_hash_init(inner);
+    dtls_hash_update(inner, key, klen);
+    dtls_hash_finalize(pad, inner);
   } else
-    memcpy(ctx->pad, key, klen);
+    memcpy(pad, key, klen);
 
   /* create ipad: */
   for (i=0; i < DTLS_HMAC_BLOCKSIZE; ++i)
-    ctx->pad[i] ^= 0x36;
+    pad[i] ^= 0x36;
 
-  dtls_hash_init(&ctx->data);
-  dtls_hmac_update(ctx, ctx->pad, DTLS_HMAC_BLOCKSIZE);
+  dtls_hash_init(inner);
+  dtls_hash_update(inner, pad, DTLS_HMAC_BLOCKSIZE);
 
   /* create opad by xor-ing pad[i] with 0x36 ^ 0x5C: */
   for (i=0; i < DTLS_HMAC_BLOCKSIZE; ++i)
-    ctx->pad[i] ^= 0x6A;
+    pad[i] ^= 0x6A;
+
+  dtls_hash_init(outer);
+  dtls_hash_update(outer, pad, DTLS_HMAC_BLOCKSIZE);
+
+  memset(pad, 0, sizeof(pad));
+}
+
+void
+dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen) {
+  assert(ctx);
+  dtls_hmac_setup(&ctx->data, &ctx->outer, key, klen);
+}
+
+void
+dtls_hmac_key_init(dtls_hmac_key_t *key,
+		   const unsigned char *secret, size_t klen) {
+  assert(key);
+  dtls_hmac_setup(&key->inner, &key->outer, secret, klen);
+}
+
+void
+dtls_hmac_init_key(dtls_hmac_context_t *ctx, const dtls_hmac_key_t *key) {
+  assert(ctx);
+  assert(key);
+  memcpy(&ctx->data, &key->inner, sizeof(dtls_hash_ctx));
+  memcpy(&ctx->outer, &key->outer, sizeof(dtls_hash_ctx));
 }
 
 void
@@ -127,8 +155,7 @@ dtls_hmac_finalize(dtls_hmac_context_t *ctx, unsigned char *result) {
   
   len = dtls_hash_finalize(buf, &ctx->data);
 
-  dtls_hash_init(&ctx->data);
-  dtls_hash_update(&ctx->data, ctx->pad, DTLS_HMAC_BLOCKSIZE);
+  memcpy(&ctx->data, &ctx->outer, sizeof(dtls_hash_ctx));
   dtls_hash_update(&ctx->data, buf, len);
 
   len = dtls_hash_finalize(result, &ctx->data);
@@ -136,6 +163,55 @@ dtls_hmac_finalize(dtls_hmac_context_t *ctx, unsigned char *result) {
   return len;
 }
 
+void
+dtls_hmac_update_multi(dtls_hmac_context_t **ctx,
+		       const unsigned char **input, const size_t *ilen,
+		       unsigned int n) {
+  dtls_hash_t h[DTLS_HASH_LANES];
+  unsigned int i, k;
+
+  for (i = 0; i < n; i += k) {
+    for (k = 0; k < DTLS_HASH_LANES && i + k < n; k++) {
+      assert(ctx[i + k]);
+      h[k] = &ctx[i + k]->data;
+    }
+    dtls_hash_update_multi(h, input + i, ilen + i, k);
+  }
+}
+
+int
+dtls_hmac_finalize_multi(dtls_hmac_context_t **ctx,
+			 unsigned char **result, unsigned int n) {
+  unsigned char buf[DTLS_HASH_LANES][DTLS_HMAC_DIGEST_SIZE];
+  unsigned char *inner[DTLS_HASH_LANES];
+  const unsigned char *input[DTLS_HASH_LANES];
+  size_t len[DTLS_HASH_LANES];
+  dtls_hash_t h[DTLS_HASH_LANES];
+  unsigned int i, k;
+
+  for (i = 0; i < n; i += k) {
+    for (k = 0; k < DTLS_HASH_LANES && i + k < n; k++) {
+      assert(ctx[i + k]);
+      assert(result[i + k]);
+      h[k] = &ctx[i + k]->data;
+      inner[k] = buf[k];
+    }
+
+    dtls_hash_finalize_multi(inner, h, k);
+
+    for (k = 0; k < DTLS_HASH_LANES && i + k < n; k++) {
+      memcpy(h[k], &ctx[i + k]->outer, sizeof(dtls_hash_ctx));
+      input[k] = buf[k];
+      len[k] = DTLS_HMAC_DIGEST_SIZE;
+    }
+    dtls_hash_update_multi(h, input, len, k);
+
+    dtls_hash_finalize_multi(result + i, h, k);
+  }
+
+  return DTLS_HMAC_DIGEST_SIZE;
+}
+
 #ifdef HMAC_TEST
 #include <stdio.h>
 
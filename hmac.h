@@ -47,6 +47,21 @@ dtls_hash_finalize(unsigned char *buf, dtls_hash_t ctx) {
   dtls_sha256_final(buf, (dtls_sha256_ctx *)ctx);
   return DTLS_SHA256_DIGEST_LENGTH;
 }
+
+/** The number of messages that are hashed in parallel */
+#define DTLS_HASH_LANES DTLS_SHA256_LANES
+
+static inline void
+dtls_hash_update_multi(dtls_hash_t *ctx, const unsigned char **input,
+		       const size_t *len, unsigned int n) {
+  dtls_sha256_update_multi(ctx, input, len, n);
+}
+
+static inline void
+dtls_hash_finalize_multi(unsigned char **buf, dtls_hash_t *ctx,
+			 unsigned int n) {
+  dtls_sha256_final_multi(buf, ctx, n);
+}
 #endif /* WITH_SHA256 */
 
 void dtls_hmac_storage_init(void);
@@ -81,10 +96,21 @@ typedef enum {
  * the structure can be used again. 
  */
 typedef struct {
-  unsigned char pad[DTLS_HMAC_BLOCKSIZE]; /**< ipad and opad storage */
-  dtls_hash_ctx data;		          /**< context for hash function */
+  dtls_hash_ctx data;		/**< context for hash function */
+  dtls_hash_ctx outer;		/**< hash state after the opad */
 } dtls_hmac_context_t;
 
+/**
+ * A secret key for HMAC that is used for more than one message. It
+ * holds the hash states after the ipad and the opad have been
+ * hashed, so that dtls_hmac_init_key() only needs to copy them
+ * instead of hashing both pads again.
+ */
+typedef struct {
+  dtls_hash_ctx inner;		/**< hash state after the ipad */
+  dtls_hash_ctx outer;		/**< hash state after the opad */
+} dtls_hmac_key_t;
+
 /**
  * Initializes an existing HMAC context. 
  *
@@ -94,6 +120,26 @@ typedef struct {
  */
 void dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen);
 
+/**
+ * Prepares @p key for use with dtls_hmac_init_key().
+ *
+ * @param key    The HMAC key to initialize.
+ * @param secret The secret key.
+ * @param klen   The length of @p secret.
+ */
+void dtls_hmac_key_init(dtls_hmac_key_t *key,
+			const unsigned char *secret, size_t klen);
+
+/**
+ * Initializes an existing HMAC context with a key that has been
+ * prepared by dtls_hmac_key_init(). The result is the same as
+ * calling dtls_hmac_init() with the secret key.
+ *
+ * @param ctx The HMAC context to initialize.
+ * @param key The HMAC key.
+ */
+void dtls_hmac_init_key(dtls_hmac_context_t *ctx, const dtls_hmac_key_t *key);
+
 /**
  * Allocates a new HMAC context \p ctx with the given secret key.
  * This function returns \c 1 if \c ctx has been set correctly, or \c
@@ -137,6 +183,33 @@ void dtls_hmac_update(dtls_hmac_context_t *ctx,
  */
 int dtls_hmac_finalize(dtls_hmac_context_t *ctx, unsigned char *result);
 
+/**
+ * Updates each of the @p n HMAC contexts in @p ctx with the data
+ * from the corresponding entry of @p input. This has the same result
+ * as calling dtls_hmac_update() for each context, but independent
+ * messages are hashed in parallel where the CPU supports it.
+ *
+ * \param ctx    The HMAC contexts.
+ * \param input  The input data for each context.
+ * \param ilen   The size of each entry in @p input.
+ * \param n      The number of contexts.
+ */
+void dtls_hmac_update_multi(dtls_hmac_context_t **ctx,
+			    const unsigned char **input, const size_t *ilen,
+			    unsigned int n);
+
+/**
+ * Completes the @p n HMAC contexts in @p ctx like dtls_hmac_finalize()
+ * and writes the results to the corresponding entries of @p result.
+ *
+ * \param ctx    The HMAC contexts.
+ * \param result The result buffers, each at least DTLS_HMAC_MAX bytes.
+ * \param n      The number of contexts.
+ * \return The number of bytes written to each buffer.
+ */
+int dtls_hmac_finalize_multi(dtls_hmac_context_t **ctx,
+			     unsigned char **result, unsigned int n);
+
 /**@}*/
 
 #endif /* _DTLS_HMAC_H_ */
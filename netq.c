@@ -17,6 +17,7 @@
 
 #include "dtls_debug.h"
 #include "netq.h"
+#include "pool.h"
 #include "utlist.h"
 
 #ifdef HAVE_ASSERT_H
@@ -31,6 +32,76 @@
 #ifndef WITH_CONTIKI
 #include <stdlib.h>
 
+#ifdef DTLS_POOL
+/* Nodes are taken from a pool for one of three sizes of their data.
+ * Larger nodes are allocated with malloc(). node->pool is the index
+ * of the pool in netq_pool_sizes, or 0 for malloc(). */
+static const size_t netq_pool_sizes[] = { 0, 128, 512, DTLS_MAX_BUF };
+
+DTLS_POOL_DEFINE(netq_pool_small, sizeof(netq_t) + 128);
+DTLS_POOL_DEFINE(netq_pool_medium, sizeof(netq_t) + 512);
+DTLS_POOL_DEFINE(netq_pool_large, sizeof(netq_t) + DTLS_MAX_BUF);
+
+static inline unsigned char
+netq_pool_index(size_t size) {
+  unsigned char i;
+
+  for (i = 1; i < sizeof(netq_pool_sizes) / sizeof(netq_pool_sizes[0]); i++) {
+    if (size <= netq_pool_sizes[i])
+      return i;
+  }
+  return 0;
+}
+
+static dtls_pool_t *
+netq_pool(unsigned char index) {
+  switch (index) {
+  case 1: return &netq_pool_small;
+  case 2: return &netq_pool_medium;
+  case 3: return &netq_pool_large;
+  default: return NULL;
+  }
+}
+
+static inline netq_t *
+netq_malloc_node(size_t size) {
+  unsigned char index = netq_pool_index(size);
+
+  if (index)
+    return (netq_t *)dtls_pool_alloc(netq_pool(index));
+  return (netq_t *)malloc(sizeof(netq_t) + size);
+}
+
+static inline void
+netq_free_node(netq_t *node) {
+  if (node->pool)
+    dtls_pool_free(netq_pool(node->pool), node);
+  else
+    free(node);
+}
+
+static inline netq_t *
+netq_realloc_node(netq_t *node, size_t size) {
+  netq_t *p;
+
+  /* nodes from malloc() are never moved to a pool */
+  if (!node->pool)
+    return (netq_t *)realloc(node, sizeof(netq_t) + size);
+
+  if (size <= netq_pool_sizes[node->pool])
+    return node;
+
+  p = netq_malloc_node(size);
+  if (!p)
+    return NULL;
+
+  memcpy(p, node, sizeof(netq_t) + netq_pool_sizes[node->pool]);
+  p->pool = netq_pool_index(size);
+  netq_free_node(node);
+  return p;
+}
+
+#else /* DTLS_POOL */
 static inline netq_t *
 netq_malloc_node(size_t size) {
   return (netq_t *)malloc(sizeof(netq_t) + size);
@@ -41,6 +112,12 @@ netq_free_node(netq_t *node) {
   free(node);
 }
 
+static inline netq_t *
+netq_realloc_node(netq_t *node, size_t size) {
+  return (netq_t *)realloc(node, sizeof(netq_t) + size);
+}
+#endif /* DTLS_POOL */
+
 #else /* WITH_CONTIKI */
 #include "memb.h"
 
@@ -56,6 +133,11 @@ netq_free_node(netq_t *node) {
   memb_free(&netq_storage, node);
 }
 
+static inline netq_t *
+netq_realloc_node(netq_t *node, size_t size) {
+  return size <= sizeof(netq_packet_t) ? node : NULL;
+}
+
 void
 netq_init() {
   memb_init(&netq_storage);
@@ -118,6 +200,12 @@ netq_t *netq_pop_first(netq_t **queue) {
 netq_t *
 netq_node_new(size_t size) {
   netq_t *node;
+
+#ifdef WITH_CONTIKI
+  if (size > sizeof(netq_packet_t))
+    return NULL;
+#endif /* WITH_CONTIKI */
+
   node = netq_malloc_node(size);
 
 #ifndef NDEBUG
@@ -125,12 +213,38 @@ netq_node_new(size_t size) {
     dtls_warn("netq_node_new: malloc\n");
 #endif
 
-  if (node)
+  if (node) {
     memset(node, 0, sizeof(netq_t));
+#ifdef DTLS_POOL
+    node->pool = netq_pool_index(size);
+#endif /* DTLS_POOL */
+  }
 
   return node;
 }
 
+netq_t *
+netq_node_resize(netq_t *node, size_t size) {
+  netq_t *p;
+
+  assert(node);
+
+  p = netq_realloc_node(node, size);
+  if (!p || p == node)
+    return p;
+
+  if (p->pprev)
+    *p->pprev = p;
+  if (p->next && p->pprev)
+    p->next->pprev = &p->next;
+  if (p->peer_pprev)
+    *p->peer_pprev = p;
+  if (p->peer_next)
+    p->peer_next->peer_pprev = &p->peer_next;
+
+  return p;
+}
+
 void 
 netq_node_free(netq_t *node) {
   if (node)
@@ -148,3 +262,214 @@ netq_delete_all(netq_t **queue) {
     *queue = NULL;
   }
 }
+
+#define NETQ_WHEEL_INDEX(T) \
+  (((T) / NETQ_WHEEL_RESOLUTION) & (NETQ_WHEEL_SLOTS - 1))
+
+#define NETQ_WHEEL_USED(Wheel, I) \
+  ((Wheel)->used[(I) / 32] & ((uint32_t)1 << ((I) % 32)))
+
+/**
+ * Returns the index of the first used slot at or after @p i, or
+ * NETQ_WHEEL_SLOTS when there is none. Slots whose lists have become
+ * empty are marked unused on the way.
+ */
+static unsigned int
+netq_wheel_find_used(netq_wheel_t *wheel, unsigned int i) {
+  uint32_t bits;
+
+  while (i < NETQ_WHEEL_SLOTS) {
+    bits = wheel->used[i / 32] >> (i % 32);
+    if (!bits) {
+      i += 32 - i % 32;
+    } else if (!(bits & 1)) {
+      i++;
+    } else if (!wheel->slots[i]) {
+      wheel->used[i / 32] &= ~((uint32_t)1 << (i % 32));
+      i++;
+    } else {
+      return i;
+    }
+  }
+  return NETQ_WHEEL_SLOTS;
+}
+
+void
+netq_wheel_insert(netq_wheel_t *wheel, netq_t *node) {
+  unsigned int i;
+  netq_t **slot;
+
+  assert(wheel);
+  assert(node);
+
+  /* nodes that are overdue go to the slot at the cursor */
+  i = NETQ_WHEEL_INDEX(node->t < wheel->base ? wheel->base : node->t);
+  slot = &wheel->slots[i];
+
+  if (!*slot || node->t < wheel->min[i])
+    wheel->min[i] = node->t;
+  wheel->used[i / 32] |= (uint32_t)1 << (i % 32);
+
+  node->next = *slot;
+  if (*slot)
+    (*slot)->pprev = &node->next;
+  node->pprev = slot;
+  *slot = node;
+
+  if (wheel->count++ == 0 || (wheel->next_valid && node->t < wheel->next)) {
+    wheel->next = node->t;
+    wheel->next_valid = 1;
+  }
+}
+
+void
+netq_wheel_remove(netq_wheel_t *wheel, netq_t *node) {
+  assert(wheel);
+  assert(node);
+  assert(node->pprev);
+
+  /* The slot stays marked as used and keeps its lower bound. Both
+   * are corrected when the slot is found empty or is walked. */
+  *node->pprev = node->next;
+  if (node->next)
+    node->next->pprev = node->pprev;
+  node->next = NULL;
+  node->pprev = NULL;
+
+  wheel->count--;
+  if (node->t == wheel->next)
+    wheel->next_valid = 0;
+}
+
+netq_t *
+netq_wheel_expire(netq_wheel_t *wheel, clock_time_t now) {
+  unsigned int steps, i;
+  clock_time_t min;
+  netq_t *p;
+
+  assert(wheel);
+
+  /* Advance the cursor slot by slot until it reaches now. After one
+   * full rotation, every slot has been checked for due nodes. */
+  for (steps = 0; wheel->count && steps < NETQ_WHEEL_SLOTS; steps++) {
+    i = NETQ_WHEEL_INDEX(wheel->base);
+    if (NETQ_WHEEL_USED(wheel, i)) {
+      p = wheel->slots[i];
+      if (!p)
+	wheel->used[i / 32] &= ~((uint32_t)1 << (i % 32));
+      for (min = p ? p->t : 0; p; p = p->next) {
+	if (p->t <= now) {
+	  netq_wheel_remove(wheel, p);
+	  return p;
+	}
+	if (p->t < min)
+	  min = p->t;
+      }
+      /* the whole slot has been walked, so its bound is exact now */
+      wheel->min[i] = min;
+    }
+
+    if (now - wheel->base < NETQ_WHEEL_RESOLUTION)
+      break;
+    wheel->base += NETQ_WHEEL_RESOLUTION;
+  }
+
+  if (steps == NETQ_WHEEL_SLOTS || !wheel->count)
+    wheel->base = now - now % NETQ_WHEEL_RESOLUTION;
+
+  /* No node is due, so a cached time-stamp up to now came from a
+   * lower bound that was too low. */
+  if (wheel->next_valid && wheel->next <= now)
+    wheel->next_valid = 0;
+  return NULL;
+}
+
+clock_time_t
+netq_wheel_next(netq_wheel_t *wheel) {
+  unsigned int cursor, i, k;
+  clock_time_t limit;
+  int found = 0;
+
+  assert(wheel);
+
+  if (!wheel->count)
+    return 0;
+
+  if (wheel->next_valid)
+    return wheel->next;
+
+  /* The first used slot from the cursor whose bound lies within the
+   * current rotation holds the earliest node. A slot whose bound lies
+   * in a later rotation holds no node of the current rotation. */
+  cursor = NETQ_WHEEL_INDEX(wheel->base);
+  for (k = 0; k < 2 && !found; k++) {
+    for (i = netq_wheel_find_used(wheel, k ? 0 : cursor);
+	 i < (k ? cursor : NETQ_WHEEL_SLOTS);
+	 i = netq_wheel_find_used(wheel, i + 1)) {
+      limit = wheel->base +
+	(((i - cursor) & (NETQ_WHEEL_SLOTS - 1)) + 1) * NETQ_WHEEL_RESOLUTION;
+      if (wheel->min[i] < limit) {
+	wheel->next = wheel->min[i];
+	found = 1;
+	break;
+      }
+    }
+  }
+
+  /* all nodes are due in later rotations */
+  for (i = netq_wheel_find_used(wheel, 0); !found && i < NETQ_WHEEL_SLOTS;
+       i = netq_wheel_find_used(wheel, i + 1)) {
+    if (!wheel->next_valid || wheel->min[i] < wheel->next) {
+      wheel->next = wheel->min[i];
+      wheel->next_valid = 1;
+    }
+  }
+
+  wheel->next_valid = 1;
+  return wheel->next;
+}
+
+void
+netq_peer_link(netq_t **list, netq_t *node) {
+  assert(list);
+  assert(node);
+
+  node->peer_next = *list;
+  if (*list)
+    (*list)->peer_pprev = &node->peer_next;
+  node->peer_pprev = list;
+  *list = node;
+}
+
+void
+netq_peer_unlink(netq_t *node) {
+  assert(node);
+
+  if (!node->peer_pprev)
+    return;
+
+  *node->peer_pprev = node->peer_next;
+  if (node->peer_next)
+    node->peer_next->peer_pprev = node->peer_pprev;
+  node->peer_next = NULL;
+  node->peer_pprev = NULL;
+}
+
+void
+netq_wheel_delete_all(netq_wheel_t *wheel) {
+  netq_t *p, *tmp;
+  unsigned int i;
+
+  assert(wheel);
+
+  for (i = 0; i < NETQ_WHEEL_SLOTS; i++) {
+    LL_FOREACH_SAFE(wheel->slots[i], p, tmp) {
+      netq_free_node(p);
+    }
+    wheel->slots[i] = NULL;
+  }
+  memset(wheel->used, 0, sizeof(wheel->used));
+
+  wheel->count = 0;
+  wheel->next_valid = 0;
+}
@@ -20,7 +20,7 @@
 
 #include "tinydtls.h"
 #include "global.h"
-#include "dtls.h"
+#include "peer.h"
 #include "dtls_time.h"
 
 /**
@@ -46,17 +46,19 @@ typedef unsigned char netq_packet_t[DTLS_MAX_BUF];
 
 typedef struct netq_t {
   struct netq_t *next;
+  struct netq_t **pprev;	/**< link to this node in a netq_wheel_t */
+  struct netq_t *peer_next;	/**< next node in peer->retransmit */
+  struct netq_t **peer_pprev;	/**< link to this node in peer->retransmit */
 
   clock_time_t t;	        /**< when to send PDU for the next time */
   unsigned int timeout;		/**< randomized timeout value */
 
   dtls_peer_t *peer;		/**< remote address */
-  uint16_t epoch;
-  uint8_t type;
   unsigned char retransmit_cnt;	/**< retransmission counter, will be removed when zero */
 
   size_t length;		/**< actual length of data */
 #ifndef WITH_CONTIKI
+  unsigned char pool;		/**< where the node has been allocated */
   unsigned char data[];		/**< the datagram to send */
 #else
   netq_packet_t data;		/**< the datagram to send */
@@ -91,6 +93,14 @@ void netq_delete_all(netq_t **queue);
 /** Creates a new node suitable for adding to a netq_t queue. */
 netq_t *netq_node_new(size_t size);
 
+/**
+ * Changes the space for data in @p node to @p size bytes. The node
+ * may be moved in memory; links from a netq_wheel_t and from the
+ * peer's list are updated. On error, @c NULL is returned and @p node
+ * is left unchanged.
+ */
+netq_t *netq_node_resize(netq_t *node, size_t size);
+
 /**
  * Returns a pointer to the first item in given queue or NULL if
  * empty. 
@@ -107,6 +117,85 @@ void netq_remove(netq_t **queue, netq_t *p);
  */
 netq_t *netq_pop_first(netq_t **queue);
 
+#ifndef NETQ_WHEEL_SLOTS
+#ifdef WITH_CONTIKI
+#define NETQ_WHEEL_SLOTS 8	/**< number of slots in netq_wheel_t */
+#else /* WITH_CONTIKI */
+#define NETQ_WHEEL_SLOTS 256	/**< number of slots in netq_wheel_t */
+#endif /* WITH_CONTIKI */
+#endif /* NETQ_WHEEL_SLOTS */
+
+#if (NETQ_WHEEL_SLOTS & (NETQ_WHEEL_SLOTS - 1)) != 0
+#error "NETQ_WHEEL_SLOTS must be a power of two"
+#endif
+
+#ifndef NETQ_WHEEL_RESOLUTION
+/** Time span covered by a single slot of netq_wheel_t. */
+#define NETQ_WHEEL_RESOLUTION ((CLOCK_SECOND + 15) / 16)
+#endif /* NETQ_WHEEL_RESOLUTION */
+
+/** Number of words in the bitmap of used slots of netq_wheel_t. */
+#define NETQ_WHEEL_WORDS ((NETQ_WHEEL_SLOTS + 31) / 32)
+
+/**
+ * A hashed timer wheel for nodes that must be handled at their
+ * time-stamp t. Each slot holds an unordered, doubly linked list of
+ * the nodes that are due within the slot's time span in the current
+ * or any later rotation of the wheel. Inserting and removing a node
+ * takes constant time.
+ *
+ * A bitmap marks the slots that hold nodes, and each such slot keeps
+ * a lower bound of its time-stamps. The bound becomes exact whenever
+ * netq_wheel_expire() walks the slot, so the earliest time-stamp is
+ * found from the bitmap and the bounds without walking any list. It
+ * is cached and only recalculated when the node that defines it has
+ * been removed.
+ *
+ * A netq_wheel_t must be initialized with zeros before use.
+ */
+typedef struct {
+  netq_t *slots[NETQ_WHEEL_SLOTS];
+  clock_time_t min[NETQ_WHEEL_SLOTS]; /**< lower bound of t in each slot */
+  uint32_t used[NETQ_WHEEL_WORDS]; /**< bit set for each slot in use */
+  clock_time_t base;		/**< start of the slot at the cursor */
+  clock_time_t next;		/**< earliest time-stamp if next_valid */
+  int next_valid;
+  size_t count;			/**< number of nodes in the wheel */
+} netq_wheel_t;
+
+/** Adds @p node to @p wheel to be handled at @p node->t. */
+void netq_wheel_insert(netq_wheel_t *wheel, netq_t *node);
+
+/** Removes @p node from @p wheel. */
+void netq_wheel_remove(netq_wheel_t *wheel, netq_t *node);
+
+/**
+ * Removes and returns a node from @p wheel whose time-stamp is not
+ * later than @p now. This function returns NULL when no node is due.
+ * Nodes that are due at the same time are returned in no particular
+ * order.
+ */
+netq_t *netq_wheel_expire(netq_wheel_t *wheel, clock_time_t now);
+
+/**
+ * Returns the earliest time-stamp of all nodes in @p wheel, or @c 0
+ * when @p wheel is empty. After nodes have been removed, the result
+ * may be earlier than the earliest remaining time-stamp, but never
+ * later. A caller that wakes up too early finds no node due in
+ * netq_wheel_expire(), which corrects the bound. This function does
+ * not walk the lists of the slots.
+ */
+clock_time_t netq_wheel_next(netq_wheel_t *wheel);
+
+/** Adds @p node to the list of nodes @p list of a single peer. */
+void netq_peer_link(netq_t **list, netq_t *node);
+
+/** Removes @p node from the list of its peer, if any. */
+void netq_peer_unlink(netq_t *node);
+
+/** Removes all nodes from @p wheel and frees the allocated storage. */
+void netq_wheel_delete_all(netq_wheel_t *wheel);
+
 /**@}*/
 
 #endif /* _DTLS_NETQ_H_ */
@@ -17,6 +17,7 @@
 
 #include "global.h"
 #include "peer.h"
+#include "pool.h"
 #include "dtls_debug.h"
 
 #ifndef WITH_CONTIKI
@@ -24,17 +25,36 @@ void peer_init(void)
 {
 }
 
+#ifdef DTLS_POOL
+DTLS_POOL_DEFINE(peer_pool, sizeof(dtls_peer_t));
+
+static inline dtls_peer_t *
+dtls_malloc_peer(void) {
+  return (dtls_peer_t *)dtls_pool_alloc(&peer_pool);
+}
+
+static inline void
+dtls_dealloc_peer(dtls_peer_t *peer) {
+  dtls_pool_free(&peer_pool, peer);
+}
+#else /* DTLS_POOL */
 static inline dtls_peer_t *
 dtls_malloc_peer(void) {
   return (dtls_peer_t *)malloc(sizeof(dtls_peer_t));
 }
 
+static inline void
+dtls_dealloc_peer(dtls_peer_t *peer) {
+  free(peer);
+}
+#endif /* DTLS_POOL */
+
 void
 dtls_free_peer(dtls_peer_t *peer) {
   dtls_handshake_free(peer->handshake_params);
   dtls_security_free(peer->security_params[0]);
   dtls_security_free(peer->security_params[1]);
-  free(peer);
+  dtls_dealloc_peer(peer);
 }
 #else /* WITH_CONTIKI */
 
@@ -68,6 +88,9 @@ dtls_new_peer(const session_t *session) {
   if (peer) {
     memset(peer, 0, sizeof(dtls_peer_t));
     memcpy(&peer->session, session, sizeof(session_t));
+    dtls_session_key(session, &peer->key);
+    peer->mtu = DTLS_DEFAULT_MTU;
+    peer->rto = DTLS_INITIAL_RTO;
     peer->security_params[0] = dtls_security_new();
 
     if (!peer->security_params[0]) {
@@ -80,3 +103,213 @@ dtls_new_peer(const session_t *session) {
 
   return peer;
 }
+
+void
+dtls_peer_rtt_sample(dtls_peer_t *peer, clock_time_t rtt) {
+  clock_time_t delta, rto;
+
+  if (!peer->srtt) {
+    peer->srtt = rtt ? rtt : 1;
+    peer->rttvar = rtt / 2;
+  } else {
+    delta = peer->srtt > rtt ? peer->srtt - rtt : rtt - peer->srtt;
+    peer->rttvar = peer->rttvar - peer->rttvar / 4 + delta / 4;
+    peer->srtt = peer->srtt - peer->srtt / 8 + rtt / 8;
+    if (!peer->srtt)
+      peer->srtt = 1;
+  }
+
+  /* RTO = SRTT + max(G, 4 * RTTVAR) with a clock granularity of 1 */
+  rto = peer->srtt + (peer->rttvar ? 4 * peer->rttvar : 1);
+  if (rto < DTLS_MIN_RTO)
+    rto = DTLS_MIN_RTO;
+  if (rto > DTLS_MAX_RTO)
+    rto = DTLS_MAX_RTO;
+  peer->rto = rto;
+}
+
+#ifndef DTLS_PEERS_NOHASH
+#ifndef DTLS_PEER_TABLE_MIN_SIZE
+/** Initial number of slots in a peer table. Must be a power of two. */
+#define DTLS_PEER_TABLE_MIN_SIZE 16
+#endif
+
+/** Number of old slots that are moved on each insert while resizing. */
+#define DTLS_PEER_TABLE_MOVE_STEP 16
+
+/** Marks a slot whose peer has been removed. */
+static dtls_peer_t dtls_peer_deleted;
+#define DELETED (&dtls_peer_deleted)
+
+/** Returns a free slot for @p hash in @p slots. */
+static dtls_peer_slot_t *
+slot_for_insert(dtls_peer_slot_t *slots, size_t size, uint32_t hash) {
+  size_t mask = size - 1, i = hash & mask;
+
+  while (slots[i].peer && slots[i].peer != DELETED)
+    i = (i + 1) & mask;
+  return &slots[i];
+}
+
+/** Returns the slot that holds @p peer or the peer with @p key. */
+static dtls_peer_slot_t *
+slot_lookup(dtls_peer_slot_t *slots, size_t size,
+	    const dtls_peer_key_t *key, const dtls_peer_t *peer,
+	    uint32_t hash) {
+  size_t mask = size - 1, i, n;
+
+  if (!slots)
+    return NULL;
+
+  for (i = hash & mask, n = 0; slots[i].peer && n < size;
+       i = (i + 1) & mask, n++) {
+    if (slots[i].hash == hash && slots[i].peer != DELETED &&
+	(peer ? slots[i].peer == peer
+	 : dtls_peer_key_equals(&slots[i].peer->key, key)))
+      return &slots[i];
+  }
+  return NULL;
+}
+
+/** Moves up to @p max slots from the old to the current array. */
+static void
+move_old_slots(dtls_peer_table_t *table, size_t max) {
+  dtls_peer_slot_t *old, *slot;
+
+  while (table->old_slots && max--) {
+    old = &table->old_slots[table->old_pos++];
+    if (old->peer && old->peer != DELETED) {
+      slot = slot_for_insert(table->slots, table->size, old->hash);
+      if (!slot->peer)
+	table->used++;
+      *slot = *old;
+      table->count++;
+      table->old_count--;
+
+      /* keep the probe sequences of the remaining old slots intact */
+      old->peer = DELETED;
+    }
+
+    if (table->old_pos == table->old_size) {
+      free(table->old_slots);
+      table->old_slots = NULL;
+      table->old_size = table->old_pos = 0;
+    }
+  }
+}
+
+/**
+ * Starts moving the peers to a new slot array. The array is doubled
+ * when at least half of the slots hold peers, otherwise it keeps its
+ * size and only gets rid of deleted slots.
+ */
+static int
+start_resize(dtls_peer_table_t *table) {
+  dtls_peer_slot_t *slots;
+  size_t size = table->size;
+
+  /* finish a pending resize before starting a new one */
+  move_old_slots(table, table->old_size);
+
+  if (!size)
+    size = DTLS_PEER_TABLE_MIN_SIZE;
+  else if ((table->count + 1) * 2 > size)
+    size *= 2;
+
+  slots = (dtls_peer_slot_t *)calloc(size, sizeof(dtls_peer_slot_t));
+  if (!slots)
+    return -1;
+
+  table->old_slots = table->slots;
+  table->old_size = table->size;
+  table->old_count = table->count;
+  table->old_pos = 0;
+  if (!table->old_slots)
+    table->old_size = 0;
+
+  table->slots = slots;
+  table->size = size;
+  table->count = table->used = 0;
+  return 0;
+}
+
+void
+dtls_peer_table_free(dtls_peer_table_t *table) {
+  free(table->slots);
+  free(table->old_slots);
+  memset(table, 0, sizeof(dtls_peer_table_t));
+}
+
+dtls_peer_t *
+dtls_peer_table_find(const dtls_peer_table_t *table,
+		     const dtls_peer_key_t *key, uint32_t hash) {
+  dtls_peer_slot_t *slot;
+
+  slot = slot_lookup(table->slots, table->size, key, NULL, hash);
+  if (!slot && table->old_slots)
+    slot = slot_lookup(table->old_slots, table->old_size, key, NULL, hash);
+
+  return slot ? slot->peer : NULL;
+}
+
+int
+dtls_peer_table_add(dtls_peer_table_t *table, dtls_peer_t *peer) {
+  dtls_peer_slot_t *slot;
+  uint32_t hash = dtls_peer_key_hash(&peer->key);
+
+  move_old_slots(table, DTLS_PEER_TABLE_MOVE_STEP);
+
+  /* keep the load factor including deleted slots below 3/4 */
+  if ((table->used + 1) * 4 > table->size * 3) {
+    if (start_resize(table) < 0) {
+      dtls_crit("cannot grow peer table\n");
+      return -1;
+    }
+    move_old_slots(table, DTLS_PEER_TABLE_MOVE_STEP);
+  }
+
+  slot = slot_for_insert(table->slots, table->size, hash);
+  if (!slot->peer)
+    table->used++;
+  slot->hash = hash;
+  slot->peer = peer;
+  table->count++;
+  return 0;
+}
+
+void
+dtls_peer_table_remove(dtls_peer_table_t *table, dtls_peer_t *peer) {
+  dtls_peer_slot_t *slot;
+  uint32_t hash = dtls_peer_key_hash(&peer->key);
+
+  slot = slot_lookup(table->slots, table->size, NULL, peer, hash);
+  if (slot) {
+    slot->peer = DELETED;
+    table->count--;
+    return;
+  }
+
+  slot = slot_lookup(table->old_slots, table->old_size, NULL, peer, hash);
+  if (slot) {
+    slot->peer = DELETED;
+    table->old_count--;
+  }
+}
+
+dtls_peer_t *
+dtls_peer_table_next(const dtls_peer_table_t *table, size_t *pos) {
+  dtls_peer_slot_t *slot;
+
+  while (*pos < table->old_size + table->size) {
+    if (*pos < table->old_size)
+      slot = &table->old_slots[*pos];
+    else
+      slot = &table->slots[*pos - table->old_size];
+    (*pos)++;
+
+    if (slot->peer && slot->peer != DELETED)
+      return slot->peer;
+  }
+  return NULL;
+}
+#endif /* DTLS_PEERS_NOHASH */
@@ -28,16 +28,49 @@
 #include "tinydtls.h"
 #include "global.h"
 #include "session.h"
+#include "dtls_time.h"
 
 #include "state.h"
 #include "crypto.h"
 
-#ifndef DTLS_PEERS_NOHASH
-#include "uthash.h"
-#endif /* DTLS_PEERS_NOHASH */
+#ifndef DTLS_INITIAL_RTO
+/** Retransmission timeout for peers without a round-trip time sample. */
+#define DTLS_INITIAL_RTO (2 * CLOCK_SECOND)
+#endif /* DTLS_INITIAL_RTO */
+
+#ifndef DTLS_MIN_RTO
+/** Lower bound for the retransmission timeout that is derived from
+    measured round-trip times. */
+#define DTLS_MIN_RTO (CLOCK_SECOND / 10)
+#endif /* DTLS_MIN_RTO */
+
+#ifndef DTLS_MAX_RTO
+/** Upper bound for the retransmission timeout including backoff. */
+#define DTLS_MAX_RTO (60 * CLOCK_SECOND)
+#endif /* DTLS_MAX_RTO */
+
+#ifndef DTLS_MSL
+/** Maximum segment lifetime. The last flight of a handshake is kept
+    for twice this time to answer retransmissions of the peer's last
+    flight (RFC 6347, section 4.2.4). */
+#define DTLS_MSL (120 * CLOCK_SECOND)
+#endif /* DTLS_MSL */
+
+#ifndef DTLS_CID_LENGTH
+/** Length of the connection ids that we ask our peers to send. */
+#define DTLS_CID_LENGTH 8
+#endif /* DTLS_CID_LENGTH */
+
+#ifndef DTLS_CID_MAX_LENGTH
+/** Longest connection id that we accept to send to a peer. Longer
+    connection ids are not negotiated. */
+#define DTLS_CID_MAX_LENGTH 16
+#endif /* DTLS_CID_MAX_LENGTH */
 
 typedef enum { DTLS_CLIENT=0, DTLS_SERVER } dtls_peer_type;
 
+struct netq_t;
+
 /** 
  * Holds security parameters, local state and the transport address
  * for each peer. */
@@ -45,16 +78,31 @@ typedef struct dtls_peer_t {
 #ifdef DTLS_PEERS_NOHASH
   struct dtls_peer_t *next;
 #else /* DTLS_PEERS_NOHASH */
-  UT_hash_handle hh;
+  struct dtls_peer_t *cid_next; /**< next peer in the same cid bucket */
 #endif /* DTLS_PEERS_NOHASH */
 
   session_t session;	     /**< peer address and local interface */
+  dtls_peer_key_t key;	     /**< lookup key derived from session */
+
+  /* Connection ids as described in RFC 9146. Records of epoch 1 and
+   * later carry the connection id of the receiver, if any. */
+  uint8 own_cid_length;      /**< 0 or DTLS_CID_LENGTH */
+  uint8 own_cid[DTLS_CID_LENGTH]; /**< connection id we receive */
+  uint8 peer_cid_length;     /**< length of peer_cid, 0 if none */
+  uint8 peer_cid[DTLS_CID_MAX_LENGTH]; /**< connection id we send */
 
   dtls_peer_type role;       /**< denotes if this host is DTLS_CLIENT or DTLS_SERVER */
   dtls_state_t state;        /**< DTLS engine state */
+  uint16_t mtu;              /**< maximum size of datagrams sent to this peer */
+
+  clock_time_t srtt;         /**< smoothed round-trip time, 0 if not measured */
+  clock_time_t rttvar;       /**< round-trip time variation */
+  clock_time_t rto;          /**< timeout for the next flight */
 
   dtls_security_parameters_t *security_params[2];
   dtls_handshake_parameters_t *handshake_params;
+
+  struct netq_t *retransmit; /**< messages in the retransmission queue */
 } dtls_peer_t;
 
 static inline dtls_security_parameters_t *dtls_security_params_epoch(dtls_peer_t *peer, uint16_t epoch)
@@ -106,6 +154,34 @@ static inline void dtls_security_params_switch(dtls_peer_t *peer)
   peer->security_params[0] = security;
 }
 
+/**
+ * Returns the smoothed round-trip time to @p peer in clock ticks, or
+ * @c 0 if no flight has been acknowledged without retransmission yet.
+ */
+static inline clock_time_t dtls_peer_srtt(const dtls_peer_t *peer)
+{
+  return peer->srtt;
+}
+
+/**
+ * Returns the timeout in clock ticks after which the next flight to
+ * @p peer will be retransmitted for the first time. The timeout is
+ * backed off when a flight is retransmitted and derived from the
+ * smoothed round-trip time again with the next measurement.
+ */
+static inline clock_time_t dtls_peer_rto(const dtls_peer_t *peer)
+{
+  return peer->rto;
+}
+
+/**
+ * Updates the round-trip time estimate of @p peer with a new sample
+ * @p rtt as described in RFC 6298, section 2. The resulting
+ * retransmission timeout is kept between DTLS_MIN_RTO and
+ * DTLS_MAX_RTO.
+ */
+void dtls_peer_rtt_sample(dtls_peer_t *peer, clock_time_t rtt);
+
 void peer_init(void);
 
 /**
@@ -124,6 +200,71 @@ dtls_peer_t *dtls_new_peer(const session_t *session);
 /** Releases the storage allocated to @p peer. */
 void dtls_free_peer(dtls_peer_t *peer);
 
+#ifndef DTLS_PEERS_NOHASH
+/** One slot of a dtls_peer_table_t. */
+typedef struct {
+  uint32_t hash;		/**< hash of peer->key, checked before the key */
+  dtls_peer_t *peer;		/**< the peer, NULL if the slot is empty */
+} dtls_peer_slot_t;
+
+/**
+ * Hash table of peers using open addressing with linear probing
+ * over a flat array of slots. When the table must grow, a new array
+ * is allocated and the entries of the old one are moved over a few
+ * at a time on each subsequent insert, so no single insert has to
+ * rehash the whole table. Until then, lookups check both arrays.
+ * An all-zero dtls_peer_table_t is a valid empty table.
+ */
+typedef struct {
+  dtls_peer_slot_t *slots;	/**< the current slot array */
+  size_t size;			/**< number of slots, a power of two */
+  size_t count;			/**< number of peers in slots */
+  size_t used;			/**< number of peers and deleted slots */
+
+  dtls_peer_slot_t *old_slots;	/**< slots that are being moved */
+  size_t old_size;		/**< number of slots in old_slots */
+  size_t old_count;		/**< number of peers left in old_slots */
+  size_t old_pos;		/**< next slot in old_slots to move */
+} dtls_peer_table_t;
+
+/** Releases the slot arrays of @p table but not the peers. */
+void dtls_peer_table_free(dtls_peer_table_t *table);
+
+/**
+ * Returns the peer with the given @p key from @p table or @c NULL if
+ * not found. @p hash must be the result of dtls_peer_key_hash() for
+ * @p key.
+ */
+dtls_peer_t *dtls_peer_table_find(const dtls_peer_table_t *table,
+				  const dtls_peer_key_t *key, uint32_t hash);
+
+/**
+ * Adds @p peer to @p table. The peer's key must not yet be in the
+ * table. This function returns @c 0 on success, or a value less than
+ * zero if no storage could be allocated.
+ */
+int dtls_peer_table_add(dtls_peer_table_t *table, dtls_peer_t *peer);
+
+/** Removes @p peer from @p table if present. */
+void dtls_peer_table_remove(dtls_peer_table_t *table, dtls_peer_t *peer);
+
+/** Returns the number of peers in @p table. */
+static inline size_t
+dtls_peer_table_count(const dtls_peer_table_t *table) {
+  return table->count + table->old_count;
+}
+
+/**
+ * Iterates over all peers in @p table. @p pos must be set to zero
+ * before the first call and is updated by each call. The function
+ * returns the next peer or @c NULL when all peers have been visited.
+ * The peer that was returned last may be removed during iteration,
+ * but no peers must be added.
+ */
+dtls_peer_t *dtls_peer_table_next(const dtls_peer_table_t *table,
+				  size_t *pos);
+#endif /* DTLS_PEERS_NOHASH */
+
 /** Returns the current state of @p peer. */
 static inline dtls_state_t dtls_peer_state(const dtls_peer_t *peer) {
   return peer->state;
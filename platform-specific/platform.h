@@ -20,7 +20,7 @@
 /* Define to the version of this package. */
 #define PACKAGE_VERSION "0.8.6"
 
-/* support for TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 */
+/* support for the TLS_ECDHE_ECDSA cipher suites */
 #ifndef DTLS_CONF_ECC
 #define DTLS_CONF_ECC 1
 #endif
@@ -28,7 +28,7 @@
 #define DTLS_ECC
 #endif
 
-/* support for TLS_PSK_WITH_AES_128_CCM_8 */
+/* support for the TLS_PSK cipher suites */
 #ifndef DTLS_CONF_PSK
 #define DTLS_CONF_PSK 1
 #endif
@@ -36,6 +36,18 @@
 #define DTLS_PSK
 #endif
 
+/* support for the _GCM_SHA256 cipher suites */
+#ifndef DTLS_CONF_GCM
+#define DTLS_CONF_GCM 0
+#endif
+#define DTLS_GCM DTLS_CONF_GCM
+
+/* support for the _CHACHA20_POLY1305_SHA256 cipher suites */
+#ifndef DTLS_CONF_CHACHA20_POLY1305
+#define DTLS_CONF_CHACHA20_POLY1305 0
+#endif
+#define DTLS_CHACHA20_POLY1305 DTLS_CONF_CHACHA20_POLY1305
+
 /* Disable all debug output and assertions */
 #ifndef DTLS_CONF_NDEBUG
 #if DTLS_CONF_NDEBUG
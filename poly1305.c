@@ -0,0 +1,287 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/*
+ * The arithmetic follows Andrew Moon's public domain poly1305-donna:
+ * h = (h + m) * r mod 2^130 - 5 with the accumulator split into
+ * three 44/44/42-bit limbs (or five 26-bit limbs without a 128-bit
+ * product type), so that all partial products fit into the next
+ * wider word.
+ */
+
+#include <string.h>
+
+#include "tinydtls.h"
+#include "poly1305.h"
+
+#ifdef DTLS_POLY1305_64BIT
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+#define MASK44 0xfffffffffffULL
+#define MASK42 0x3ffffffffffULL
+
+static inline uint64_t
+get_le64(const unsigned char *p) {
+  return (uint64_t)p[0] | ((uint64_t)p[1] << 8)
+    | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+    | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+    | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline void
+put_le64(unsigned char *p, uint64_t v) {
+  int i;
+
+  for (i = 0; i < 8; i++, v >>= 8)
+    p[i] = v & 0xff;
+}
+
+void
+dtls_poly1305_init(dtls_poly1305_t *st,
+		   const unsigned char key[DTLS_POLY1305_KEY_SIZE]) {
+  uint64_t t0 = get_le64(key), t1 = get_le64(key + 8);
+
+  /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+  st->r[0] = t0 & 0xffc0fffffffULL;
+  st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+  st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+
+  st->h[0] = st->h[1] = st->h[2] = 0;
+
+  st->pad[0] = get_le64(key + 16);
+  st->pad[1] = get_le64(key + 24);
+}
+
+static void
+poly1305_blocks(dtls_poly1305_t *st, const unsigned char *m, size_t blocks) {
+  const uint64_t hibit = (uint64_t)1 << 40; /* 2^128 */
+  uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+  uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+  uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint64_t c, t0, t1;
+  uint128_t d0, d1, d2;
+
+  for (; blocks; blocks--, m += 16) {
+    t0 = get_le64(m);
+    t1 = get_le64(m + 8);
+
+    h0 += t0 & MASK44;
+    h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+    h2 += ((t1 >> 24) & MASK42) | hibit;
+
+    d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+    d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+    d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+    c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & MASK44;
+    d1 += c; c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & MASK44;
+    d2 += c; c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+    h1 += c;
+  }
+
+  st->h[0] = h0;
+  st->h[1] = h1;
+  st->h[2] = h2;
+}
+
+void
+dtls_poly1305_finish(dtls_poly1305_t *st,
+		     unsigned char mac[DTLS_POLY1305_TAG_SIZE]) {
+  uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint64_t g0, g1, g2, c, t0, t1;
+
+  /* fully carry h */
+  c = h1 >> 44; h1 &= MASK44;
+  h2 += c; c = h2 >> 42; h2 &= MASK42;
+  h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+  h1 += c; c = h1 >> 44; h1 &= MASK44;
+  h2 += c; c = h2 >> 42; h2 &= MASK42;
+  h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+  h1 += c;
+
+  /* g = h + -p, select h if h < p or g otherwise in constant time */
+  g0 = h0 + 5; c = g0 >> 44; g0 &= MASK44;
+  g1 = h1 + c; c = g1 >> 44; g1 &= MASK44;
+  g2 = h2 + c - ((uint64_t)1 << 42);
+
+  c = (g2 >> 63) - 1;
+  g0 &= c; g1 &= c; g2 &= c;
+  c = ~c;
+  h0 = (h0 & c) | g0;
+  h1 = (h1 & c) | g1;
+  h2 = (h2 & c) | g2;
+
+  /* h = (h + pad) mod 2^128 */
+  t0 = st->pad[0];
+  t1 = st->pad[1];
+
+  h0 += t0 & MASK44; c = h0 >> 44; h0 &= MASK44;
+  h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + c; c = h1 >> 44; h1 &= MASK44;
+  h2 += ((t1 >> 24) & MASK42) + c; h2 &= MASK42;
+
+  put_le64(mac, h0 | (h1 << 44));
+  put_le64(mac + 8, (h1 >> 20) | (h2 << 24));
+
+  memset(st, 0, sizeof(*st));
+}
+
+#else /* DTLS_POLY1305_64BIT */
+
+#define MASK26 0x3ffffff
+
+static inline uint32_t
+get_le32(const unsigned char *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+    | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+put_le32(unsigned char *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+void
+dtls_poly1305_init(dtls_poly1305_t *st,
+		   const unsigned char key[DTLS_POLY1305_KEY_SIZE]) {
+  /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+  st->r[0] = get_le32(key) & 0x3ffffff;
+  st->r[1] = (get_le32(key + 3) >> 2) & 0x3ffff03;
+  st->r[2] = (get_le32(key + 6) >> 4) & 0x3ffc0ff;
+  st->r[3] = (get_le32(key + 9) >> 6) & 0x3f03fff;
+  st->r[4] = (get_le32(key + 12) >> 8) & 0x00fffff;
+
+  memset(st->h, 0, sizeof(st->h));
+
+  st->pad[0] = get_le32(key + 16);
+  st->pad[1] = get_le32(key + 20);
+  st->pad[2] = get_le32(key + 24);
+  st->pad[3] = get_le32(key + 28);
+}
+
+static void
+poly1305_blocks(dtls_poly1305_t *st, const unsigned char *m, size_t blocks) {
+  const uint32_t hibit = (uint32_t)1 << 24; /* 2^128 */
+  uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+  uint32_t r3 = st->r[3], r4 = st->r[4];
+  uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint32_t h3 = st->h[3], h4 = st->h[4];
+  uint64_t d0, d1, d2, d3, d4;
+  uint32_t c;
+
+  for (; blocks; blocks--, m += 16) {
+    h0 += get_le32(m) & MASK26;
+    h1 += (get_le32(m + 3) >> 2) & MASK26;
+    h2 += (get_le32(m + 6) >> 4) & MASK26;
+    h3 += (get_le32(m + 9) >> 6) & MASK26;
+    h4 += (get_le32(m + 12) >> 8) | hibit;
+
+    d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3
+      + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4
+      + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0
+      + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1
+      + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2
+      + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & MASK26;
+    d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & MASK26;
+    d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & MASK26;
+    d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & MASK26;
+    d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & MASK26;
+    h0 += c * 5; c = h0 >> 26; h0 &= MASK26;
+    h1 += c;
+  }
+
+  st->h[0] = h0; st->h[1] = h1; st->h[2] = h2;
+  st->h[3] = h3; st->h[4] = h4;
+}
+
+void
+dtls_poly1305_finish(dtls_poly1305_t *st,
+		     unsigned char mac[DTLS_POLY1305_TAG_SIZE]) {
+  uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint32_t h3 = st->h[3], h4 = st->h[4];
+  uint32_t g0, g1, g2, g3, g4, c, mask;
+  uint64_t f;
+
+  /* fully carry h */
+  c = h1 >> 26; h1 &= MASK26;
+  h2 += c; c = h2 >> 26; h2 &= MASK26;
+  h3 += c; c = h3 >> 26; h3 &= MASK26;
+  h4 += c; c = h4 >> 26; h4 &= MASK26;
+  h0 += c * 5; c = h0 >> 26; h0 &= MASK26;
+  h1 += c;
+
+  /* g = h + -p, select h if h < p or g otherwise in constant time */
+  g0 = h0 + 5; c = g0 >> 26; g0 &= MASK26;
+  g1 = h1 + c; c = g1 >> 26; g1 &= MASK26;
+  g2 = h2 + c; c = g2 >> 26; g2 &= MASK26;
+  g3 = h3 + c; c = g3 >> 26; g3 &= MASK26;
+  g4 = h4 + c - ((uint32_t)1 << 26);
+
+  mask = (g4 >> 31) - 1;
+  g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+  mask = ~mask;
+  h0 = (h0 & mask) | g0;
+  h1 = (h1 & mask) | g1;
+  h2 = (h2 & mask) | g2;
+  h3 = (h3 & mask) | g3;
+  h4 = (h4 & mask) | g4;
+
+  /* h = h % 2^128 */
+  h0 = h0 | (h1 << 26);
+  h1 = (h1 >> 6) | (h2 << 20);
+  h2 = (h2 >> 12) | (h3 << 14);
+  h3 = (h3 >> 18) | (h4 << 8);
+
+  /* mac = (h + pad) % 2^128 */
+  f = (uint64_t)h0 + st->pad[0]; h0 = (uint32_t)f;
+  f = (uint64_t)h1 + st->pad[1] + (f >> 32); h1 = (uint32_t)f;
+  f = (uint64_t)h2 + st->pad[2] + (f >> 32); h2 = (uint32_t)f;
+  f = (uint64_t)h3 + st->pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+  put_le32(mac, h0);
+  put_le32(mac + 4, h1);
+  put_le32(mac + 8, h2);
+  put_le32(mac + 12, h3);
+
+  memset(st, 0, sizeof(*st));
+}
+
+#endif /* DTLS_POLY1305_64BIT */
+
+void
+dtls_poly1305_update_padded(dtls_poly1305_t *st,
+			    const unsigned char *m, size_t len) {
+  unsigned char last[16];
+
+  poly1305_blocks(st, m, len / 16);
+
+  if (len % 16) {
+    memset(last, 0, sizeof(last));
+    memcpy(last, m + len - len % 16, len % 16);
+    poly1305_blocks(st, last, 1);
+  }
+}
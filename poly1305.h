@@ -0,0 +1,64 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#ifndef _DTLS_POLY1305_H_
+#define _DTLS_POLY1305_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Poly1305 one-time authenticator, RFC 8439 */
+
+#define DTLS_POLY1305_KEY_SIZE 32 /**< size of the one-time key */
+#define DTLS_POLY1305_TAG_SIZE 16 /**< size of the tag */
+
+/* Use 44-bit limbs in 64-bit words where the compiler provides a
+ * 128-bit product, 26-bit limbs in 32-bit words otherwise. */
+#if defined(__SIZEOF_INT128__) && !defined(DTLS_POLY1305_32BIT)
+#define DTLS_POLY1305_64BIT 1
+#endif
+
+typedef struct {
+#ifdef DTLS_POLY1305_64BIT
+  uint64_t r[3];
+  uint64_t h[3];
+  uint64_t pad[2];
+#else /* DTLS_POLY1305_64BIT */
+  uint32_t r[5];
+  uint32_t h[5];
+  uint32_t pad[4];
+#endif /* DTLS_POLY1305_64BIT */
+} dtls_poly1305_t;
+
+/** Initializes \p st with the one-time \p key. */
+void dtls_poly1305_init(dtls_poly1305_t *st,
+			const unsigned char key[DTLS_POLY1305_KEY_SIZE]);
+
+/**
+ * Adds \p len bytes from \p m to the MAC. A partial last block is
+ * padded with zeroes to 16 bytes as required for the AEAD
+ * construction of RFC 8439, hence only the last call for the
+ * additional data or the ciphertext may pass a length that is not a
+ * multiple of 16.
+ */
+void dtls_poly1305_update_padded(dtls_poly1305_t *st,
+				 const unsigned char *m, size_t len);
+
+/** Writes the tag to \p mac and clears \p st. */
+void dtls_poly1305_finish(dtls_poly1305_t *st,
+			  unsigned char mac[DTLS_POLY1305_TAG_SIZE]);
+
+#endif /* _DTLS_POLY1305_H_ */
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include <stdlib.h>
+
+#include "pool.h"
+#include "dtls_debug.h"
+
+#ifdef DTLS_POOL
+
+/* Objects and the slab header are aligned like the result of malloc()
+ * on common platforms. */
+#define POOL_ALIGN (2 * sizeof(void *))
+#define POOL_ROUND(Size) (((Size) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+/* the pools that have been used by this thread */
+static __thread dtls_pool_t *pools;
+
+static void
+pool_register(dtls_pool_t *pool) {
+  pool->registered = 1;
+  pool->next = pools;
+  pools = pool;
+}
+
+/* Allocates a new slab and adds its objects to the free list. */
+static int
+pool_grow(dtls_pool_t *pool) {
+  size_t stride = POOL_ROUND(pool->size < sizeof(void *)
+			     ? sizeof(void *) : pool->size);
+  size_t count = 1, i;
+  unsigned char *slab;
+
+  if (DTLS_POOL_SLAB_SIZE > POOL_ALIGN + stride)
+    count = (DTLS_POOL_SLAB_SIZE - POOL_ALIGN) / stride;
+
+  slab = (unsigned char *)malloc(POOL_ALIGN + count * stride);
+  if (!slab) {
+    dtls_crit("cannot grow pool %s\n", pool->name);
+    return -1;
+  }
+
+  /* the slabs are chained through their first bytes */
+  *(void **)slab = pool->slabs;
+  pool->slabs = slab;
+  pool->slab_count++;
+  pool->objects += count;
+
+  for (i = 0; i < count; i++)
+    dtls_pool_free(pool, slab + POOL_ALIGN + i * stride);
+  return 0;
+}
+
+void *
+dtls_pool_alloc(dtls_pool_t *pool) {
+  void *object;
+
+  if (!pool->registered)
+    pool_register(pool);
+
+  if (!pool->free && pool_grow(pool) < 0)
+    return NULL;
+
+  object = pool->free;
+  pool->free = *(void **)object;
+  pool->free_count--;
+
+  if (pool->objects > pool->free_count
+      && pool->objects - pool->free_count > pool->peak)
+    pool->peak = pool->objects - pool->free_count;
+  return object;
+}
+
+void
+dtls_pool_free(dtls_pool_t *pool, void *object) {
+  if (!object)
+    return;
+
+  if (!pool->registered)
+    pool_register(pool);
+
+  /* free objects are chained through their first bytes */
+  *(void **)object = pool->free;
+  pool->free = object;
+  pool->free_count++;
+}
+
+size_t
+dtls_pool_get_stats(dtls_pool_stats_t *stats, size_t max) {
+  dtls_pool_t *pool;
+  size_t n = 0;
+
+  for (pool = pools; pool; pool = pool->next, n++) {
+    if (n < max) {
+      stats[n].name = pool->name;
+      stats[n].size = pool->size;
+      stats[n].slabs = pool->slab_count;
+      stats[n].objects = pool->objects;
+      stats[n].free = pool->free_count;
+      stats[n].peak = pool->peak;
+    }
+  }
+  return n;
+}
+
+#else /* DTLS_POOL */
+
+size_t
+dtls_pool_get_stats(dtls_pool_stats_t *stats, size_t max) {
+  (void)stats;
+  (void)max;
+  return 0;
+}
+
+#endif /* DTLS_POOL */
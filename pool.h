@@ -0,0 +1,119 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file pool.h
+ * @brief Pools of fixed-size objects for POSIX systems
+ */
+
+#ifndef _DTLS_POOL_H_
+#define _DTLS_POOL_H_
+
+#include <stddef.h>
+
+#include "tinydtls.h"
+
+/**
+ * \defgroup pool Object Pools
+ * The peers, security parameters, handshake parameters and queued
+ * messages that are created for every handshake are taken from pools
+ * instead of being allocated with malloc() one by one. Like a MEMB
+ * pool on Contiki, a pool hands out objects of one size. When it runs
+ * empty, it grows by a slab of DTLS_POOL_SLAB_SIZE bytes. Slabs are
+ * kept for reuse and are never returned to the system.
+ *
+ * Each thread has its own pools, so no locking is needed. An object
+ * that is released by another thread than the one that has created it
+ * is added to the pool of the releasing thread.
+ *
+ * The pools are used when DTLS_POOL is defined, which is done by
+ * configure unless --without-pool is given. Contiki uses its static
+ * MEMB pools instead.
+ * @{
+ */
+
+#if defined(DTLS_POOL) && defined(WITH_CONTIKI)
+#undef DTLS_POOL
+#endif /* DTLS_POOL && WITH_CONTIKI */
+
+#if defined(DTLS_POOL) && !defined(__GNUC__)
+#warning "object pools need __thread, using malloc() instead"
+#undef DTLS_POOL
+#endif /* DTLS_POOL && !__GNUC__ */
+
+#ifndef DTLS_POOL_SLAB_SIZE
+/** Number of bytes that are allocated when a pool grows. */
+#define DTLS_POOL_SLAB_SIZE 16384
+#endif /* DTLS_POOL_SLAB_SIZE */
+
+/** A pool of objects of the same size, see DTLS_POOL_DEFINE(). */
+typedef struct dtls_pool_t {
+  const char *name;		/**< the name used in the statistics */
+  size_t size;			/**< the size of the objects */
+  void *free;			/**< objects that can be handed out */
+  void *slabs;			/**< memory allocated by this pool */
+  size_t slab_count;		/**< number of slabs */
+  size_t objects;		/**< number of objects in all slabs */
+  size_t free_count;		/**< number of objects in free */
+  size_t peak;			/**< most objects in use at the same time */
+  struct dtls_pool_t *next;	/**< next pool of the same thread */
+  int registered;		/**< set when listed for dtls_pool_get_stats() */
+} dtls_pool_t;
+
+#ifdef DTLS_POOL
+/**
+ * Defines the pool @p Name for objects of @p Size bytes. Every thread
+ * gets its own instance of the pool.
+ */
+#define DTLS_POOL_DEFINE(Name, Size)					\
+  static __thread dtls_pool_t Name = { #Name, (Size), NULL, NULL, 0, 0, 0, 0, NULL, 0 }
+
+/**
+ * Returns an object from @p pool, or @c NULL if the pool is empty
+ * and no memory is left to grow it. The object is not initialized.
+ */
+void *dtls_pool_alloc(dtls_pool_t *pool);
+
+/** Returns @p object, which has been taken from @p pool, to the pool. */
+void dtls_pool_free(dtls_pool_t *pool, void *object);
+#endif /* DTLS_POOL */
+
+/** Occupancy of one pool as reported by dtls_pool_get_stats(). */
+typedef struct {
+  const char *name;		/**< the name of the pool */
+  size_t size;			/**< the size of the objects */
+  size_t slabs;			/**< number of slabs */
+  size_t objects;		/**< number of objects in all slabs */
+  size_t free;			/**< number of objects that are not in use */
+  size_t peak;			/**< most objects in use at the same time */
+} dtls_pool_stats_t;
+
+/**
+ * Reports the occupancy of the pools of the calling thread. Pools
+ * that have not been used by this thread yet are not reported. As
+ * objects move to the pool of the thread that releases them, @c free
+ * may exceed @c objects for a single thread.
+ *
+ * @param stats The result array.
+ * @param max   The number of elements in @p stats.
+ * @return The number of pools, which may be greater than @p max.
+ *         Without DTLS_POOL, this is always @c 0.
+ */
+size_t dtls_pool_get_stats(dtls_pool_stats_t *stats, size_t max);
+
+/** @} */
+
+#endif /* _DTLS_POOL_H_ */
@@ -71,3 +71,54 @@ dtls_session_equals(const session_t *a, const session_t *b) {
   assert(a); assert(b);
   return _dtls_address_equals_impl(a, b);
 }
+
+void
+dtls_session_key(const session_t *sess, dtls_peer_key_t *key) {
+  assert(sess); assert(key);
+  memset(key, 0, sizeof(dtls_peer_key_t));
+  key->ifindex = (uint32_t)sess->ifindex;
+
+#ifdef WITH_CONTIKI
+  key->family = sizeof(uip_ipaddr_t) == 16 ? 6 : 4;
+  key->port = sess->port;
+  memcpy(key->addr, &sess->addr, sizeof(uip_ipaddr_t));
+#else /* WITH_CONTIKI */
+  switch (sess->addr.sa.sa_family) {
+  case AF_INET:
+    key->family = 4;
+    key->port = sess->addr.sin.sin_port;
+    memcpy(key->addr, &sess->addr.sin.sin_addr, sizeof(struct in_addr));
+    break;
+  case AF_INET6:
+    key->family = 6;
+    key->port = sess->addr.sin6.sin6_port;
+    memcpy(key->addr, &sess->addr.sin6.sin6_addr, sizeof(struct in6_addr));
+    break;
+  default:
+    ;
+  }
+#endif /* WITH_CONTIKI */
+}
+
+uint32_t
+dtls_peer_key_hash(const dtls_peer_key_t *key) {
+  uint32_t w, h = 0x811c9dc5;
+  size_t i;
+
+  /* mix the key one 32-bit word at a time, the size of
+   * dtls_peer_key_t is a multiple of four */
+  for (i = 0; i < sizeof(dtls_peer_key_t); i += sizeof(w)) {
+    memcpy(&w, (const uint8_t *)key + i, sizeof(w));
+    h ^= w;
+    h *= 0x9e3779b1;
+    h ^= h >> 15;
+  }
+
+  /* final avalanche from MurmurHash3 */
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
@@ -49,6 +49,20 @@ typedef struct {
 } session_t;
 #endif /* WITH_CONTIKI */
 
+/**
+ * Compact and normalized representation of the remote address, port
+ * and local interface of a session. This is used as key for looking
+ * up peers. All bytes that are not used by the address family are
+ * zero, hence two keys can be compared with memcmp().
+ */
+typedef struct {
+  uint32_t ifindex;		/**< local interface */
+  uint16_t port;		/**< remote port in network byte order */
+  uint8_t family;		/**< 4 for IPv4, 6 for IPv6, 0 if unknown */
+  uint8_t reserved;		/**< always zero */
+  uint8_t addr[16];		/**< remote IPv4 or IPv6 address */
+} dtls_peer_key_t;
+
 /** 
  * Resets the given session_t object @p sess to its default
  * values.  In particular, the member rlen must be initialized to the
@@ -64,4 +78,24 @@ void dtls_session_init(session_t *sess);
  */
 int dtls_session_equals(const session_t *a, const session_t *b);
 
+/**
+ * Fills @p key with the compact lookup key for @p sess.
+ *
+ * @param sess The session to create the key for.
+ * @param key  The key object to fill.
+ */
+void dtls_session_key(const session_t *sess, dtls_peer_key_t *key);
+
+/** Returns the hash value of the given peer @p key. */
+uint32_t dtls_peer_key_hash(const dtls_peer_key_t *key);
+
+/**
+ * Compares the given peer keys. This function returns @c 0 when
+ * @p a and @p b differ, @c 1 otherwise.
+ */
+static inline int
+dtls_peer_key_equals(const dtls_peer_key_t *a, const dtls_peer_key_t *b) {
+  return memcmp(a, b, sizeof(dtls_peer_key_t)) == 0;
+}
+
 #endif /* _DTLS_SESSION_H_ */
@@ -44,6 +44,13 @@
 #endif
 #include "sha2.h"
 
+#if !defined(SHA2_NO_SIMD) && defined(WITH_SHA256) && \
+    (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA2_X86	1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 /*
  * ASSERT NOTE:
  * Some sanity checking code is included using assert().  On my FreeBSD
@@ -62,6 +69,11 @@
  *
  *   #define SHA2_UNROLL_TRANSFORM
  *
+ * SIMD NOTE:
+ * On x86 with GCC or clang, SHA-256 uses the SHA extensions and AVX2
+ * when the CPU supports them.  Define SHA2_NO_SIMD to use the portable
+ * transform only.
+ *
  */
 
 
@@ -550,8 +562,303 @@ void dtls_sha256_transform(dtls_sha256_ctx* context, const sha2_word32* data) {
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+/*** SHA-256 Block Processing: ****************************************/
+#ifdef SHA2_X86
+/*
+ * The extensions found by dtls_sha256_features() plus 0x100 once the
+ * CPU has been checked, and the ones disabled by the application:
+ */
+static unsigned int sha256_cpu = 0;
+static unsigned int sha256_disabled = 0;
+
+unsigned int dtls_sha256_features(void) {
+	unsigned int	eax, ebx, ecx, edx;
+	unsigned int	cpu = __atomic_load_n(&sha256_cpu, __ATOMIC_RELAXED);
+
+	if (!cpu) {
+		cpu = 0x100;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+		    (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+		    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+		    (ebx & bit_SHA)) {
+			cpu |= DTLS_SHA256_SHANI;
+		}
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			cpu |= DTLS_SHA256_AVX2;
+		}
+		__atomic_store_n(&sha256_cpu, cpu, __ATOMIC_RELAXED);
+	}
+	return cpu & ~__atomic_load_n(&sha256_disabled, __ATOMIC_RELAXED) &
+	    (DTLS_SHA256_SHANI | DTLS_SHA256_AVX2);
+}
+
+void dtls_sha256_set_features(unsigned int features) {
+	__atomic_store_n(&sha256_disabled, ~features, __ATOMIC_RELAXED);
+}
+
+/*
+ * SHA-NI: Each SHA256RNDS2 does two rounds on the state, which is
+ * kept as ABEF and CDGH.  SHA256MSG1 and SHA256MSG2 compute the next
+ * four message words from the previous sixteen.
+ */
+#define SHANI_ROUNDS(i, m)	\
+	msg = _mm_add_epi32((m), \
+	    _mm_loadu_si128((const __m128i *)&K256[4 * (i)])); \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+	msg = _mm_shuffle_epi32(msg, 0x0e); \
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg)
+
+#define SHANI_MSG1(prev, cur)	\
+	(prev) = _mm_sha256msg1_epu32((prev), (cur))
+
+#define SHANI_MSG2(next, cur, prev)	\
+	(next) = _mm_add_epi32((next), _mm_alignr_epi8((cur), (prev), 4)); \
+	(next) = _mm_sha256msg2_epu32((next), (cur))
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_shani(sha2_word32 *state, const sha2_byte *data, size_t blocks) {
+	const __m128i	bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					       0x0405060700010203ULL);
+	__m128i		state0, state1, save0, save1, msg, tmp;
+	__m128i		m0, m1, m2, m3;
+
+	/* Rearrange ABCD and EFGH to ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	while (blocks--) {
+		save0 = state0;
+		save1 = state1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data +  0)), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+
+		SHANI_ROUNDS(0, m0);
+		SHANI_ROUNDS(1, m1);	SHANI_MSG1(m0, m1);
+		SHANI_ROUNDS(2, m2);	SHANI_MSG1(m1, m2);
+		SHANI_ROUNDS(3, m3);	SHANI_MSG2(m0, m3, m2);	SHANI_MSG1(m2, m3);
+		SHANI_ROUNDS(4, m0);	SHANI_MSG2(m1, m0, m3);	SHANI_MSG1(m3, m0);
+		SHANI_ROUNDS(5, m1);	SHANI_MSG2(m2, m1, m0);	SHANI_MSG1(m0, m1);
+		SHANI_ROUNDS(6, m2);	SHANI_MSG2(m3, m2, m1);	SHANI_MSG1(m1, m2);
+		SHANI_ROUNDS(7, m3);	SHANI_MSG2(m0, m3, m2);	SHANI_MSG1(m2, m3);
+		SHANI_ROUNDS(8, m0);	SHANI_MSG2(m1, m0, m3);	SHANI_MSG1(m3, m0);
+		SHANI_ROUNDS(9, m1);	SHANI_MSG2(m2, m1, m0);	SHANI_MSG1(m0, m1);
+		SHANI_ROUNDS(10, m2);	SHANI_MSG2(m3, m2, m1);	SHANI_MSG1(m1, m2);
+		SHANI_ROUNDS(11, m3);	SHANI_MSG2(m0, m3, m2);	SHANI_MSG1(m2, m3);
+		SHANI_ROUNDS(12, m0);	SHANI_MSG2(m1, m0, m3);	SHANI_MSG1(m3, m0);
+		SHANI_ROUNDS(13, m1);	SHANI_MSG2(m2, m1, m0);
+		SHANI_ROUNDS(14, m2);	SHANI_MSG2(m3, m2, m1);
+		SHANI_ROUNDS(15, m3);
+
+		state0 = _mm_add_epi32(state0, save0);
+		state1 = _mm_add_epi32(state1, save1);
+		data += DTLS_SHA256_BLOCK_LENGTH;
+	}
+
+	/* And back to ABCD and EFGH */
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+/*
+ * AVX2: Eight independent blocks, one in each 32-bit lane of the
+ * registers.  This is slower than SHA-NI for a single message but
+ * faster than the portable transform as soon as a few messages are
+ * hashed together.
+ */
+#define AVX2_ROR(x, n)	\
+	_mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define AVX2_ADD(x, y)	_mm256_add_epi32((x), (y))
+
+/* Transposes the 8x8 matrix of 32-bit words in r: */
+__attribute__((target("avx2")))
+static inline void sha256_avx2_transpose(__m256i *r) {
+	__m256i	t0, t1, t2, t3, t4, t5, t6, t7;
+
+	t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+	t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+	t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+	t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+	t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+	r[0] = _mm256_unpacklo_epi64(t0, t2);
+	r[1] = _mm256_unpackhi_epi64(t0, t2);
+	r[2] = _mm256_unpacklo_epi64(t1, t3);
+	r[3] = _mm256_unpackhi_epi64(t1, t3);
+	r[4] = _mm256_unpacklo_epi64(t4, t6);
+	r[5] = _mm256_unpackhi_epi64(t4, t6);
+	r[6] = _mm256_unpacklo_epi64(t5, t7);
+	r[7] = _mm256_unpackhi_epi64(t5, t7);
+
+	t0 = _mm256_permute2x128_si256(r[0], r[4], 0x20);
+	t1 = _mm256_permute2x128_si256(r[1], r[5], 0x20);
+	t2 = _mm256_permute2x128_si256(r[2], r[6], 0x20);
+	t3 = _mm256_permute2x128_si256(r[3], r[7], 0x20);
+	t4 = _mm256_permute2x128_si256(r[0], r[4], 0x31);
+	t5 = _mm256_permute2x128_si256(r[1], r[5], 0x31);
+	t6 = _mm256_permute2x128_si256(r[2], r[6], 0x31);
+	t7 = _mm256_permute2x128_si256(r[3], r[7], 0x31);
+
+	r[0] = t0; r[1] = t1; r[2] = t2; r[3] = t3;
+	r[4] = t4; r[5] = t5; r[6] = t6; r[7] = t7;
+}
+
+__attribute__((target("avx2")))
+static void sha256_avx2(sha2_word32 **state, const sha2_byte **data) {
+	const __m256i	bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+						4, 5, 6, 7, 0, 1, 2, 3,
+						12, 13, 14, 15, 8, 9, 10, 11,
+						4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i		s[8], W256[16];
+	__m256i		a, b, c, d, e, f, g, h, s0, s1, T1, T2;
+	int		j;
+
+	for (j = 0; j < 8; j++) {
+		s[j] = _mm256_loadu_si256((const __m256i *)state[j]);
+		W256[j] = _mm256_loadu_si256((const __m256i *)data[j]);
+		W256[j + 8] = _mm256_loadu_si256((const __m256i *)(data[j] + 32));
+	}
+	sha256_avx2_transpose(s);
+	sha256_avx2_transpose(W256);
+	sha256_avx2_transpose(W256 + 8);
+
+	for (j = 0; j < 16; j++) {
+		W256[j] = _mm256_shuffle_epi8(W256[j], bswap);
+	}
+
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	for (j = 0; j < 64; j++) {
+		if (j >= 16) {
+			/* Part of the message block expansion: */
+			s0 = W256[(j+1)&0x0f];
+			s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(s0, 7),
+			    AVX2_ROR(s0, 18)), _mm256_srli_epi32(s0, 3));
+			s1 = W256[(j+14)&0x0f];
+			s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(s1, 17),
+			    AVX2_ROR(s1, 19)), _mm256_srli_epi32(s1, 10));
+			W256[j&0x0f] = AVX2_ADD(AVX2_ADD(W256[j&0x0f], s0),
+			    AVX2_ADD(W256[(j+9)&0x0f], s1));
+		}
+
+		/* T1 = h + Sigma1(e) + Ch(e, f, g) + K256[j] + W256[j] */
+		T1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(e, 6),
+		    AVX2_ROR(e, 11)), AVX2_ROR(e, 25));
+		T1 = AVX2_ADD(AVX2_ADD(h, T1),
+		    _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)));
+		T1 = AVX2_ADD(T1, AVX2_ADD(_mm256_set1_epi32(K256[j]), W256[j&0x0f]));
+
+		/* T2 = Sigma0(a) + Maj(a, b, c) */
+		T2 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(a, 2),
+		    AVX2_ROR(a, 13)), AVX2_ROR(a, 22));
+		T2 = AVX2_ADD(T2, _mm256_or_si256(_mm256_and_si256(a, b),
+		    _mm256_and_si256(c, _mm256_or_si256(a, b))));
+
+		h = g;
+		g = f;
+		f = e;
+		e = AVX2_ADD(d, T1);
+		d = c;
+		c = b;
+		b = a;
+		a = AVX2_ADD(T1, T2);
+	}
+
+	s[0] = AVX2_ADD(s[0], a); s[1] = AVX2_ADD(s[1], b);
+	s[2] = AVX2_ADD(s[2], c); s[3] = AVX2_ADD(s[3], d);
+	s[4] = AVX2_ADD(s[4], e); s[5] = AVX2_ADD(s[5], f);
+	s[6] = AVX2_ADD(s[6], g); s[7] = AVX2_ADD(s[7], h);
+	sha256_avx2_transpose(s);
+
+	for (j = 0; j < 8; j++) {
+		_mm256_storeu_si256((__m256i *)state[j], s[j]);
+	}
+}
+
+/* Use AVX2 for a round of the multi-buffer functions with at least
+ * this many blocks: */
+#define SHA256_AVX2_MIN_LANES	3
+
+#else /* SHA2_X86 */
+
+unsigned int dtls_sha256_features(void) {
+	return 0;
+}
+
+void dtls_sha256_set_features(unsigned int features) {
+	(void)features;
+}
+
+#endif /* SHA2_X86 */
+
+/* Processes the given number of complete blocks from data: */
+static void sha256_blocks(dtls_sha256_ctx* context, const sha2_byte *data, size_t blocks) {
+#ifdef SHA2_X86
+	if (dtls_sha256_features() & DTLS_SHA256_SHANI) {
+		sha256_shani(context->state, data, blocks);
+		return;
+	}
+#endif /* SHA2_X86 */
+	while (blocks--) {
+		dtls_sha256_transform(context, (const sha2_word32*)data);
+		data += DTLS_SHA256_BLOCK_LENGTH;
+	}
+}
+
+/*
+ * Processes one block for each of the n <= DTLS_SHA256_LANES contexts
+ * whose entry in block is not NULL:
+ */
+static void sha256_lanes(dtls_sha256_ctx **context, const sha2_byte **block, unsigned int n) {
+	unsigned int	i;
+#ifdef SHA2_X86
+	sha2_word32	*state[DTLS_SHA256_LANES], spare[8];
+	const sha2_byte	*data[DTLS_SHA256_LANES];
+	unsigned int	active = 0;
+
+	for (i = 0; i < n; i++) {
+		if (block[i]) {
+			state[active] = context[i]->state;
+			data[active++] = block[i];
+		}
+	}
+
+	if (active >= SHA256_AVX2_MIN_LANES &&
+	    (dtls_sha256_features() & (DTLS_SHA256_SHANI | DTLS_SHA256_AVX2)) ==
+	    DTLS_SHA256_AVX2) {
+		/* Unused lanes work on a copy of the first state: */
+		MEMCPY_BCOPY(spare, state[0], sizeof(spare));
+		for (i = active; i < DTLS_SHA256_LANES; i++) {
+			state[i] = spare;
+			data[i] = data[0];
+		}
+		sha256_avx2(state, data);
+		return;
+	}
+#endif /* SHA2_X86 */
+	for (i = 0; i < n; i++) {
+		if (block[i]) {
+			sha256_blocks(context[i], block[i], 1);
+		}
+	}
+}
+
 void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t len) {
 	unsigned int	freespace, usedspace;
+	size_t		blocks;
 
 	if (len == 0) {
 		/* Calling with no data is valid - we do nothing */
@@ -572,7 +879,7 @@ void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t
 			context->bitcount += freespace << 3;
 			len -= freespace;
 			data += freespace;
-			dtls_sha256_transform(context, (sha2_word32*)context->buffer);
+			sha256_blocks(context, context->buffer, 1);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -582,12 +889,13 @@ void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t
 			return;
 		}
 	}
-	while (len >= DTLS_SHA256_BLOCK_LENGTH) {
+	if (len >= DTLS_SHA256_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
-		dtls_sha256_transform(context, (sha2_word32*)data);
-		context->bitcount += DTLS_SHA256_BLOCK_LENGTH << 3;
-		len -= DTLS_SHA256_BLOCK_LENGTH;
-		data += DTLS_SHA256_BLOCK_LENGTH;
+		blocks = len / DTLS_SHA256_BLOCK_LENGTH;
+		sha256_blocks(context, data, blocks);
+		context->bitcount += (sha2_word64)blocks * DTLS_SHA256_BLOCK_LENGTH << 3;
+		len -= blocks * DTLS_SHA256_BLOCK_LENGTH;
+		data += blocks * DTLS_SHA256_BLOCK_LENGTH;
 	}
 	if (len > 0) {
 		/* There's left-overs, so save 'em */
@@ -600,7 +908,8 @@ void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t
 
 void dtls_sha256_final(sha2_byte digest[], dtls_sha256_ctx* context) {
 	sha2_word32	*d = (sha2_word32*)digest;
-	unsigned int	usedspace;
+	sha2_word64	bitcount;
+	unsigned int	usedspace, j;
 
 	/* Sanity check: */
 	assert(context != (dtls_sha256_ctx*)0);
@@ -608,10 +917,6 @@ void dtls_sha256_final(sha2_byte digest[], dtls_sha256_ctx* context) {
 	/* If no digest buffer is passed, we don't bother doing this: */
 	if (digest != (sha2_byte*)0) {
 		usedspace = (context->bitcount >> 3) % DTLS_SHA256_BLOCK_LENGTH;
-#if BYTE_ORDER == LITTLE_ENDIAN
-		/* Convert FROM host byte order */
-		REVERSE64(context->bitcount,context->bitcount);
-#endif
 		if (usedspace > 0) {
 			/* Begin padding with a 1 bit: */
 			context->buffer[usedspace++] = 0x80;
@@ -624,7 +929,7 @@ void dtls_sha256_final(sha2_byte digest[], dtls_sha256_ctx* context) {
 					MEMSET_BZERO(&context->buffer[usedspace], DTLS_SHA256_BLOCK_LENGTH - usedspace);
 				}
 				/* Do second-to-last transform: */
-				dtls_sha256_transform(context, (sha2_word32*)context->buffer);
+				sha256_blocks(context, context->buffer, 1);
 
 				/* And set-up for the last transform: */
 				MEMSET_BZERO(context->buffer, DTLS_SHA256_SHORT_BLOCK_LENGTH);
@@ -636,16 +941,20 @@ void dtls_sha256_final(sha2_byte digest[], dtls_sha256_ctx* context) {
 			/* Begin padding with a 1 bit: */
 			*context->buffer = 0x80;
 		}
-		/* Set the bit count: */
-                *(sha2_word64*)(context->buffer+DTLS_SHA256_SHORT_BLOCK_LENGTH) = context->bitcount;
+		/* Set the bit count (big endian, byte by byte to avoid
+		 * accessing the buffer through different types): */
+		bitcount = context->bitcount;
+		for (j = DTLS_SHA256_BLOCK_LENGTH; j > DTLS_SHA256_SHORT_BLOCK_LENGTH; j--) {
+			context->buffer[j - 1] = (sha2_byte)bitcount;
+			bitcount >>= 8;
+		}
 
 		/* Final transform: */
-		dtls_sha256_transform(context, (sha2_word32*)context->buffer);
+		sha256_blocks(context, context->buffer, 1);
 
 #if BYTE_ORDER == LITTLE_ENDIAN
 		{
 			/* Convert TO host byte order */
-			int	j;
 			for (j = 0; j < 8; j++) {
 				REVERSE32(context->state[j],context->state[j]);
 				*d++ = context->state[j];
@@ -661,6 +970,118 @@ void dtls_sha256_final(sha2_byte digest[], dtls_sha256_ctx* context) {
 	usedspace = 0;
 }
 
+void dtls_sha256_update_multi(dtls_sha256_ctx **context, const sha2_byte **data, const size_t *len, unsigned int n) {
+	const sha2_byte	*p[DTLS_SHA256_LANES], *block[DTLS_SHA256_LANES];
+	size_t		left[DTLS_SHA256_LANES], k;
+	unsigned int	i, usedspace, active;
+
+	for (; n > DTLS_SHA256_LANES; n -= DTLS_SHA256_LANES) {
+		dtls_sha256_update_multi(context, data, len, DTLS_SHA256_LANES);
+		context += DTLS_SHA256_LANES;
+		data += DTLS_SHA256_LANES;
+		len += DTLS_SHA256_LANES;
+	}
+
+	for (i = 0; i < n; i++) {
+		assert(context[i] != (dtls_sha256_ctx*)0);
+		p[i] = data[i];
+		left[i] = len[i];
+	}
+
+	/*
+	 * Each round takes the next block from every message, either
+	 * directly from the input or from the buffer once it is full,
+	 * and processes all of them together:
+	 */
+	do {
+		active = 0;
+		for (i = 0; i < n; i++) {
+			block[i] = (sha2_byte*)0;
+			usedspace = (context[i]->bitcount >> 3) % DTLS_SHA256_BLOCK_LENGTH;
+			if (usedspace == 0 && left[i] >= DTLS_SHA256_BLOCK_LENGTH) {
+				block[i] = p[i];
+				k = DTLS_SHA256_BLOCK_LENGTH;
+			} else {
+				k = DTLS_SHA256_BLOCK_LENGTH - usedspace;
+				if (k > left[i]) {
+					k = left[i];
+				}
+				if (k > 0) {
+					MEMCPY_BCOPY(&context[i]->buffer[usedspace], p[i], k);
+				}
+				if (usedspace + k == DTLS_SHA256_BLOCK_LENGTH) {
+					block[i] = context[i]->buffer;
+				}
+			}
+			context[i]->bitcount += (sha2_word64)k << 3;
+			p[i] += k;
+			left[i] -= k;
+			if (block[i]) {
+				active++;
+			}
+		}
+		if (active) {
+			sha256_lanes(context, block, n);
+		}
+	} while (active);
+}
+
+void dtls_sha256_final_multi(sha2_byte **digest, dtls_sha256_ctx **context, unsigned int n) {
+	const sha2_byte	*block[DTLS_SHA256_LANES];
+	sha2_word64	bitcount;
+	unsigned int	i, j, usedspace, active;
+
+	for (; n > DTLS_SHA256_LANES; n -= DTLS_SHA256_LANES) {
+		dtls_sha256_final_multi(digest, context, DTLS_SHA256_LANES);
+		digest += DTLS_SHA256_LANES;
+		context += DTLS_SHA256_LANES;
+	}
+
+	/* Begin padding with a 1 bit, which may need an extra block: */
+	active = 0;
+	for (i = 0; i < n; i++) {
+		assert(context[i] != (dtls_sha256_ctx*)0 && digest[i] != (sha2_byte*)0);
+		block[i] = (sha2_byte*)0;
+		usedspace = (context[i]->bitcount >> 3) % DTLS_SHA256_BLOCK_LENGTH;
+		context[i]->buffer[usedspace++] = 0x80;
+		if (usedspace <= DTLS_SHA256_SHORT_BLOCK_LENGTH) {
+			MEMSET_BZERO(&context[i]->buffer[usedspace], DTLS_SHA256_SHORT_BLOCK_LENGTH - usedspace);
+		} else {
+			MEMSET_BZERO(&context[i]->buffer[usedspace], DTLS_SHA256_BLOCK_LENGTH - usedspace);
+			block[i] = context[i]->buffer;
+			active++;
+		}
+	}
+	if (active) {
+		sha256_lanes(context, block, n);
+	}
+
+	/* Set the bit count for the final transform: */
+	for (i = 0; i < n; i++) {
+		if (block[i]) {
+			MEMSET_BZERO(context[i]->buffer, DTLS_SHA256_SHORT_BLOCK_LENGTH);
+		}
+		bitcount = context[i]->bitcount;
+		for (j = DTLS_SHA256_BLOCK_LENGTH; j > DTLS_SHA256_SHORT_BLOCK_LENGTH; j--) {
+			context[i]->buffer[j - 1] = (sha2_byte)bitcount;
+			bitcount >>= 8;
+		}
+		block[i] = context[i]->buffer;
+	}
+	sha256_lanes(context, block, n);
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 8; j++) {
+			digest[i][4 * j] = (sha2_byte)(context[i]->state[j] >> 24);
+			digest[i][4 * j + 1] = (sha2_byte)(context[i]->state[j] >> 16);
+			digest[i][4 * j + 2] = (sha2_byte)(context[i]->state[j] >> 8);
+			digest[i][4 * j + 3] = (sha2_byte)context[i]->state[j];
+		}
+		/* Clean up state data: */
+		MEMSET_BZERO(context[i], sizeof(*context[i]));
+	}
+}
+
 char *dtls_sha256_end(dtls_sha256_ctx* context, char buffer[]) {
 	sha2_byte	digest[DTLS_SHA256_DIGEST_LENGTH], *d = digest;
 	int		i;
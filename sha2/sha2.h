@@ -124,6 +124,26 @@ typedef struct _dtls_sha512_ctx {
 typedef dtls_sha512_ctx dtls_sha384_ctx;
 
 
+/*** SHA-256 Accelerated Implementations ******************************/
+/*
+ * On x86, the SHA-256 compression function uses the SHA extensions
+ * (SHA-NI) if the CPU has them.  dtls_sha256_update_multi() and
+ * dtls_sha256_final_multi() hash several independent messages at
+ * once, eight of them in parallel with AVX2 on CPUs without SHA-NI.
+ * The result is the same as with the single message functions.
+ *
+ * dtls_sha256_features() returns the available extensions, and
+ * dtls_sha256_set_features() can restrict them, e.g. to compare the
+ * implementations.  Define SHA2_NO_SIMD to build the portable code
+ * only.
+ */
+#define DTLS_SHA256_SHANI	0x01	/* SHA extensions */
+#define DTLS_SHA256_AVX2	0x02	/* eight lanes with AVX2 */
+
+/* The number of messages that are hashed in parallel */
+#define DTLS_SHA256_LANES	8
+
+
 /*** SHA-256/384/512 Function Prototypes ******************************/
 #ifndef NOPROTO
 #ifdef SHA2_USE_INTTYPES_H
@@ -132,6 +152,10 @@ typedef dtls_sha512_ctx dtls_sha384_ctx;
 void dtls_sha256_init(dtls_sha256_ctx *);
 void dtls_sha256_update(dtls_sha256_ctx*, const uint8_t*, size_t);
 void dtls_sha256_final(uint8_t[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ctx*);
+void dtls_sha256_update_multi(dtls_sha256_ctx**, const uint8_t**, const size_t*, unsigned int);
+void dtls_sha256_final_multi(uint8_t**, dtls_sha256_ctx**, unsigned int);
+unsigned int dtls_sha256_features(void);
+void dtls_sha256_set_features(unsigned int);
 char* dtls_sha256_end(dtls_sha256_ctx*, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 char* dtls_sha256_data(const uint8_t*, size_t, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 #endif
@@ -158,6 +182,10 @@ char* dtls_sha512_data(const uint8_t*, size_t, char[DTLS_SHA512_DIGEST_STRING_LE
 void dtls_sha256_init(dtls_sha256_ctx *);
 void dtls_sha256_update(dtls_sha256_ctx*, const u_int8_t*, size_t);
 void dtls_sha256_final(u_int8_t[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ctx*);
+void dtls_sha256_update_multi(dtls_sha256_ctx**, const u_int8_t**, const size_t*, unsigned int);
+void dtls_sha256_final_multi(u_int8_t**, dtls_sha256_ctx**, unsigned int);
+unsigned int dtls_sha256_features(void);
+void dtls_sha256_set_features(unsigned int);
 char* dtls_sha256_end(dtls_sha256_ctx*, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 char* dtls_sha256_data(const u_int8_t*, size_t, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 #endif
@@ -186,6 +214,10 @@ char* dtls_sha512_data(const u_int8_t*, size_t, char[DTLS_SHA512_DIGEST_STRING_L
 void dtls_sha256_init();
 void dtls_sha256_update();
 void dtls_sha256_final();
+void dtls_sha256_update_multi();
+void dtls_sha256_final_multi();
+unsigned int dtls_sha256_features();
+void dtls_sha256_set_features();
 char* dtls_sha256_end();
 char* dtls_sha256_data();
 #endif
@@ -46,6 +46,20 @@ void usage(char *prog) {
 	exit(-1);
 }
 
+/* The SHA-256 implementations to compare, see dtls_sha256_features(): */
+static const struct {
+	const char	*name;
+	unsigned int	features;
+	int		multi;	/* hash DTLS_SHA256_LANES messages at once */
+} sha256_impl[] = {
+	{ "SHA-256              ", 0, 0 },
+	{ "SHA-256 (SHA-NI)     ", DTLS_SHA256_SHANI, 0 },
+	{ "SHA-256 x8           ", 0, 1 },
+	{ "SHA-256 x8 (SHA-NI)  ", DTLS_SHA256_SHANI, 1 },
+	{ "SHA-256 x8 (AVX2)    ", DTLS_SHA256_AVX2, 1 }
+};
+#define SHA256_IMPLS	(sizeof(sha256_impl) / sizeof(sha256_impl[0]))
+
 void printspeed(char *caption, unsigned long bytes, double time) {
 	if (bytes / 1073741824UL > 0) {
                 printf("%s %.4f sec (%.3f GBps)\n", caption, time, (double)bytes/1073741824UL/time);
@@ -59,16 +73,56 @@ void printspeed(char *caption, unsigned long bytes, double time) {
 }
 
 
+/*
+ * Hashes bytes in total, either as one message or split evenly into
+ * DTLS_SHA256_LANES messages, and returns the hex digest of the first
+ * message in md:
+ */
+void sha256_run(int multi, char *buf, int bytes, char *md) {
+	dtls_sha256_ctx	c[DTLS_SHA256_LANES], *cp[DTLS_SHA256_LANES];
+	const u_int8_t	*data[DTLS_SHA256_LANES];
+	size_t		len[DTLS_SHA256_LANES];
+	u_int8_t	digest[DTLS_SHA256_LANES][DTLS_SHA256_DIGEST_LENGTH];
+	u_int8_t	*dp[DTLS_SHA256_LANES];
+	int		lanes, lanebytes, i, j;
+
+	lanes = multi ? DTLS_SHA256_LANES : 1;
+	lanebytes = bytes / lanes;
+	for (i = 0; i < lanes; i++) {
+		dtls_sha256_init(&c[i]);
+		cp[i] = &c[i];
+		data[i] = (u_int8_t*)buf;
+		len[i] = BUFSIZE;
+		dp[i] = digest[i];
+	}
+	for (j = 0; j < lanebytes / BUFSIZE; j++) {
+		dtls_sha256_update_multi(cp, data, len, lanes);
+	}
+	if (lanebytes % BUFSIZE) {
+		for (i = 0; i < lanes; i++) {
+			len[i] = lanebytes % BUFSIZE;
+		}
+		dtls_sha256_update_multi(cp, data, len, lanes);
+	}
+	dtls_sha256_final_multi(dp, cp, lanes);
+
+	for (i = 0; i < DTLS_SHA256_DIGEST_LENGTH; i++) {
+		sprintf(md + 2 * i, "%02x", digest[0][i]);
+	}
+}
+
 int main(int argc, char **argv) {
-	dtls_sha256_ctx	c256;
 	dtls_sha384_ctx	c384;
 	dtls_sha512_ctx	c512;
 	char		buf[BUFSIZE];
 	char		md[DTLS_SHA512_DIGEST_STRING_LENGTH];
+	char		caption[64];
 	int		bytes, blocks, rep, i, j;
+	unsigned int	k, features;
 	struct timeval	start, end;
-	double		t, ave256, ave384, ave512;
-	double		best256, best384, best512;
+	double		t, ave384, ave512;
+	double		best384, best512;
+	double		ave256[SHA256_IMPLS], best256[SHA256_IMPLS];
 
 	if (argc > 4) {
 		usage(argv[0]);
@@ -77,7 +131,7 @@ int main(int argc, char **argv) {
 	/* Default to 1024 16K blocks (16 MB) */
 	bytes = 1024 * 1024 * 16;
 	if (argc > 1) {
-		blocks = atoi(argv[1]);
+		bytes = atoi(argv[1]);
 	}
 	blocks = bytes / BUFSIZE;
 
@@ -89,33 +143,38 @@ int main(int argc, char **argv) {
 
 	/* Set up the input data */
 	if (argc > 3) {
-		memset(buf, atoi(argv[2]), BUFSIZE);
+		memset(buf, atoi(argv[3]), BUFSIZE);
 	} else {
 		memset(buf, 0xb7, BUFSIZE);
 	}
 
-	ave256 = ave384 = ave512 = 0;
-	best256 = best384 = best512 = 100000;
+	features = dtls_sha256_features();
+	ave384 = ave512 = 0;
+	best384 = best512 = 100000;
+	for (k = 0; k < SHA256_IMPLS; k++) {
+		ave256[k] = 0;
+		best256[k] = 100000;
+	}
 	for (i = 0; i < rep; i++) {
-		dtls_sha256_init(&c256);
 		dtls_sha384_init(&c384);
 		dtls_sha512_init(&c512);
-	
-		gettimeofday(&start, (struct timezone*)0);
-		for (j = 0; j < blocks; j++) {
-			dtls_sha256_update(&c256, (unsigned char*)buf, BUFSIZE);
-		}
-		if (bytes % BUFSIZE) {
-			dtls_sha256_update(&c256, (unsigned char*)buf, bytes % BUFSIZE);
-		}
-		dtls_sha256_end(&c256, md);
-		gettimeofday(&end, (struct timezone*)0);
-		t = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / 1000000.0;
-		ave256 += t;
-		if (t < best256) {
-			best256 = t;
+
+		for (k = 0; k < SHA256_IMPLS; k++) {
+			if (sha256_impl[k].features & ~features) {
+				continue;
+			}
+			dtls_sha256_set_features(sha256_impl[k].features);
+			gettimeofday(&start, (struct timezone*)0);
+			sha256_run(sha256_impl[k].multi, buf, bytes, md);
+			gettimeofday(&end, (struct timezone*)0);
+			t = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / 1000000.0;
+			ave256[k] += t;
+			if (t < best256[k]) {
+				best256[k] = t;
+			}
+			printf("%s[%d] (%.4f/%.4f/%.4f seconds) = 0x%s\n", sha256_impl[k].name, i+1, t, ave256[k]/(i+1), best256[k], md);
 		}
-		printf("SHA-256[%d] (%.4f/%.4f/%.4f seconds) = 0x%s\n", i+1, t, ave256/(i+1), best256, md);
+		dtls_sha256_set_features(features);
 
 		gettimeofday(&start, (struct timezone*)0);
 		for (j = 0; j < blocks; j++) {
@@ -149,7 +208,6 @@ int main(int argc, char **argv) {
 		}
 		printf("SHA-512[%d] (%.4f/%.4f/%.4f seconds) = 0x%s\n", i+1, t, ave512/(i+1), best512, md);
 	}
-	ave256 /= rep;
 	ave384 /= rep;
 	ave512 /= rep;
 	printf("\nTEST RESULTS SUMMARY:\nTEST REPETITIONS: %d\n", rep);
@@ -162,8 +220,15 @@ int main(int argc, char **argv) {
 	} else {
 		printf("TEST SET SIZE: %d B\n", bytes);
 	}
-	printspeed("SHA-256 average:", bytes, ave256);
-	printspeed("SHA-256 best:   ", bytes, best256);
+	for (k = 0; k < SHA256_IMPLS; k++) {
+		if (sha256_impl[k].features & ~features) {
+			continue;
+		}
+		sprintf(caption, "%s average:", sha256_impl[k].name);
+		printspeed(caption, bytes, ave256[k] / rep);
+		sprintf(caption, "%s best:   ", sha256_impl[k].name);
+		printspeed(caption, bytes, best256[k]);
+	}
 	printspeed("SHA-384 average:", bytes, ave384);
 	printspeed("SHA-384 best:   ", bytes, best384);
 	printspeed("SHA-512 average:", bytes, ave512);
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_CONTIKI
+#include "contiki.h"
+#include "contiki-lib.h"
+#include "contiki-net.h"
+#endif /* WITH_CONTIKI */
+
+#include "tinydtls.h"
+#include "numeric.h"
+#include "chacha20.h"
+
+#include "chacha20-testdata.c"
+
+void
+dump(unsigned char *buf, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    printf("%02x ", buf[i++]);
+    if (i % 4 == 0)
+      printf(" ");
+    if (i % 16 == 0)
+      printf("\n\t");
+  }
+  printf("\n");
+}
+
+#ifdef WITH_CONTIKI
+PROCESS(chacha20_test_process, "ChaCha20-Poly1305 test process");
+AUTOSTART_PROCESSES(&chacha20_test_process);
+PROCESS_THREAD(chacha20_test_process, ev, d)
+{
+#else  /* WITH_CONTIKI */
+int main(int argc, char **argv) {
+#endif /* WITH_CONTIKI */
+  static unsigned char msg[1000];
+  static unsigned char buf[sizeof(msg) + DTLS_POLY1305_TAG_SIZE];
+  long int len;
+  size_t i;
+  int n;
+
+#ifdef WITH_CONTIKI
+  PROCESS_BEGIN();
+#endif /* WITH_CONTIKI */
+
+  for (n = 0; n < sizeof(data)/sizeof(struct test_vector); ++n) {
+
+    if (data[n].msg)
+      memcpy(msg, data[n].msg, data[n].lm);
+    else
+      for (i = 0; i < data[n].lm; i++)
+	msg[i] = i % 251;
+
+    memcpy(buf, msg, data[n].lm);
+    len = dtls_chacha20_poly1305_encrypt_message(data[n].key, data[n].nonce,
+						 buf, data[n].lm,
+						 data[n].aad, data[n].la);
+
+    printf("Test Case #%d ", n+1);
+    if (len != data[n].lm + DTLS_POLY1305_TAG_SIZE
+	|| (data[n].result && memcmp(buf, data[n].result, data[n].lm))
+	|| memcmp(buf + data[n].lm, data[n].tag, DTLS_POLY1305_TAG_SIZE))
+      printf("FAILED, ");
+    else
+      printf("OK, ");
+
+    printf("tag is (total length = %lu):\n\t", len);
+    dump(buf + data[n].lm, DTLS_POLY1305_TAG_SIZE);
+
+    len = dtls_chacha20_poly1305_decrypt_message(data[n].key, data[n].nonce,
+						 buf, len,
+						 data[n].aad, data[n].la);
+
+    if (len < 0 || memcmp(buf, msg, data[n].lm))
+      printf("Test Case #%d: cannot decrypt message\n", n+1);
+    else
+      printf("\t*** tag verified (length = %lu) ***\n", len);
+  }
+
+#ifdef WITH_CONTIKI
+  PROCESS_END();
+#else /* WITH_CONTIKI */
+  return 0;
+#endif /* WITH_CONTIKI */
+}
@@ -0,0 +1,511 @@
+/* dtls-bench -- handshake rate and record throughput without sockets
+ *
+ * A server dtls_context_t and a number of client contexts are
+ * connected through an in-memory network that can drop and reorder
+ * datagrams. The benchmark reports
+ *
+ *  - the handshake rate for each cipher suite, with a fixed number
+ *    of clients doing handshakes concurrently, and
+ *  - the application data rate in records/s and MB/s for payloads
+ *    of 16 to 1024 bytes over a single connection.
+ *
+ * With -j, each result is written as a JSON object on a line of its
+ * own, so that results of different releases can be compared by
+ * scripts.
+ *
+ * usage: dtls-bench [-c clients] [-p psk_handshakes] [-e ecdhe_handshakes]
+ *                   [-n records] [-l loss%] [-r reorder%] [-s seed] [-j]
+ */
+
+#include "tinydtls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "global.h"
+#include "dtls_debug.h"
+#include "dtls.h"
+#include "test-harness.h"
+
+#define SERVER_PORT 20220
+#define CLIENT_PORT 30000
+#define MAX_CLIENTS 20000	/* distinct client ports per run */
+
+#define QUEUE_SIZE 4096		/* datagrams in flight */
+#define HANDSHAKE_TIMEOUT 10	/* seconds until a handshake is abandoned */
+
+/* A server or client context and its transport address. */
+typedef struct {
+  dtls_context_t *ctx;
+  session_t addr;
+  int connected;
+  int failed;
+  double deadline;		/* when the handshake is abandoned */
+  unsigned long received;	/* application data records */
+} endpoint_t;
+
+typedef struct {
+  in_port_t to;			/* destination port */
+  session_t from;
+  size_t length;
+  uint8 data[DTLS_MAX_BUF];
+} packet_t;
+
+/* the in-memory network */
+static struct {
+  packet_t *packets;
+  size_t head;			/* next packet to deliver */
+  size_t count;
+  unsigned int loss;		/* percentage of dropped datagrams */
+  unsigned int reorder;		/* percentage of swapped datagrams */
+  unsigned long dropped;
+} net;
+
+static endpoint_t server;
+static endpoint_t *endpoints[65536]; /* by port */
+static uint32_t rand_state = 1;
+static int json;
+
+/* xorshift32, so that runs with the same seed are comparable */
+static uint32_t
+next_random(void) {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+static double
+now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *data, size_t len) {
+  endpoint_t *self = (endpoint_t *)dtls_get_app_data(ctx);
+  packet_t *p;
+
+  if (len > DTLS_MAX_BUF || net.count == QUEUE_SIZE ||
+      next_random() % 100 < net.loss) {
+    net.dropped++;
+    return len;
+  }
+
+  p = &net.packets[(net.head + net.count) % QUEUE_SIZE];
+  p->to = ntohs(session->addr.sin.sin_port);
+  memcpy(&p->from, &self->addr, sizeof(session_t));
+  memcpy(p->data, data, len);
+  p->length = len;
+  net.count++;
+
+  /* let the new datagram overtake the one queued before */
+  if (net.count > 1 && next_random() % 100 < net.reorder) {
+    packet_t tmp;
+    packet_t *q = &net.packets[(net.head + net.count - 2) % QUEUE_SIZE];
+
+    memcpy(&tmp, q, sizeof(packet_t));
+    memcpy(q, p, sizeof(packet_t));
+    memcpy(p, &tmp, sizeof(packet_t));
+  }
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+	       uint8 *data, size_t len) {
+  endpoint_t *self = (endpoint_t *)dtls_get_app_data(ctx);
+  (void)session;
+  (void)data;
+  (void)len;
+
+  self->received++;
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level, unsigned short code) {
+  endpoint_t *self = (endpoint_t *)dtls_get_app_data(ctx);
+  (void)session;
+
+  if (self == &server)
+    return 0;
+
+  if (code == DTLS_EVENT_CONNECTED)
+    self->connected = 1;
+  else if (level == DTLS_ALERT_LEVEL_FATAL)
+    self->failed = 1;
+  return 0;
+}
+
+static dtls_handler_t server_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+#ifdef DTLS_PSK
+  .get_psk_info = test_get_psk_info,
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  .get_ecdsa_key = test_get_ecdsa_key,
+  .verify_ecdsa_key = test_verify_ecdsa_key
+#endif /* DTLS_ECC */
+};
+
+#ifdef DTLS_PSK
+static dtls_handler_t psk_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_psk_info = test_get_psk_info,
+};
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static dtls_handler_t ecdhe_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_ecdsa_key = test_get_ecdsa_key,
+  .verify_ecdsa_key = test_verify_ecdsa_key
+};
+#endif /* DTLS_ECC */
+
+/* Delivers datagrams until the network is idle. */
+static void
+deliver(void) {
+  packet_t p;
+  endpoint_t *to;
+
+  while (net.count) {
+    memcpy(&p, &net.packets[net.head], sizeof(packet_t));
+    net.head = (net.head + 1) % QUEUE_SIZE;
+    net.count--;
+
+    to = endpoints[p.to];
+    if (to)
+      dtls_handle_message(to->ctx, &p.from, p.data, p.length);
+  }
+}
+
+/* Waits until the next retransmission of any context in list or
+ * until deadline and sends the retransmissions that are due. */
+static void
+wait_retransmit(endpoint_t **list, size_t count, double deadline) {
+  clock_time_t next, earliest = 0;
+  dtls_tick_t now;
+  double wait;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    if (list[i]) {
+      dtls_check_retransmit(list[i]->ctx, &next);
+      if (next && (!earliest || next < earliest))
+	earliest = next;
+    }
+  }
+
+  wait = deadline - now_sec();
+  if (earliest) {
+    dtls_ticks(&now);
+    if (earliest <= now)
+      wait = 0;
+    else if ((double)(earliest - now) / DTLS_TICKS_PER_SECOND < wait)
+      wait = (double)(earliest - now) / DTLS_TICKS_PER_SECOND;
+  }
+  if (wait > 0)
+    usleep(wait * 1e6);
+
+  for (i = 0; i < count; i++)
+    if (list[i])
+      dtls_check_retransmit(list[i]->ctx, NULL);
+}
+
+static endpoint_t *
+new_endpoint(in_port_t port, dtls_handler_t *cb) {
+  endpoint_t *e = calloc(1, sizeof(endpoint_t));
+
+  if (!e)
+    return NULL;
+  e->ctx = dtls_new_context(e);
+  if (!e->ctx) {
+    free(e);
+    return NULL;
+  }
+  dtls_set_handler(e->ctx, cb);
+  test_set_addr(&e->addr, port);
+  endpoints[port] = e;
+  return e;
+}
+
+static void
+free_endpoint(endpoint_t *e) {
+  in_port_t port = ntohs(e->addr.addr.sin.sin_port);
+
+  /* sends a close_notify through the network */
+  dtls_free_context(e->ctx);
+  endpoints[port] = NULL;
+  free(e);
+}
+
+static int
+start_server(void) {
+  memset(&server, 0, sizeof(server));
+  server.ctx = dtls_new_context(&server);
+  if (!server.ctx)
+    return -1;
+  dtls_set_handler(server.ctx, &server_cb);
+  test_set_addr(&server.addr, SERVER_PORT);
+  endpoints[SERVER_PORT] = &server;
+  return 0;
+}
+
+static void
+stop_server(void) {
+  dtls_free_context(server.ctx);
+  endpoints[SERVER_PORT] = NULL;
+  net.count = 0;
+}
+
+/* Starts a handshake with a client on the next free port. */
+static endpoint_t *
+start_client(dtls_handler_t *cb, unsigned long *sequence) {
+  endpoint_t *e;
+
+  e = new_endpoint(CLIENT_PORT + (*sequence)++ % MAX_CLIENTS, cb);
+  if (!e)
+    return NULL;
+  e->deadline = now_sec() + HANDSHAKE_TIMEOUT;
+  if (dtls_connect(e->ctx, &server.addr) < 0) {
+    free_endpoint(e);
+    return NULL;
+  }
+  return e;
+}
+
+static void
+report_handshakes(const char *suite, unsigned long completed,
+		  unsigned long failed, double elapsed) {
+  if (json)
+    printf("{\"bench\":\"handshake\",\"suite\":\"%s\",\"completed\":%lu,"
+	   "\"failed\":%lu,\"seconds\":%.3f,\"handshakes_per_sec\":%.1f,"
+	   "\"loss\":%u,\"reorder\":%u}\n",
+	   suite, completed, failed, elapsed, completed / elapsed,
+	   net.loss, net.reorder);
+  else
+    printf("handshake %-12s %8lu ok %6lu failed %8.3f s %10.1f handshakes/s\n",
+	   suite, completed, failed, elapsed, completed / elapsed);
+}
+
+/* Runs total handshakes with up to concurrency clients at a time. */
+static int
+bench_handshakes(const char *suite, dtls_handler_t *cb,
+		 unsigned long total, size_t concurrency) {
+  endpoint_t **clients;
+  unsigned long started = 0, completed = 0, failed = 0, sequence = 0;
+  double start, elapsed, deadline;
+  size_t i, active;
+
+  if (!total)
+    return 0;
+  if (concurrency > total)
+    concurrency = total;
+
+  clients = calloc(concurrency + 1, sizeof(endpoint_t *));
+  if (!clients || start_server() < 0) {
+    free(clients);
+    return -1;
+  }
+  clients[concurrency] = &server;
+
+  start = now_sec();
+  for (i = 0; i < concurrency; i++, started++)
+    clients[i] = start_client(cb, &sequence);
+
+  for (;;) {
+    deliver();
+
+    active = 0;
+    deadline = now_sec() + HANDSHAKE_TIMEOUT;
+    for (i = 0; i < concurrency; i++) {
+      endpoint_t *c = clients[i];
+
+      if (!c)
+	continue;
+      if (c->connected || c->failed || now_sec() > c->deadline) {
+	if (c->connected)
+	  completed++;
+	else
+	  failed++;
+	free_endpoint(c);
+	clients[i] = NULL;
+	if (started < total) {
+	  clients[i] = start_client(cb, &sequence);
+	  started++;
+	}
+      }
+      if (clients[i]) {
+	active++;
+	if (clients[i]->deadline < deadline)
+	  deadline = clients[i]->deadline;
+      }
+    }
+    if (!active)
+      break;
+
+    if (!net.count)
+      wait_retransmit(clients, concurrency + 1, deadline);
+  }
+  elapsed = now_sec() - start;
+
+  stop_server();
+  free(clients);
+  report_handshakes(suite, completed, failed, elapsed);
+  return completed ? 0 : -1;
+}
+
+/* Sends count records of size bytes from a client to the server. */
+static int
+bench_records(dtls_handler_t *cb, unsigned long count, size_t size) {
+  uint8 payload[1024];
+  endpoint_t *client;
+  endpoint_t *list[2];
+  unsigned long i, sequence = 0;
+  double start, elapsed;
+
+  if (start_server() < 0)
+    return -1;
+  client = start_client(cb, &sequence);
+  list[0] = client;
+  list[1] = &server;
+  while (client && !client->connected && !client->failed &&
+	 now_sec() < client->deadline) {
+    deliver();
+    if (!client->connected && !net.count)
+      wait_retransmit(list, 2, client->deadline);
+  }
+  if (!client || !client->connected) {
+    fprintf(stderr, "dtls-bench: no connection for the record test\n");
+    if (client)
+      free_endpoint(client);
+    stop_server();
+    return -1;
+  }
+
+  memset(payload, 0x5a, size);
+  server.received = 0;
+  start = now_sec();
+  for (i = 0; i < count; i++) {
+    dtls_write(client->ctx, &server.addr, payload, size);
+    if (net.count >= 64)
+      deliver();
+  }
+  deliver();
+  elapsed = now_sec() - start;
+
+  if (json)
+    printf("{\"bench\":\"records\",\"size\":%zu,\"records\":%lu,"
+	   "\"delivered\":%lu,\"seconds\":%.3f,\"records_per_sec\":%.1f,"
+	   "\"mbytes_per_sec\":%.3f,\"loss\":%u,\"reorder\":%u}\n",
+	   size, count, server.received, elapsed, count / elapsed,
+	   count * size / elapsed / 1e6, net.loss, net.reorder);
+  else
+    printf("records %4zu bytes %10lu sent %10lu delivered %8.3f s "
+	   "%10.1f records/s %8.3f MB/s\n",
+	   size, count, server.received, elapsed, count / elapsed,
+	   count * size / elapsed / 1e6);
+
+  free_endpoint(client);
+  stop_server();
+  return 0;
+}
+
+int
+main(int argc, char **argv) {
+  static const size_t sizes[] = { 16, 64, 256, 1024 };
+  unsigned long psk_handshakes = 1000, ecdhe_handshakes = 20;
+  unsigned long records = 100000;
+  size_t concurrency = 16, i;
+  dtls_handler_t *record_cb = NULL;
+  int opt, res = 0;
+
+  while ((opt = getopt(argc, argv, "c:p:e:n:l:r:s:j")) != -1) {
+    switch (opt) {
+    case 'c':
+      concurrency = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      psk_handshakes = strtoul(optarg, NULL, 10);
+      break;
+    case 'e':
+      ecdhe_handshakes = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      records = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      net.loss = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      net.reorder = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      rand_state = strtoul(optarg, NULL, 10);
+      if (!rand_state)
+	rand_state = 1;
+      break;
+    case 'j':
+      json = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c clients] [-p psk_handshakes] "
+	      "[-e ecdhe_handshakes] [-n records] [-l loss%%] "
+	      "[-r reorder%%] [-s seed] [-j]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (concurrency < 1)
+    concurrency = 1;
+  if (concurrency > MAX_CLIENTS / 2)
+    concurrency = MAX_CLIENTS / 2;
+
+  net.packets = calloc(QUEUE_SIZE, sizeof(packet_t));
+  if (!net.packets)
+    return 1;
+
+  dtls_init();
+  dtls_set_log_level(DTLS_LOG_EMERG);
+
+#ifdef DTLS_PSK
+  if (bench_handshakes("psk", &psk_cb, psk_handshakes, concurrency) < 0)
+    res = 1;
+  record_cb = &psk_cb;
+#else /* DTLS_PSK */
+  if (psk_handshakes)
+    fprintf(stderr, "dtls-bench: no PSK support, skipping PSK handshakes\n");
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  if (bench_handshakes("ecdhe-ecdsa", &ecdhe_cb, ecdhe_handshakes,
+		       concurrency) < 0)
+    res = 1;
+  if (!record_cb)
+    record_cb = &ecdhe_cb;
+#else /* DTLS_ECC */
+  if (ecdhe_handshakes)
+    fprintf(stderr, "dtls-bench: no ECC support, skipping ECDHE_ECDSA handshakes\n");
+#endif /* DTLS_ECC */
+
+  for (i = 0; record_cb && i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    if (bench_records(record_cb, records, sizes[i]) < 0)
+      res = 1;
+
+  free(net.packets);
+  return res;
+}
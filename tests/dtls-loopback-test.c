@@ -0,0 +1,1104 @@
+/* dtls-loopback-test -- handshake scenarios over an in-memory loopback
+ *
+ * A client and a server dtls_context_t exchange datagrams through
+ * in-memory queues. Each test case sets up fresh contexts, runs a
+ * scenario and checks the outcome. The program exits with a non-zero
+ * status if any test case fails.
+ *
+ * usage: dtls-loopback-test
+ */
+
+#include "tinydtls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "global.h"
+#include "dtls_debug.h"
+#include "dtls.h"
+#include "pool.h"
+#include "ticket.h"
+#include "test-harness.h"
+
+/* Number of clients in the batch tests. */
+#define BATCH_CLIENTS 3
+
+/* The state of one test case. The dtls contexts point here via app. */
+typedef struct {
+  dtls_context_t *server;
+  dtls_context_t *client;
+  session_t server_addr;
+  session_t client_addr;
+  test_queue_t to_server;
+  test_queue_t to_client;
+  int connected;
+  int psk_lookups;		/* number of PSK lookups by the server */
+  unsigned long received;	/* application records at the server */
+  unsigned long client_received; /* application records at the client */
+  int batches;			/* calls to the write_batch handler */
+  size_t batch_size;		/* datagrams in the last batch */
+  int fail_writes;		/* let the write handler fail */
+} loopback_t;
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *data, size_t len) {
+  loopback_t *l = (loopback_t *)dtls_get_app_data(ctx);
+  test_queue_t *q = ctx == l->server ? &l->to_client : &l->to_server;
+
+  if (l->fail_writes)
+    return -1;
+
+  return test_queue_add(q, ctx, session, data, len);
+}
+
+static int
+send_batch(struct dtls_context_t *ctx, session_t sessions[],
+	   uint8 *bufs[], size_t lens[], size_t count) {
+  loopback_t *l = (loopback_t *)dtls_get_app_data(ctx);
+  size_t i;
+
+  l->batches++;
+  l->batch_size = count;
+  for (i = 0; i < count; i++)
+    send_to_peer(ctx, &sessions[i], bufs[i], lens[i]);
+  return count;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+	       uint8 *data, size_t len) {
+  loopback_t *l = (loopback_t *)dtls_get_app_data(ctx);
+  (void)session;
+  (void)data;
+  (void)len;
+
+  if (ctx == l->server)
+    l->received++;
+  else
+    l->client_received++;
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level, unsigned short code) {
+  loopback_t *l = (loopback_t *)dtls_get_app_data(ctx);
+  (void)session;
+  (void)level;
+
+  if (ctx == l->client && code == DTLS_EVENT_CONNECTED)
+    l->connected = 1;
+  return 0;
+}
+
+#ifdef DTLS_PSK
+/* Counts the PSK lookups of the server, which are skipped when a
+ * session is resumed. */
+static int
+get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id, size_t id_len,
+	     unsigned char *result, size_t result_length) {
+  loopback_t *l = (loopback_t *)dtls_get_app_data(ctx);
+
+  if (type == DTLS_PSK_KEY && ctx != l->client)
+    l->psk_lookups++;
+  return test_get_psk_info(ctx, session, type, id, id_len,
+			   result, result_length);
+}
+#endif /* DTLS_PSK */
+
+static dtls_handler_t cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+#ifdef DTLS_PSK
+  .get_psk_info = get_psk_info,
+#endif /* DTLS_PSK */
+};
+
+/* Like cb, but collects datagrams with send_batch(). */
+static dtls_handler_t batch_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+#ifdef DTLS_PSK
+  .get_psk_info = get_psk_info,
+#endif /* DTLS_PSK */
+  .write_batch = send_batch,
+};
+
+#ifdef DTLS_ECC
+/* Offers ECDHE_ECDSA only and collects datagrams with send_batch(). */
+static dtls_handler_t ecdhe_batch_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_ecdsa_key = test_get_ecdsa_key,
+  .verify_ecdsa_key = test_verify_ecdsa_key,
+  .write_batch = send_batch,
+};
+#endif /* DTLS_ECC */
+
+static dtls_context_t *
+new_context(loopback_t *l) {
+  dtls_context_t *ctx = dtls_new_context(l);
+
+  if (ctx)
+    dtls_set_handler(ctx, &cb);
+  return ctx;
+}
+
+static int
+loopback_init(loopback_t *l) {
+  memset(l, 0, sizeof(loopback_t));
+  test_set_addr(&l->server_addr, 20220);
+  test_set_addr(&l->client_addr, 40000);
+  l->server = new_context(l);
+  l->client = new_context(l);
+  return l->server && l->client ? 0 : -1;
+}
+
+static void
+loopback_free(loopback_t *l) {
+  dtls_free_context(l->server);
+  dtls_free_context(l->client);
+}
+
+/* Delivers queued datagrams until both directions are idle. */
+static void
+pump(loopback_t *l) {
+  test_queue_t q;
+  int i;
+
+  while (l->to_server.count || l->to_client.count) {
+    q = l->to_server;
+    l->to_server.count = 0;
+    for (i = 0; i < q.count; i++)
+      dtls_handle_message(l->server, &l->client_addr,
+			  q.packets[i].data, q.packets[i].length);
+
+    q = l->to_client;
+    l->to_client.count = 0;
+    for (i = 0; i < q.count; i++)
+      dtls_handle_message(l->client, &l->server_addr,
+			  q.packets[i].data, q.packets[i].length);
+  }
+}
+
+/* Runs a handshake from the client and sends one record. Returns 1
+ * if the record has arrived at the server. */
+static int
+connect_and_send(loopback_t *l) {
+  uint8 payload[16];
+  unsigned long received = l->received;
+
+  l->connected = 0;
+  dtls_connect(l->client, &l->server_addr);
+  pump(l);
+  if (!l->connected)
+    return 0;
+
+  memset(payload, 0x5a, sizeof(payload));
+  dtls_write(l->client, &l->server_addr, payload, sizeof(payload));
+  pump(l);
+  return l->received == received + 1;
+}
+
+/* Forgets the connection on the client. The client's session cache
+ * is kept, so the next handshake is an abbreviated one. */
+static void
+client_forget(loopback_t *l) {
+  dtls_peer_t *peer = dtls_get_peer(l->client, &l->server_addr);
+
+  if (peer)
+    dtls_reset_peer(l->client, peer);
+  pump(l);			/* deliver the close_notify */
+}
+
+/* Sends one record from the client and returns 1 if it has arrived at
+ * the server. The record is copied to @p record if not NULL. */
+static int
+client_send(loopback_t *l, test_packet_t *record) {
+  uint8 payload[16];
+  unsigned long received = l->received;
+
+  memset(payload, 0x5a, sizeof(payload));
+  dtls_write(l->client, &l->server_addr, payload, sizeof(payload));
+  if (record && l->to_server.count)
+    *record = l->to_server.packets[0];
+  pump(l);
+  return l->received == received + 1;
+}
+
+static const unsigned char ticket_key_name[DTLS_TICKET_KEY_NAME_LENGTH] =
+  "loopback ticket";
+static const unsigned char ticket_key[DTLS_TICKET_KEY_LENGTH] =
+  "0123456789abcde";
+
+/* A client resumes its session from a ticket with a server that has
+ * never seen the session but shares the ticket key. */
+static int
+test_ticket_resumption(void) {
+  loopback_t l;
+  int ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = dtls_set_ticket_key(l.server, ticket_key_name, ticket_key) == 0
+    && connect_and_send(&l) && l.psk_lookups == 1;
+
+  /* a new server with an empty session cache */
+  client_forget(&l);
+  dtls_free_context(l.server);
+  l.server = new_context(&l);
+  l.psk_lookups = 0;
+
+  ok = ok && l.server
+    && dtls_set_ticket_key(l.server, ticket_key_name, ticket_key) == 0
+    && connect_and_send(&l) && l.psk_lookups == 0;
+
+  loopback_free(&l);
+  return ok;
+}
+
+/* A client with session tickets disabled resumes its session from
+ * the server's session cache. */
+static int
+test_cache_resumption(void) {
+  loopback_t l;
+  int ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  dtls_set_session_tickets(l.client, 0);
+  ok = connect_and_send(&l) && l.psk_lookups == 1;
+
+  client_forget(&l);
+  l.psk_lookups = 0;
+  ok = ok && connect_and_send(&l) && l.psk_lookups == 0;
+
+  loopback_free(&l);
+  return ok;
+}
+
+/* A ticket is not accepted after DTLS_SESSION_LIFETIME, even if the
+ * key that sealed it is still in use. */
+static int
+test_ticket_expiry(void) {
+  dtls_ticket_keys_t keys;
+  uint8 ticket[DTLS_TICKET_LENGTH];
+  uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
+  uint8 opened[DTLS_MASTER_SECRET_LENGTH];
+  dtls_cipher_t cipher;
+  dtls_compression_t compression;
+  clock_time_t now = 1000;
+  int len, ok;
+
+  memset(&keys, 0, sizeof(keys));
+  memset(master_secret, 0x42, sizeof(master_secret));
+
+  ok = dtls_ticket_set_key(&keys, ticket_key_name, ticket_key, now) == 0;
+  len = dtls_ticket_seal(&keys, TLS_PSK_WITH_AES_128_CCM_8,
+			 TLS_COMPRESSION_NULL, master_secret,
+			 ticket, sizeof(ticket), now);
+  ok = ok && len == DTLS_TICKET_LENGTH;
+
+  ok = ok && dtls_ticket_open(&keys, ticket, len, &cipher, &compression,
+			      opened, now + CLOCK_SECOND) == 0
+    && cipher == TLS_PSK_WITH_AES_128_CCM_8
+    && memcmp(opened, master_secret, sizeof(opened)) == 0;
+
+  ok = ok && dtls_ticket_open(&keys, ticket, len, &cipher, &compression,
+			      opened, now + DTLS_SESSION_LIFETIME * CLOCK_SECOND) < 0;
+  return ok;
+}
+
+/* The client changes its port mid-session. The server finds the peer
+ * by its connection id and answers at the new address. */
+static int
+test_cid_rebind(void) {
+  loopback_t l;
+  session_t old_addr;
+  test_packet_t record;
+  uint8 payload[16];
+  int ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = connect_and_send(&l);
+
+  old_addr = l.client_addr;
+  test_set_addr(&l.client_addr, 40001);
+  ok = ok && client_send(&l, &record)
+    && record.data[0] == DTLS_CT_TLS12_CID
+    && dtls_get_peer(l.server, &l.client_addr)
+    && !dtls_get_peer(l.server, &old_addr);
+
+  memset(payload, 0xa5, sizeof(payload));
+  ok = ok && dtls_write(l.server, &l.client_addr, payload, sizeof(payload)) > 0;
+  pump(&l);
+  ok = ok && l.client_received == 1;
+
+  loopback_free(&l);
+  return ok;
+}
+
+/* Someone who has seen a record of the client sends it again, followed
+ * by a ClientHello with a valid cookie for its own address. The
+ * client's session must survive. */
+static int
+test_cid_replay(void) {
+  loopback_t l;
+  dtls_context_t *attacker;
+  session_t attacker_addr;
+  test_packet_t record, hello, datagram;
+  int ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = connect_and_send(&l) && client_send(&l, &record)
+    && record.data[0] == DTLS_CT_TLS12_CID;
+
+  /* obtain a cookie for the attacker's address */
+  test_set_addr(&attacker_addr, 40002);
+  attacker = new_context(&l);
+  ok = ok && attacker && dtls_connect(attacker, &l.server_addr) > 0
+    && l.to_server.count == 1;
+  if (ok) {
+    l.to_server.count = 0;
+    dtls_handle_message(l.server, &attacker_addr, l.to_server.packets[0].data,
+			l.to_server.packets[0].length);
+    ok = l.to_client.count == 1;
+  }
+  if (ok) {
+    l.to_client.count = 0;
+    dtls_handle_message(attacker, &l.server_addr, l.to_client.packets[0].data,
+			l.to_client.packets[0].length);
+    ok = l.to_server.count == 1;
+  }
+  if (ok) {
+    hello = l.to_server.packets[0];
+    l.to_server.count = 0;
+    ok = record.length + hello.length <= sizeof(datagram.data);
+  }
+
+  if (ok) {
+    memcpy(datagram.data, record.data, record.length);
+    memcpy(datagram.data + record.length, hello.data, hello.length);
+    datagram.length = record.length + hello.length;
+    dtls_handle_message(l.server, &attacker_addr,
+			datagram.data, datagram.length);
+    l.to_client.count = 0;	/* nothing for the client here */
+
+    ok = dtls_get_peer(l.server, &l.client_addr)
+      && !dtls_get_peer(l.server, &attacker_addr)
+      && client_send(&l, NULL);
+  }
+
+  dtls_free_context(attacker);
+  loopback_free(&l);
+  return ok;
+}
+
+#if DTLS_STATS
+/* Returns the number of completed handshakes in @p stats. */
+static uint64_t
+handshakes_completed(const dtls_stats_t *stats) {
+  uint64_t n = 0;
+  int i;
+
+  for (i = 0; i < DTLS_STATS_CIPHERS; i++)
+    n += stats->handshakes_completed[i];
+  return n;
+}
+
+/* Returns 1 if @p histogram holds at least one duration and its
+ * buckets add up to its count. */
+static int
+histogram_recorded(const dtls_histogram_t *histogram) {
+  uint64_t n = 0;
+  int i;
+
+  for (i = 0; i < DTLS_HISTOGRAM_BUCKETS; i++)
+    n += histogram->buckets[i];
+  return histogram->count > 0 && n == histogram->count;
+}
+
+/* Index of the content type in dtls_stats_t.records_in/_out. */
+#define STATS_CT(Type) ((Type) - DTLS_CT_CHANGE_CIPHER_SPEC)
+
+/* A handshake and one application record, checked in the counters
+ * and in the phase durations of both sides. */
+static int
+test_stats(void) {
+  loopback_t l;
+  dtls_stats_t server, client;
+  int ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = connect_and_send(&l);
+  dtls_get_stats(l.server, &server);
+  dtls_get_stats(l.client, &client);
+
+  ok = ok && server.handshakes_started == 1 && client.handshakes_started == 1
+    && handshakes_completed(&server) == 1 && handshakes_completed(&client) == 1
+    && server.handshakes_failed[DTLS_STATS_CIPHER_NONE] == 0
+    && server.hello_verify_requests == 1 && client.hello_verify_requests == 0
+    && client.records_out[STATS_CT(DTLS_CT_APPLICATION_DATA)] == 1
+    && server.records_in[STATS_CT(DTLS_CT_APPLICATION_DATA)] == 1
+    && server.records_in[STATS_CT(DTLS_CT_CHANGE_CIPHER_SPEC)] == 1
+    && client.records_in[STATS_CT(DTLS_CT_CHANGE_CIPHER_SPEC)] == 1
+    && server.records_in[STATS_CT(DTLS_CT_HANDSHAKE)]
+       == client.records_out[STATS_CT(DTLS_CT_HANDSHAKE)]
+    && client.records_in[STATS_CT(DTLS_CT_HANDSHAKE)]
+       == server.records_out[STATS_CT(DTLS_CT_HANDSHAKE)]
+    && server.bytes_in == client.bytes_out && client.bytes_in == server.bytes_out
+    && server.decrypt_failures == 0 && server.replays == 0
+    && server.write_errors == 0 && server.peers == 1 && client.peers == 1;
+
+  /* the cookie exchange is timed by the client, the ServerHello
+   * flight by the server */
+  ok = ok && histogram_recorded(&client.phases[DTLS_PHASE_COOKIE])
+    && server.phases[DTLS_PHASE_COOKIE].count == 0
+    && histogram_recorded(&server.phases[DTLS_PHASE_SERVER_HELLO])
+    && client.phases[DTLS_PHASE_SERVER_HELLO].count == 0
+    && histogram_recorded(&client.phases[DTLS_PHASE_KEY_BLOCK])
+    && histogram_recorded(&server.phases[DTLS_PHASE_KEY_BLOCK])
+    && histogram_recorded(&client.phases[DTLS_PHASE_FINISHED])
+    && histogram_recorded(&server.phases[DTLS_PHASE_FINISHED]);
+
+  loopback_free(&l);
+  return ok;
+}
+#endif /* DTLS_STATS */
+
+#ifdef DTLS_POOL
+#define POOLS_MAX 16
+
+/* While a connection is open, its objects are taken from the pools.
+ * After a close, all objects are back in their pools, and each pool
+ * reports how many objects were in use at the same time. */
+static int
+test_pool_stats(void) {
+  dtls_pool_stats_t stats[POOLS_MAX];
+  loopback_t l;
+  size_t i, n;
+  int used = 0, ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = connect_and_send(&l);
+  n = dtls_pool_get_stats(stats, POOLS_MAX);
+  for (i = 0; i < n && i < POOLS_MAX; i++)
+    used += stats[i].objects > stats[i].free;
+  ok = ok && n > 0 && n <= POOLS_MAX && used > 0;
+
+  ok = ok && dtls_close(l.client, &l.server_addr) == 0;
+  pump(&l);
+  loopback_free(&l);
+
+  n = dtls_pool_get_stats(stats, POOLS_MAX);
+  ok = ok && n > 0 && n <= POOLS_MAX;
+  for (i = 0; ok && i < n; i++)
+    ok = stats[i].free == stats[i].objects && stats[i].peak > 0;
+  return ok;
+}
+#endif /* DTLS_POOL */
+
+/* Adds @p duration to @p histogram as the statistics do. */
+static void
+histogram_add(dtls_histogram_t *histogram, uint64_t duration) {
+  histogram->count++;
+  histogram->sum += duration;
+  histogram->buckets[dtls_histogram_bucket(duration)]++;
+}
+
+/* Quantiles of known durations are the upper ends of their buckets.
+ * The last bucket has no upper end and is reported as the end of its
+ * first power of two. */
+static int
+test_histogram(void) {
+  static const uint64_t durations[] = { 0, 1, 3, 100, 1000 };
+  const uint64_t last = ((uint64_t)2 << (DTLS_HISTOGRAM_BUCKETS - 1)) - 1;
+  dtls_histogram_t h;
+  size_t i;
+  int ok;
+
+  memset(&h, 0, sizeof(h));
+  ok = dtls_histogram_quantile(&h, 0) == 0
+    && dtls_histogram_quantile(&h, 500) == 0
+    && dtls_histogram_quantile(&h, 1000) == 0;
+
+  /* bucket i holds 2^i to 2^(i+1)-1 */
+  ok = ok && dtls_histogram_bucket(0) == 0 && dtls_histogram_bucket(1) == 0
+    && dtls_histogram_bucket(2) == 1 && dtls_histogram_bucket(3) == 1
+    && dtls_histogram_bucket(1023) == 9 && dtls_histogram_bucket(1024) == 10
+    && dtls_histogram_bucket(last) == DTLS_HISTOGRAM_BUCKETS - 1
+    && dtls_histogram_bucket(UINT64_MAX) == DTLS_HISTOGRAM_BUCKETS - 1;
+
+  for (i = 0; i < sizeof(durations) / sizeof(durations[0]); i++)
+    histogram_add(&h, durations[i]);
+
+  ok = ok && dtls_histogram_quantile(&h, 0) == 1
+    && dtls_histogram_quantile(&h, 200) == 1
+    && dtls_histogram_quantile(&h, 400) == 1
+    && dtls_histogram_quantile(&h, 500) == 3
+    && dtls_histogram_quantile(&h, 800) == 127
+    && dtls_histogram_quantile(&h, 990) == 1023
+    && dtls_histogram_quantile(&h, 1000) == 1023;
+
+  /* durations beyond the last bucket are counted in it */
+  histogram_add(&h, last + 1);
+  histogram_add(&h, UINT64_MAX);
+  ok = ok && h.buckets[DTLS_HISTOGRAM_BUCKETS - 1] == 2
+    && dtls_histogram_quantile(&h, 500) == 127
+    && dtls_histogram_quantile(&h, 750) == last
+    && dtls_histogram_quantile(&h, 1000) == last
+    && dtls_histogram_quantile(&h, 2000) == last;
+  return ok;
+}
+
+/* The server cannot send the HelloVerifyRequest, which is packed
+ * into a datagram of its own at the end of dtls_handle_message().
+ * The error must be returned and counted. */
+static int
+test_write_error(void) {
+  loopback_t l;
+#if DTLS_STATS
+  dtls_stats_t stats;
+#endif /* DTLS_STATS */
+  test_queue_t q;
+  int ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = dtls_connect(l.client, &l.server_addr) > 0 && l.to_server.count == 1;
+
+  q = l.to_server;
+  l.to_server.count = 0;
+  l.fail_writes = 1;
+  ok = ok && dtls_handle_message(l.server, &l.client_addr,
+				 q.packets[0].data, q.packets[0].length) < 0;
+
+#if DTLS_STATS
+  dtls_get_stats(l.server, &stats);
+  ok = ok && stats.write_errors == 1;
+#endif /* DTLS_STATS */
+
+  loopback_free(&l);
+  return ok;
+}
+
+/* Returns the index of the client in @p clients that has sent
+ * @p p, or that the server has addressed @p p to. */
+static int
+batch_client(const test_packet_t *p, dtls_context_t *clients[],
+	     const session_t addrs[]) {
+  int k;
+
+  for (k = 0; k < BATCH_CLIENTS; k++)
+    if (p->sender == clients[k] ||
+	p->session.addr.sin.sin_port == addrs[k].addr.sin.sin_port)
+      return k;
+  return -1;
+}
+
+/* Identifies a record by its content type and, for unprotected
+ * handshake records, the handshake type. */
+#define RECORD_TAG(ContentType, HandshakeType) \
+  ((ContentType) << 8 | (HandshakeType))
+
+/* Stores the RECORD_TAG() of each record in @p p in @p tags and
+ * returns the number of records, at most @p max. */
+static int
+record_tags(const test_packet_t *p, int *tags, int max) {
+  const size_t rh = sizeof(dtls_record_header_t);
+  const dtls_record_header_t *header;
+  size_t pos, rlen;
+  int n = 0;
+
+  for (pos = 0; pos + rh < p->length && n < max; pos += rlen) {
+    header = (const dtls_record_header_t *)(p->data + pos);
+    rlen = rh + dtls_uint16_to_int(header->length);
+    tags[n++] = header->content_type == DTLS_CT_HANDSHAKE
+      && dtls_uint16_to_int(header->epoch) == 0
+      ? RECORD_TAG(DTLS_CT_HANDSHAKE, p->data[pos + rh])
+      : RECORD_TAG(header->content_type, 0);
+  }
+  return n;
+}
+
+/* Returns the number of HelloVerifyRequest records in @p p. */
+static int
+count_hello_verify(const test_packet_t *p) {
+  int tags[TEST_QUEUE_SIZE];
+  int i, n, count = 0;
+
+  n = record_tags(p, tags, TEST_QUEUE_SIZE);
+  for (i = 0; i < n; i++)
+    count += tags[i] == RECORD_TAG(DTLS_CT_HANDSHAKE,
+				   DTLS_HT_HELLO_VERIFY_REQUEST);
+  return count;
+}
+
+/* Several clients connect at the same time. The server receives
+ * their datagrams interleaved through dtls_handle_messages(), and
+ * every ClientHello arrives twice. The first client obtains its
+ * cookie from dtls_handle_message(), so the precomputed cookie for
+ * its next ClientHello must match the one computed without batching.
+ * The server's answers to all clients leave in one write_batch call
+ * per dtls_handle_messages(). */
+static int
+test_handle_messages(void) {
+  loopback_t l;
+  dtls_context_t *clients[BATCH_CLIENTS];
+  session_t addrs[BATCH_CLIENTS];
+  dtls_message_t msgs[TEST_QUEUE_SIZE];
+  test_queue_t q;
+  dtls_peer_t *peer;
+  int hello_verify = 0;
+  int i, k, n, ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  dtls_set_handler(l.server, &batch_cb);
+  ok = 1;
+  for (k = 0; k < BATCH_CLIENTS; k++) {
+    clients[k] = new_context(&l);
+    test_set_addr(&addrs[k], 41000 + k);
+    ok = ok && clients[k] && dtls_connect(clients[k], &l.server_addr) > 0;
+  }
+  ok = ok && l.to_server.count == BATCH_CLIENTS;
+
+  if (ok) {
+    q = l.to_server;
+    l.to_server.count = 0;
+    dtls_handle_message(l.server, &addrs[0],
+			q.packets[0].data, q.packets[0].length);
+    ok = l.to_client.count == 1;
+    hello_verify += count_hello_verify(&l.to_client.packets[0]);
+    l.to_client.count = 0;
+    dtls_handle_message(clients[0], &l.server_addr,
+			l.to_client.packets[0].data,
+			l.to_client.packets[0].length);
+    ok = ok && l.to_server.count == 1;
+    for (i = 1; i < q.count; i++)
+      l.to_server.packets[l.to_server.count++] = q.packets[i];
+  }
+
+  /* send every ClientHello again */
+  for (i = 0; ok && i < BATCH_CLIENTS; i++)
+    l.to_server.packets[l.to_server.count++] = l.to_server.packets[i];
+
+  while (ok && (l.to_server.count || l.to_client.count)) {
+    q = l.to_server;
+    l.to_server.count = 0;
+    for (i = n = 0; i < q.count; i++) {
+      k = batch_client(&q.packets[i], clients, addrs);
+      ok = ok && k >= 0;
+      msgs[n].session = &addrs[k < 0 ? 0 : k];
+      msgs[n].msg = q.packets[i].data;
+      msgs[n].msglen = q.packets[i].length;
+      msgs[n].result = -1;
+      n++;
+    }
+    l.batches = 0;
+    ok = ok && dtls_handle_messages(l.server, msgs, n) == n;
+    for (i = 0; i < n; i++)
+      ok = ok && msgs[i].result == 0;
+    ok = ok && l.batches == (l.to_client.count > 0)
+      && l.batch_size == (size_t)l.to_client.count;
+
+    q = l.to_client;
+    l.to_client.count = 0;
+    for (i = 0; i < q.count; i++) {
+      hello_verify += count_hello_verify(&q.packets[i]);
+      k = batch_client(&q.packets[i], clients, addrs);
+      if (k >= 0)
+	dtls_handle_message(clients[k], &l.server_addr,
+			    q.packets[i].data, q.packets[i].length);
+    }
+  }
+
+  /* one HelloVerifyRequest for each ClientHello without a cookie */
+  ok = ok && hello_verify == 1 + 2 * (BATCH_CLIENTS - 1);
+  for (k = 0; k < BATCH_CLIENTS; k++) {
+    peer = dtls_get_peer(clients[k], &l.server_addr);
+    ok = ok && peer && dtls_peer_is_connected(peer);
+    peer = dtls_get_peer(l.server, &addrs[k]);
+    ok = ok && peer && dtls_peer_is_connected(peer);
+  }
+
+  for (k = 0; k < BATCH_CLIENTS; k++)
+    dtls_free_context(clients[k]);
+  loopback_free(&l);
+  return ok;
+}
+
+/* Stores the RECORD_TAG() of all records queued in @p q in @p tags
+ * and returns their number. */
+static int
+queue_tags(const test_queue_t *q, int *tags, int max) {
+  int i, n = 0;
+
+  for (i = 0; i < q->count; i++)
+    n += record_tags(&q->packets[i], tags + n, max - n);
+  return n;
+}
+
+/* Delivers the datagrams queued for one side to that side. */
+static void
+deliver(loopback_t *l, int to_server) {
+  test_queue_t q = to_server ? l->to_server : l->to_client;
+  int i;
+
+  if (to_server) {
+    l->to_server.count = 0;
+    for (i = 0; i < q.count; i++)
+      dtls_handle_message(l->server, &l->client_addr,
+			  q.packets[i].data, q.packets[i].length);
+  } else {
+    l->to_client.count = 0;
+    for (i = 0; i < q.count; i++)
+      dtls_handle_message(l->client, &l->server_addr,
+			  q.packets[i].data, q.packets[i].length);
+  }
+}
+
+/* Lets the retransmission timer of @p node expire now. */
+static void
+expire_now(dtls_context_t *ctx, netq_t *node) {
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  netq_wheel_remove(&ctx->sendqueue, node);
+  node->t = now;
+  netq_wheel_insert(&ctx->sendqueue, node);
+}
+
+/* Returns the number of timers that retransmit messages to @p peer. */
+static int
+count_timers(const dtls_peer_t *peer) {
+  const netq_t *node;
+  int n = 0;
+
+  for (node = peer->retransmit; node; node = node->peer_next)
+    n++;
+  return n;
+}
+
+/* The client's second flight is lost. It is kept with a single timer
+ * and all of its records are sent again when the timer expires. The
+ * retransmission timeout grows with the loss and goes back down when
+ * a renegotiation measures the round-trip time again. */
+static int
+test_flight_loss(void) {
+  int flight[TEST_QUEUE_SIZE], resent[TEST_QUEUE_SIZE];
+  loopback_t l;
+  dtls_peer_t *peer;
+  clock_time_t rto = 0;
+  int n, ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = dtls_connect(l.client, &l.server_addr) > 0;
+  deliver(&l, 1);		/* HelloVerifyRequest */
+  deliver(&l, 0);		/* ClientHello with cookie */
+  deliver(&l, 1);		/* ServerHello, ServerHelloDone */
+  deliver(&l, 0);		/* ClientKeyExchange, CCS, Finished */
+
+  peer = dtls_get_peer(l.client, &l.server_addr);
+  n = queue_tags(&l.to_server, flight, TEST_QUEUE_SIZE);
+  ok = ok && peer && n == 3 && count_timers(peer) == 1;
+
+  if (ok) {
+    /* measured from the ClientHello with cookie */
+    rto = dtls_peer_rto(peer);
+    ok = dtls_peer_srtt(peer) > 0 && rto < DTLS_INITIAL_RTO;
+
+    l.to_server.count = 0;
+    expire_now(l.client, peer->retransmit);
+    dtls_check_retransmit(l.client, NULL);
+    ok = ok && queue_tags(&l.to_server, resent, TEST_QUEUE_SIZE) == n
+      && memcmp(resent, flight, n * sizeof(int)) == 0
+      && count_timers(peer) == 1
+      && dtls_peer_rto(peer) == 2 * rto;
+  }
+
+  pump(&l);
+  ok = ok && l.connected;
+
+  /* the retransmitted flight yields no sample (Karn's algorithm) */
+  ok = ok && dtls_peer_rto(peer) == 2 * rto;
+
+  l.connected = 0;
+  ok = ok && dtls_renegotiate(l.client, &l.server_addr) >= 0;
+  pump(&l);
+  ok = ok && l.connected && dtls_peer_rto(peer) <= rto;
+
+  loopback_free(&l);
+  return ok;
+}
+
+/* A server flight that exceeds the limit set with
+ * dtls_set_flight_limit() is kept as one message per timer. Each
+ * message is sent again when its own timer expires. */
+static int
+test_flight_split(void) {
+  int flight[TEST_QUEUE_SIZE], resent[TEST_QUEUE_SIZE];
+  netq_t *nodes[TEST_QUEUE_SIZE], *node;
+  loopback_t l;
+  dtls_peer_t *peer;
+  int i, n, ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  dtls_set_flight_limit(l.server, 1);
+  ok = dtls_connect(l.client, &l.server_addr) > 0;
+  deliver(&l, 1);		/* HelloVerifyRequest */
+  deliver(&l, 0);		/* ClientHello with cookie */
+  deliver(&l, 1);		/* ServerHello, ServerHelloDone */
+
+  peer = dtls_get_peer(l.server, &l.client_addr);
+  n = queue_tags(&l.to_client, flight, TEST_QUEUE_SIZE);
+  ok = ok && peer && n >= 2 && count_timers(peer) == n;
+
+  if (ok) {
+    /* the list holds the last message first */
+    for (i = n, node = peer->retransmit; node; node = node->peer_next)
+      nodes[--i] = node;
+
+    l.to_client.count = 0;
+    expire_now(l.server, nodes[n - 1]);
+    dtls_check_retransmit(l.server, NULL);
+    ok = queue_tags(&l.to_client, resent, TEST_QUEUE_SIZE) == 1
+      && resent[0] == flight[n - 1];
+
+    /* resend the flight in order, one message at a time */
+    l.to_client.count = 0;
+    for (i = 0; i < n; i++) {
+      expire_now(l.server, nodes[i]);
+      dtls_check_retransmit(l.server, NULL);
+    }
+    ok = ok && queue_tags(&l.to_client, resent, TEST_QUEUE_SIZE) == n
+      && l.to_client.count == n
+      && memcmp(resent, flight, n * sizeof(int)) == 0;
+  }
+
+  pump(&l);
+  ok = ok && l.connected;
+
+  loopback_free(&l);
+  return ok;
+}
+
+/* The last flight of a handshake is lost. Its sender keeps the
+ * flight after the handshake and sends it again when the peer
+ * retransmits its own last flight. In a full handshake, this is the
+ * server's CCS and Finished, which are released by the first
+ * application data from the client. In an abbreviated handshake, the
+ * client sends the last flight. */
+static int
+test_final_flight_loss(void) {
+  int flight[TEST_QUEUE_SIZE], resent[TEST_QUEUE_SIZE];
+  loopback_t l;
+  dtls_peer_t *client, *server;
+  int i, n, ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  ok = dtls_connect(l.client, &l.server_addr) > 0;
+  deliver(&l, 1);		/* HelloVerifyRequest */
+  deliver(&l, 0);		/* ClientHello with cookie */
+  deliver(&l, 1);		/* ServerHello, ServerHelloDone */
+  deliver(&l, 0);		/* ClientKeyExchange, CCS, Finished */
+  deliver(&l, 1);		/* CCS, Finished */
+
+  client = dtls_get_peer(l.client, &l.server_addr);
+  server = dtls_get_peer(l.server, &l.client_addr);
+  n = queue_tags(&l.to_client, flight, TEST_QUEUE_SIZE);
+  ok = ok && client && server && n >= 2
+    && dtls_peer_is_connected(server) && count_timers(server) == 1;
+
+  l.to_client.count = 0;
+  if (ok) {
+    expire_now(l.client, client->retransmit);
+    dtls_check_retransmit(l.client, NULL);
+  }
+  deliver(&l, 1);
+  ok = ok && queue_tags(&l.to_client, resent, TEST_QUEUE_SIZE) == n
+    && memcmp(resent, flight, n * sizeof(int)) == 0;
+
+  deliver(&l, 0);
+  ok = ok && l.connected && count_timers(server) == 1;
+  ok = ok && client_send(&l, NULL) && count_timers(server) == 0;
+
+  client_forget(&l);
+  l.connected = 0;
+  l.psk_lookups = 0;
+  ok = ok && dtls_connect(l.client, &l.server_addr) > 0;
+  for (i = 0; i < TEST_QUEUE_SIZE && !l.connected; i++) {
+    deliver(&l, 1);
+    deliver(&l, 0);
+  }
+
+  client = dtls_get_peer(l.client, &l.server_addr);
+  server = dtls_get_peer(l.server, &l.client_addr);
+  n = queue_tags(&l.to_server, flight, TEST_QUEUE_SIZE);
+  ok = ok && l.connected && l.psk_lookups == 0 && client && server
+    && n == 2 && !dtls_peer_is_connected(server)
+    && count_timers(client) == 1;
+
+  l.to_server.count = 0;
+  if (ok) {
+    expire_now(l.server, server->retransmit);
+    dtls_check_retransmit(l.server, NULL);
+  }
+  deliver(&l, 0);
+  ok = ok && queue_tags(&l.to_server, resent, TEST_QUEUE_SIZE) == n
+    && memcmp(resent, flight, n * sizeof(int)) == 0;
+
+  deliver(&l, 1);
+  ok = ok && dtls_peer_is_connected(server);
+
+  /* the kept flight is dropped after twice the segment lifetime */
+  if (ok) {
+    expire_now(l.client, client->retransmit);
+    dtls_check_retransmit(l.client, NULL);
+  }
+  ok = ok && count_timers(client) == 0 && l.to_server.count == 0;
+
+  loopback_free(&l);
+  return ok;
+}
+
+#ifdef DTLS_ECC
+/* An ECDHE_ECDSA handshake with a write_batch handler on both sides.
+ * Each flight must leave in a single call with its records in order.
+ * The client's MTU is lowered so that its second flight needs more
+ * than one datagram. */
+static int
+test_write_batch(void) {
+  static const int server_flight[] = {
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_SERVER_HELLO),
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_CERTIFICATE),
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_SERVER_KEY_EXCHANGE),
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_CERTIFICATE_REQUEST),
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_SERVER_HELLO_DONE),
+  };
+  static const int client_flight[] = {
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_CERTIFICATE),
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_CLIENT_KEY_EXCHANGE),
+    RECORD_TAG(DTLS_CT_HANDSHAKE, DTLS_HT_CERTIFICATE_VERIFY),
+    RECORD_TAG(DTLS_CT_CHANGE_CIPHER_SPEC, 0),
+    RECORD_TAG(DTLS_CT_TLS12_CID, 0),	/* Finished */
+  };
+  loopback_t l;
+  dtls_peer_t *peer;
+  int tags[TEST_QUEUE_SIZE];
+  int ok;
+
+  if (loopback_init(&l) < 0)
+    return 0;
+
+  dtls_set_handler(l.server, &ecdhe_batch_cb);
+  dtls_set_handler(l.client, &ecdhe_batch_cb);
+
+  ok = dtls_connect(l.client, &l.server_addr) > 0;
+  peer = dtls_get_peer(l.client, &l.server_addr);
+  ok = ok && peer;
+  if (peer)
+    peer->mtu = 200;
+
+  deliver(&l, 1);		/* HelloVerifyRequest */
+  deliver(&l, 0);		/* ClientHello with cookie */
+
+  l.batches = 0;
+  deliver(&l, 1);
+  ok = ok && l.batches == 1 && l.batch_size == 1
+    && queue_tags(&l.to_client, tags, TEST_QUEUE_SIZE) == 5
+    && memcmp(tags, server_flight, sizeof(server_flight)) == 0;
+
+  l.batches = 0;
+  deliver(&l, 0);
+  ok = ok && l.batches == 1 && l.batch_size > 1
+    && l.batch_size == (size_t)l.to_server.count
+    && queue_tags(&l.to_server, tags, TEST_QUEUE_SIZE) == 5
+    && memcmp(tags, client_flight, sizeof(client_flight)) == 0;
+
+  pump(&l);
+  ok = ok && l.connected;
+
+  loopback_free(&l);
+  return ok;
+}
+#endif /* DTLS_ECC */
+
+static const struct {
+  const char *name;
+  int (*run)(void);
+} tests[] = {
+  { "ticket resumption", test_ticket_resumption },
+  { "ticket expiry", test_ticket_expiry },
+  { "cache resumption", test_cache_resumption },
+  { "connection id rebind", test_cid_rebind },
+  { "connection id replay", test_cid_replay },
+#ifdef DTLS_POOL
+  { "pool statistics", test_pool_stats },
+#endif /* DTLS_POOL */
+  { "histogram", test_histogram },
+  { "write error", test_write_error },
+#if DTLS_STATS
+  { "statistics", test_stats },
+#endif /* DTLS_STATS */
+  { "batched receive", test_handle_messages },
+  { "flight loss", test_flight_loss },
+  { "flight split", test_flight_split },
+  { "final flight loss", test_final_flight_loss },
+#ifdef DTLS_ECC
+  { "batched write", test_write_batch },
+#endif /* DTLS_ECC */
+};
+
+int
+main(void) {
+  size_t i;
+  int failed = 0, ok;
+
+#ifndef DTLS_PSK
+  fprintf(stderr, "dtls-loopback-test requires PSK support\n");
+  return 0;
+#endif /* DTLS_PSK */
+#if !DTLS_SESSION_TICKETS || DTLS_SESSION_CACHE_SIZE == 0 || DTLS_MAX_BUF < 200
+  fprintf(stderr, "dtls-loopback-test requires session tickets, "
+	  "the session cache and DTLS_MAX_BUF of at least 200\n");
+  return 0;
+#endif /* tickets, cache and DTLS_MAX_BUF */
+
+  dtls_init();
+  dtls_set_log_level(getenv("DTLS_LOG") ? atoi(getenv("DTLS_LOG")) : DTLS_LOG_EMERG);
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    ok = tests[i].run();
+    printf("%s: %s\n", tests[i].name, ok ? "ok" : "FAILED");
+    failed += !ok;
+  }
+
+  return failed ? 1 : 0;
+}
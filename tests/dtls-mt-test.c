@@ -0,0 +1,426 @@
+/* dtls-mt-test -- record throughput with multiple threads
+ *
+ * Each worker thread runs its own client and server dtls_context_t
+ * that are connected through an in-memory loopback. After the PSK
+ * handshake, the client sends a fixed number of application data
+ * records to the server. The total record rate is reported for an
+ * increasing number of threads to show how the record protection
+ * path scales when contexts do not share any state.
+ *
+ * Afterwards, several threads log into the log ring while another
+ * thread drains it. The drained messages are checked for losses,
+ * torn entries, the count of dropped messages when the ring is full,
+ * and the truncation of long messages.
+ *
+ * usage: dtls-mt-test [-t max_threads] [-n records] [-s size]
+ */
+
+#include "tinydtls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "global.h"
+#include "dtls_debug.h"
+#include "dtls.h"
+#include "test-harness.h"
+
+/* All state of one worker. The dtls contexts point here via app. */
+typedef struct {
+  dtls_context_t *server;
+  dtls_context_t *client;
+  session_t server_addr;
+  session_t client_addr;
+  test_queue_t to_server;
+  test_queue_t to_client;
+  int connected;
+  unsigned long received;
+  unsigned long records;
+  size_t size;
+  int ok;
+} worker_t;
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *data, size_t len) {
+  worker_t *w = (worker_t *)dtls_get_app_data(ctx);
+  test_queue_t *q = ctx == w->server ? &w->to_client : &w->to_server;
+
+  return test_queue_add(q, ctx, session, data, len);
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+	       uint8 *data, size_t len) {
+  worker_t *w = (worker_t *)dtls_get_app_data(ctx);
+  (void)session;
+  (void)data;
+  (void)len;
+
+  if (ctx == w->server)
+    w->received++;
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level, unsigned short code) {
+  worker_t *w = (worker_t *)dtls_get_app_data(ctx);
+  (void)session;
+  (void)level;
+
+  if (ctx == w->client && code == DTLS_EVENT_CONNECTED)
+    w->connected = 1;
+  return 0;
+}
+
+static dtls_handler_t cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+#ifdef DTLS_PSK
+  .get_psk_info = test_get_psk_info,
+#endif /* DTLS_PSK */
+};
+
+/* Delivers queued datagrams until both directions are idle. */
+static void
+pump(worker_t *w) {
+  test_queue_t q;
+  int i;
+
+  while (w->to_server.count || w->to_client.count) {
+    q = w->to_server;
+    w->to_server.count = 0;
+    for (i = 0; i < q.count; i++)
+      dtls_handle_message(w->server, &w->client_addr,
+			  q.packets[i].data, q.packets[i].length);
+
+    q = w->to_client;
+    w->to_client.count = 0;
+    for (i = 0; i < q.count; i++)
+      dtls_handle_message(w->client, &w->server_addr,
+			  q.packets[i].data, q.packets[i].length);
+  }
+}
+
+static void *
+run_worker(void *arg) {
+  worker_t *w = (worker_t *)arg;
+  uint8 payload[DTLS_MAX_BUF];
+  unsigned long i;
+
+  w->server = dtls_new_context(w);
+  w->client = dtls_new_context(w);
+  if (!w->server || !w->client)
+    goto finish;
+
+  dtls_set_handler(w->server, &cb);
+  dtls_set_handler(w->client, &cb);
+
+  dtls_connect(w->client, &w->server_addr);
+  pump(w);
+  if (!w->connected)
+    goto finish;
+
+  memset(payload, 0x5a, w->size);
+  for (i = 0; i < w->records; i++) {
+    dtls_write(w->client, &w->server_addr, payload, w->size);
+    pump(w);
+  }
+  w->ok = w->received == w->records;
+
+ finish:
+  if (w->server)
+    dtls_free_context(w->server);
+  if (w->client)
+    dtls_free_context(w->client);
+  return NULL;
+}
+
+static double
+now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs nthreads workers and returns the total record rate or a
+ * negative value on error. */
+static double
+run(int nthreads, unsigned long records, size_t size) {
+  pthread_t *threads;
+  worker_t *workers;
+  double start, elapsed;
+  int i, ok = 1;
+
+  threads = calloc(nthreads, sizeof(pthread_t));
+  workers = calloc(nthreads, sizeof(worker_t));
+  if (!threads || !workers) {
+    free(threads);
+    free(workers);
+    return -1;
+  }
+
+  start = now_sec();
+  for (i = 0; i < nthreads; i++) {
+    test_set_addr(&workers[i].server_addr, 20220);
+    test_set_addr(&workers[i].client_addr, 40000 + i);
+    workers[i].records = records;
+    workers[i].size = size;
+    pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+    ok &= workers[i].ok;
+  }
+  elapsed = now_sec() - start;
+
+  free(threads);
+  free(workers);
+  return ok ? (nthreads * records) / elapsed : -1;
+}
+
+/* Number of slots of the log ring, a power of two. */
+#define LOG_RING_ENTRIES 256
+#define LOG_PRODUCERS 4
+
+/* Length of the padding of a test message, which identifies it. */
+#define LOG_PAD 40
+
+typedef struct {
+  int id;
+  int messages;
+} producer_t;
+
+static volatile int producers_done;
+
+static void *
+run_producer(void *arg) {
+  producer_t *p = (producer_t *)arg;
+  char pad[LOG_PAD + 1];
+  int i;
+
+  for (i = 0; i < p->messages; i++) {
+    memset(pad, 'a' + (p->id + i) % 26, LOG_PAD);
+    pad[LOG_PAD] = '\0';
+    dtls_warn("ring %d %d %s\n", p->id, i, pad);
+  }
+  return NULL;
+}
+
+static void *
+run_drain(void *arg) {
+  (void)arg;
+
+  while (!__atomic_load_n(&producers_done, __ATOMIC_ACQUIRE))
+    dtls_log_ring_drain();
+  dtls_log_ring_drain();
+  return NULL;
+}
+
+/* Redirects stdout, where the log ring is drained to, to @p out.
+ * Returns the descriptor to pass to capture_end(). */
+static int
+capture_begin(FILE *out) {
+  int fd;
+
+  fflush(stdout);
+  fd = dup(STDOUT_FILENO);
+  dup2(fileno(out), STDOUT_FILENO);
+  return fd;
+}
+
+static void
+capture_end(int fd) {
+  fflush(stdout);
+  dup2(fd, STDOUT_FILENO);
+  close(fd);
+}
+
+/* Logs @p messages from each producer, either while another thread
+ * drains the ring if @p drain is set, or before draining otherwise.
+ * The drained messages are written to @p out. Returns the number of
+ * messages drained after the producers have finished. */
+static size_t
+log_ring_round(FILE *out, int messages, int drain) {
+  pthread_t threads[LOG_PRODUCERS], drainer;
+  producer_t producers[LOG_PRODUCERS];
+  size_t n = 0;
+  int fd, i;
+
+  fd = capture_begin(out);
+
+  producers_done = 0;
+  if (drain)
+    pthread_create(&drainer, NULL, run_drain, NULL);
+  for (i = 0; i < LOG_PRODUCERS; i++) {
+    producers[i].id = i;
+    producers[i].messages = messages;
+    pthread_create(&threads[i], NULL, run_producer, &producers[i]);
+  }
+  for (i = 0; i < LOG_PRODUCERS; i++)
+    pthread_join(threads[i], NULL);
+  __atomic_store_n(&producers_done, 1, __ATOMIC_RELEASE);
+  if (drain)
+    pthread_join(drainer, NULL);
+  else
+    n = dtls_log_ring_drain();
+
+  capture_end(fd);
+  return n;
+}
+
+/* Reads the messages written by log_ring_round() from @p in. Each
+ * message must be complete and the messages of each producer must be
+ * in order. Returns the number of messages or -1 on error. */
+static int
+log_ring_check(FILE *in) {
+  char line[DTLS_LOG_RING_ENTRY_SIZE + 64], pad[LOG_PAD + 2];
+  char expected[LOG_PAD + 1];
+  int next[LOG_PRODUCERS] = { 0 };
+  int id, seq, count = 0;
+  char *text;
+
+  rewind(in);
+  while (fgets(line, sizeof(line), in)) {
+    text = strstr(line, "ring ");
+    if (!text || sscanf(text, "ring %d %d %41s", &id, &seq, pad) != 3
+	|| id < 0 || id >= LOG_PRODUCERS || seq < next[id]
+	|| line[strlen(line) - 1] != '\n')
+      return -1;
+
+    memset(expected, 'a' + (id + seq) % 26, LOG_PAD);
+    expected[LOG_PAD] = '\0';
+    if (strcmp(pad, expected) != 0)
+      return -1;
+    next[id] = seq + 1;
+    count++;
+  }
+  return count;
+}
+
+/* Checks the log ring with several producer threads. */
+static int
+test_log_ring(void) {
+  char long_message[2 * DTLS_LOG_RING_ENTRY_SIZE];
+  char line[4 * DTLS_LOG_RING_ENTRY_SIZE];
+  unsigned long dropped;
+  FILE *out;
+  char *text;
+  int fd, ok;
+
+  if (dtls_log_ring_enable(LOG_RING_ENTRIES) < 0)
+    return 1;			/* not available on this platform */
+
+  dtls_set_log_level(DTLS_LOG_WARN);
+
+  /* below capacity, no message is lost or torn while draining */
+  out = tmpfile();
+  if (!out)
+    return 0;
+  log_ring_round(out, LOG_RING_ENTRIES / LOG_PRODUCERS, 1);
+  ok = log_ring_check(out) == LOG_RING_ENTRIES
+    && dtls_log_ring_dropped() == 0;
+  fclose(out);
+
+  /* above capacity, the ring keeps the first messages */
+  out = tmpfile();
+  if (!out)
+    return 0;
+  dropped = dtls_log_ring_dropped();
+  ok = ok && log_ring_round(out, LOG_RING_ENTRIES, 0) == LOG_RING_ENTRIES
+    && log_ring_check(out) == LOG_RING_ENTRIES
+    && dtls_log_ring_dropped() - dropped
+       == (LOG_PRODUCERS - 1) * LOG_RING_ENTRIES;
+  fclose(out);
+
+  /* a long message is cut to the slot and keeps its line break */
+  out = tmpfile();
+  if (!out)
+    return 0;
+  memset(long_message, 'x', sizeof(long_message) - 1);
+  long_message[sizeof(long_message) - 1] = '\0';
+  fd = capture_begin(out);
+  dtls_warn("%s\n", long_message);
+  dtls_warn("ring 0 0 short\n");
+  ok = ok && dtls_log_ring_drain() == 2;
+  capture_end(fd);
+
+  rewind(out);
+  ok = ok && fgets(line, sizeof(line), out)
+    && (text = strchr(line, 'x')) != NULL
+    && strlen(text) == DTLS_LOG_RING_ENTRY_SIZE - 1
+    && strspn(text, "x") == DTLS_LOG_RING_ENTRY_SIZE - 2
+    && fgets(line, sizeof(line), out)
+    && strstr(line, "ring 0 0 short\n") != NULL;
+  fclose(out);
+
+  dtls_set_log_level(DTLS_LOG_EMERG);
+  return ok;
+}
+
+int
+main(int argc, char **argv) {
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned long records = 20000;
+  size_t size = 64;
+  double base = 0, rate;
+  int n, opt;
+
+  while ((opt = getopt(argc, argv, "t:n:s:")) != -1) {
+    switch (opt) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'n':
+      records = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-t max_threads] [-n records] [-s size]\n",
+	      argv[0]);
+      return 1;
+    }
+  }
+
+  if (max_threads < 1)
+    max_threads = 1;
+  if (size > 1024)
+    size = 1024;
+
+#ifndef DTLS_PSK
+  fprintf(stderr, "dtls-mt-test requires PSK support\n");
+  return 0;
+#endif /* DTLS_PSK */
+
+  dtls_init();
+  dtls_set_log_level(DTLS_LOG_EMERG);
+
+  printf("threads records/s speedup\n");
+  for (n = 1; n <= max_threads; n *= 2) {
+    rate = run(n, records, size);
+    if (rate < 0) {
+      printf("%d FAILED\n", n);
+      return 1;
+    }
+    if (n == 1)
+      base = rate;
+    printf("%d %.0f %.2f\n", n, rate, rate / base);
+  }
+
+  if (!test_log_ring()) {
+    printf("log ring: FAILED\n");
+    return 1;
+  }
+  printf("log ring: ok\n");
+  return 0;
+}
@@ -0,0 +1,669 @@
+/* dtls-sharded-server -- multi-threaded DTLS echo server
+ *
+ * This example runs N shards. Each shard is a thread with its own
+ * dtls_context_t and its own UDP socket that is bound to the same
+ * address and port with SO_REUSEPORT. The kernel steers every
+ * datagram by its 4-tuple, so all datagrams of one client end up on
+ * the same shard and the contexts never need to be locked.
+ *
+ * A peer can be moved to another shard with dtls_detach_peer() and
+ * dtls_attach_peer(). The moved peers are recorded in a shared
+ * affinity table. A shard consults this table only for datagrams
+ * from unknown peers and forwards datagrams of moved peers to the
+ * owning shard's inbox. Clients can request a move to the next shard
+ * by sending "server:move". Every shard periodically drops the
+ * entries of peers it owns that have been closed in the meantime, so
+ * that a new client on a reused address and port is not misrouted.
+ *
+ * All shards share one session ticket key, so a client that comes
+ * back from a different port can resume its session on any shard.
+ */
+
+/* This is needed for apple */
+#define __APPLE_USE_RFC_3542
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <signal.h>
+
+#include "tinydtls.h"
+#include "dtls.h"
+#include "dtls_debug.h"
+
+#define DEFAULT_PORT 20220
+#define MAX_SHARDS 256
+
+/** size of the affinity table, must be a power of two */
+#define AFFINITY_SIZE 4096
+
+/** seconds between two scans for entries of closed peers */
+#define AFFINITY_PRUNE_INTERVAL 5
+
+#define DTLS_SERVER_CMD_MOVE "server:move"
+
+#ifdef DTLS_ECC
+static const unsigned char ecdsa_priv_key[] = {
+			0xD9, 0xE2, 0x70, 0x7A, 0x72, 0xDA, 0x6A, 0x05,
+			0x04, 0x99, 0x5C, 0x86, 0xED, 0xDB, 0xE3, 0xEF,
+			0xC7, 0xF1, 0xCD, 0x74, 0x83, 0x8F, 0x75, 0x70,
+			0xC8, 0x07, 0x2D, 0x0A, 0x76, 0x26, 0x1B, 0xD4};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+			0xD0, 0x55, 0xEE, 0x14, 0x08, 0x4D, 0x6E, 0x06,
+			0x15, 0x59, 0x9D, 0xB5, 0x83, 0x91, 0x3E, 0x4A,
+			0x3E, 0x45, 0x26, 0xA2, 0x70, 0x4D, 0x61, 0xF2,
+			0x7A, 0x4C, 0xCF, 0xBA, 0x97, 0x58, 0xEF, 0x9A};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+			0xB4, 0x18, 0xB6, 0x4A, 0xFE, 0x80, 0x30, 0xDA,
+			0x1D, 0xDC, 0xF4, 0xF4, 0x2E, 0x2F, 0x26, 0x31,
+			0xD0, 0x43, 0xB1, 0xFB, 0x03, 0xE2, 0x2F, 0x4D,
+			0x17, 0xDE, 0x43, 0xF9, 0xF9, 0xAD, 0xEE, 0x70};
+#endif /* DTLS_ECC */
+
+/* An item in a shard's inbox: either a datagram that was received
+ * by another shard or a peer that is handed over to this shard. */
+typedef struct inbox_item_t {
+  struct inbox_item_t *next;
+  session_t session;
+  dtls_peer_t *peer;		/* set for handovers */
+  size_t length;
+  uint8 data[];
+} inbox_item_t;
+
+typedef struct {
+  int index;
+  int fd;
+  int wakeup[2];		/* pipe that signals a non-empty inbox */
+  pthread_t thread;
+  dtls_context_t *ctx;
+
+  pthread_mutex_t inbox_lock;
+  inbox_item_t *inbox_head;
+  inbox_item_t *inbox_tail;
+
+  /* A move requested from a callback is carried out after the
+   * datagram has been handled completely. */
+  int move_pending;
+  session_t move_session;
+} shard_t;
+
+static shard_t shards[MAX_SHARDS];
+static int num_shards;
+
+/* the session ticket key shared by all shards */
+static unsigned char ticket_key_name[DTLS_TICKET_KEY_NAME_LENGTH];
+static unsigned char ticket_key[DTLS_TICKET_KEY_LENGTH];
+
+/* Entries of the affinity table for peers that have been moved away
+ * from the shard the kernel steers them to. */
+typedef struct affinity_t {
+  struct affinity_t *next;
+  dtls_peer_key_t key;
+  session_t session;		/* address of the moved peer */
+  int shard;
+  int attached;			/* set when the owner has taken the peer */
+} affinity_t;
+
+static affinity_t *affinity[AFFINITY_SIZE];
+static pthread_rwlock_t affinity_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Returns the shard a peer has been moved to, or -1. */
+static int
+affinity_get(const dtls_peer_key_t *key) {
+  affinity_t *a;
+  int shard = -1;
+
+  pthread_rwlock_rdlock(&affinity_lock);
+  for (a = affinity[dtls_peer_key_hash(key) & (AFFINITY_SIZE - 1)];
+       a; a = a->next) {
+    if (dtls_peer_key_equals(&a->key, key)) {
+      shard = a->shard;
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&affinity_lock);
+  return shard;
+}
+
+/* Records that the peer is handed over to shard. The entry is not
+ * pruned before the owner has attached the peer. */
+static void
+affinity_set(const dtls_peer_t *peer, int shard) {
+  affinity_t **a, *n;
+
+  pthread_rwlock_wrlock(&affinity_lock);
+  for (a = &affinity[dtls_peer_key_hash(&peer->key) & (AFFINITY_SIZE - 1)];
+       *a; a = &(*a)->next) {
+    if (dtls_peer_key_equals(&(*a)->key, &peer->key)) {
+      (*a)->shard = shard;
+      (*a)->attached = 0;
+      goto finish;
+    }
+  }
+
+  n = malloc(sizeof(affinity_t));
+  if (n) {
+    memcpy(&n->key, &peer->key, sizeof(dtls_peer_key_t));
+    memcpy(&n->session, &peer->session, sizeof(session_t));
+    n->shard = shard;
+    n->attached = 0;
+    n->next = NULL;
+    *a = n;
+  } else {
+    dtls_warn("cannot record affinity for moved peer\n");
+  }
+ finish:
+  pthread_rwlock_unlock(&affinity_lock);
+}
+
+/* Marks the entry for peer as attached to shard, or removes it when
+ * the handover has failed. */
+static void
+affinity_attached(const dtls_peer_t *peer, int shard, int ok) {
+  affinity_t **a, *n;
+
+  pthread_rwlock_wrlock(&affinity_lock);
+  for (a = &affinity[dtls_peer_key_hash(&peer->key) & (AFFINITY_SIZE - 1)];
+       *a; a = &(*a)->next) {
+    if (dtls_peer_key_equals(&(*a)->key, &peer->key)) {
+      if ((*a)->shard == shard) {
+	if (ok) {
+	  (*a)->attached = 1;
+	} else {
+	  n = *a;
+	  *a = n->next;
+	  free(n);
+	}
+      }
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&affinity_lock);
+}
+
+/* Removes the entries for peers owned by shard that do not exist
+ * any more. Must be called from the shard's own thread. */
+static void
+affinity_prune(shard_t *shard) {
+  affinity_t **a, *n;
+  int i, pruned = 0;
+
+  pthread_rwlock_wrlock(&affinity_lock);
+  for (i = 0; i < AFFINITY_SIZE; i++) {
+    for (a = &affinity[i]; *a;) {
+      if ((*a)->shard == shard->index && (*a)->attached &&
+	  !dtls_get_peer(shard->ctx, &(*a)->session)) {
+	n = *a;
+	*a = n->next;
+	free(n);
+	pruned++;
+      } else {
+	a = &(*a)->next;
+      }
+    }
+  }
+  pthread_rwlock_unlock(&affinity_lock);
+
+  if (pruned)
+    dtls_debug("shard %d: pruned %d affinity entries\n", shard->index, pruned);
+}
+
+/* Appends an item to the inbox of shard and wakes up its thread. */
+static void
+inbox_push(shard_t *shard, inbox_item_t *item) {
+  char c = 0;
+
+  item->next = NULL;
+  pthread_mutex_lock(&shard->inbox_lock);
+  if (shard->inbox_tail)
+    shard->inbox_tail->next = item;
+  else
+    shard->inbox_head = item;
+  shard->inbox_tail = item;
+  pthread_mutex_unlock(&shard->inbox_lock);
+
+  if (write(shard->wakeup[1], &c, 1) < 0 && errno != EAGAIN)
+    dtls_warn("cannot wake up shard %d\n", shard->index);
+}
+
+/* Moves the peer for session from shard to the shard with index to. */
+static int
+move_peer(shard_t *shard, session_t *session, int to) {
+  inbox_item_t *item;
+  dtls_peer_t *peer;
+
+  if (to == shard->index)
+    return 0;
+
+  item = malloc(sizeof(inbox_item_t));
+  if (!item)
+    return -1;
+
+  peer = dtls_detach_peer(shard->ctx, session);
+  if (!peer) {
+    free(item);
+    return -1;
+  }
+
+  /* Record the new owner before the handover so that datagrams that
+   * arrive in the meantime are queued behind it. */
+  affinity_set(peer, to);
+
+  memset(item, 0, sizeof(inbox_item_t));
+  item->peer = peer;
+  inbox_push(&shards[to], item);
+  dtls_info("moved peer from shard %d to %d\n", shard->index, to);
+  return 0;
+}
+
+/* Carries out a move that has been requested while handling the
+ * last datagram. */
+static void
+shard_finish_message(shard_t *shard) {
+  if (shard->move_pending) {
+    shard->move_pending = 0;
+    move_peer(shard, &shard->move_session, (shard->index + 1) % num_shards);
+  }
+}
+
+/* Handles all items in the inbox of shard in FIFO order. */
+static void
+inbox_process(shard_t *shard) {
+  inbox_item_t *item, *next;
+  char buf[64];
+
+  while (read(shard->wakeup[0], buf, sizeof(buf)) > 0)
+    ;
+
+  pthread_mutex_lock(&shard->inbox_lock);
+  item = shard->inbox_head;
+  shard->inbox_head = shard->inbox_tail = NULL;
+  pthread_mutex_unlock(&shard->inbox_lock);
+
+  for (; item; item = next) {
+    next = item->next;
+    if (item->peer) {
+      if (dtls_attach_peer(shard->ctx, item->peer) < 0) {
+	affinity_attached(item->peer, shard->index, 0);
+	dtls_free_peer(item->peer);
+      } else {
+	affinity_attached(item->peer, shard->index, 1);
+      }
+    } else {
+      dtls_handle_message(shard->ctx, &item->session,
+			  item->data, item->length);
+      shard_finish_message(shard);
+    }
+    free(item);
+  }
+}
+
+#ifdef DTLS_PSK
+/* This function is the "key store" for tinyDTLS. It is called to
+ * retrieve a key for the given identity within this particular
+ * session. */
+static int
+get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id, size_t id_len,
+	     unsigned char *result, size_t result_length) {
+
+  struct keymap_t {
+    unsigned char *id;
+    size_t id_length;
+    unsigned char *key;
+    size_t key_length;
+  } psk[3] = {
+    { (unsigned char *)"Client_identity", 15,
+      (unsigned char *)"secretPSK", 9 },
+    { (unsigned char *)"default identity", 16,
+      (unsigned char *)"\x11\x22\x33", 3 },
+    { (unsigned char *)"\0", 2,
+      (unsigned char *)"", 1 }
+  };
+
+  if (type != DTLS_PSK_KEY) {
+    return 0;
+  }
+
+  if (id) {
+    size_t i;
+    for (i = 0; i < sizeof(psk)/sizeof(struct keymap_t); i++) {
+      if (id_len == psk[i].id_length && memcmp(id, psk[i].id, id_len) == 0) {
+	if (result_length < psk[i].key_length) {
+	  dtls_warn("buffer too small for PSK");
+	  return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+	}
+
+	memcpy(result, psk[i].key, psk[i].key_length);
+	return psk[i].key_length;
+      }
+    }
+  }
+
+  return dtls_alert_fatal_create(DTLS_ALERT_DECRYPT_ERROR);
+}
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static int
+get_ecdsa_key(struct dtls_context_t *ctx,
+	      const session_t *session,
+	      const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
+  };
+
+  *result = &ecdsa_key;
+  return 0;
+}
+
+static int
+verify_ecdsa_key(struct dtls_context_t *ctx,
+		 const session_t *session,
+		 const unsigned char *other_pub_x,
+		 const unsigned char *other_pub_y,
+		 size_t key_size) {
+  return 0;
+}
+#endif /* DTLS_ECC */
+
+static int
+read_from_peer(struct dtls_context_t *ctx,
+	       session_t *session, uint8 *data, size_t len) {
+  shard_t *shard = (shard_t *)dtls_get_app_data(ctx);
+  int res;
+
+  res = dtls_write(ctx, session, data, len);
+
+  if (len >= strlen(DTLS_SERVER_CMD_MOVE) &&
+      !memcmp(data, DTLS_SERVER_CMD_MOVE, strlen(DTLS_SERVER_CMD_MOVE))) {
+    memcpy(&shard->move_session, session, sizeof(session_t));
+    shard->move_pending = 1;
+  }
+
+  return res;
+}
+
+static int
+send_to_peer(struct dtls_context_t *ctx,
+	     session_t *session, uint8 *data, size_t len) {
+  shard_t *shard = (shard_t *)dtls_get_app_data(ctx);
+  return sendto(shard->fd, data, len, MSG_DONTWAIT,
+		&session->addr.sa, session->size);
+}
+
+static dtls_handler_t cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = NULL,
+#ifdef DTLS_PSK
+  .get_psk_info = get_psk_info,
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key
+#endif /* DTLS_ECC */
+};
+
+/* Reads one datagram from the shard's socket and either handles it
+ * or forwards it to the shard that owns the peer. */
+static int
+shard_handle_read(shard_t *shard) {
+  session_t session;
+  static __thread uint8 buf[DTLS_MAX_BUF];
+  dtls_peer_key_t key;
+  inbox_item_t *item;
+  int len, owner, res;
+
+  memset(&session, 0, sizeof(session_t));
+  session.size = sizeof(session.addr);
+  len = recvfrom(shard->fd, buf, sizeof(buf), MSG_DONTWAIT,
+		 &session.addr.sa, &session.size);
+
+  if (len < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      perror("recvfrom");
+    return -1;
+  }
+
+  /* Known peers are handled right away. Only for unknown peers, the
+   * shared affinity table is checked. */
+  if (!dtls_get_peer(shard->ctx, &session)) {
+    dtls_session_key(&session, &key);
+    owner = affinity_get(&key);
+    if (owner >= 0 && owner != shard->index) {
+      item = malloc(sizeof(inbox_item_t) + len);
+      if (!item)
+	return -1;
+      memset(item, 0, sizeof(inbox_item_t));
+      memcpy(&item->session, &session, sizeof(session_t));
+      item->length = len;
+      memcpy(item->data, buf, len);
+      inbox_push(&shards[owner], item);
+      return 0;
+    }
+  }
+
+  res = dtls_handle_message(shard->ctx, &session, buf, len);
+  shard_finish_message(shard);
+  return res;
+}
+
+static void *
+shard_run(void *arg) {
+  shard_t *shard = (shard_t *)arg;
+  fd_set rfds;
+  struct timeval timeout;
+  clock_time_t now, next, last_prune;
+  int maxfd, result;
+
+  maxfd = shard->fd > shard->wakeup[0] ? shard->fd : shard->wakeup[0];
+  dtls_ticks(&last_prune);
+
+  while (1) {
+    FD_ZERO(&rfds);
+    FD_SET(shard->fd, &rfds);
+    FD_SET(shard->wakeup[0], &rfds);
+
+    dtls_check_retransmit(shard->ctx, &next);
+    timeout.tv_sec = 5;
+    timeout.tv_usec = 0;
+    if (next) {
+      dtls_ticks(&now);
+      next = next > now ? next - now : 0;
+      timeout.tv_sec = next / CLOCK_SECOND;
+      timeout.tv_usec = (next % CLOCK_SECOND) * (1000000 / CLOCK_SECOND);
+    }
+
+    result = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+
+    if (result < 0) {		/* error */
+      if (errno != EINTR)
+	perror("select");
+    } else if (result > 0) {
+      if (FD_ISSET(shard->wakeup[0], &rfds))
+	inbox_process(shard);
+      if (FD_ISSET(shard->fd, &rfds))
+	while (shard_handle_read(shard) >= 0)
+	  ;
+    }
+
+    dtls_ticks(&now);
+    if (now - last_prune >= AFFINITY_PRUNE_INTERVAL * CLOCK_SECOND) {
+      affinity_prune(shard);
+      last_prune = now;
+    }
+  }
+
+  return NULL;
+}
+
+static int
+init_ticket_key(void) {
+  FILE *urandom = fopen("/dev/urandom", "r");
+  int ok;
+
+  if (!urandom)
+    return 0;
+  ok = fread(ticket_key_name, sizeof(ticket_key_name), 1, urandom) == 1
+    && fread(ticket_key, sizeof(ticket_key), 1, urandom) == 1;
+  fclose(urandom);
+  return ok;
+}
+
+static int
+shard_init(shard_t *shard, int index, struct sockaddr_in6 *listen_addr) {
+  int on = 1;
+
+  memset(shard, 0, sizeof(shard_t));
+  shard->index = index;
+  pthread_mutex_init(&shard->inbox_lock, NULL);
+
+  shard->fd = socket(listen_addr->sin6_family, SOCK_DGRAM, 0);
+  if (shard->fd < 0) {
+    dtls_alert("socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (setsockopt(shard->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+    dtls_alert("setsockopt SO_REUSEADDR: %s\n", strerror(errno));
+  }
+
+#ifdef SO_REUSEPORT
+  if (setsockopt(shard->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    dtls_alert("setsockopt SO_REUSEPORT: %s\n", strerror(errno));
+    return -1;
+  }
+#else /* SO_REUSEPORT */
+  if (index > 0) {
+    dtls_alert("SO_REUSEPORT is not supported on this platform\n");
+    return -1;
+  }
+#endif /* SO_REUSEPORT */
+
+  if (bind(shard->fd, (struct sockaddr *)listen_addr,
+	   sizeof(struct sockaddr_in6)) < 0) {
+    dtls_alert("bind: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (pipe(shard->wakeup) < 0) {
+    dtls_alert("pipe: %s\n", strerror(errno));
+    return -1;
+  }
+  fcntl(shard->wakeup[0], F_SETFL, O_NONBLOCK);
+  fcntl(shard->wakeup[1], F_SETFL, O_NONBLOCK);
+
+  shard->ctx = dtls_new_context(shard);
+  if (!shard->ctx)
+    return -1;
+
+  dtls_set_handler(shard->ctx, &cb);
+#if DTLS_SESSION_TICKETS
+  return dtls_set_ticket_key(shard->ctx, ticket_key_name, ticket_key);
+#else /* DTLS_SESSION_TICKETS */
+  return 0;
+#endif /* DTLS_SESSION_TICKETS */
+}
+
+static void
+usage(const char *program, const char *version) {
+  const char *p;
+
+  p = strrchr( program, '/' );
+  if ( p )
+    program = ++p;
+
+  fprintf(stderr, "%s v%s -- sharded DTLS server\n"
+	  "usage: %s [-n shards] [-p port] [-v num]\n"
+	  "\t-n shards\t\tnumber of worker threads (default: number of CPUs)\n"
+	  "\t-p port\t\tlisten on specified port (default is %d)\n"
+	  "\t-v num\t\tverbosity level (default: 3)\n",
+	   program, version, program, DEFAULT_PORT);
+}
+
+int
+main(int argc, char **argv) {
+  log_t log_level = DTLS_LOG_WARN;
+  struct sockaddr_in6 listen_addr;
+  int opt, i;
+
+  num_shards = sysconf(_SC_NPROCESSORS_ONLN);
+
+  memset(&listen_addr, 0, sizeof(struct sockaddr_in6));
+
+  /* fill extra field for 4.4BSD-based systems (see RFC 3493, section 3.4) */
+#if defined(SIN6_LEN) || defined(HAVE_SOCKADDR_IN6_SIN6_LEN)
+  listen_addr.sin6_len = sizeof(struct sockaddr_in6);
+#endif
+
+  listen_addr.sin6_family = AF_INET6;
+  listen_addr.sin6_port = htons(DEFAULT_PORT);
+  listen_addr.sin6_addr = in6addr_any;
+
+  while ((opt = getopt(argc, argv, "n:p:v:")) != -1) {
+    switch (opt) {
+    case 'n' :
+      num_shards = atoi(optarg);
+      break;
+    case 'p' :
+      listen_addr.sin6_port = htons(atoi(optarg));
+      break;
+    case 'v' :
+      log_level = strtol(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0], dtls_package_version());
+      exit(1);
+    }
+  }
+
+  if (num_shards < 1)
+    num_shards = 1;
+  if (num_shards > MAX_SHARDS)
+    num_shards = MAX_SHARDS;
+
+  dtls_set_log_level(log_level);
+  dtls_init();
+
+  if (!init_ticket_key()) {
+    dtls_alert("cannot create session ticket key\n");
+    exit(1);
+  }
+
+  for (i = 0; i < num_shards; i++) {
+    if (shard_init(&shards[i], i, &listen_addr) < 0) {
+      dtls_alert("cannot initialize shard %d\n", i);
+      exit(1);
+    }
+  }
+
+  for (i = 0; i < num_shards; i++) {
+    if (pthread_create(&shards[i].thread, NULL, shard_run, &shards[i]) != 0) {
+      dtls_alert("cannot start shard %d\n", i);
+      exit(1);
+    }
+  }
+
+  dtls_info("running %d shards\n", num_shards);
+  for (i = 0; i < num_shards; i++)
+    pthread_join(shards[i].thread, NULL);
+
+  exit(0);
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_CONTIKI
+#include "contiki.h"
+#include "contiki-lib.h"
+#include "contiki-net.h"
+#endif /* WITH_CONTIKI */
+
+#include "tinydtls.h"
+#include "numeric.h"
+#include "gcm.h"
+
+#include "gcm-testdata.c"
+
+void
+dump(unsigned char *buf, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    printf("%02x ", buf[i++]);
+    if (i % 4 == 0)
+      printf(" ");
+    if (i % 16 == 0)
+      printf("\n\t");
+  }
+  printf("\n");
+}
+
+#ifdef WITH_CONTIKI
+PROCESS(gcm_test_process, "GCM test process");
+AUTOSTART_PROCESSES(&gcm_test_process);
+PROCESS_THREAD(gcm_test_process, ev, d)
+{
+#else  /* WITH_CONTIKI */
+int main(int argc, char **argv) {
+#endif /* WITH_CONTIKI */
+  unsigned char buf[sizeof(data[0].msg) + DTLS_GCM_TAG_SIZE];
+  long int len;
+  int n;
+
+  rijndael_ctx ctx;
+  dtls_ghash_key_t key;
+
+#ifdef WITH_CONTIKI
+  PROCESS_BEGIN();
+#endif /* WITH_CONTIKI */
+
+  for (n = 0; n < sizeof(data)/sizeof(struct test_vector); ++n) {
+
+    if (rijndael_set_key_enc_only(&ctx, data[n].key, 8*sizeof(data[n].key)) < 0) {
+      fprintf(stderr, "cannot set key\n");
+      return -1;
+    }
+    dtls_gcm_init(&key, &ctx);
+
+    memcpy(buf, data[n].msg, data[n].lm);
+    len = dtls_gcm_encrypt_message(&ctx, &key, data[n].nonce,
+				   buf, data[n].lm,
+				   data[n].aad, data[n].la);
+
+    printf("Test Case #%d ", n+1);
+    if (len != data[n].lm + DTLS_GCM_TAG_SIZE
+	|| memcmp(buf, data[n].result, data[n].lm)
+	|| memcmp(buf + data[n].lm, data[n].tag, DTLS_GCM_TAG_SIZE))
+      printf("FAILED, ");
+    else
+      printf("OK, ");
+
+    printf("result is (total length = %lu):\n\t", len);
+    dump(buf, len);
+
+    len = dtls_gcm_decrypt_message(&ctx, &key, data[n].nonce,
+				   buf, len,
+				   data[n].aad, data[n].la);
+
+    if (len < 0 || memcmp(buf, data[n].msg, data[n].lm))
+      printf("Test Case #%d: cannot decrypt message\n", n+1);
+    else
+      printf("\t*** tag verified (length = %lu) ***\n", len);
+  }
+
+#ifdef WITH_CONTIKI
+  PROCESS_END();
+#else /* WITH_CONTIKI */
+  return 0;
+#endif /* WITH_CONTIKI */
+}
@@ -1,123 +1,186 @@
-#include <string.h>
-#include <stdio.h>
+/* netq-test -- checks the sorted queue and the timer wheel of netq
+ *
+ * The program exits with a non-zero status if any check fails.
+ *
+ * usage: netq-test
+ */
 
-#include "utlist.h" 
-#include "netq.h" 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-void
-dump_queue(struct netq_t *queue) {
-  struct netq_t *p;
-  int i = 0;
+#include "utlist.h"
+#include "netq.h"
 
-  if (!queue) {
-    printf("(null)\n");
-  } else {
-    LL_FOREACH(queue, p) {
-      printf("node #%d, timeout: %d\n", i++, p->t);
-    }
-  }
-}
+/** One rotation of the timer wheel in clock ticks. */
+#define ROTATION (NETQ_WHEEL_SLOTS * NETQ_WHEEL_RESOLUTION)
 
-int main(int argc, char **argv) {
-  struct netq_t *nq = NULL, *node;
-  int i;
-    
-  clock_time_t timestamps[] = { 300, 100, 200, 400, 500 };
+#define NODES 64
 
-  for (i = 0; i < sizeof(timestamps)/sizeof(clock_time_t); i++) {
-    node = netq_node_new(0);
+static int failed;
 
-    if (!node) {
-      fprintf(stderr, "E: cannot create node #%d\n", i);
-      exit(EXIT_FAILURE);
-    }
+#define CHECK(Cond) do {						\
+    if (!(Cond)) {							\
+      fprintf(stderr, "%s:%d: check failed: %s\n",			\
+	      __FILE__, __LINE__, #Cond);				\
+      failed++;								\
+    }									\
+  } while (0)
 
-    node->t = timestamps[i];
+static netq_t *
+new_node(clock_time_t t) {
+  netq_t *node = netq_node_new(0);
 
-    if (!netq_insert_node(&nq, node)) {
-      fprintf(stderr, "E: cannot add node to nodelist #%d\n", i);
-      exit(EXIT_FAILURE);
-    }
+  if (!node) {
+    fprintf(stderr, "E: cannot create node\n");
+    exit(EXIT_FAILURE);
   }
+  node->t = t;
+  return node;
+}
 
-  printf("------------------------------------------------------------------------\n");
-  printf("initial queue:\n");
-  dump_queue(nq);
-
-  printf("------------------------------------------------------------------------\n");
-  printf("pop first element:\n");
-  node = netq_pop_first(&nq);
+static void
+test_queue(void) {
+  clock_time_t timestamps[] = { 300, 100, 200, 400, 500 };
+  netq_t *nq = NULL, *node;
+  size_t i;
 
-  assert(node);
-  printf("first node's timeout is %d\n", node->t);
-  dump_queue(nq);
+  for (i = 0; i < sizeof(timestamps) / sizeof(timestamps[0]); i++)
+    CHECK(netq_insert_node(&nq, new_node(timestamps[i])));
 
+  node = netq_pop_first(&nq);
+  CHECK(node && node->t == 100);
   netq_node_free(node);
-  
-  printf("------------------------------------------------------------------------\n");
-  printf("queue head:\n");
-  node = netq_head(&nq);
-
-  printf("head's timeout is %d\n", node->t);
-  dump_queue(nq);
-
-  printf("------------------------------------------------------------------------\n");
-  printf("next timeout:\n");
-
-  node = netq_next(node);
-
-  printf("next node's timeout is %d\n", node->t);
-
-  printf("------------------------------------------------------------------------\n");
-  printf("remove next:\n");
 
+  node = netq_next(netq_head(&nq));
+  CHECK(node && node->t == 300);
   netq_remove(&nq, node);
-  dump_queue(nq);
-
   netq_node_free(node);
 
-  printf("------------------------------------------------------------------------\n");
-  printf("insert new item (timeout 50):\n");
-  node = netq_node_new(0);
-
-  assert(node);
-  node->t = 50;
+  netq_insert_node(&nq, new_node(50));
+  netq_insert_node(&nq, new_node(350));
+  for (i = 0, node = netq_head(&nq); node; node = netq_next(node), i++)
+    CHECK(!node->next || node->t <= node->next->t);
+  CHECK(i == 5 && netq_head(&nq)->t == 50);
 
-  netq_insert_node(&nq, node);
-  dump_queue(nq);
-
-  printf("------------------------------------------------------------------------\n");
-  printf("insert new item (timeout 350):\n");
-  node = netq_node_new(0);
-
-  assert(node);
-  node->t = 350;
-
-  netq_insert_node(&nq, node);
-  dump_queue(nq);
-
-  printf("------------------------------------------------------------------------\n");
-  printf("insert new item (timeout 1000):\n");
-  node = netq_node_new(0);
-
-  assert(node);
-  node->t = 1000;
+  netq_delete_all(&nq);
+  CHECK(netq_pop_first(&nq) == NULL);
+}
 
-  netq_insert_node(&nq, node);
-  dump_queue(nq);
+/** Returns the earliest time-stamp of @p nodes that are not NULL. */
+static clock_time_t
+earliest(netq_t *nodes[], size_t count) {
+  clock_time_t t = 0;
+  int found = 0;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    if (nodes[i] && (!found || nodes[i]->t < t)) {
+      t = nodes[i]->t;
+      found = 1;
+    }
+  }
+  return t;
+}
 
-  printf("------------------------------------------------------------------------\n");
-  printf("remove all:\n");
-  
-  netq_delete_all(&nq);
-  dump_queue(nq);
+/**
+ * Checks that netq_wheel_next() is a lower bound of the earliest
+ * time-stamp in @p nodes and that waking up at that bound reaches the
+ * exact time-stamp after a few wakeups that find no node due.
+ */
+static void
+check_next(netq_wheel_t *wheel, netq_t *nodes[], size_t count) {
+  clock_time_t t = earliest(nodes, count), next;
+  int wakeups;
+
+  for (wakeups = 0; wakeups < 4; wakeups++) {
+    next = netq_wheel_next(wheel);
+    CHECK(next <= t);
+    if (next == t)
+      return;
+    CHECK(netq_wheel_expire(wheel, next) == NULL);
+  }
+  CHECK(netq_wheel_next(wheel) == t);
+}
 
-  printf("------------------------------------------------------------------------\n");
-  printf("pop first element of empty queue:\n");
-  node = netq_pop_first(&nq);
+static void
+test_wheel(void) {
+  netq_wheel_t wheel;
+  netq_t *nodes[NODES], *node;
+  clock_time_t now, last;
+  size_t i, expired, rounds;
+
+  memset(&wheel, 0, sizeof(wheel));
+  CHECK(netq_wheel_next(&wheel) == 0);
+  CHECK(netq_wheel_expire(&wheel, 1000) == NULL);
+
+  /* spread the nodes over several rotations, with slots shared by
+   * nodes of different rotations */
+  for (i = 0; i < NODES; i++) {
+    nodes[i] = new_node(wheel.base + 100 +
+			(i * 7919) % (3 * ROTATION) + (i % 3) * ROTATION);
+    netq_wheel_insert(&wheel, nodes[i]);
+    CHECK(netq_wheel_next(&wheel) == earliest(nodes, i + 1));
+  }
+  CHECK(wheel.count == NODES);
+
+  /* remove the earliest nodes one after another */
+  for (i = 0; i < NODES / 4; i++) {
+    node = NULL;
+    for (expired = 0; expired < NODES; expired++) {
+      if (nodes[expired] && (!node || nodes[expired]->t < node->t))
+	node = nodes[expired];
+    }
+    for (expired = 0; nodes[expired] != node; expired++)
+      ;
+    netq_wheel_remove(&wheel, node);
+    netq_node_free(node);
+    nodes[expired] = NULL;
+    check_next(&wheel, nodes, NODES);
+  }
+  CHECK(wheel.count == NODES - NODES / 4);
+
+  /* an overdue node is due at once */
+  now = wheel.base;
+  node = new_node(now > 10 ? now - 10 : 0);
+  netq_wheel_insert(&wheel, node);
+  CHECK(netq_wheel_next(&wheel) == node->t);
+  CHECK(netq_wheel_expire(&wheel, now) == node);
+  netq_node_free(node);
+  check_next(&wheel, nodes, NODES);
+
+  /* expire all nodes in order of their time-stamps */
+  expired = 0;
+  last = now;
+  for (rounds = 0; wheel.count && rounds < 4 * NODES; rounds++) {
+    now = netq_wheel_next(&wheel);
+    CHECK(now >= last);
+    while ((node = netq_wheel_expire(&wheel, now))) {
+      CHECK(node->t <= now && node->t >= last);
+      for (i = 0; nodes[i] != node; i++)
+	;
+      nodes[i] = NULL;
+      netq_node_free(node);
+      expired++;
+    }
+    CHECK(earliest(nodes, NODES) == 0 || earliest(nodes, NODES) > now);
+    last = now;
+  }
+  CHECK(expired == NODES - NODES / 4);
+  CHECK(netq_wheel_next(&wheel) == 0);
+
+  /* a slot that has been emptied is reused with a fresh bound */
+  node = new_node(now + 2 * ROTATION);
+  netq_wheel_insert(&wheel, node);
+  CHECK(netq_wheel_next(&wheel) == node->t);
+  netq_wheel_delete_all(&wheel);
+  CHECK(wheel.count == 0 && netq_wheel_next(&wheel) == 0);
+}
 
-  assert(node == NULL);
-  dump_queue(nq);
+int main(int argc, char **argv) {
+  test_queue();
+  test_wheel();
 
-  return 0;
+  printf("netq-test: %s\n", failed ? "FAILED" : "ok");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
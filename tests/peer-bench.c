@@ -0,0 +1,135 @@
+/* peer-bench -- lookup latency of the peer table vs. number of peers
+ *
+ * Fills a dtls_peer_table_t with an increasing number of IPv4 peers
+ * and reports the average and worst insert time as well as the
+ * average time for successful and failed lookups.
+ *
+ * usage: peer-bench [-n max_peers] [-l lookups]
+ */
+
+#include "tinydtls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "global.h"
+#include "session.h"
+#include "peer.h"
+
+#ifndef DTLS_PEERS_NOHASH
+static inline double
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+make_session(session_t *s, unsigned long n) {
+  dtls_session_init(s);
+  s->size = sizeof(struct sockaddr_in);
+  s->addr.sin.sin_family = AF_INET;
+  s->addr.sin.sin_addr.s_addr = htonl(0x0a000000 | (n >> 4));
+  s->addr.sin.sin_port = htons(20000 + (n & 0x0f));
+}
+
+static int
+run(unsigned long npeers, unsigned long nlookups) {
+  dtls_peer_table_t table;
+  dtls_peer_t *peers;
+  dtls_peer_key_t *misses;
+  session_t session;
+  double t, dt, insert_max = 0, insert_sum = 0, hit, miss;
+  unsigned long i, found = 0;
+
+  peers = calloc(npeers, sizeof(dtls_peer_t));
+  misses = calloc(npeers, sizeof(dtls_peer_key_t));
+  if (!peers || !misses) {
+    fprintf(stderr, "cannot allocate %lu peers\n", npeers);
+    free(peers);
+    free(misses);
+    return -1;
+  }
+
+  memset(&table, 0, sizeof(table));
+  for (i = 0; i < npeers; i++) {
+    make_session(&session, i);
+    dtls_session_key(&session, &peers[i].key);
+    make_session(&session, i + npeers);
+    dtls_session_key(&session, &misses[i]);
+  }
+
+  for (i = 0; i < npeers; i++) {
+    t = now_ns();
+    if (dtls_peer_table_add(&table, &peers[i]) < 0) {
+      fprintf(stderr, "cannot add peer %lu\n", i);
+      break;
+    }
+    dt = now_ns() - t;
+    insert_sum += dt;
+    if (dt > insert_max)
+      insert_max = dt;
+  }
+
+  /* pseudo-random access pattern that is independent of rand() */
+  t = now_ns();
+  for (i = 0; i < nlookups; i++) {
+    dtls_peer_key_t *key = &peers[(i * 2654435761UL) % npeers].key;
+    found += dtls_peer_table_find(&table, key, dtls_peer_key_hash(key)) != NULL;
+  }
+  hit = (now_ns() - t) / nlookups;
+
+  t = now_ns();
+  for (i = 0; i < nlookups; i++) {
+    dtls_peer_key_t *key = &misses[(i * 2654435761UL) % npeers];
+    found += dtls_peer_table_find(&table, key, dtls_peer_key_hash(key)) != NULL;
+  }
+  miss = (now_ns() - t) / nlookups;
+
+  printf("%9lu %10.1f %10.0f %10.1f %10.1f\n", npeers,
+	 insert_sum / npeers, insert_max, hit, miss);
+
+  dtls_peer_table_free(&table);
+  free(peers);
+  free(misses);
+  return found == nlookups ? 0 : -1;
+}
+#endif /* DTLS_PEERS_NOHASH */
+
+int
+main(int argc, char **argv) {
+#ifndef DTLS_PEERS_NOHASH
+  unsigned long max_peers = 1000000, lookups = 1000000, n;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+    switch (opt) {
+    case 'n':
+      max_peers = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      lookups = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n max_peers] [-l lookups]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("    peers  insert_ns insert_max     hit_ns    miss_ns\n");
+  for (n = 10; n <= max_peers; n *= 10) {
+    if (run(n, lookups) < 0) {
+      printf("FAILED\n");
+      return 1;
+    }
+  }
+#else /* DTLS_PEERS_NOHASH */
+  (void)argc;
+  (void)argv;
+  fprintf(stderr, "peer-bench requires the peer hash table\n");
+#endif /* DTLS_PEERS_NOHASH */
+  return 0;
+}
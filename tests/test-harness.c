@@ -0,0 +1,108 @@
+/* test-harness -- in-memory transport and credentials for tests */
+
+#include <string.h>
+
+#include "test-harness.h"
+
+void
+test_set_addr(session_t *s, in_port_t port) {
+  memset(s, 0, sizeof(session_t));
+  s->size = sizeof(struct sockaddr_in);
+  s->addr.sin.sin_family = AF_INET;
+  s->addr.sin.sin_port = htons(port);
+  s->addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+int
+test_queue_add(test_queue_t *q, dtls_context_t *ctx,
+	       const session_t *session, const uint8 *data, size_t len) {
+  test_packet_t *p;
+
+  if (q->count < TEST_QUEUE_SIZE && len <= DTLS_MAX_BUF) {
+    p = &q->packets[q->count++];
+    p->sender = ctx;
+    p->session = *session;
+    memcpy(p->data, data, len);
+    p->length = len;
+  }
+  return len;
+}
+
+#ifdef DTLS_PSK
+int
+test_get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+		  dtls_credentials_type_t type,
+		  const unsigned char *id, size_t id_len,
+		  unsigned char *result, size_t result_length) {
+  (void)ctx;
+  (void)session;
+  (void)id;
+  (void)id_len;
+
+  switch (type) {
+  case DTLS_PSK_IDENTITY:
+    if (result_length < strlen(TEST_PSK_IDENTITY))
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, TEST_PSK_IDENTITY, strlen(TEST_PSK_IDENTITY));
+    return strlen(TEST_PSK_IDENTITY);
+  case DTLS_PSK_KEY:
+    if (result_length < strlen(TEST_PSK_KEY))
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, TEST_PSK_KEY, strlen(TEST_PSK_KEY));
+    return strlen(TEST_PSK_KEY);
+  default:
+    return 0;
+  }
+}
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static const unsigned char ecdsa_priv_key[] = {
+			0xD9, 0xE2, 0x70, 0x7A, 0x72, 0xDA, 0x6A, 0x05,
+			0x04, 0x99, 0x5C, 0x86, 0xED, 0xDB, 0xE3, 0xEF,
+			0xC7, 0xF1, 0xCD, 0x74, 0x83, 0x8F, 0x75, 0x70,
+			0xC8, 0x07, 0x2D, 0x0A, 0x76, 0x26, 0x1B, 0xD4};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+			0xD0, 0x55, 0xEE, 0x14, 0x08, 0x4D, 0x6E, 0x06,
+			0x15, 0x59, 0x9D, 0xB5, 0x83, 0x91, 0x3E, 0x4A,
+			0x3E, 0x45, 0x26, 0xA2, 0x70, 0x4D, 0x61, 0xF2,
+			0x7A, 0x4C, 0xCF, 0xBA, 0x97, 0x58, 0xEF, 0x9A};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+			0xB4, 0x18, 0xB6, 0x4A, 0xFE, 0x80, 0x30, 0xDA,
+			0x1D, 0xDC, 0xF4, 0xF4, 0x2E, 0x2F, 0x26, 0x31,
+			0xD0, 0x43, 0xB1, 0xFB, 0x03, 0xE2, 0x2F, 0x4D,
+			0x17, 0xDE, 0x43, 0xF9, 0xF9, 0xAD, 0xEE, 0x70};
+
+int
+test_get_ecdsa_key(struct dtls_context_t *ctx,
+		   const session_t *session,
+		   const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
+  };
+  (void)ctx;
+  (void)session;
+
+  *result = &ecdsa_key;
+  return 0;
+}
+
+int
+test_verify_ecdsa_key(struct dtls_context_t *ctx,
+		      const session_t *session,
+		      const unsigned char *other_pub_x,
+		      const unsigned char *other_pub_y,
+		      size_t key_size) {
+  (void)ctx;
+  (void)session;
+  (void)other_pub_x;
+  (void)other_pub_y;
+  (void)key_size;
+  return 0;
+}
+#endif /* DTLS_ECC */
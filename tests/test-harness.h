@@ -0,0 +1,78 @@
+/* test-harness -- in-memory transport and credentials for tests
+ *
+ * dtls-loopback-test, dtls-mt-test and dtls-bench connect client and
+ * server dtls_context_t objects without sockets. This file holds
+ * what they have in common: the addresses of the endpoints, a queue
+ * of datagrams in transit and the PSK and ECDSA credentials that
+ * both sides use.
+ */
+
+#ifndef _TEST_HARNESS_H_
+#define _TEST_HARNESS_H_
+
+#include "tinydtls.h"
+
+#include <netinet/in.h>
+
+#include "global.h"
+#include "dtls.h"
+
+#define TEST_PSK_IDENTITY "Client_identity"
+#define TEST_PSK_KEY      "secretPSK"
+
+/** Number of datagrams that a test_queue_t holds. */
+#define TEST_QUEUE_SIZE 32
+
+/** A datagram in transit. */
+typedef struct {
+  dtls_context_t *sender;
+  session_t session;		/**< the session passed to the write handler */
+  size_t length;
+  unsigned char data[DTLS_MAX_BUF];
+} test_packet_t;
+
+/** The datagrams in transit to one side. */
+typedef struct {
+  test_packet_t packets[TEST_QUEUE_SIZE];
+  int count;
+} test_queue_t;
+
+/** Sets @p s to the IPv4 loopback address with @p port. */
+void test_set_addr(session_t *s, in_port_t port);
+
+/**
+ * Appends the datagram that @p ctx sends to @p session to @p q. Like
+ * on a real network, the datagram is dropped silently if it does not
+ * fit into @p q.
+ *
+ * @return @p len, i.e. the datagram counts as sent.
+ */
+int test_queue_add(test_queue_t *q, dtls_context_t *ctx,
+		   const session_t *session, const uint8 *data, size_t len);
+
+#ifdef DTLS_PSK
+/**
+ * A get_psk_info handler that returns TEST_PSK_IDENTITY and
+ * TEST_PSK_KEY for every peer.
+ */
+int test_get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+		      dtls_credentials_type_t type,
+		      const unsigned char *id, size_t id_len,
+		      unsigned char *result, size_t result_length);
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+/** A get_ecdsa_key handler that returns a fixed key pair. */
+int test_get_ecdsa_key(struct dtls_context_t *ctx,
+		       const session_t *session,
+		       const dtls_ecdsa_key_t **result);
+
+/** A verify_ecdsa_key handler that accepts every public key. */
+int test_verify_ecdsa_key(struct dtls_context_t *ctx,
+			  const session_t *session,
+			  const unsigned char *other_pub_x,
+			  const unsigned char *other_pub_y,
+			  size_t key_size);
+#endif /* DTLS_ECC */
+
+#endif /* _TEST_HARNESS_H_ */
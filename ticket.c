@@ -0,0 +1,176 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "ticket.h"
+#include "cache.h"
+#include "numeric.h"
+#include "prng.h"
+#include "dtls_debug.h"
+
+#if DTLS_SESSION_TICKETS
+
+/* size of the encrypted session state */
+#define TICKET_STATE_LENGTH \
+  (sizeof(uint32) + sizeof(uint16) + sizeof(uint8) + DTLS_MASTER_SECRET_LENGTH)
+
+/* Returns @p now in seconds since the epoch, so that servers that
+ * share a ticket key agree on the age of a ticket. */
+static inline uint32_t
+ticket_time(clock_time_t now) {
+  return dtls_clock_offset + now / CLOCK_SECOND;
+}
+
+int
+dtls_ticket_set_key(dtls_ticket_keys_t *keys,
+		    const uint8 name[DTLS_TICKET_KEY_NAME_LENGTH],
+		    const uint8 key[DTLS_TICKET_KEY_LENGTH],
+		    clock_time_t now) {
+  dtls_ticket_key_t new_key;
+
+  memcpy(new_key.name, name, DTLS_TICKET_KEY_NAME_LENGTH);
+  if (dtls_cipher_set_key(&new_key.ccm, TLS_PSK_WITH_AES_128_CCM_8,
+			  key, DTLS_TICKET_KEY_LENGTH) < 0)
+    return -1;
+
+  /* the current key becomes the previous one */
+  keys->keys[1] = keys->keys[0];
+  keys->keys[0] = new_key;
+  memset(&new_key, 0, sizeof(new_key));
+
+  if (keys->valid < 2)
+    keys->valid++;
+  keys->created = now;
+  keys->external = 1;
+  return 0;
+}
+
+/* Replaces the current key by a random key. */
+static int
+rotate_key(dtls_ticket_keys_t *keys, clock_time_t now) {
+  uint8 name[DTLS_TICKET_KEY_NAME_LENGTH];
+  uint8 key[DTLS_TICKET_KEY_LENGTH];
+  int res = -1;
+
+  if (dtls_prng(name, sizeof(name)) && dtls_prng(key, sizeof(key))) {
+    res = dtls_ticket_set_key(keys, name, key, now);
+    keys->external = 0;
+  }
+
+  memset(key, 0, sizeof(key));
+  return res;
+}
+
+int
+dtls_ticket_seal(dtls_ticket_keys_t *keys,
+		 dtls_cipher_t cipher, dtls_compression_t compression,
+		 const uint8 *master_secret,
+		 uint8 *buf, size_t buf_length, clock_time_t now) {
+  uint8 nonce[DTLS_CCM_BLOCKSIZE];
+  uint8 *p = buf;
+  int res;
+
+  if (buf_length < DTLS_TICKET_LENGTH)
+    return -1;
+
+  if (!keys->valid || (!keys->external &&
+		       now - keys->created >= DTLS_TICKET_LIFETIME * CLOCK_SECOND)) {
+    dtls_debug("create new ticket key\n");
+    if (rotate_key(keys, now) < 0)
+      return -1;
+  }
+
+  memcpy(p, keys->keys[0].name, DTLS_TICKET_KEY_NAME_LENGTH);
+  p += DTLS_TICKET_KEY_NAME_LENGTH;
+
+  memset(nonce, 0, sizeof(nonce));
+  if (!dtls_prng(nonce, DTLS_CCM_NONCE_SIZE))
+    return -1;
+  memcpy(p, nonce, DTLS_CCM_NONCE_SIZE);
+  p += DTLS_CCM_NONCE_SIZE;
+
+  dtls_int_to_uint32(p, ticket_time(now));
+  dtls_int_to_uint16(p + sizeof(uint32), cipher);
+  dtls_int_to_uint8(p + sizeof(uint32) + sizeof(uint16), compression);
+  memcpy(p + sizeof(uint32) + sizeof(uint16) + sizeof(uint8), master_secret,
+	 DTLS_MASTER_SECRET_LENGTH);
+
+  /* the key name is authenticated as additional data */
+  res = dtls_encrypt_ctx(&keys->keys[0].ccm, p, TICKET_STATE_LENGTH, p,
+			 nonce, buf, DTLS_TICKET_KEY_NAME_LENGTH);
+  if (res < 0)
+    return res;
+
+  return (p - buf) + res;
+}
+
+int
+dtls_ticket_open(dtls_ticket_keys_t *keys,
+		 const uint8 *ticket, size_t length,
+		 dtls_cipher_t *cipher, dtls_compression_t *compression,
+		 uint8 *master_secret, clock_time_t now) {
+  uint8 nonce[DTLS_CCM_BLOCKSIZE];
+  uint8 state[DTLS_TICKET_LENGTH];
+  const uint8 *ciphertext;
+  unsigned int i;
+  int res;
+
+  if (length != DTLS_TICKET_LENGTH)
+    return -1;
+
+  for (i = 0; i < keys->valid; i++) {
+    if (memcmp(keys->keys[i].name, ticket, DTLS_TICKET_KEY_NAME_LENGTH) == 0)
+      break;
+  }
+
+  if (i == keys->valid) {
+    dtls_debug("ticket key is unknown or has expired\n");
+    return -1;
+  }
+
+  memset(nonce, 0, sizeof(nonce));
+  memcpy(nonce, ticket + DTLS_TICKET_KEY_NAME_LENGTH, DTLS_CCM_NONCE_SIZE);
+  ciphertext = ticket + DTLS_TICKET_KEY_NAME_LENGTH + DTLS_CCM_NONCE_SIZE;
+
+  res = dtls_decrypt_ctx(&keys->keys[i].ccm, ciphertext,
+			 length - (ciphertext - ticket), state,
+			 nonce, ticket, DTLS_TICKET_KEY_NAME_LENGTH);
+  if (res != TICKET_STATE_LENGTH) {
+    dtls_debug("cannot decrypt ticket\n");
+    memset(state, 0, sizeof(state));
+    return -1;
+  }
+
+  /* the ticket expires like a cached session, also when the key is
+   * set by the application and never rotated */
+  if ((int32_t)(ticket_time(now) - dtls_uint32_to_int(state))
+      >= DTLS_SESSION_LIFETIME) {
+    dtls_debug("ticket has expired\n");
+    memset(state, 0, sizeof(state));
+    return -1;
+  }
+
+  *cipher = dtls_uint16_to_int(state + sizeof(uint32));
+  *compression = dtls_uint8_to_int(state + sizeof(uint32) + sizeof(uint16));
+  memcpy(master_secret, state + sizeof(uint32) + sizeof(uint16) + sizeof(uint8),
+	 DTLS_MASTER_SECRET_LENGTH);
+
+  memset(state, 0, sizeof(state));
+  return 0;
+}
+
+#endif /* DTLS_SESSION_TICKETS */
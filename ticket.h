@@ -0,0 +1,193 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file ticket.h
+ * @brief Session tickets as described in RFC 5077
+ */
+
+#ifndef _DTLS_TICKET_H_
+#define _DTLS_TICKET_H_
+
+#include "tinydtls.h"
+#include "global.h"
+#include "crypto.h"
+#include "ccm.h"
+#include "dtls_time.h"
+
+/**
+ * \defgroup ticket Session Tickets
+ * A session ticket carries the state that is needed to resume a
+ * session, encrypted and authenticated with AES-CCM under a key that
+ * only the server knows. The client stores the ticket and presents it
+ * in the ClientHello of a later handshake, so that the server does not
+ * need to keep any state per client. Servers that share the ticket key
+ * accept each other's tickets. A ticket is accepted for
+ * DTLS_SESSION_LIFETIME seconds after it has been issued. Session
+ * tickets are compiled out when DTLS_SESSION_TICKETS is 0.
+ *
+ * A ticket has the following format:
+ *
+ * \code
+ * key_name[DTLS_TICKET_KEY_NAME_LENGTH]
+ * nonce[DTLS_CCM_NONCE_SIZE]
+ * encrypted {
+ *   issued (uint32, Unix time)
+ *   cipher (uint16)
+ *   compression (uint8)
+ *   master_secret[DTLS_MASTER_SECRET_LENGTH]
+ * }
+ * MAC[8]
+ * \endcode
+ * @{
+ */
+
+#define DTLS_TICKET_KEY_NAME_LENGTH 16 /**< identifies the ticket key */
+#define DTLS_TICKET_KEY_LENGTH 16      /**< AES-128 */
+
+/** The size of the tickets that are created by dtls_ticket_seal(). */
+#define DTLS_TICKET_LENGTH						\
+  (DTLS_TICKET_KEY_NAME_LENGTH + DTLS_CCM_NONCE_SIZE + sizeof(uint32)	\
+   + sizeof(uint16) + sizeof(uint8) + DTLS_MASTER_SECRET_LENGTH + 8)
+
+#ifndef DTLS_TICKET_LIFETIME
+/** Time in seconds after which a generated ticket key is replaced.
+    Tickets are accepted until the key following their own key is
+    replaced as well. */
+#define DTLS_TICKET_LIFETIME 3600
+#endif /* DTLS_TICKET_LIFETIME */
+
+#if DTLS_SESSION_TICKETS
+typedef struct {
+  uint8 name[DTLS_TICKET_KEY_NAME_LENGTH]; /**< the key name, random */
+  dtls_aead_t ccm;		/**< the expanded AES key */
+} dtls_ticket_key_t;
+
+/** The current and the previous ticket key of a server. */
+typedef struct {
+  dtls_ticket_key_t keys[2];	/**< keys[0] seals, both open */
+  clock_time_t created;		/**< when keys[0] has been installed */
+  unsigned int valid:2;		/**< number of keys that are set */
+  unsigned int external:1;	/**< set by the application, not rotated */
+} dtls_ticket_keys_t;
+
+/**
+ * Installs a new ticket key in @p keys. The current key is kept to
+ * open tickets that have been issued before. Keys that are set with
+ * this function are not rotated automatically.
+ *
+ * @param keys    The ticket keys to update.
+ * @param name    The name of the new key.
+ * @param key     The new AES-128 key.
+ * @param now     The current time.
+ * @return @c 0 on success, less than zero otherwise.
+ */
+int dtls_ticket_set_key(dtls_ticket_keys_t *keys,
+			const uint8 name[DTLS_TICKET_KEY_NAME_LENGTH],
+			const uint8 key[DTLS_TICKET_KEY_LENGTH],
+			clock_time_t now);
+
+/**
+ * Creates a ticket for the given session state in @p buf. A random
+ * key is generated when no key is set or when the generated key is
+ * older than DTLS_TICKET_LIFETIME.
+ *
+ * @param keys          The ticket keys.
+ * @param cipher        The negotiated cipher suite.
+ * @param compression   The negotiated compression method.
+ * @param master_secret The master secret of the session.
+ * @param buf           The result buffer.
+ * @param buf_length    The size of @p buf.
+ * @param now           The current time.
+ * @return The length of the ticket on success, less than zero
+ *         otherwise.
+ */
+int dtls_ticket_seal(dtls_ticket_keys_t *keys,
+		     dtls_cipher_t cipher, dtls_compression_t compression,
+		     const uint8 *master_secret,
+		     uint8 *buf, size_t buf_length, clock_time_t now);
+
+/**
+ * Decrypts and verifies @p ticket. The ticket must be sealed with
+ * one of the keys in @p keys and must not be older than
+ * DTLS_SESSION_LIFETIME.
+ *
+ * @param keys          The ticket keys.
+ * @param ticket        The ticket presented by the client.
+ * @param length        The length of @p ticket.
+ * @param cipher        Set to the cipher suite of the session.
+ * @param compression   Set to the compression method of the session.
+ * @param master_secret Set to the master secret of the session, must
+ *                      hold DTLS_MASTER_SECRET_LENGTH bytes.
+ * @param now           The current time.
+ * @return @c 0 if the ticket is valid, less than zero otherwise.
+ */
+int dtls_ticket_open(dtls_ticket_keys_t *keys,
+		     const uint8 *ticket, size_t length,
+		     dtls_cipher_t *cipher, dtls_compression_t *compression,
+		     uint8 *master_secret, clock_time_t now);
+
+#else /* DTLS_SESSION_TICKETS */
+typedef struct {
+  uint8 unused;
+} dtls_ticket_keys_t;
+
+static inline int
+dtls_ticket_set_key(dtls_ticket_keys_t *keys,
+		    const uint8 name[DTLS_TICKET_KEY_NAME_LENGTH],
+		    const uint8 key[DTLS_TICKET_KEY_LENGTH],
+		    clock_time_t now) {
+  (void)keys;
+  (void)name;
+  (void)key;
+  (void)now;
+  return -1;
+}
+
+static inline int
+dtls_ticket_seal(dtls_ticket_keys_t *keys,
+		 dtls_cipher_t cipher, dtls_compression_t compression,
+		 const uint8 *master_secret,
+		 uint8 *buf, size_t buf_length, clock_time_t now) {
+  (void)keys;
+  (void)cipher;
+  (void)compression;
+  (void)master_secret;
+  (void)buf;
+  (void)buf_length;
+  (void)now;
+  return -1;
+}
+
+static inline int
+dtls_ticket_open(dtls_ticket_keys_t *keys,
+		 const uint8 *ticket, size_t length,
+		 dtls_cipher_t *cipher, dtls_compression_t *compression,
+		 uint8 *master_secret, clock_time_t now) {
+  (void)keys;
+  (void)ticket;
+  (void)length;
+  (void)cipher;
+  (void)compression;
+  (void)master_secret;
+  (void)now;
+  return -1;
+}
+#endif /* DTLS_SESSION_TICKETS */
+
+/** @} */
+
+#endif /* _DTLS_TICKET_H_ */